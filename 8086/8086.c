@@ -63,42 +63,42 @@ char *readFile(const char *filename, size_t *len)
 
 int16_t consumeTwoBytesAsSigned(State *state)
 {
-    if (state->instructions.instructionPointer + 2u > state->instructions.size)
+    if (state->cpu.instructionPointer + 2u > state->instructions.size)
     {
         error(__FILE__, __LINE__, "reached end of instuctions stream");
     }
 
-    int16_t result = *((int16_t *)(state->instructions.bytes + state->instructions.instructionPointer));
+    int16_t result = *((int16_t *)(state->instructions.bytes + state->cpu.instructionPointer));
 
-    state->instructions.instructionPointer += 2;
+    state->cpu.instructionPointer += 2;
 
     return result;
 }
 
 uint8_t consumeByteAsUnsigned(State *state)
 {
-    if (state->instructions.instructionPointer >= state->instructions.size)
+    if (state->cpu.instructionPointer >= state->instructions.size)
     {
         error(__FILE__, __LINE__, "reached end of instuctions stream");
     }
 
-    uint8_t result = state->instructions.bytes[state->instructions.instructionPointer];
+    uint8_t result = state->instructions.bytes[state->cpu.instructionPointer];
 
-    state->instructions.instructionPointer++;
+    state->cpu.instructionPointer++;
 
     return result;
 }
 
 int8_t consumeByteAsSigned(State *state)
 {
-    if (state->instructions.instructionPointer >= state->instructions.size)
+    if (state->cpu.instructionPointer >= state->instructions.size)
     {
         error(__FILE__, __LINE__, "reached end of instuctions stream");
     }
 
-    int8_t result = state->instructions.bytes[state->instructions.instructionPointer];
+    int8_t result = state->instructions.bytes[state->cpu.instructionPointer];
 
-    state->instructions.instructionPointer++;
+    state->cpu.instructionPointer++;
 
     return result;
 }
@@ -344,18 +344,139 @@ void printOperand(Operand operand, uint16_t instructionByteCount, Register segme
     }
 }
 
-void printFlags(State *state)
+bool isZero(OpValue value)
+{
+
+    if (value.isWide)
+    {
+        return value.value.signedWord == 0;
+    }
+    else
+    {
+        return value.value.signedByte == 0;
+    }
+}
+
+bool isNegative(OpValue value)
+{
+
+    if (value.isWide)
+    {
+        return value.value.signedWord < 0;
+    }
+    else
+    {
+        return value.value.signedByte < 0;
+    }
+}
+
+bool isParityEven(OpValue result)
+{
+    size_t setCount = 0;
+    for (uint8_t bitIndex = 0; bitIndex < 8; bitIndex++)
+    {
+        bool isSet = extractBit(result.value.signedByte, bitIndex);
+        if (isSet)
+        {
+            setCount++;
+        }
+    }
+
+    return setCount % 2 == 0;
+}
+
+bool computeFlag(OpValue result, Flag flag)
+{
+    switch (flag)
+    {
+    case flag_carry:
+    {
+        return result.isCarry;
+    }
+    break;
+    case flag_aux_carry:
+    {
+        return result.isAuxCarry;
+    }
+    break;
+    case flag_overflow:
+    {
+        return result.isOverflow;
+    }
+    break;
+    case flag_zero:
+    {
+        return isZero(result);
+    }
+    break;
+    case flag_sign:
+    {
+        return isNegative(result);
+    }
+    break;
+    case flag_parity:
+    {
+        return isParityEven(result);
+    }
+    break;
+    default:
+    {
+        assert(false && "Not an arithmetic flag");
+        return false;
+    }
+    }
+}
+
+// add, sub and cmp only record their result, most of the flags they set are overwritten before anything reads them
+void updateArithmeticFlags(OpValue result, State *state)
+{
+    state->cpu.flagsResult = result;
+    state->cpu.pendingFlags = (uint16_t)ARITHMETIC_FLAGS;
+}
+
+bool getFlag(Cpu *cpu, Flag flag)
+{
+    if (cpu->pendingFlags & FLAG_BIT(flag))
+    {
+        if (computeFlag(cpu->flagsResult, flag))
+        {
+            cpu->flags = (uint16_t)(cpu->flags | FLAG_BIT(flag));
+        }
+        else
+        {
+            cpu->flags = (uint16_t)(cpu->flags & ~FLAG_BIT(flag));
+        }
+
+        cpu->pendingFlags = (uint16_t)(cpu->pendingFlags & ~FLAG_BIT(flag));
+    }
+
+    return (cpu->flags & FLAG_BIT(flag)) != 0;
+}
+
+// Computes every pending flag, for the places that look at the whole word
+uint16_t resolveFlags(Cpu *cpu)
 {
     for (Flag flag = 0; flag < FLAG_COUNT; flag++)
     {
-        if (state->flags[flag])
+        getFlag(cpu, flag);
+    }
+
+    return cpu->flags;
+}
+
+void printFlags(Cpu *cpu)
+{
+    for (Flag flag = 0; flag < FLAG_COUNT; flag++)
+    {
+        if (getFlag(cpu, flag))
         {
             printf(FlagNames[flag].name);
         }
     }
 }
 
-void printInstruction(Instruction instruction, size_t clocks, State *before, State *after)
+// before is only read when executing, the trace then shows what changed
+void printInstruction(Instruction instruction, size_t clocks, const Config *config, Cpu *before, Cpu *after)
 {
     assert(instruction.type != instruction_none);
     assert(InstructionInfos[instruction.type].type == instruction.type);
@@ -395,7 +516,7 @@ void printInstruction(Instruction instruction, size_t clocks, State *before, Sta
     }
 
     printf("\t");
-    if (after->execute)
+    if (config->execute)
     {
 
         printf("Clocks: +%zu = %zu\t", clocks, after->clocks);
@@ -412,15 +533,7 @@ void printInstruction(Instruction instruction, size_t clocks, State *before, Sta
             }
         }
 
-        bool isFlagChange = false;
-        for (Flag flag = 0; flag < FLAG_COUNT; flag++)
-        {
-            if (before->flags[flag] != after->flags[flag])
-            {
-                isFlagChange = true;
-                break;
-            }
-        }
+        bool isFlagChange = resolveFlags(before) != resolveFlags(after);
         if (isFlagChange)
         {
             printf(" Flags:");
@@ -428,7 +541,7 @@ void printInstruction(Instruction instruction, size_t clocks, State *before, Sta
             printf("->");
             printFlags(after);
         }
-        printf(" ip:%#x--->%#x", before->instructions.instructionPointer, after->instructions.instructionPointer);
+        printf(" ip:%#x--->%#x", before->instructionPointer, after->instructionPointer);
     }
 
     if (instruction.type == instruction_rep || instruction.type == instruction_lock)
@@ -785,892 +898,614 @@ Instruction decodeImmediateWithinSegment(State *state)
     return instruction;
 }
 
-Instruction decodeInstruction(State *state)
+InstructionType decodeRegType(Opcode opcode, uint8_t secondByte)
 {
+    uint8_t reg = extractBits(secondByte, 3, 6);
+    InstructionType result = opcode.regTypes[reg];
 
-    uint16_t initialStackPointer = state->instructions.instructionPointer;
-
-    uint8_t firstByte = consumeByteAsUnsigned(state);
-
-    Instruction instruction = {0};
-
-    Register segmentRegister = reg_none;
-
-    if (firstByte >= 0x88 && firstByte <= 0x8b)
+    if (result == instruction_none)
     {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
-        instruction.type = instruction_mov;
+        error(__FILE__, __LINE__, "Unknown instruction, first byte=%#X, reg=%#X", opcode.firstByte, reg);
     }
-    else if (firstByte == 0xc6 || firstByte == 0xc7)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
 
-        instruction = decodeImmediateToRegisterMemory(firstByte, false, secondByte, state);
+    return result;
+}
 
-        uint8_t reg = extractBits(secondByte, 3, 6);
-        switch (reg)
-        {
-        case 0x00:
-        {
-            instruction.type = instruction_mov;
-        }
-        break;
-        default:
-        {
-            error(__FILE__, __LINE__, "Unknown instruction, first byte=%#X, reg=%#X", firstByte, reg);
-        }
-        }
-    }
-    else if (firstByte >= 0xb0 && firstByte <= 0xbf)
-    {
-        bool wBit = extractBit(firstByte, 3);
-        uint8_t reg = extractLowBits(firstByte, 3);
+Instruction decodeOpcodeNoOperands(Opcode opcode, State *state)
+{
+    (void)state;
 
-        instruction = decodeImmediateToRegister(wBit, reg, state);
-        instruction.type = instruction_mov;
-    }
-    else if (firstByte == 0xa0 || firstByte == 0xa1)
-    {
-        instruction = decodeMemoryToAccumulator(firstByte, state);
-        instruction.type = instruction_mov;
-    }
-    else if (firstByte == 0xa2 || firstByte == 0xa3)
-    {
-        instruction = decodeAccumulatorToMemory(firstByte, state);
+    Instruction result = {0};
+    result.isWide = opcode.wBit;
+    result.type = opcode.type;
 
-        instruction.type = instruction_mov;
-    }
-    else if (firstByte == 0x8c)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
-        uint8_t mod = extractBits(secondByte, 6, 8);
-        if (extractBit(secondByte, 5) != 0)
-        {
-            error(__FILE__, __LINE__, "Expected a 0 bit in the 5th bit of bite 2 for mov from segmente register");
-        }
-        uint8_t sr = extractBits(secondByte, 3, 5);
-        uint8_t rm = extractLowBits(secondByte, 3);
+    return result;
+}
 
-        instruction.operandCount = 2;
-        instruction.firstOperand = decodeRmOperand(true, mod, rm, state);
-        instruction.secondOperand = decodeSrOperand(sr);
-        instruction.type = instruction_mov;
-    }
-    else if (firstByte == 0x8e)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
-        uint8_t mod = extractBits(secondByte, 6, 8);
-        if (extractBit(secondByte, 5) != 0)
-        {
-            error(__FILE__, __LINE__, "Expected a 0 bit in the 5th bit of bite 2 for mov from segmente register");
-        }
-        uint8_t sr = extractBits(secondByte, 3, 5);
-        uint8_t rm = extractLowBits(secondByte, 3);
+Instruction decodeOpcodeRegRm(Opcode opcode, State *state)
+{
+    Instruction result = decodeRegMemToFromRegMem(opcode.dBit, opcode.wBit, state);
+    result.type = opcode.type;
 
-        instruction.operandCount = 2;
-        instruction.firstOperand = decodeSrOperand(sr);
-        instruction.secondOperand = decodeRmOperand(true, mod, rm, state);
-        instruction.type = instruction_mov;
-    }
-    else if (firstByte == 0xfe || firstByte == 0xff)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
-        uint8_t reg = extractBits(secondByte, 3, 6);
+    return result;
+}
 
-        if (firstByte == 0xff && reg == 0x6)
-        {
-            instruction = decodeRegisterMemory(secondByte, true, state);
-            instruction.type = instruction_push;
-        }
-        else if (firstByte == 0xff && reg == 0x03)
-        {
-            instruction = decodeIndirectIntersegment(secondByte, state);
-            instruction.type = instruction_call_far;
-        }
+Instruction decodeOpcodeRmImmediate(Opcode opcode, State *state)
+{
+    uint8_t secondByte = consumeByteAsUnsigned(state);
 
-        else if (firstByte == 0xff && reg == 0x05)
-        {
-            instruction = decodeIndirectIntersegment(secondByte, state);
-            instruction.type = instruction_jmp_far;
-        }
-        else
-        {
+    Instruction result = decodeImmediateToRegisterMemory(opcode.firstByte, opcode.sBit, secondByte, state);
+    result.type = decodeRegType(opcode, secondByte);
 
-            if (reg == 0x0)
-            {
-                bool wBit = extractBit(firstByte, 0);
-                instruction = decodeRegisterMemory(secondByte, wBit, state);
+    return result;
+}
 
-                instruction.type = instruction_inc;
-            }
-            else if (reg == 0x1)
-            {
-                bool wBit = extractBit(firstByte, 0);
-                instruction = decodeRegisterMemory(secondByte, wBit, state);
+Instruction decodeOpcodeRm(Opcode opcode, State *state)
+{
+    uint8_t secondByte = consumeByteAsUnsigned(state);
 
-                instruction.type = instruction_dec;
-            }
-            else if (reg == 0x2)
-            {
-                bool wBit = extractBit(firstByte, 0);
-                instruction = decodeRegisterMemory(secondByte, wBit, state);
+    Instruction result = decodeRegisterMemory(secondByte, opcode.wBit, state);
+    result.type = decodeRegType(opcode, secondByte);
 
-                instruction.type = instruction_call;
-            }
-            else if (reg == 0x4)
-            {
-                bool wBit = extractBit(firstByte, 0);
-                instruction = decodeRegisterMemory(secondByte, wBit, state);
+    return result;
+}
 
-                instruction.type = instruction_jmp;
-            }
-        }
-    }
-    else if (firstByte == 0x3c || firstByte == 0x3d)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        instruction = decodeImmediateFromAccumulator(wBit, state);
+// test is the only one of its group to take an immediate
+Instruction decodeOpcodeRmOrTestImmediate(Opcode opcode, State *state)
+{
+    uint8_t secondByte = consumeByteAsUnsigned(state);
+    InstructionType type = decodeRegType(opcode, secondByte);
 
-        instruction.type = instruction_cmp;
-    }
-    else if (firstByte >= 0x38 && firstByte <= 0x3b)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
-        instruction.type = instruction_cmp;
-    }
-    else if (firstByte >= 0x50 && firstByte <= 0x57)
-    {
-        instruction = decodeRegister(firstByte, true);
-        instruction.type = instruction_push;
-    }
-    else if (extractBits(firstByte, 5, 8) == 0x0 && extractLowBits(firstByte, 3) == 0x06)
-    {
-        instruction = decodeSegmentRegister(firstByte);
-        instruction.type = instruction_push;
-    }
-    else if (firstByte >= 0x58 && firstByte <= 0x5f)
-    {
-        instruction = decodeRegister(firstByte, true);
-        instruction.type = instruction_pop;
-    }
-    else if (extractBits(firstByte, 5, 8) == 0x0 && extractLowBits(firstByte, 3) == 0x7)
-    {
-        instruction = decodeSegmentRegister(firstByte);
-        instruction.type = instruction_pop;
-    }
-    else if (firstByte == 0x8f)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
-        instruction = decodeRegisterMemory(secondByte, true, state);
-        uint8_t reg = extractBits(secondByte, 3, 6);
+    Instruction result = {0};
 
-        switch (reg)
-        {
-        case 0x00:
-        {
-            instruction.type = instruction_pop;
-        }
-        break;
-        default:
-        {
-            error(__FILE__, __LINE__, "Unknown instruction, first byte=%#X, reg=%#X", firstByte, reg);
-        }
-        }
-    }
-    else if (firstByte == 0x86 || firstByte == 0x87)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
-        instruction.type = instruction_xchg;
-    }
-    else if (firstByte >= 0x90 && firstByte <= 0x97)
+    if (type == instruction_test)
     {
-        instruction = decodeRegisterWithAccumulator(firstByte);
-        instruction.type = instruction_xchg;
+        result = decodeImmediateToRegisterMemory(opcode.firstByte, false, secondByte, state);
     }
-    else if (firstByte == 0xe4 || firstByte == 0xe5)
-    {
-        instruction = decodeFixedPort(false, firstByte, state);
-        instruction.type = instruction_in;
-    }
-    else if (firstByte == 0xec || firstByte == 0xed)
-    {
-        instruction = decodeVariablePort(false, firstByte);
-        instruction.type = instruction_in;
-    }
-    else if (firstByte == 0xe6 || firstByte == 0xe7)
-    {
-        instruction = decodeFixedPort(true, firstByte, state);
-        instruction.type = instruction_out;
-    }
-    else if (firstByte == 0xee || firstByte == 0xef)
+    else
     {
-        instruction = decodeVariablePort(true, firstByte);
-        instruction.type = instruction_out;
+        result = decodeRegisterMemory(secondByte, opcode.wBit, state);
     }
-    else if (firstByte == 0xd7)
+
+    result.type = type;
+
+    return result;
+}
+
+Instruction decodeOpcodeShift(Opcode opcode, State *state)
+{
+    uint8_t secondByte = consumeByteAsUnsigned(state);
+    uint8_t mod = extractBits(secondByte, 6, 8);
+    uint8_t rm = extractLowBits(secondByte, 3);
+
+    Instruction result = {0};
+    result.isWide = opcode.wBit;
+    result.operandCount = 2;
+    result.type = decodeRegType(opcode, secondByte);
+
+    if (opcode.vBit)
     {
-        instruction.type = instruction_xlat;
+        result.secondOperand.type = operand_type_register;
+        result.secondOperand.payload.reg.reg = reg_c;
+        result.secondOperand.payload.reg.portion = reg_portion_l;
     }
-    else if (firstByte == 0x8d)
+    else
     {
-        instruction = decodeRegMemToFromRegMem(true, true, state);
-        instruction.type = instruction_lea;
+        result.secondOperand.type = operand_type_immediate;
+        result.secondOperand.payload.immediate.value = 1;
     }
-    else if (firstByte == 0xc5)
+
+    result.firstOperand = decodeRmOperand(opcode.wBit, mod, rm, state);
+
+    if (result.firstOperand.type == operand_type_memory)
     {
-        instruction = decodeRegMemToFromRegMem(true, true, state);
-        instruction.type = instruction_lds;
+        result.needsDecorator = true;
     }
-    else if (firstByte == 0xc4)
+
+    return result;
+}
+
+Instruction decodeOpcodeImmediateToRegister(Opcode opcode, State *state)
+{
+    uint8_t reg = extractLowBits(opcode.firstByte, 3);
+
+    Instruction result = decodeImmediateToRegister(opcode.wBit, reg, state);
+    result.type = opcode.type;
+
+    return result;
+}
+
+Instruction decodeOpcodeAccumulatorImmediate(Opcode opcode, State *state)
+{
+    Instruction result = decodeImmediateFromAccumulator(opcode.wBit, state);
+    result.type = opcode.type;
+
+    return result;
+}
+
+// The d bit is set when the accumulator is the source
+Instruction decodeOpcodeAccumulatorMemory(Opcode opcode, State *state)
+{
+    Instruction result = {0};
+
+    if (opcode.dBit)
     {
-        instruction = decodeRegMemToFromRegMem(true, true, state);
-        instruction.type = instruction_les;
+        result = decodeAccumulatorToMemory(opcode.firstByte, state);
     }
-    else if (firstByte == 0x9f)
+    else
     {
-        instruction.type = instruction_lahf;
+        result = decodeMemoryToAccumulator(opcode.firstByte, state);
     }
-    else if (firstByte == 0x9e)
+
+    result.type = opcode.type;
+
+    return result;
+}
+
+// The d bit is set when the segment register is the destination
+Instruction decodeOpcodeRmSegment(Opcode opcode, State *state)
+{
+    uint8_t secondByte = consumeByteAsUnsigned(state);
+    uint8_t mod = extractBits(secondByte, 6, 8);
+    if (extractBit(secondByte, 5) != 0)
     {
-        instruction.type = instruction_sahf;
+        error(__FILE__, __LINE__, "Expected a 0 bit in the 5th bit of bite 2 for mov from segmente register");
     }
-    else if (firstByte == 0x9c)
+    uint8_t sr = extractBits(secondByte, 3, 5);
+    uint8_t rm = extractLowBits(secondByte, 3);
+
+    Instruction result = {0};
+    result.operandCount = 2;
+    result.type = opcode.type;
+
+    if (opcode.dBit)
     {
-        instruction.type = instruction_pushf;
+        result.firstOperand = decodeSrOperand(sr);
+        result.secondOperand = decodeRmOperand(true, mod, rm, state);
     }
-    else if (firstByte == 0x9d)
+    else
     {
-        instruction.type = instruction_popf;
+        result.firstOperand = decodeRmOperand(true, mod, rm, state);
+        result.secondOperand = decodeSrOperand(sr);
     }
-    else if (firstByte >= 0x00 && firstByte <= 0x03)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
 
-        instruction.type = instruction_add;
-    }
-    else if (firstByte >= 0x80 && firstByte <= 0x83)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
-        bool sBit = extractBit(firstByte, 1);
+    return result;
+}
 
-        instruction = decodeImmediateToRegisterMemory(firstByte, sBit, secondByte, state);
+Instruction decodeOpcodeRegister(Opcode opcode, State *state)
+{
+    (void)state;
 
-        uint8_t reg = extractBits(secondByte, 3, 6);
-        switch (reg)
-        {
-        case 0x00:
-        {
-            instruction.type = instruction_add;
-        }
-        break;
-        case 0x01:
-        {
-            instruction.type = instruction_or;
-        }
-        break;
-        case 0x02:
-        {
-            instruction.type = instruction_adc;
-        }
-        break;
-        case 0x03:
-        {
-            instruction.type = instruction_sbb;
-        }
-        break;
-        case 0x04:
-        {
-            instruction.type = instruction_and;
-        }
-        break;
-        case 0x05:
-        {
-            instruction.type = instruction_sub;
-        }
-        break;
-        case 0x06:
-        {
-            instruction.type = instruction_xor;
-        }
-        break;
-        case 0x07:
-        {
-            instruction.type = instruction_cmp;
-        }
-        break;
-        default:
-        {
-            error(__FILE__, __LINE__, "Unknown instruction, first byte=%#X, reg=%#X", firstByte, reg);
-        }
-        }
-    }
-    else if (firstByte == 0x04 || firstByte == 0x05)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction = decodeImmediateFromAccumulator(wBit, state);
+    Instruction result = decodeRegister(opcode.firstByte, opcode.wBit);
+    result.type = opcode.type;
 
-        instruction.type = instruction_add;
-    }
-    else if (firstByte >= 0x10 && firstByte <= 0x13)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
+    return result;
+}
 
-        instruction.type = instruction_adc;
-    }
-    else if (firstByte == 0x14 || firstByte == 0x15)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction = decodeImmediateFromAccumulator(wBit, state);
+Instruction decodeOpcodeSegmentRegister(Opcode opcode, State *state)
+{
+    (void)state;
 
-        instruction.type = instruction_adc;
-    }
-    else if (firstByte >= 0x40 && firstByte <= 0x47)
-    {
-        instruction = decodeRegister(firstByte, true);
-        instruction.type = instruction_inc;
-    }
-    else if (firstByte == 0x37)
-    {
-        instruction.type = instruction_aaa;
-    }
-    else if (firstByte == 0x27)
-    {
-        instruction.type = instruction_daa;
-    }
-    else if (firstByte >= 0x28 && firstByte <= 0x2b)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
-        instruction.type = instruction_sub;
-    }
-    else if (firstByte == 0x2c || firstByte == 0x2d)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        instruction = decodeImmediateFromAccumulator(wBit, state);
+    Instruction result = decodeSegmentRegister(opcode.firstByte);
+    result.type = opcode.type;
 
-        instruction.type = instruction_sub;
-    }
-    else if (firstByte >= 0x18 && firstByte <= 0x1b)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
-        instruction.type = instruction_sbb;
-    }
-    else if (firstByte == 0x1c || firstByte == 0x1d)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        instruction = decodeImmediateFromAccumulator(wBit, state);
+    return result;
+}
 
-        instruction.type = instruction_sbb;
-    }
-    else if (firstByte >= 0x48 && firstByte <= 0x4f)
-    {
-        instruction = decodeRegister(firstByte, true);
-        instruction.type = instruction_dec;
-    }
-    else if (firstByte == 0xf6 || firstByte == 0xf7)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
-        uint8_t reg = extractBits(secondByte, 3, 6);
-        bool wBit = extractBit(firstByte, 0);
+Instruction decodeOpcodeRegisterWithAccumulator(Opcode opcode, State *state)
+{
+    (void)state;
 
-        if (reg != 0)
-        {
-            instruction = decodeRegisterMemory(secondByte, wBit, state);
-        }
-        else
-        {
-            instruction = decodeImmediateToRegisterMemory(firstByte, 0, secondByte, state);
-        }
+    Instruction result = decodeRegisterWithAccumulator(opcode.firstByte);
+    result.type = opcode.type;
 
-        switch (reg)
-        {
-        case 0x0:
-        {
-            instruction.type = instruction_test;
-        }
-        break;
-        case 0x2:
-        {
+    return result;
+}
 
-            instruction.type = instruction_not;
-        }
-        break;
-        case 0x3:
-        {
-            instruction.type = instruction_neg;
-        }
-        break;
-        case 0x4:
-        {
-            instruction.type = instruction_mul;
-        }
-        break;
-        case 0x5:
-        {
-            instruction.type = instruction_imul;
-        }
-        break;
-        case 0x6:
-        {
-            instruction.type = instruction_div;
-        }
-        break;
-        case 0x7:
-        {
-            instruction.type = instruction_idiv;
-        }
-        break;
-        }
-    }
-    else if (firstByte == 0x3f)
-    {
-        instruction.type = instruction_aas;
-    }
-    else if (firstByte == 0x2f)
-    {
-        instruction.type = instruction_das;
-    }
-    else if (firstByte == 0xd4)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
-        if (secondByte == 0x0a)
-        {
-            instruction.type = instruction_aam;
-        }
-    }
-    else if (firstByte == 0xd5)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
-        if (secondByte == 0x0a)
-        {
-            instruction.type = instruction_aad;
-        }
-    }
-    else if (firstByte == 0x98)
-    {
-        instruction.type = instruction_cbw;
-    }
-    else if (firstByte == 0x99)
-    {
-        instruction.type = instruction_cwd;
-    }
-    else if (firstByte >= 0xd0 && firstByte <= 0xd3)
-    {
-        uint8_t secondByte = consumeByteAsUnsigned(state);
-        uint8_t mod = extractBits(secondByte, 6, 8);
-        uint8_t reg = extractBits(secondByte, 3, 6);
-        uint8_t rm = extractLowBits(secondByte, 3);
+// The d bit is set when the port is the destination
+Instruction decodeOpcodeFixedPort(Opcode opcode, State *state)
+{
+    Instruction result = decodeFixedPort(opcode.dBit, opcode.firstByte, state);
+    result.type = opcode.type;
 
-        bool wBit = extractBit(firstByte, 0);
-        bool vBit = extractBit(firstByte, 1);
-        instruction.isWide = wBit;
-        instruction.operandCount = 2;
-        if (vBit)
-        {
-            instruction.secondOperand.type = operand_type_register;
-            instruction.secondOperand.payload.reg.reg = reg_c;
-            instruction.secondOperand.payload.reg.portion = reg_portion_l;
-        }
-        else
-        {
-            instruction.secondOperand.type = operand_type_immediate;
-            instruction.secondOperand.payload.immediate.value = 1;
-        }
+    return result;
+}
 
-        instruction.firstOperand = decodeRmOperand(wBit, mod, rm, state);
+Instruction decodeOpcodeVariablePort(Opcode opcode, State *state)
+{
+    (void)state;
 
-        if (instruction.firstOperand.type == operand_type_memory)
-        {
-            instruction.needsDecorator = true;
-        }
+    Instruction result = decodeVariablePort(opcode.dBit, opcode.firstByte);
+    result.type = opcode.type;
 
-        switch (reg)
-        {
-        case 0x0:
-        {
-            instruction.type = instruction_rol;
-        }
-        break;
-        case 0x1:
-        {
-            instruction.type = instruction_ror;
-        }
-        break;
-        case 0x2:
-        {
-            instruction.type = instruction_rcl;
-        }
-        break;
-        case 0x3:
-        {
-            instruction.type = instruction_rcr;
-        }
-        break;
-        case 0x4:
-        {
-            instruction.type = instruction_shl;
-        }
-        break;
-        case 0x5:
-        {
-            instruction.type = instruction_shr;
-        }
-        break;
-        case 0x7:
-        {
-            instruction.type = instruction_sar;
-        }
-        break;
-        }
-    }
-    else if (firstByte >= 0x20 && firstByte <= 0x23)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
+    return result;
+}
 
-        instruction.type = instruction_and;
-    }
-    else if (firstByte == 0x24 || firstByte == 0x25)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction = decodeImmediateFromAccumulator(wBit, state);
+Instruction decodeOpcodeShortJump(Opcode opcode, State *state)
+{
+    Instruction result = decodeJump(state);
+    result.type = opcode.type;
 
-        instruction.type = instruction_and;
-    }
-    else if (firstByte == 0x84 || firstByte == 0x85)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
+    return result;
+}
 
-        instruction.type = instruction_test;
-    }
-    else if (firstByte == 0xa8 || firstByte == 0xa9)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction = decodeImmediateFromAccumulator(wBit, state);
+Instruction decodeOpcodeNearJump(Opcode opcode, State *state)
+{
+    Instruction result = decodeImmediateWithinSegment(state);
+    result.type = opcode.type;
 
-        instruction.type = instruction_test;
-    }
-    else if (firstByte >= 0x08 && firstByte <= 0x0b)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
+    return result;
+}
 
-        instruction.type = instruction_or;
-    }
-    else if (firstByte == 0x0c || firstByte == 0x0d)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction = decodeImmediateFromAccumulator(wBit, state);
+Instruction decodeOpcodeFarImmediate(Opcode opcode, State *state)
+{
+    Instruction result = decodeIntersegmentImmediate(state);
+    result.type = opcode.type;
 
-        instruction.type = instruction_or;
-    }
-    else if (firstByte >= 0x30 && firstByte <= 0x33)
-    {
-        bool wBit = extractBit(firstByte, 0);
-        bool dBit = extractBit(firstByte, 1);
-        instruction = decodeRegMemToFromRegMem(dBit, wBit, state);
+    return result;
+}
 
-        instruction.type = instruction_xor;
-    }
-    else if (firstByte == 0x34 || firstByte == 0x35)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction = decodeImmediateFromAccumulator(wBit, state);
+Instruction decodeOpcodeWordImmediate(Opcode opcode, State *state)
+{
+    Instruction result = {0};
+    result.operandCount = 1;
+    result.firstOperand = decodeImmediateOperand(true, false, state);
+    result.isWide = true;
+    result.type = opcode.type;
 
-        instruction.type = instruction_xor;
-    }
-    else if (firstByte == 0xf2 || firstByte == 0xf3)
-    {
-        instruction.type = instruction_rep;
-    }
-    else if (firstByte == 0xa4 || firstByte == 0xa5)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction.isWide = wBit;
-        instruction.type = instruction_movs;
-    }
-    else if (firstByte == 0xa6 || firstByte == 0xa7)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction.isWide = wBit;
-        instruction.type = instruction_cmps;
-    }
-    else if (firstByte == 0xae || firstByte == 0xaf)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction.isWide = wBit;
-        instruction.type = instruction_scas;
-    }
-    else if (firstByte == 0xac || firstByte == 0xad)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction.isWide = wBit;
-        instruction.type = instruction_lods;
-    }
-    else if (firstByte == 0xaa || firstByte == 0xab)
-    {
-        bool wBit = extractLowBits(firstByte, 1);
-        instruction.isWide = wBit;
-        instruction.type = instruction_stos;
-    }
-    else if (firstByte == 0xe8)
-    {
-        instruction = decodeImmediateWithinSegment(state);
-        instruction.type = instruction_call;
-    }
-    else if (firstByte == 0x9a)
-    {
-        instruction = decodeIntersegmentImmediate(state);
-        instruction.type = instruction_call;
-    }
-    else if (firstByte == 0xea)
-    {
-        instruction = decodeIntersegmentImmediate(state);
-        instruction.type = instruction_jmp;
-    }
-    else if (firstByte == 0xe9)
-    {
-        instruction = decodeImmediateWithinSegment(state);
-        instruction.type = instruction_jmp;
-    }
-    else if (firstByte == 0xc3)
-    {
-        instruction.type = instruction_ret;
-    }
-    else if (firstByte == 0xc2)
-    {
-        instruction.operandCount = 1;
-        instruction.firstOperand = decodeImmediateOperand(true, false, state);
-        instruction.isWide = true;
-        instruction.type = instruction_ret;
-    }
-    else if (firstByte == 0xca)
-    {
-        instruction.operandCount = 1;
-        instruction.firstOperand = decodeImmediateOperand(true, false, state);
-        instruction.isWide = true;
-        instruction.type = instruction_retf;
-    }
-    else if (firstByte == 0xcb)
-    {
-        instruction.type = instruction_retf;
-    }
-    else if (firstByte == 0x74)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_je;
-    }
-    else if (firstByte == 0x7c)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jl;
-    }
-    else if (firstByte == 0x7e)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jle;
-    }
-    else if (firstByte == 0x72)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jb;
-    }
-    else if (firstByte == 0x76)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jbe;
-    }
-    else if (firstByte == 0x7a)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jp;
-    }
-    else if (firstByte == 0x70)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jo;
-    }
-    else if (firstByte == 0x78)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_js;
-    }
-    else if (firstByte == 0x75)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jnz;
-    }
-    else if (firstByte == 0x7d)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jnl;
-    }
-    else if (firstByte == 0x7f)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jnle;
-    }
-    else if (firstByte == 0x73)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jnb;
-    }
-    else if (firstByte == 0x77)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_ja;
-    }
-    else if (firstByte == 0x7b)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jnp;
-    }
-    else if (firstByte == 0x71)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jno;
-    }
-    else if (firstByte == 0x79)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jns;
-    }
-    else if (firstByte == 0xe2)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_loop;
-    }
-    else if (firstByte == 0xe1)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_loopz;
-    }
-    else if (firstByte == 0xe0)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_loopnz;
-    }
-    else if (firstByte == 0xe3)
-    {
-        instruction = decodeJump(state);
-        instruction.type = instruction_jcxz;
-    }
-    else if (firstByte == 0xcd)
-    {
-        instruction.operandCount = 1;
-        instruction.firstOperand.type = operand_type_immediate;
-        instruction.firstOperand.payload.immediate.value = consumeByteAsUnsigned(state);
-        instruction.type = instruction_int;
-    }
-    else if (firstByte == 0xcc)
-    {
-        instruction.type = instruction_int3;
-    }
-    else if (firstByte == 0xce)
-    {
-        instruction.type = instruction_into;
-    }
-    else if (firstByte == 0xcf)
-    {
-        instruction.type = instruction_iret;
-    }
-    else if (firstByte == 0xf8)
-    {
-        instruction.type = instruction_clc;
-    }
-    else if (firstByte == 0xf5)
-    {
-        instruction.type = instruction_cmc;
-    }
-    else if (firstByte == 0xf9)
+    return result;
+}
+
+Instruction decodeOpcodeByteImmediate(Opcode opcode, State *state)
+{
+    Instruction result = {0};
+    result.operandCount = 1;
+    result.firstOperand.type = operand_type_immediate;
+    result.firstOperand.payload.immediate.value = consumeByteAsUnsigned(state);
+    result.type = opcode.type;
+
+    return result;
+}
+
+// aam and aad are followed by a second byte that is always 0x0a
+Instruction decodeOpcodeAsciiAdjust(Opcode opcode, State *state)
+{
+    uint8_t secondByte = consumeByteAsUnsigned(state);
+    if (secondByte != 0x0a)
     {
-        instruction.type = instruction_stc;
+        error(__FILE__, __LINE__, "Unknown instruction, first byte=%#X, second byte=%#X", opcode.firstByte, secondByte);
     }
-    else if (firstByte == 0xfc)
+
+    Instruction result = {0};
+    result.type = opcode.type;
+
+    return result;
+}
+
+Instruction decodeInstruction(State *state);
+
+// The prefix is folded into the instruction it applies to, its sr field names the segment
+Instruction decodeOpcodeSegmentOverride(Opcode opcode, State *state)
+{
+    Instruction result = decodeInstruction(state);
+    result.segmentRegister = decodeSrField(extractBits(opcode.firstByte, 3, 5));
+
+    return result;
+}
+
+const InstructionType ImmediateGroupTypes[8] = {
+    instruction_add,
+    instruction_or,
+    instruction_adc,
+    instruction_sbb,
+    instruction_and,
+    instruction_sub,
+    instruction_xor,
+    instruction_cmp,
+};
+
+const InstructionType MovGroupTypes[8] = {instruction_mov};
+
+const InstructionType PopGroupTypes[8] = {instruction_pop};
+
+const InstructionType ShiftGroupTypes[8] = {
+    instruction_rol,
+    instruction_ror,
+    instruction_rcl,
+    instruction_rcr,
+    instruction_shl,
+    instruction_shr,
+    instruction_none,
+    instruction_sar,
+};
+
+const InstructionType UnaryGroupTypes[8] = {
+    instruction_test,
+    instruction_none,
+    instruction_not,
+    instruction_neg,
+    instruction_mul,
+    instruction_imul,
+    instruction_div,
+    instruction_idiv,
+};
+
+// fe only encodes inc and dec, call and jmp are kept as the decoder read them before
+const InstructionType IncDecByteGroupTypes[8] = {
+    instruction_inc,
+    instruction_dec,
+    instruction_call,
+    instruction_none,
+    instruction_jmp,
+};
+
+const InstructionType IncDecWordGroupTypes[8] = {
+    instruction_inc,
+    instruction_dec,
+    instruction_call,
+    instruction_call_far,
+    instruction_jmp,
+    instruction_jmp_far,
+    instruction_push,
+    instruction_none,
+};
+
+#define OPCODE(byte, type, decode, fields, regTypes) [byte] = {type, decode, fields, regTypes}
+#define OPCODE_2(byte, ...) OPCODE(byte, __VA_ARGS__), OPCODE((byte) + 1, __VA_ARGS__)
+#define OPCODE_4(byte, ...) OPCODE_2(byte, __VA_ARGS__), OPCODE_2((byte) + 2, __VA_ARGS__)
+#define OPCODE_8(byte, ...) OPCODE_4(byte, __VA_ARGS__), OPCODE_4((byte) + 4, __VA_ARGS__)
+#define OPCODE_16(byte, ...) OPCODE_8(byte, __VA_ARGS__), OPCODE_8((byte) + 8, __VA_ARGS__)
+
+// Indexed by the first byte of the instruction, bytes that are not listed have no decoder
+const OpcodeEncoding OpcodeEncodings[256] = {
+    OPCODE_4(0x00, instruction_add, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_2(0x04, instruction_add, decodeOpcodeAccumulatorImmediate, opcode_w, NULL),
+    OPCODE(0x06, instruction_push, decodeOpcodeSegmentRegister, 0, NULL),
+    OPCODE(0x07, instruction_pop, decodeOpcodeSegmentRegister, 0, NULL),
+    OPCODE_4(0x08, instruction_or, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_2(0x0c, instruction_or, decodeOpcodeAccumulatorImmediate, opcode_w, NULL),
+    OPCODE(0x0e, instruction_push, decodeOpcodeSegmentRegister, 0, NULL),
+    OPCODE(0x0f, instruction_pop, decodeOpcodeSegmentRegister, 0, NULL),
+
+    OPCODE_4(0x10, instruction_adc, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_2(0x14, instruction_adc, decodeOpcodeAccumulatorImmediate, opcode_w, NULL),
+    OPCODE(0x16, instruction_push, decodeOpcodeSegmentRegister, 0, NULL),
+    OPCODE(0x17, instruction_pop, decodeOpcodeSegmentRegister, 0, NULL),
+    OPCODE_4(0x18, instruction_sbb, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_2(0x1c, instruction_sbb, decodeOpcodeAccumulatorImmediate, opcode_w, NULL),
+    OPCODE(0x1e, instruction_push, decodeOpcodeSegmentRegister, 0, NULL),
+    OPCODE(0x1f, instruction_pop, decodeOpcodeSegmentRegister, 0, NULL),
+
+    OPCODE_4(0x20, instruction_and, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_2(0x24, instruction_and, decodeOpcodeAccumulatorImmediate, opcode_w, NULL),
+    OPCODE(0x26, instruction_es, decodeOpcodeSegmentOverride, 0, NULL),
+    OPCODE(0x27, instruction_daa, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE_4(0x28, instruction_sub, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_2(0x2c, instruction_sub, decodeOpcodeAccumulatorImmediate, opcode_w, NULL),
+    OPCODE(0x2e, instruction_cs, decodeOpcodeSegmentOverride, 0, NULL),
+    OPCODE(0x2f, instruction_das, decodeOpcodeNoOperands, 0, NULL),
+
+    OPCODE_4(0x30, instruction_xor, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_2(0x34, instruction_xor, decodeOpcodeAccumulatorImmediate, opcode_w, NULL),
+    OPCODE(0x36, instruction_ss, decodeOpcodeSegmentOverride, 0, NULL),
+    OPCODE(0x37, instruction_aaa, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE_4(0x38, instruction_cmp, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_2(0x3c, instruction_cmp, decodeOpcodeAccumulatorImmediate, opcode_w, NULL),
+    OPCODE(0x3e, instruction_ds, decodeOpcodeSegmentOverride, 0, NULL),
+    OPCODE(0x3f, instruction_aas, decodeOpcodeNoOperands, 0, NULL),
+
+    OPCODE_8(0x40, instruction_inc, decodeOpcodeRegister, opcode_word, NULL),
+    OPCODE_8(0x48, instruction_dec, decodeOpcodeRegister, opcode_word, NULL),
+    OPCODE_8(0x50, instruction_push, decodeOpcodeRegister, opcode_word, NULL),
+    OPCODE_8(0x58, instruction_pop, decodeOpcodeRegister, opcode_word, NULL),
+
+    OPCODE(0x70, instruction_jo, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x71, instruction_jno, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x72, instruction_jb, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x73, instruction_jnb, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x74, instruction_je, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x75, instruction_jnz, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x76, instruction_jbe, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x77, instruction_ja, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x78, instruction_js, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x79, instruction_jns, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x7a, instruction_jp, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x7b, instruction_jnp, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x7c, instruction_jl, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x7d, instruction_jnl, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x7e, instruction_jle, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0x7f, instruction_jnle, decodeOpcodeShortJump, 0, NULL),
+
+    OPCODE_4(0x80, instruction_none, decodeOpcodeRmImmediate, opcode_s | opcode_w, ImmediateGroupTypes),
+    OPCODE_2(0x84, instruction_test, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_2(0x86, instruction_xchg, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE_4(0x88, instruction_mov, decodeOpcodeRegRm, opcode_d | opcode_w, NULL),
+    OPCODE(0x8c, instruction_mov, decodeOpcodeRmSegment, opcode_d, NULL),
+    OPCODE(0x8d, instruction_lea, decodeOpcodeRegRm, opcode_to_register | opcode_word, NULL),
+    OPCODE(0x8e, instruction_mov, decodeOpcodeRmSegment, opcode_d, NULL),
+    OPCODE(0x8f, instruction_none, decodeOpcodeRm, opcode_word, PopGroupTypes),
+
+    OPCODE_8(0x90, instruction_xchg, decodeOpcodeRegisterWithAccumulator, 0, NULL),
+    OPCODE(0x98, instruction_cbw, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0x99, instruction_cwd, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0x9a, instruction_call, decodeOpcodeFarImmediate, 0, NULL),
+    OPCODE(0x9b, instruction_wait, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0x9c, instruction_pushf, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0x9d, instruction_popf, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0x9e, instruction_sahf, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0x9f, instruction_lahf, decodeOpcodeNoOperands, 0, NULL),
+
+    OPCODE_4(0xa0, instruction_mov, decodeOpcodeAccumulatorMemory, opcode_d | opcode_w, NULL),
+    OPCODE_2(0xa4, instruction_movs, decodeOpcodeNoOperands, opcode_w, NULL),
+    OPCODE_2(0xa6, instruction_cmps, decodeOpcodeNoOperands, opcode_w, NULL),
+    OPCODE_2(0xa8, instruction_test, decodeOpcodeAccumulatorImmediate, opcode_w, NULL),
+    OPCODE_2(0xaa, instruction_stos, decodeOpcodeNoOperands, opcode_w, NULL),
+    OPCODE_2(0xac, instruction_lods, decodeOpcodeNoOperands, opcode_w, NULL),
+    OPCODE_2(0xae, instruction_scas, decodeOpcodeNoOperands, opcode_w, NULL),
+
+    OPCODE_16(0xb0, instruction_mov, decodeOpcodeImmediateToRegister, opcode_w_bit3, NULL),
+
+    OPCODE(0xc2, instruction_ret, decodeOpcodeWordImmediate, 0, NULL),
+    OPCODE(0xc3, instruction_ret, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xc4, instruction_les, decodeOpcodeRegRm, opcode_to_register | opcode_word, NULL),
+    OPCODE(0xc5, instruction_lds, decodeOpcodeRegRm, opcode_to_register | opcode_word, NULL),
+    OPCODE_2(0xc6, instruction_none, decodeOpcodeRmImmediate, opcode_w, MovGroupTypes),
+    OPCODE(0xca, instruction_retf, decodeOpcodeWordImmediate, 0, NULL),
+    OPCODE(0xcb, instruction_retf, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xcc, instruction_int3, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xcd, instruction_int, decodeOpcodeByteImmediate, 0, NULL),
+    OPCODE(0xce, instruction_into, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xcf, instruction_iret, decodeOpcodeNoOperands, 0, NULL),
+
+    OPCODE_4(0xd0, instruction_none, decodeOpcodeShift, opcode_v | opcode_w, ShiftGroupTypes),
+    OPCODE(0xd4, instruction_aam, decodeOpcodeAsciiAdjust, 0, NULL),
+    OPCODE(0xd5, instruction_aad, decodeOpcodeAsciiAdjust, 0, NULL),
+    OPCODE(0xd7, instruction_xlat, decodeOpcodeNoOperands, 0, NULL),
+
+    OPCODE(0xe0, instruction_loopnz, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0xe1, instruction_loopz, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0xe2, instruction_loop, decodeOpcodeShortJump, 0, NULL),
+    OPCODE(0xe3, instruction_jcxz, decodeOpcodeShortJump, 0, NULL),
+    OPCODE_2(0xe4, instruction_in, decodeOpcodeFixedPort, opcode_d | opcode_w, NULL),
+    OPCODE_2(0xe6, instruction_out, decodeOpcodeFixedPort, opcode_d | opcode_w, NULL),
+    OPCODE(0xe8, instruction_call, decodeOpcodeNearJump, 0, NULL),
+    OPCODE(0xe9, instruction_jmp, decodeOpcodeNearJump, 0, NULL),
+    OPCODE(0xea, instruction_jmp, decodeOpcodeFarImmediate, 0, NULL),
+    OPCODE_2(0xec, instruction_in, decodeOpcodeVariablePort, opcode_d | opcode_w, NULL),
+    OPCODE_2(0xee, instruction_out, decodeOpcodeVariablePort, opcode_d | opcode_w, NULL),
+
+    OPCODE(0xf0, instruction_lock, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE_2(0xf2, instruction_rep, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xf4, instruction_hlt, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xf5, instruction_cmc, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE_2(0xf6, instruction_none, decodeOpcodeRmOrTestImmediate, opcode_w, UnaryGroupTypes),
+    OPCODE(0xf8, instruction_clc, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xf9, instruction_stc, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xfa, instruction_cli, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xfb, instruction_sti, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xfc, instruction_cld, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xfd, instruction_std, decodeOpcodeNoOperands, 0, NULL),
+    OPCODE(0xfe, instruction_none, decodeOpcodeRm, opcode_w, IncDecByteGroupTypes),
+    OPCODE(0xff, instruction_none, decodeOpcodeRm, opcode_w, IncDecWordGroupTypes),
+};
+
+Opcode decodeOpcodeFields(uint8_t firstByte, const OpcodeEncoding *encoding)
+{
+    Opcode result = {0};
+    result.firstByte = firstByte;
+    result.type = encoding->type;
+    result.regTypes = encoding->regTypes;
+
+    if (encoding->fields & opcode_d)
     {
-        instruction.type = instruction_cld;
+        result.dBit = extractBit(firstByte, 1);
     }
-    else if (firstByte == 0xfd)
+    else
     {
-        instruction.type = instruction_std;
+        result.dBit = (encoding->fields & opcode_to_register) != 0;
     }
-    else if (firstByte == 0xfa)
+
+    if (encoding->fields & opcode_w)
     {
-        instruction.type = instruction_cli;
+        result.wBit = extractBit(firstByte, 0);
     }
-    else if (firstByte == 0xfb)
+    else if (encoding->fields & opcode_w_bit3)
     {
-        instruction.type = instruction_sti;
+        result.wBit = extractBit(firstByte, 3);
     }
-    else if (firstByte == 0xf4)
+    else
     {
-        instruction.type = instruction_hlt;
+        result.wBit = (encoding->fields & opcode_word) != 0;
     }
-    else if (firstByte == 0x9b)
+
+    result.sBit = (encoding->fields & opcode_s) && extractBit(firstByte, 1);
+    result.vBit = (encoding->fields & opcode_v) && extractBit(firstByte, 1);
+
+    return result;
+}
+
+Instruction decodeInstruction(State *state)
+{
+
+    uint16_t initialStackPointer = state->cpu.instructionPointer;
+
+    uint8_t firstByte = consumeByteAsUnsigned(state);
+
+    const OpcodeEncoding *encoding = &OpcodeEncodings[firstByte];
+
+    if (encoding->decode == NULL)
     {
-        instruction.type = instruction_wait;
+        error(__FILE__, __LINE__, "Unknown instruction, first byte=%#X", firstByte);
     }
-    else if (firstByte == 0xf0)
+
+    Instruction instruction = encoding->decode(decodeOpcodeFields(firstByte, encoding), state);
+
+    if (encoding->decode != decodeOpcodeSegmentOverride)
     {
-        instruction.type = instruction_lock;
+        instruction.segmentRegister = reg_none;
     }
-    else if (firstByte == 0x2e)
+
+    if (
+        instruction.operandCount == 1 && instruction.firstOperand.type != operand_type_register && !(instruction.firstOperand.type == operand_type_immediate && instruction.firstOperand.payload.immediate.isRelativeOffset))
     {
-        instruction = decodeInstruction(state);
-        segmentRegister = reg_cs;
+        instruction.needsDecorator = true;
     }
-    else if (firstByte == 0x3e)
+    if (instruction.operandCount == 2 && instruction.firstOperand.type != operand_type_register && instruction.secondOperand.type != operand_type_register)
     {
-        instruction = decodeInstruction(state);
-        segmentRegister = reg_ds;
+        instruction.needsDecorator = true;
     }
-    else if (firstByte == 0x26)
+
+    instruction.byteCount = state->cpu.instructionPointer - initialStackPointer;
+    return instruction;
+}
+
+// Decoding is skipped for instructions already seen at the same instruction pointer, the loops of the listings run
+// the same few instructions over and over
+Instruction fetchInstruction(State *state)
+{
+    uint16_t instructionPointer = state->cpu.instructionPointer;
+
+    if (state->decodedInstructions == NULL)
     {
-        instruction = decodeInstruction(state);
-        segmentRegister = reg_es;
+        return decodeInstruction(state);
     }
-    else if (firstByte == 0x36)
+
+    DecodedInstruction *decoded = &state->decodedInstructions[instructionPointer];
+
+    if (decoded->isDecoded)
     {
-        instruction = decodeInstruction(state);
-        segmentRegister = reg_ss;
+        state->cpu.instructionPointer += decoded->instruction.byteCount;
     }
     else
     {
-        error(__FILE__, __LINE__, "Unknown instruction, first byte=%#X", firstByte);
+        decoded->instruction = decodeInstruction(state);
+        decoded->isDecoded = true;
     }
 
-    if (
-        instruction.operandCount == 1 && instruction.firstOperand.type != operand_type_register && !(instruction.firstOperand.type == operand_type_immediate && instruction.firstOperand.payload.immediate.isRelativeOffset))
-    {
-        instruction.needsDecorator = true;
-    }
-    if (instruction.operandCount == 2 && instruction.firstOperand.type != operand_type_register && instruction.secondOperand.type != operand_type_register)
+    return decoded->instruction;
+}
+
+// Writes into the instruction stream are rare enough that any of them drops every decoded instruction and block
+void invalidateDecodedInstructions(uint8_t *target, size_t size, State *state)
+{
+    uintptr_t codeStart = (uintptr_t)state->instructions.bytes;
+    uintptr_t codeEnd = codeStart + state->instructions.size;
+
+    if ((uintptr_t)target < codeEnd && (uintptr_t)target + size > codeStart)
     {
-        instruction.needsDecorator = true;
-    }
+        if (state->decodedInstructions != NULL)
+        {
+            memset(state->decodedInstructions, 0, state->instructions.size * sizeof(DecodedInstruction));
+        }
 
-    instruction.segmentRegister = segmentRegister;
+        // The blocks stay allocated, one of them may be running
+        if (state->blockCache != NULL)
+        {
+            memset(state->blockCache, 0, state->instructions.size * sizeof(Block *));
+        }
 
-    instruction.byteCount = state->instructions.instructionPointer - initialStackPointer;
-    return instruction;
+        state->codeWrites++;
+    }
 }
 
 OpValue getRegisterValue(RegisterLocation registerLocation, State *state)
@@ -1680,15 +1515,15 @@ OpValue getRegisterValue(RegisterLocation registerLocation, State *state)
     if (registerLocation.portion == reg_portion_x)
     {
         result.isWide = true;
-        result.value.signedWord = state->registers[registerLocation.reg].x;
+        result.value.signedWord = state->cpu.registers[registerLocation.reg].x;
     }
     else if (registerLocation.portion == reg_portion_l)
     {
-        result.value.signedByte = state->registers[registerLocation.reg].lh.l;
+        result.value.signedByte = state->cpu.registers[registerLocation.reg].lh.l;
     }
     else
     {
-        result.value.signedByte = state->registers[registerLocation.reg].lh.h;
+        result.value.signedByte = state->cpu.registers[registerLocation.reg].lh.h;
     }
 
     return result;
@@ -1767,17 +1602,17 @@ void setDestination(Operand destination, OpValue sourceValue, State *state)
         if (destination.payload.reg.portion == reg_portion_x)
         {
             assert(sourceValue.isWide);
-            state->registers[destination.payload.reg.reg].x = sourceValue.value.signedWord;
+            state->cpu.registers[destination.payload.reg.reg].x = sourceValue.value.signedWord;
         }
         else if (destination.payload.reg.portion == reg_portion_l)
         {
             assert(!sourceValue.isWide);
-            state->registers[destination.payload.reg.reg].lh.l = sourceValue.value.signedByte;
+            state->cpu.registers[destination.payload.reg.reg].lh.l = sourceValue.value.signedByte;
         }
         else
         {
             assert(!sourceValue.isWide);
-            state->registers[destination.payload.reg.reg].lh.h = sourceValue.value.signedByte;
+            state->cpu.registers[destination.payload.reg.reg].lh.h = sourceValue.value.signedByte;
         }
     }
     else
@@ -1793,6 +1628,8 @@ void setDestination(Operand destination, OpValue sourceValue, State *state)
                 MEMORY_SIZE);
         }
 
+        invalidateDecodedInstructions(state->memory + address, sourceValue.isWide ? 2 : 1, state);
+
         if (sourceValue.isWide)
         {
             *((int16_t *)(state->memory + address)) = sourceValue.value.signedWord;
@@ -1830,209 +1667,102 @@ OpValue opValueSubtract(OpValue left, OpValue right)
         {
             result.isOverflow = true;
         }
-        if (left.value.signedWord < 0 && right.value.signedWord >= 0 && result.value.signedWord >= 0)
-        {
-            result.isOverflow = true;
-        }
-    }
-    else
-    {
-        if (result.value.unsignedByte > left.value.unsignedByte)
-        {
-            result.isCarry = true;
-        }
-
-        if (result.value.signedByte >= 0 && left.value.signedByte < 0 && result.value.signedByte < 0)
-        {
-            result.isOverflow = true;
-        }
-        if (result.value.signedByte < 0 && left.value.signedByte >= 0 && result.value.signedByte >= 0)
-        {
-            result.isOverflow = true;
-        }
-    }
-
-    uint8_t leftLowNibble = extractLowBits(left.value.unsignedByte, 4);
-    uint8_t rightLowNibble = extractLowBits(right.value.unsignedByte, 4);
-
-    uint8_t halfByteResult = 0U + leftLowNibble - rightLowNibble;
-
-    if (halfByteResult > 0xf)
-    {
-        result.isAuxCarry = true;
-    }
-
-    return result;
-}
-
-OpValue opValueAdd(OpValue left, OpValue right)
-{
-    assert(left.isWide == right.isWide);
-
-    OpValue result = {0};
-    result.isWide = left.isWide;
-    if (result.isWide)
-    {
-        result.value.unsignedWord = 0U + left.value.unsignedWord + right.value.unsignedWord;
-    }
-    else
-    {
-        result.value.unsignedByte = 0U + left.value.unsignedByte + right.value.unsignedByte;
-    }
-
-    if (result.isWide)
-    {
-        if (result.value.unsignedWord < left.value.unsignedWord)
-        {
-            result.isCarry = true;
-        }
-
-        if (left.value.signedWord >= 0 && right.value.signedWord >= 0 && result.value.signedWord < 0)
-        {
-            result.isOverflow = true;
-        }
-
-        if (left.value.signedWord < 0 && right.value.signedWord < 0 && result.value.signedWord >= 0)
-        {
-            result.isOverflow = true;
-        }
-    }
-    else
-    {
-        if (result.value.unsignedByte < left.value.unsignedByte)
-        {
-            result.isCarry = true;
-        }
-
-        if (left.value.signedByte >= 0 && right.value.signedByte >= 0 && result.value.signedByte < 0)
-        {
-            result.isOverflow = true;
-        }
-
-        if (left.value.signedByte < 0 && right.value.signedByte < 0 && result.value.signedByte >= 0)
-        {
-            result.isOverflow = true;
-        }
-    }
-
-    uint8_t leftLowNibble = extractLowBits(left.value.unsignedByte, 4);
-    uint8_t rightLowNibble = extractLowBits(right.value.unsignedByte, 4);
-
-    uint8_t halfByteSum = 0U + leftLowNibble + rightLowNibble;
-
-    if (halfByteSum > 0xf)
-    {
-        result.isAuxCarry = true;
-    }
-
-    return result;
-}
-
-bool isZero(OpValue value)
-{
-
-    if (value.isWide)
-    {
-        return value.value.signedWord == 0;
-    }
-    else
-    {
-        return value.value.signedByte == 0;
-    }
-}
-
-bool isNegative(OpValue value)
-{
-
-    if (value.isWide)
-    {
-        return value.value.signedWord < 0;
-    }
-    else
-    {
-        return value.value.signedByte < 0;
-    }
-}
-
-void updateZeroFlag(OpValue result, State *state)
-{
-    if (isZero(result))
-    {
-        state->flags[flag_zero] = true;
-    }
-    else
-    {
-        state->flags[flag_zero] = false;
-    }
-}
-
-void updateSignFlag(OpValue result, State *state)
-{
-    if (isNegative(result))
-    {
-        state->flags[flag_sign] = true;
-    }
-    else
-    {
-        state->flags[flag_sign] = false;
-    }
-}
-
-void updateParityFlag(OpValue result, State *state)
-{
-    size_t setCount = 0;
-    for (uint8_t bitIndex = 0; bitIndex < 8; bitIndex++)
-    {
-        bool isSet = extractBit(result.value.signedByte, bitIndex);
-        if (isSet)
+        if (left.value.signedWord < 0 && right.value.signedWord >= 0 && result.value.signedWord >= 0)
         {
-            setCount++;
+            result.isOverflow = true;
         }
     }
-    if (setCount % 2 == 0)
+    else
     {
-        state->flags[flag_parity] = true;
+        if (result.value.unsignedByte > left.value.unsignedByte)
+        {
+            result.isCarry = true;
+        }
+
+        if (result.value.signedByte >= 0 && left.value.signedByte < 0 && result.value.signedByte < 0)
+        {
+            result.isOverflow = true;
+        }
+        if (result.value.signedByte < 0 && left.value.signedByte >= 0 && result.value.signedByte >= 0)
+        {
+            result.isOverflow = true;
+        }
     }
-    else
+
+    uint8_t leftLowNibble = extractLowBits(left.value.unsignedByte, 4);
+    uint8_t rightLowNibble = extractLowBits(right.value.unsignedByte, 4);
+
+    uint8_t halfByteResult = 0U + leftLowNibble - rightLowNibble;
+
+    if (halfByteResult > 0xf)
     {
-        state->flags[flag_parity] = false;
+        result.isAuxCarry = true;
     }
+
+    return result;
 }
 
-void updateCarryFlag(OpValue result, State *state)
+OpValue opValueAdd(OpValue left, OpValue right)
 {
-    if (result.isCarry)
+    assert(left.isWide == right.isWide);
+
+    OpValue result = {0};
+    result.isWide = left.isWide;
+    if (result.isWide)
     {
-        state->flags[flag_carry] = true;
+        result.value.unsignedWord = 0U + left.value.unsignedWord + right.value.unsignedWord;
     }
     else
     {
-        state->flags[flag_carry] = false;
+        result.value.unsignedByte = 0U + left.value.unsignedByte + right.value.unsignedByte;
     }
-}
 
-void updateOverflowFlag(OpValue result, State *state)
-{
-    if (result.isOverflow)
+    if (result.isWide)
     {
-        state->flags[flag_overflow] = true;
+        if (result.value.unsignedWord < left.value.unsignedWord)
+        {
+            result.isCarry = true;
+        }
+
+        if (left.value.signedWord >= 0 && right.value.signedWord >= 0 && result.value.signedWord < 0)
+        {
+            result.isOverflow = true;
+        }
+
+        if (left.value.signedWord < 0 && right.value.signedWord < 0 && result.value.signedWord >= 0)
+        {
+            result.isOverflow = true;
+        }
     }
     else
     {
-        state->flags[flag_overflow] = false;
-    }
-}
+        if (result.value.unsignedByte < left.value.unsignedByte)
+        {
+            result.isCarry = true;
+        }
 
-void updateAuxCarryFlag(OpValue result, State *state)
-{
-    if (result.isAuxCarry)
-    {
-        state->flags[flag_aux_carry] = true;
+        if (left.value.signedByte >= 0 && right.value.signedByte >= 0 && result.value.signedByte < 0)
+        {
+            result.isOverflow = true;
+        }
+
+        if (left.value.signedByte < 0 && right.value.signedByte < 0 && result.value.signedByte >= 0)
+        {
+            result.isOverflow = true;
+        }
     }
-    else
+
+    uint8_t leftLowNibble = extractLowBits(left.value.unsignedByte, 4);
+    uint8_t rightLowNibble = extractLowBits(right.value.unsignedByte, 4);
+
+    uint8_t halfByteSum = 0U + leftLowNibble + rightLowNibble;
+
+    if (halfByteSum > 0xf)
     {
-        state->flags[flag_aux_carry] = false;
+        result.isAuxCarry = true;
     }
+
+    return result;
 }
 
 size_t parityClocksForOperand(Operand operand, State *state)
@@ -2041,7 +1771,7 @@ size_t parityClocksForOperand(Operand operand, State *state)
     assert(operand.type == operand_type_memory);
 
     size_t address = getAddress(operand, state);
-    if (state->test8088 || address % 2 == 1)
+    if (state->config.test8088 || address % 2 == 1)
     {
         return 4;
     }
@@ -2195,162 +1925,652 @@ size_t estimateClocks(Instruction instruction, State *state)
             size_t extraClocks = clocksForEffectiveAddress(instruction.secondOperand);
             result = 9 + extraClocks;
         }
-        else if (instruction.firstOperand.type == operand_type_register && instruction.secondOperand.type == operand_type_register)
+        else if (instruction.firstOperand.type == operand_type_register && instruction.secondOperand.type == operand_type_register)
+        {
+            result = 3;
+        }
+        else if (instruction.firstOperand.type == operand_type_register && instruction.secondOperand.type == operand_type_immediate)
+        {
+
+            result = 4;
+        }
+        else if (instruction.firstOperand.type == operand_type_memory && instruction.secondOperand.type == operand_type_immediate)
+        {
+            size_t extraClocks = clocksForEffectiveAddress(instruction.firstOperand);
+            result = 17 + extraClocks;
+        }
+        else
+        {
+            assert(false && "Unimplemented");
+        }
+
+        result += parityClocksForInstruction(instruction, 2, state);
+    }
+    break;
+
+    default:
+    {
+        assert(instruction.type == InstructionInfos[instruction.type].type);
+        error(__FILE__, __LINE__, "Clocks estimation not implemented for %s", InstructionInfos[instruction.type].name);
+    }
+    }
+
+    return result;
+}
+
+void executeInstruction(Instruction instruction, State *state)
+{
+    switch (instruction.type)
+    {
+    case instruction_mov:
+    {
+        assert(instruction.operandCount == 2);
+
+        OpValue sourceValue = getOperandValue(instruction.secondOperand, instruction.isWide, state);
+
+        setDestination(instruction.firstOperand, sourceValue, state);
+    }
+    break;
+    case instruction_sub:
+    {
+        OpValue sourceValue = getOperandValue(instruction.secondOperand, instruction.isWide, state);
+        OpValue destinationValue = getOperandValue(instruction.firstOperand, instruction.isWide, state);
+
+        OpValue result = opValueSubtract(destinationValue, sourceValue);
+
+        setDestination(instruction.firstOperand, result, state);
+
+        updateArithmeticFlags(result, state);
+    }
+    break;
+    case instruction_cmp:
+    {
+        OpValue left = getOperandValue(instruction.firstOperand, instruction.isWide, state);
+
+        OpValue right = getOperandValue(instruction.secondOperand, instruction.isWide, state);
+
+        OpValue result = opValueSubtract(left, right);
+
+        updateArithmeticFlags(result, state);
+    }
+    break;
+    case instruction_add:
+    {
+        OpValue left = getOperandValue(instruction.firstOperand, instruction.isWide, state);
+
+        OpValue right = getOperandValue(instruction.secondOperand, instruction.isWide, state);
+
+        OpValue result = opValueAdd(left, right);
+        setDestination(instruction.firstOperand, result, state);
+
+        updateArithmeticFlags(result, state);
+    }
+    break;
+    case instruction_jb:
+    {
+        if (getFlag(&state->cpu, flag_carry))
+        {
+            state->cpu.instructionPointer += instruction.firstOperand.payload.immediate.value;
+        }
+    }
+    break;
+    case instruction_je:
+    {
+        if (getFlag(&state->cpu, flag_zero))
+        {
+            state->cpu.instructionPointer += instruction.firstOperand.payload.immediate.value;
+        }
+    }
+    break;
+    case instruction_jnz:
+    {
+        if (!getFlag(&state->cpu, flag_zero))
+        {
+            state->cpu.instructionPointer += instruction.firstOperand.payload.immediate.value;
+        }
+    }
+    break;
+    case instruction_jp:
+    {
+        if (getFlag(&state->cpu, flag_parity))
+        {
+            state->cpu.instructionPointer += instruction.firstOperand.payload.immediate.value;
+        }
+    }
+    break;
+    case instruction_loop:
+    {
+        state->cpu.registers[reg_c].x--;
+        if (!getFlag(&state->cpu, flag_zero) && state->cpu.registers[reg_c].x != 0)
+        {
+            state->cpu.instructionPointer += instruction.firstOperand.payload.immediate.value;
+        }
+    }
+    break;
+    case instruction_loopnz:
+    {
+        state->cpu.registers[reg_c].x--;
+        if (state->cpu.registers[reg_c].x != 0)
+        {
+            state->cpu.instructionPointer += instruction.firstOperand.payload.immediate.value;
+        }
+    }
+    break;
+    default:
+    {
+        assert(instruction.type == InstructionInfos[instruction.type].type);
+        error(
+            __FILE__,
+            __LINE__,
+            "Unimplemented instruction: %s",
+            InstructionInfos[instruction.type].name);
+    }
+    }
+}
+
+OpValue readRegisterWord(const BlockOperand *operand, State *state)
+{
+    OpValue result = {0};
+    result.isWide = true;
+    result.value.signedWord = state->cpu.registers[operand->reg].x;
+
+    return result;
+}
+
+OpValue readRegisterLow(const BlockOperand *operand, State *state)
+{
+    OpValue result = {0};
+    result.value.signedByte = state->cpu.registers[operand->reg].lh.l;
+
+    return result;
+}
+
+OpValue readRegisterHigh(const BlockOperand *operand, State *state)
+{
+    OpValue result = {0};
+    result.value.signedByte = state->cpu.registers[operand->reg].lh.h;
+
+    return result;
+}
+
+OpValue readConstant(const BlockOperand *operand, State *state)
+{
+    (void)state;
+
+    return operand->constant;
+}
+
+OpValue readMemory(const BlockOperand *operand, State *state)
+{
+    return getOperandValue(operand->operand, operand->isWide, state);
+}
+
+void writeRegisterWord(const BlockOperand *operand, OpValue value, State *state)
+{
+    assert(value.isWide);
+    state->cpu.registers[operand->reg].x = value.value.signedWord;
+}
+
+void writeRegisterLow(const BlockOperand *operand, OpValue value, State *state)
+{
+    assert(!value.isWide);
+    state->cpu.registers[operand->reg].lh.l = value.value.signedByte;
+}
+
+void writeRegisterHigh(const BlockOperand *operand, OpValue value, State *state)
+{
+    assert(!value.isWide);
+    state->cpu.registers[operand->reg].lh.h = value.value.signedByte;
+}
+
+void writeMemory(const BlockOperand *operand, OpValue value, State *state)
+{
+    setDestination(operand->operand, value, state);
+}
+
+void writeImmediate(const BlockOperand *operand, OpValue value, State *state)
+{
+    (void)value;
+    (void)state;
+
+    error(__FILE__, __LINE__, "Cannot write to the immediate %d", operand->operand.payload.immediate.value);
+}
+
+BlockOperand translateOperand(Operand operand, bool isWide)
+{
+    BlockOperand result = {0};
+    result.operand = operand;
+    result.isWide = isWide;
+
+    if (operand.type == operand_type_register)
+    {
+        assert(operand.payload.reg.reg != reg_none);
+        result.reg = operand.payload.reg.reg;
+
+        if (operand.payload.reg.portion == reg_portion_x)
+        {
+            result.read = readRegisterWord;
+            result.write = writeRegisterWord;
+        }
+        else if (operand.payload.reg.portion == reg_portion_l)
         {
-            result = 3;
+            result.read = readRegisterLow;
+            result.write = writeRegisterLow;
         }
-        else if (instruction.firstOperand.type == operand_type_register && instruction.secondOperand.type == operand_type_immediate)
+        else
         {
-
-            result = 4;
+            result.read = readRegisterHigh;
+            result.write = writeRegisterHigh;
         }
-        else if (instruction.firstOperand.type == operand_type_memory && instruction.secondOperand.type == operand_type_immediate)
+    }
+    else if (operand.type == operand_type_immediate)
+    {
+        result.constant.isWide = isWide;
+
+        if (isWide)
         {
-            size_t extraClocks = clocksForEffectiveAddress(instruction.firstOperand);
-            result = 17 + extraClocks;
+            result.constant.value.signedWord = operand.payload.immediate.value;
         }
         else
         {
-            assert(false && "Unimplemented");
+            result.constant.value.signedByte = (int8_t)operand.payload.immediate.value;
         }
 
-        result += parityClocksForInstruction(instruction, 2, state);
+        result.read = readConstant;
+        result.write = writeImmediate;
     }
-    break;
-
-    default:
+    else
     {
-        assert(instruction.type == InstructionInfos[instruction.type].type);
-        error(__FILE__, __LINE__, "Clocks estimation not implemented for %s", InstructionInfos[instruction.type].name);
-    }
+        result.read = readMemory;
+        result.write = writeMemory;
     }
 
     return result;
 }
 
-void executeInstruction(Instruction instruction, State *state)
+void executeBlockMov(const BlockOp *op, State *state)
 {
-    switch (instruction.type)
+    OpValue sourceValue = op->source.read(&op->source, state);
+
+    op->destination.write(&op->destination, sourceValue, state);
+}
+
+void executeBlockAdd(const BlockOp *op, State *state)
+{
+    OpValue left = op->destination.read(&op->destination, state);
+    OpValue right = op->source.read(&op->source, state);
+
+    OpValue result = opValueAdd(left, right);
+    op->destination.write(&op->destination, result, state);
+
+    updateArithmeticFlags(result, state);
+}
+
+void executeBlockSub(const BlockOp *op, State *state)
+{
+    OpValue left = op->destination.read(&op->destination, state);
+    OpValue right = op->source.read(&op->source, state);
+
+    OpValue result = opValueSubtract(left, right);
+    op->destination.write(&op->destination, result, state);
+
+    updateArithmeticFlags(result, state);
+}
+
+void executeBlockCmp(const BlockOp *op, State *state)
+{
+    OpValue left = op->destination.read(&op->destination, state);
+    OpValue right = op->source.read(&op->source, state);
+
+    OpValue result = opValueSubtract(left, right);
+
+    updateArithmeticFlags(result, state);
+}
+
+void executeBlockJb(const BlockOp *op, State *state)
+{
+    if (getFlag(&state->cpu, flag_carry))
     {
-    case instruction_mov:
+        state->cpu.instructionPointer += op->jumpOffset;
+    }
+}
+
+void executeBlockJe(const BlockOp *op, State *state)
+{
+    if (getFlag(&state->cpu, flag_zero))
     {
-        assert(instruction.operandCount == 2);
+        state->cpu.instructionPointer += op->jumpOffset;
+    }
+}
 
-        OpValue sourceValue = getOperandValue(instruction.secondOperand, instruction.isWide, state);
+void executeBlockJnz(const BlockOp *op, State *state)
+{
+    if (!getFlag(&state->cpu, flag_zero))
+    {
+        state->cpu.instructionPointer += op->jumpOffset;
+    }
+}
 
-        setDestination(instruction.firstOperand, sourceValue, state);
+void executeBlockJp(const BlockOp *op, State *state)
+{
+    if (getFlag(&state->cpu, flag_parity))
+    {
+        state->cpu.instructionPointer += op->jumpOffset;
     }
-    break;
-    case instruction_sub:
+}
+
+void executeBlockLoop(const BlockOp *op, State *state)
+{
+    state->cpu.registers[reg_c].x--;
+    if (!getFlag(&state->cpu, flag_zero) && state->cpu.registers[reg_c].x != 0)
     {
-        OpValue sourceValue = getOperandValue(instruction.secondOperand, instruction.isWide, state);
-        OpValue destinationValue = getOperandValue(instruction.firstOperand, instruction.isWide, state);
+        state->cpu.instructionPointer += op->jumpOffset;
+    }
+}
 
-        OpValue result = opValueSubtract(destinationValue, sourceValue);
+void executeBlockLoopnz(const BlockOp *op, State *state)
+{
+    state->cpu.registers[reg_c].x--;
+    if (state->cpu.registers[reg_c].x != 0)
+    {
+        state->cpu.instructionPointer += op->jumpOffset;
+    }
+}
 
-        setDestination(instruction.firstOperand, result, state);
+// The interpreter reports the instruction, only once it is reached
+void executeBlockUnimplemented(const BlockOp *op, State *state)
+{
+    executeInstruction(op->instruction, state);
+}
 
-        updateCarryFlag(result, state);
-        updateAuxCarryFlag(result, state);
-        updateZeroFlag(result, state);
-        updateSignFlag(result, state);
-        updateParityFlag(result, state);
-        updateOverflowFlag(result, state);
-    }
-    break;
-    case instruction_cmp:
+BlockOp translateInstruction(Instruction instruction, uint16_t nextInstructionPointer)
+{
+    BlockOp result = {0};
+    result.instruction = instruction;
+    result.nextInstructionPointer = nextInstructionPointer;
+
+    if (instruction.operandCount > 0)
     {
-        OpValue left = getOperandValue(instruction.firstOperand, instruction.isWide, state);
+        result.destination = translateOperand(instruction.firstOperand, instruction.isWide);
 
-        OpValue right = getOperandValue(instruction.secondOperand, instruction.isWide, state);
+        if (instruction.firstOperand.type == operand_type_immediate)
+        {
+            result.jumpOffset = instruction.firstOperand.payload.immediate.value;
+        }
+    }
 
-        OpValue result = opValueSubtract(left, right);
+    if (instruction.operandCount > 1)
+    {
+        result.source = translateOperand(instruction.secondOperand, instruction.isWide);
+    }
 
-        updateCarryFlag(result, state);
-        updateAuxCarryFlag(result, state);
-        updateZeroFlag(result, state);
-        updateSignFlag(result, state);
-        updateParityFlag(result, state);
-        updateOverflowFlag(result, state);
+    switch (instruction.type)
+    {
+    case instruction_mov:
+    {
+        result.execute = executeBlockMov;
     }
     break;
     case instruction_add:
     {
-        OpValue left = getOperandValue(instruction.firstOperand, instruction.isWide, state);
-
-        OpValue right = getOperandValue(instruction.secondOperand, instruction.isWide, state);
-
-        OpValue result = opValueAdd(left, right);
-        setDestination(instruction.firstOperand, result, state);
-
-        updateCarryFlag(result, state);
-        updateAuxCarryFlag(result, state);
-        updateZeroFlag(result, state);
-        updateSignFlag(result, state);
-        updateParityFlag(result, state);
-        updateOverflowFlag(result, state);
+        result.execute = executeBlockAdd;
+    }
+    break;
+    case instruction_sub:
+    {
+        result.execute = executeBlockSub;
+    }
+    break;
+    case instruction_cmp:
+    {
+        result.execute = executeBlockCmp;
     }
     break;
     case instruction_jb:
     {
-        if (state->flags[flag_carry])
-        {
-            state->instructions.instructionPointer += instruction.firstOperand.payload.immediate.value;
-        }
+        result.execute = executeBlockJb;
     }
     break;
     case instruction_je:
     {
-        if (state->flags[flag_zero])
-        {
-            state->instructions.instructionPointer += instruction.firstOperand.payload.immediate.value;
-        }
+        result.execute = executeBlockJe;
     }
     break;
     case instruction_jnz:
     {
-        if (!state->flags[flag_zero])
-        {
-            state->instructions.instructionPointer += instruction.firstOperand.payload.immediate.value;
-        }
+        result.execute = executeBlockJnz;
     }
     break;
     case instruction_jp:
     {
-        if (state->flags[flag_parity])
-        {
-            state->instructions.instructionPointer += instruction.firstOperand.payload.immediate.value;
-        }
+        result.execute = executeBlockJp;
     }
     break;
     case instruction_loop:
     {
-        state->registers[reg_c].x--;
-        if (!state->flags[flag_zero] && state->registers[reg_c].x != 0)
-        {
-            state->instructions.instructionPointer += instruction.firstOperand.payload.immediate.value;
-        }
+        result.execute = executeBlockLoop;
     }
     break;
     case instruction_loopnz:
     {
-        state->registers[reg_c].x--;
-        if (state->registers[reg_c].x != 0)
-        {
-            state->instructions.instructionPointer += instruction.firstOperand.payload.immediate.value;
-        }
+        result.execute = executeBlockLoopnz;
     }
     break;
     default:
     {
-        assert(instruction.type == InstructionInfos[instruction.type].type);
-        error(
-            __FILE__,
-            __LINE__,
-            "Unimplemented instruction: %s",
-            InstructionInfos[instruction.type].name);
+        result.execute = executeBlockUnimplemented;
     }
     }
+
+    return result;
+}
+
+bool endsBlock(InstructionType type)
+{
+    // From call to jcxz the instruction types are all jumps, calls, returns and loops
+    bool isJump = type >= instruction_call && type <= instruction_jcxz;
+    bool isInterrupt = type >= instruction_int && type <= instruction_iret;
+
+    return isJump || isInterrupt || type == instruction_hlt;
+}
+
+Block *translateBlock(State *state)
+{
+    uint16_t startInstructionPointer = state->cpu.instructionPointer;
+
+    BlockOp ops[BLOCK_CAPACITY];
+    size_t opCount = 0;
+
+    while (opCount < BLOCK_CAPACITY && state->cpu.instructionPointer < state->instructions.size)
+    {
+        Instruction instruction = fetchInstruction(state);
+        ops[opCount++] = translateInstruction(instruction, state->cpu.instructionPointer);
+
+        if (endsBlock(instruction.type))
+        {
+            break;
+        }
+    }
+
+    state->cpu.instructionPointer = startInstructionPointer;
+
+    Block *block = malloc(sizeof(Block));
+    BlockOp *blockOps = malloc(opCount * sizeof(BlockOp));
+
+    if (block == NULL || blockOps == NULL)
+    {
+        error(__FILE__, __LINE__, "Failed to allocate");
+    }
+
+    memcpy(blockOps, ops, opCount * sizeof(BlockOp));
+
+    block->ops = blockOps;
+    block->opCount = opCount;
+    block->next = state->translatedBlocks;
+    state->translatedBlocks = block;
+    state->blockCache[startInstructionPointer] = block;
+
+    return block;
+}
+
+// Runs the program a block at a time, each op calling its handler directly. Returns the number of instructions run.
+size_t runBlocks(State *state)
+{
+    size_t result = 0;
+
+    while (state->cpu.instructionPointer < state->instructions.size)
+    {
+        Block *block = state->blockCache[state->cpu.instructionPointer];
+
+        if (block == NULL)
+        {
+            block = translateBlock(state);
+        }
+
+        uint32_t codeWrites = state->codeWrites;
+
+        for (size_t opIndex = 0; opIndex < block->opCount; opIndex++)
+        {
+            const BlockOp *op = &block->ops[opIndex];
+
+            state->cpu.instructionPointer = op->nextInstructionPointer;
+            op->execute(op, state);
+
+            if (state->config.estimateClocks)
+            {
+                state->cpu.clocks += estimateClocks(op->instruction, state);
+            }
+
+            result++;
+
+            if (state->codeWrites != codeWrites)
+            {
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+void freeBlocks(State *state)
+{
+    Block *block = state->translatedBlocks;
+
+    while (block != NULL)
+    {
+        Block *next = block->next;
+        free(block->ops);
+        free(block);
+        block = next;
+    }
+
+    state->translatedBlocks = NULL;
+}
+
+// Returns the number of instructions run
+size_t runInterpreter(State *state)
+{
+    size_t result = 0;
+
+    while (state->cpu.instructionPointer < state->instructions.size)
+    {
+        Instruction instruction = fetchInstruction(state);
+        executeInstruction(instruction, state);
+
+        if (state->config.estimateClocks)
+        {
+            state->cpu.clocks += estimateClocks(instruction, state);
+        }
+
+        result++;
+    }
+
+    return result;
+}
+
+void resetExecution(State *state)
+{
+    memset(&state->cpu, 0, sizeof(state->cpu));
+    memset(state->memory, 0, MEMORY_SIZE);
+}
+
+bool executionsEqual(Cpu *left, Cpu *right)
+{
+    bool result = memcmp(left->registers, right->registers, sizeof(left->registers)) == 0;
+    result = result && resolveFlags(left) == resolveFlags(right);
+    result = result && left->instructionPointer == right->instructionPointer;
+    result = result && left->clocks == right->clocks;
+
+    return result;
+}
+
+double getSeconds(void)
+{
+    struct timespec time = {0};
+    timespec_get(&time, TIME_UTC);
+
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+typedef enum
+{
+    engine_decode,
+    engine_cached,
+    engine_blocks,
+    engine_count
+} Engine;
+
+const char *EngineNames[engine_count] = {"decode", "cached", "blocks"};
+
+// Runs the program over and over with each engine, from a cleared state every time. Only the runs are timed, the
+// clearing of the memory is not.
+void benchmarkEngines(State *state)
+{
+    Cpu expected = {0};
+
+    for (Engine engine = 0; engine < engine_count; engine++)
+    {
+        DecodedInstruction *decodedInstructions = state->decodedInstructions;
+
+        if (engine == engine_decode)
+        {
+            state->decodedInstructions = NULL;
+        }
+
+        size_t instructionCount = 0;
+        size_t runCount = 0;
+        double runSeconds = 0;
+        double startSeconds = getSeconds();
+
+        while (getSeconds() - startSeconds < BENCHMARK_SECONDS)
+        {
+            resetExecution(state);
+
+            double runStart = getSeconds();
+            instructionCount += engine == engine_blocks ? runBlocks(state) : runInterpreter(state);
+            runSeconds += getSeconds() - runStart;
+            runCount++;
+        }
+
+        state->decodedInstructions = decodedInstructions;
+
+        if (engine == 0)
+        {
+            expected = state->cpu;
+        }
+        else if (!executionsEqual(&expected, &state->cpu))
+        {
+            error(__FILE__, __LINE__, "The %s engine ended in a different state than the %s one", EngineNames[engine], EngineNames[0]);
+        }
+
+        printf(
+            "%s:\t%zu instructions per run, %zu runs, %f million instructions/s\n",
+            EngineNames[engine],
+            instructionCount / runCount,
+            runCount,
+            (double)instructionCount / runSeconds / 1e6);
+    }
 }
 
 bool cStringsEqual(char *left, char *right)
@@ -2382,24 +2602,34 @@ int main(int argc, char *argv[])
 
         if (cStringsEqual(argument, "--execute"))
         {
-            state.execute = true;
+            state.config.execute = true;
         }
         else if (cStringsEqual(argument, "--clocks"))
         {
-            state.execute = true;
-            state.estimateClocks = true;
+            state.config.execute = true;
+            state.config.estimateClocks = true;
         }
         else if (cStringsEqual(argument, "--dump"))
         {
-            state.dump = true;
+            state.config.dump = true;
         }
         else if (cStringsEqual(argument, "--img"))
         {
-            state.image = true;
+            state.config.image = true;
         }
         else if (cStringsEqual(argument, "--8088"))
         {
-            state.test8088 = true;
+            state.config.test8088 = true;
+        }
+        else if (cStringsEqual(argument, "--blocks"))
+        {
+            state.config.execute = true;
+            state.config.blocks = true;
+        }
+        else if (cStringsEqual(argument, "--benchmark"))
+        {
+            state.config.execute = true;
+            state.config.benchmark = true;
         }
         else if (inputPath == NULL)
         {
@@ -2417,45 +2647,67 @@ int main(int argc, char *argv[])
     state.instructions.bytes = bytes;
     state.instructions.size = fileSize;
 
+    state.decodedInstructions = calloc(fileSize, sizeof(DecodedInstruction));
+    state.blockCache = calloc(fileSize, sizeof(Block *));
+
+    if (state.decodedInstructions == NULL || state.blockCache == NULL)
+    {
+        error(__FILE__, __LINE__, "Failed to allocate");
+    }
+
     size_t offset = fileNameStart(inputPath);
     const char *filePrefix = inputPath + offset;
 
-    while (state.instructions.instructionPointer < state.instructions.size)
+    if (state.config.benchmark)
+    {
+        benchmarkEngines(&state);
+        resetExecution(&state);
+    }
+
+    // Blocks run without the trace, only the final state is printed
+    if (state.config.blocks || state.config.benchmark)
     {
+        runBlocks(&state);
+    }
 
-        State before = state;
+    while (state.cpu.instructionPointer < state.instructions.size)
+    {
+        // Only the cpu is copied, the trace prints the registers that changed against it
+        Cpu before = state.cpu;
 
-        Instruction instruction = decodeInstruction(&state);
+        Instruction instruction = fetchInstruction(&state);
         size_t clocks = 0;
-        if (state.execute)
+        if (state.config.execute)
         {
             executeInstruction(instruction, &state);
-            if (state.estimateClocks)
+            if (state.config.estimateClocks)
             {
                 clocks = estimateClocks(instruction, &state);
-                state.clocks += clocks;
+                state.cpu.clocks += clocks;
             }
         }
-        State after = state;
 
-        printInstruction(instruction, clocks, &before, &after);
+        printInstruction(instruction, clocks, &state.config, &before, &state.cpu);
     }
 
-    if (state.execute)
+    if (state.config.execute)
     {
         for (size_t regIndex = 0; regIndex < REGISTER_COUNT; regIndex++)
         {
-            printf("; %s = \t%u\n", RegisterInfos[regIndex].name, state.registers[regIndex].x);
+            printf("; %s = \t%u\n", RegisterInfos[regIndex].name, state.cpu.registers[regIndex].x);
         }
 
-        printf("; ip = \t %u\n", state.instructions.instructionPointer);
+        printf("; ip = \t %u\n", state.cpu.instructionPointer);
 
         printf("Flags:");
-        printFlags(&state);
+        printFlags(&state.cpu);
     }
 
-    if (state.dump)
+    if (state.config.dump)
     {
+        // The dump holds only the cpu, with the flags as a plain word
+        resolveFlags(&state.cpu);
+
         char *outputPath = malloc(strlen(filePrefix) + 10);
         if (outputPath)
         {
@@ -2465,7 +2717,7 @@ int main(int argc, char *argv[])
 
             if (outputFile != NULL)
             {
-                if (fwrite(&state, sizeof(State), 1, outputFile) != 1)
+                if (fwrite(&state.cpu, sizeof(Cpu), 1, outputFile) != 1)
                 {
                     fprintf(stderr, "Could not dump final state");
                 }
@@ -2475,7 +2727,7 @@ int main(int argc, char *argv[])
             free(outputPath);
         }
 
-        if (state.image)
+        if (state.config.image)
         {
 
             FILE *outputFile = fopen(IMAGE_PATH, "wb");
@@ -2506,5 +2758,17 @@ int main(int argc, char *argv[])
         free(state.memory);
     }
 
+    if (state.decodedInstructions != NULL)
+    {
+        free(state.decodedInstructions);
+    }
+
+    if (state.blockCache != NULL)
+    {
+        free(state.blockCache);
+    }
+
+    freeBlocks(&state);
+
     return 0;
 }
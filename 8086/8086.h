@@ -7,6 +7,7 @@
 #include "stdint.h"
 #include "assert.h"
 #include "string.h"
+#include "time.h"
 
 #define DUMP_PATH "tmp/%s.dump"
 
@@ -392,21 +393,41 @@ typedef struct
 {
     char *bytes;
     size_t size;
-    uint16_t instructionPointer;
 } Stream;
 
+typedef struct
+{
+    bool isDecoded;
+    Instruction instruction;
+} DecodedInstruction;
+
+typedef struct
+{
+    bool isWide;
+    bool isCarry;
+    bool isAuxCarry;
+    bool isOverflow;
+    union
+    {
+        int16_t signedWord;
+        int8_t signedByte;
+        uint8_t unsignedByte;
+        uint16_t unsignedWord;
+    } value;
+
+} OpValue;
+
 #define REGISTER_COUNT 12
 #define FLAG_COUNT 9
+#define FLAG_BIT(flag) (1u << (flag))
+// The flags add, sub and cmp set from their result
+#define ARITHMETIC_FLAGS (FLAG_BIT(flag_overflow) | FLAG_BIT(flag_sign) | FLAG_BIT(flag_zero) | FLAG_BIT(flag_aux_carry) | FLAG_BIT(flag_parity) | FLAG_BIT(flag_carry))
 #define MEMORY_SIZE 1024 * 1024
+#define CACHE_LINE_SIZE 64
+
+// Everything an instruction reads or writes besides memory, small enough to copy for the trace
 typedef struct
 {
-    bool execute;
-    bool estimateClocks;
-    bool dump;
-    bool image;
-    bool test8088;
-    Stream instructions;
-    uint8_t *memory;
     size_t clocks;
     union
     {
@@ -419,24 +440,125 @@ typedef struct
 
     } registers[REGISTER_COUNT];
 
-    bool flags[FLAG_COUNT];
+    uint16_t instructionPointer;
+
+    // One bit per Flag. The bits in pendingFlags are stale, they are computed from flagsResult when read.
+    uint16_t flags;
+    uint16_t pendingFlags;
+    OpValue flagsResult;
+} Cpu;
 
+// Fails to compile when Cpu outgrows a cache line. MSVC has no static_assert in its default C mode.
+typedef char CpuFitsCacheLine[sizeof(Cpu) <= CACHE_LINE_SIZE ? 1 : -1];
+
+typedef struct
+{
+    bool execute;
+    bool estimateClocks;
+    bool dump;
+    bool image;
+    bool test8088;
+    bool blocks;
+    bool benchmark;
+} Config;
+
+typedef struct
+{
+    Cpu cpu;
+    Config config;
+    Stream instructions;
+    // One slot per byte of the instruction stream, indexed by the instruction pointer
+    DecodedInstruction *decodedInstructions;
+    // The translated block starting at each byte of the instruction stream
+    struct Block **blockCache;
+    // Every block translated so far, including the ones dropped after a write into the instruction stream
+    struct Block *translatedBlocks;
+    // Bumped by every write into the instruction stream, so a running block can tell it went stale
+    uint32_t codeWrites;
+    uint8_t *memory;
 } State;
 
+// Fields an opcode carries in its first byte, besides the ones its decoder reads from the low bits
+typedef enum
+{
+    opcode_d = 1 << 0,
+    opcode_w = 1 << 1,
+    // The w bit of the immediate to register movs, which keep the register in the low bits
+    opcode_w_bit3 = 1 << 2,
+    opcode_s = 1 << 3,
+    opcode_v = 1 << 4,
+    // Without a w bit the operands are words
+    opcode_word = 1 << 5,
+    // Without a d bit the reg field is the destination
+    opcode_to_register = 1 << 6
+} OpcodeField;
+
+typedef struct
+{
+    uint8_t firstByte;
+    InstructionType type;
+    // For opcodes whose reg field selects the instruction
+    const InstructionType *regTypes;
+    bool dBit;
+    bool wBit;
+    bool sBit;
+    bool vBit;
+} Opcode;
+
+typedef Instruction (*OpcodeDecoder)(Opcode opcode, State *state);
+
 typedef struct
 {
+    InstructionType type;
+    OpcodeDecoder decode;
+    uint8_t fields;
+    const InstructionType *regTypes;
+} OpcodeEncoding;
+
+
+OpValue opValueAdd(OpValue left, OpValue right);
+
+#define BLOCK_CAPACITY 64
+
+#define BENCHMARK_SECONDS 1.0
+
+typedef struct BlockOperand BlockOperand;
+
+typedef OpValue (*OperandReader)(const BlockOperand *operand, State *state);
+
+typedef void (*OperandWriter)(const BlockOperand *operand, OpValue value, State *state);
+
+// An operand with its kind resolved when the block is translated. Registers and immediates are read without going
+// through the operand type, memory operands still compute their address on every access.
+struct BlockOperand
+{
+    OperandReader read;
+    OperandWriter write;
+    Operand operand;
+    Register reg;
+    OpValue constant;
     bool isWide;
-    bool isCarry;
-    bool isAuxCarry;
-    bool isOverflow;
-    union
-    {
-        int16_t signedWord;
-        int8_t signedByte;
-        uint8_t unsignedByte;
-        uint16_t unsignedWord;
-    } value;
+};
 
-} OpValue;
+typedef struct BlockOp BlockOp;
+
+typedef void (*BlockHandler)(const BlockOp *op, State *state);
 
-OpValue opValueAdd(OpValue left, OpValue right);
\ No newline at end of file
+struct BlockOp
+{
+    BlockHandler execute;
+    BlockOperand destination;
+    BlockOperand source;
+    int16_t jumpOffset;
+    uint16_t nextInstructionPointer;
+    // Kept for the clock estimates and the error of unimplemented instructions
+    Instruction instruction;
+};
+
+// Straight-line instructions up to and including the first one that can jump
+typedef struct Block
+{
+    struct Block *next;
+    BlockOp *ops;
+    size_t opCount;
+} Block;
@@ -84,12 +84,13 @@ void testDecoding(const char *filePath)
     assert(memcmp(inputData, outputData, inputFileSize) == 0);
 }
 
-void testFinalState(const char *filePath, State expected, bool testIp, bool testClock, bool test8088)
+void testFinalStateWith(const char *filePath, const char *engine, Cpu expected, bool testIp, bool testClock, bool test8088)
 {
 
     printf("Executing %s...\n", filePath);
     char buffer[1024];
-    sprintf(buffer, "8086.exe --dump --execute %s %s %s > nul ",
+    sprintf(buffer, "8086.exe --dump --execute %s %s %s %s > nul ",
+            engine,
             testClock ? "--clocks" : "",
             test8088 ? "--8088" : "",
             filePath);
@@ -105,7 +106,7 @@ void testFinalState(const char *filePath, State expected, bool testIp, bool test
     {
         sprintf(inputPath, DUMP_PATH, filePrefix);
         char *inputData = readFile(inputPath, &fileSize);
-        State *found = (State *)inputData;
+        Cpu *found = (Cpu *)inputData;
 
         for (size_t regIndex = 0; regIndex < REGISTER_COUNT; regIndex++)
         {
@@ -122,23 +123,26 @@ void testFinalState(const char *filePath, State expected, bool testIp, bool test
         for (size_t flagIndex = 0; flagIndex < FLAG_COUNT; flagIndex++)
         {
 
+            bool expectedFlag = (expected.flags & FLAG_BIT(flagIndex)) != 0;
+            bool foundFlag = (found->flags & FLAG_BIT(flagIndex)) != 0;
+
             printf(
                 "%s : expected %d, found %d\n",
                 FlagNames[flagIndex].name,
-                expected.flags[flagIndex],
-                found->flags[flagIndex]);
+                expectedFlag,
+                foundFlag);
 
-            assert(expected.flags[flagIndex] == found->flags[flagIndex]);
+            assert(expectedFlag == foundFlag);
         }
 
         if (testIp)
         {
             printf(
                 "ip : expected %d, found %d\n",
-                expected.instructions.instructionPointer,
-                found->instructions.instructionPointer);
+                expected.instructionPointer,
+                found->instructionPointer);
 
-            assert(expected.instructions.instructionPointer == found->instructions.instructionPointer);
+            assert(expected.instructionPointer == found->instructionPointer);
         }
         if (testClock)
         {
@@ -155,9 +159,16 @@ void testFinalState(const char *filePath, State expected, bool testIp, bool test
     }
 }
 
+// The listings are run both through the interpreter and as translated blocks
+void testFinalState(const char *filePath, Cpu expected, bool testIp, bool testClock, bool test8088)
+{
+    testFinalStateWith(filePath, "", expected, testIp, testClock, test8088);
+    testFinalStateWith(filePath, "--blocks", expected, testIp, testClock, test8088);
+}
+
 void testFinalState43()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_a].x = 1;
     expected.registers[reg_b].x = 2;
@@ -173,7 +184,7 @@ void testFinalState43()
 
 void testFinalState44()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_a].x = 4;
     expected.registers[reg_b].x = 3;
@@ -189,7 +200,7 @@ void testFinalState44()
 
 void testFinalState45()
 {
-    State expected = {0};
+    Cpu expected = {0};
     expected.registers[reg_a].x = 17425;
     expected.registers[reg_b].x = 13124;
     expected.registers[reg_c].x = 26231;
@@ -207,149 +218,138 @@ void testFinalState45()
 
 void testFinalState46()
 {
-    State expected = {0};
+    Cpu expected = {0};
     expected.registers[reg_b].x = -7934;
     expected.registers[reg_c].x = 3841;
     expected.registers[reg_sp].x = 998;
-    expected.flags[flag_parity] = true;
-    expected.flags[flag_zero] = true;
+    expected.flags = (uint16_t)(FLAG_BIT(flag_parity) | FLAG_BIT(flag_zero));
 
     testFinalState(LISTING_46, expected, false, false, false);
 }
 
 void testFinalState47()
 {
-    State expected = {0};
+    Cpu expected = {0};
     expected.registers[reg_b].x = -25435;
     expected.registers[reg_d].x = 10;
     expected.registers[reg_sp].x = 99;
     expected.registers[reg_bp].x = 98;
 
-    expected.flags[flag_carry] = true;
-    expected.flags[flag_parity] = true;
-    expected.flags[flag_aux_carry] = true;
-    expected.flags[flag_sign] = true;
+    expected.flags = (uint16_t)(FLAG_BIT(flag_carry) | FLAG_BIT(flag_parity) | FLAG_BIT(flag_aux_carry) | FLAG_BIT(flag_sign));
 
     testFinalState(LISTING_47, expected, false, false, false);
 }
 
 void testFinalState48()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_b].x = 2000;
     expected.registers[reg_c].x = 64736;
-    expected.instructions.instructionPointer = 14;
-    expected.flags[flag_carry] = true;
-    expected.flags[flag_sign] = true;
+    expected.instructionPointer = 14;
+    expected.flags = (uint16_t)(FLAG_BIT(flag_carry) | FLAG_BIT(flag_sign));
 
     testFinalState(LISTING_48, expected, true, false, false);
 }
 
 void testFinalState49()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_b].x = 1030;
-    expected.instructions.instructionPointer = 14;
-    expected.flags[flag_parity] = true;
-    expected.flags[flag_zero] = true;
+    expected.instructionPointer = 14;
+    expected.flags = (uint16_t)(FLAG_BIT(flag_parity) | FLAG_BIT(flag_zero));
 
     testFinalState(LISTING_49, expected, true, false, false);
 }
 
 void testFinalState50()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_a].x = 13;
     expected.registers[reg_b].x = -5;
-    expected.instructions.instructionPointer = 28;
-    expected.flags[flag_carry] = true;
-    expected.flags[flag_aux_carry] = true;
-    expected.flags[flag_sign] = true;
+    expected.instructionPointer = 28;
+    expected.flags = (uint16_t)(FLAG_BIT(flag_carry) | FLAG_BIT(flag_aux_carry) | FLAG_BIT(flag_sign));
 
     testFinalState(LISTING_50, expected, true, false, false);
 }
 
 void testFinalState51()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_b].x = 1;
     expected.registers[reg_c].x = 2;
     expected.registers[reg_d].x = 10;
     expected.registers[reg_bp].x = 4;
-    expected.instructions.instructionPointer = 48;
+    expected.instructionPointer = 48;
 
     testFinalState(LISTING_51, expected, true, false, false);
 }
 
 void testFinalState52()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_b].x = 6;
     expected.registers[reg_c].x = 4;
     expected.registers[reg_d].x = 6;
     expected.registers[reg_bp].x = 1000;
     expected.registers[reg_si].x = 6;
-    expected.instructions.instructionPointer = 35;
-    expected.flags[flag_zero] = true;
-    expected.flags[flag_parity] = true;
+    expected.instructionPointer = 35;
+    expected.flags = (uint16_t)(FLAG_BIT(flag_zero) | FLAG_BIT(flag_parity));
 
     testFinalState(LISTING_52, expected, true, false, false);
 }
 
 void testFinalState53()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_b].x = 6;
     expected.registers[reg_d].x = 6;
     expected.registers[reg_bp].x = 998;
-    expected.instructions.instructionPointer = 33;
-    expected.flags[flag_zero] = true;
-    expected.flags[flag_parity] = true;
+    expected.instructionPointer = 33;
+    expected.flags = (uint16_t)(FLAG_BIT(flag_zero) | FLAG_BIT(flag_parity));
 
     testFinalState(LISTING_53, expected, true, false, false);
 }
 
 void testFinalState54()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_c].x = 64;
     expected.registers[reg_d].x = 64;
     expected.registers[reg_bp].x = 16640;
-    expected.instructions.instructionPointer = 38;
-    expected.flags[flag_zero] = true;
-    expected.flags[flag_parity] = true;
+    expected.instructionPointer = 38;
+    expected.flags = (uint16_t)(FLAG_BIT(flag_zero) | FLAG_BIT(flag_parity));
 
     testFinalState(LISTING_54, expected, true, false, false);
 }
 
 void testFinalState55()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_b].x = 16388;
     expected.registers[reg_bp].x = 764;
-    expected.instructions.instructionPointer = 68;
+    expected.instructionPointer = 68;
 
     testFinalState(LISTING_55, expected, true, false, false);
 }
 
 void testFinalState56()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_b].x = 1000;
     expected.registers[reg_d].x = 50;
     expected.registers[reg_bp].x = 2000;
     expected.registers[reg_si].x = 3000;
     expected.registers[reg_di].x = 4000;
-    expected.instructions.instructionPointer = 55;
+    expected.instructionPointer = 55;
     expected.clocks = 192;
 
     testFinalState(LISTING_56, expected, true, true, false);
@@ -360,15 +360,15 @@ void testFinalState56()
 
 void testFinalState57()
 {
-    State expected = {0};
+    Cpu expected = {0};
 
     expected.registers[reg_b].x = 1000;
     expected.registers[reg_bp].x = 2000;
     expected.registers[reg_si].x = 3000;
     expected.registers[reg_di].x = 4000;
-    expected.instructions.instructionPointer = 54;
+    expected.instructionPointer = 54;
     expected.clocks = 289;
-    expected.flags[flag_aux_carry] = true;
+    expected.flags = (uint16_t)(FLAG_BIT(flag_aux_carry));
 
     testFinalState(LISTING_57, expected, true, true, false);
 
@@ -1,208 +1,211 @@
+#ifndef ASM_C
+
+#define ASM_C
+
 #include "common.c"
 #include "stdio.h"
 #include "stdbool.h"
 #include "stdint.h"
 #include "stdlib.h"
-#include "profiler.c"
-#include "float.h"
+#include "runner.c"
 
-void cmpAllBytes(int64_t counter, void *buffer);
+#define ASM_RESULTS_PATH "data/asm_results.json"
 
-void decSlow(int64_t counter, void *buffer);
+#define ASM_COUNTER (4LL * 1024LL * 1024LL * 1024LL)
 
-void nop3x1(int64_t counter, void *buffer);
+ASM_CALL void cmpAllBytes(int64_t counter, void *buffer);
 
-void nop1x3(int64_t counter, void *buffer);
+ASM_CALL void decSlow(int64_t counter, void *buffer);
 
-void nop9(int64_t counter, void *buffer);
+ASM_CALL void nop3x1(int64_t counter, void *buffer);
 
-void jumps(int64_t counter, void *buffer);
+ASM_CALL void nop1x3(int64_t counter, void *buffer);
 
-void align64(int64_t counter, void *buffer);
+ASM_CALL void nop9(int64_t counter, void *buffer);
 
-void align1(int64_t counter, void *buffer);
+ASM_CALL void jumps(int64_t counter, void *buffer);
 
-void align15(int64_t counter, void *buffer);
+ASM_CALL void align64(int64_t counter, void *buffer);
 
-void align62(int64_t counter, void *buffer);
+ASM_CALL void align1(int64_t counter, void *buffer);
 
-void align63(int64_t counter, void *buffer);
+ASM_CALL void align15(int64_t counter, void *buffer);
 
-void read1(int64_t counter, void *buffer);
+ASM_CALL void align62(int64_t counter, void *buffer);
 
-void read2(int64_t counter, void *buffer);
+ASM_CALL void align63(int64_t counter, void *buffer);
 
-void read3(int64_t counter, void *buffer);
+ASM_CALL void read1(int64_t counter, void *buffer);
 
-void read4(int64_t counter, void *buffer);
+ASM_CALL void read2(int64_t counter, void *buffer);
 
-void write1(int64_t counter, void *buffer);
+ASM_CALL void read3(int64_t counter, void *buffer);
 
-void write2(int64_t counter, void *buffer);
+ASM_CALL void read4(int64_t counter, void *buffer);
 
-void write3(int64_t counter, void *buffer);
+ASM_CALL void write1(int64_t counter, void *buffer);
 
-void write4(int64_t counter, void *buffer);
+ASM_CALL void write2(int64_t counter, void *buffer);
 
-void read2x4(int64_t counter, void *buffer);
+ASM_CALL void write3(int64_t counter, void *buffer);
 
-void read2x8(int64_t counter, void *buffer);
+ASM_CALL void write4(int64_t counter, void *buffer);
 
-void read2x16(int64_t counter, void *buffer);
+ASM_CALL void read2x4(int64_t counter, void *buffer);
 
-void read2x32(int64_t counter, void *buffer);
+ASM_CALL void read2x8(int64_t counter, void *buffer);
 
-void read1x32(int64_t counter, void *buffer);
+ASM_CALL void read2x16(int64_t counter, void *buffer);
 
-void read2x64(int64_t counter, void *buffer);
+ASM_CALL void read2x32(int64_t counter, void *buffer);
 
-#define MAKE_TEST(f, n, r, b) {\
-    .minSeconds = FLT_MAX,\
-    .function = f,\
-    .name = n,\
-    .counter = r,\
-    .buffer = b\
-}
-
-typedef struct {
-    float minSeconds;
-    float maxSeconds;
-    float sumSeconds;
-    size_t executionCount;
-    void (*function) (int64_t counter, void *buffer);
-    char *name;
-    float maxThroughput;
-    int64_t counter;
-    void *buffer;
-} Test;
+ASM_CALL void read1x32(int64_t counter, void *buffer);
 
-void repeatTest(Test *test, uint64_t rdtscFrequency) {
-    uint64_t ticksSinceLastReset = __rdtsc();
+ASM_CALL void read2x64(int64_t counter, void *buffer);
 
-    float secondsSinceLastReset = 0.0f;
+ASM_CALL void read1x64(int64_t counter, void *buffer);
 
-    printf("%s:\n", test->name);
+typedef enum {
+    AsmMemory_None,
+    // Reads or writes the first bytes of the buffer over and over
+    AsmMemory_Buffer,
+    // Walks a byte per iteration through a buffer filled with a jump pattern
+    AsmMemory_Pattern,
+    AsmMemory_Count
+} AsmMemory;
 
-    while (true) {
-        uint64_t start = __rdtsc();
-        test->function(test->counter, test->buffer);
-        uint64_t end = __rdtsc();
+typedef enum {
+    JumpPattern_AllOnes,
+    JumpPattern_AllZeros,
+    JumpPattern_OneEveryTwo,
+    JumpPattern_Random,
+    JumpPattern_Count
+} JumpPattern;
 
-        uint64_t ticks = end - start;
+const char *JumpPatternNames[JumpPattern_Count] = {"allOnes", "allZeros", "oneEveryTwo", "random"};
 
-        float secondsForFunction = (float) ticks / (float) rdtscFrequency;
-
-        if (secondsForFunction < test->minSeconds) {
-            test->minSeconds = secondsForFunction;
+typedef struct {
+    const char *name;
+    void (ASM_CALL *function) (int64_t counter, void *buffer);
+    AsmMemory memory;
+    bool needsAvx2;
+    bool needsAvx512;
+} AsmKernel;
+
+AsmKernel AsmKernels[] = {
+    {"decSlow", decSlow, AsmMemory_None, false, false},
+    {"cmpAllBytes", cmpAllBytes, AsmMemory_None, false, false},
+    {"align64", align64, AsmMemory_None, false, false},
+    {"align1", align1, AsmMemory_None, false, false},
+    {"align15", align15, AsmMemory_None, false, false},
+    {"align62", align62, AsmMemory_None, false, false},
+    {"align63", align63, AsmMemory_None, false, false},
+    {"nop1x3", nop1x3, AsmMemory_None, false, false},
+    {"nop3x1", nop3x1, AsmMemory_None, false, false},
+    {"nop9", nop9, AsmMemory_None, false, false},
+    {"read1", read1, AsmMemory_Buffer, false, false},
+    {"read2", read2, AsmMemory_Buffer, false, false},
+    {"read3", read3, AsmMemory_Buffer, false, false},
+    {"read4", read4, AsmMemory_Buffer, false, false},
+    {"write1", write1, AsmMemory_Buffer, false, false},
+    {"write2", write2, AsmMemory_Buffer, false, false},
+    {"write3", write3, AsmMemory_Buffer, false, false},
+    {"write4", write4, AsmMemory_Buffer, false, false},
+    {"read2x4", read2x4, AsmMemory_Buffer, false, false},
+    {"read2x8", read2x8, AsmMemory_Buffer, false, false},
+    {"read2x16", read2x16, AsmMemory_Buffer, false, false},
+    {"read1x32", read1x32, AsmMemory_Buffer, true, false},
+    {"read2x32", read2x32, AsmMemory_Buffer, true, false},
+    {"read1x64", read1x64, AsmMemory_Buffer, true, true},
+    {"read2x64", read2x64, AsmMemory_Buffer, true, true},
+    {"jumps", jumps, AsmMemory_Pattern, false, false},
+};
+
+// The pattern is written once per benchmark rather than kept in a buffer of its own, four of them would not fit
+bool setupJumpPattern(Benchmark *benchmark, BenchmarkContext *context) {
+    (void) context;
+
+    JumpPattern pattern = (JumpPattern) benchmark->arguments[1];
+    uint8_t *buffer = benchmark->buffer;
+
+    srand(0);
+
+    for (uint64_t byteIndex = 0; byteIndex < benchmark->bufferSize; byteIndex++) {
+        switch (pattern) {
+            case JumpPattern_AllOnes: {
+                buffer[byteIndex] = 1;
+            }
+            break;
+            case JumpPattern_AllZeros: {
+                buffer[byteIndex] = 0;
+            }
+            break;
+            case JumpPattern_OneEveryTwo: {
+                buffer[byteIndex] = (byteIndex % 2) == 0;
+            }
+            break;
+            case JumpPattern_Random: {
+                buffer[byteIndex] = (rand() % 2) == 0;
+            }
+            break;
+            default: {
+                assert(false);
+            }
+        }
+    }
 
-            secondsSinceLastReset = 0.0f;
+    return true;
+}
 
-            ticksSinceLastReset = __rdtsc();
-        }
+void sampleAsmKernel(Benchmark *benchmark, BenchmarkContext *context, RepetitionTester *tester) {
+    (void) context;
 
-        if (secondsForFunction > test->maxSeconds) {
-            test->maxSeconds = secondsForFunction;
-        }
+    AsmKernel *kernel = &AsmKernels[benchmark->kernel];
+    int64_t counter = benchmark->arguments[0];
 
-        test->executionCount++;
-        test->sumSeconds += secondsForFunction;
+    beginSample(tester);
+    kernel->function(counter, benchmark->buffer);
+    endSample(tester, (uint64_t) counter);
+}
 
-        float averageSeconds = test->sumSeconds / (float) test->executionCount;
-        float minThroughput = (float) test->counter / test->maxSeconds;
-        float maxThroughput = (float) test->counter / test->minSeconds;
-        float avgThroughput = (float) test->counter / averageSeconds;
+void registerAsmBenchmarks(BenchmarkRegistry *registry) {
+    for (size_t kernelIndex = 0; kernelIndex < ARRAYSIZE(AsmKernels); kernelIndex++) {
+        AsmKernel *kernel = &AsmKernels[kernelIndex];
 
-        test->maxThroughput = maxThroughput;
+        int patternCount = kernel->memory == AsmMemory_Pattern ? JumpPattern_Count : 1;
 
-        printf("Best : %f s, Throughput: %f,\n", test->minSeconds, maxThroughput);
-        printf("Worst: %f s, Throughput: %f\n", test->maxSeconds, minThroughput);
-        printf("Avg. : %f s, Throughput: %f\n", averageSeconds, avgThroughput);
+        for (int pattern = 0; pattern < patternCount; pattern++) {
+            Benchmark *benchmark = addBenchmark(registry, "asm", kernel->name, sampleAsmKernel);
+            benchmark->kernel = kernelIndex;
+            benchmark->arguments[0] = ASM_COUNTER;
+            benchmark->needsAvx2 = kernel->needsAvx2;
+            benchmark->needsAvx512 = kernel->needsAvx512;
 
-        ticks = __rdtsc();
-        secondsSinceLastReset = ((float) (ticks - ticksSinceLastReset)) / ((float) rdtscFrequency);
+            addBenchmarkParameter(benchmark, makeNumberParameter("counter", ASM_COUNTER));
 
-        if (secondsSinceLastReset > 10.0f) {
-            break;
-        }
+            if (kernel->memory == AsmMemory_Buffer) {
+                benchmark->bufferSize = 64;
+            }
+            else if (kernel->memory == AsmMemory_Pattern) {
+                // The walk reads one byte past the counter
+                benchmark->bufferSize = ASM_COUNTER + 1;
+                benchmark->arguments[1] = pattern;
+                benchmark->setup = setupJumpPattern;
 
-        for (size_t i = 0; i < 3; i++) {
-            printf("\033[F");
+                addBenchmarkParameter(benchmark, makeParameter("pattern", JumpPatternNames[pattern]));
+            }
         }
     }
-
-    printf("\n");
 }
 
-int main(void) {
-    uint64_t rdtscFrequency = estimateRdtscFrequency();
-
-    int64_t counter = 4LL * 1024LL * 1024LL * 1024LL;
-
-    char *buffer = malloc(counter);
-    assert(buffer);
-    // char buffer[64] = {0};
-    // char *allZeros = malloc(counter);
-    // memset(allZeros, 1, counter);
-    // char *allOnes = malloc(counter);
-    // memset(allOnes, 1, counter);
-    // char *oneEveryTwo = malloc(counter);
-    // for (int i = 0; i < counter; i++) {
-    // oneEveryTwo[i] = (i % 2) == 0;
-    // }
-    // char *random = malloc(counter);
-    // for (int i = 0; i < counter; i++) {
-    // random[i] = (rand() % 2) == 0;
-    // }
-    Test tests[] = {
-        // MAKE_TEST(decSlow, "decSlow", counter, 0),
-        // MAKE_TEST(cmpAllBytes, "cmpAllBytes", counter, 0),
-        // MAKE_TEST(align64, "align64", counter, 0),
-        // MAKE_TEST(align1, "align1", counter, 0),
-        // MAKE_TEST(align15, "align15", counter, 0),
-        // MAKE_TEST(align62, "align62", counter, 0),
-        // MAKE_TEST(align63, "align63", counter, 0),
-        // MAKE_TEST(read1, "read1", counter, buffer),
-        // MAKE_TEST(read2, "read2", counter, buffer),
-        // MAKE_TEST(read3, "read3", counter, buffer),
-        // MAKE_TEST(read4, "read4", counter, buffer),
-        // MAKE_TEST(write1, "write1", counter, buffer),
-        // MAKE_TEST(write2, "write2", counter, buffer),
-        // MAKE_TEST(write3, "write3", counter, buffer),
-        // MAKE_TEST(write4, "write4", counter, buffer),
-        // MAKE_TEST(jumps, "allOnes", counter, allOnes),
-        // MAKE_TEST(jumps, "allZeros", counter, allZeros),
-        // MAKE_TEST(jumps, "oneEveryTwo", counter, oneEveryTwo),
-        // MAKE_TEST(jumps, "random", counter, random),
-        // MAKE_TEST(nop1x3, "nop1x3", counter, NULL),
-        // MAKE_TEST(nop3x1, "nop3x1", counter, NULL),
-        // MAKE_TEST(nop9, "nop9", counter, NULL),
-        // MAKE_TEST(read2x4, "read2x4", counter, buffer),
-        MAKE_TEST(read2x8, "read2x8", counter, buffer),
-        MAKE_TEST(read2x16, "read2x16", counter, buffer),
-        MAKE_TEST(read2x32, "read2x32", counter, buffer),
-    };
-
-    while (true) {
-        for (size_t i = 0; i < ARRAYSIZE(tests); i++) {
-            Test *test = tests + i;
-
-            repeatTest(test, rdtscFrequency);
-        }
-
-        float maxThroughput = 0;
+#ifndef BENCHMARK_SUITE
 
-        char *bestTest = "";
+int main(int argc, char **argv) {
+    BenchmarkRegistrar *registrars[] = {registerAsmBenchmarks};
 
-        for (size_t i = 0; i < ARRAYSIZE(tests); i++) {
-            Test test = tests[i];
-            if (test.maxThroughput > maxThroughput) {
-                maxThroughput = test.maxThroughput;
-                bestTest = test.name;
-            }
-        }
+    return runBenchmarks(argc, argv, registrars, ARRAYSIZE(registrars), ASM_RESULTS_PATH);
+}
 
-        printf("BEST THROUGHPUT: %s, %f\n\n", bestTest, maxThroughput);
-    }
+#endif
 
-    return 0;
-}
+#endif
@@ -0,0 +1,355 @@
+#ifndef BACKING_C
+
+#define BACKING_C
+
+#include "stdio.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+#include "platform.c"
+
+#ifndef _WIN32
+
+#include "sys/syscall.h"
+#include "linux/mempolicy.h"
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#endif
+
+#define SMALL_PAGE_SIZE (4 * 1024ull)
+
+#define HUGE_PAGE_SIZE (2 * 1024ull * 1024ull)
+
+#define GIGANTIC_PAGE_SIZE (1024ull * 1024ull * 1024ull)
+
+#define BACKING_DESCRIPTION_CAPACITY 64
+
+typedef enum {
+    PageSize_Small,
+    PageSize_Transparent,
+    PageSize_Huge,
+    PageSize_Gigantic,
+    PageSize_Count
+} PageSize;
+
+typedef enum {
+    Numa_Default,
+    Numa_Local,
+    Numa_Interleave,
+    Numa_Count
+} Numa;
+
+const char *PageSizeNames[PageSize_Count] = {"4k", "thp", "2m", "1g"};
+
+const char *NumaNames[Numa_Count] = {"default", "local", "interleave"};
+
+typedef struct {
+    PageSize pageSize;
+    bool prefault;
+    Numa numa;
+} Backing;
+
+typedef struct {
+    void *memory;
+    size_t size;
+    void *mapping;
+    size_t mappingSize;
+    Backing backing;
+} Buffer;
+
+void describeBacking(Backing backing, char *description, size_t capacity) {
+    snprintf(
+        description,
+        capacity,
+        "pages=%s prefault=%s numa=%s",
+        PageSizeNames[backing.pageSize],
+        backing.prefault ? "yes" : "no",
+        NumaNames[backing.numa]
+    );
+}
+
+bool isBackingArgument(const char *arg) {
+    bool result = strcmp(arg, "prefault") == 0 || strcmp(arg, "noprefault") == 0;
+
+    for (int pageSize = 0; pageSize < PageSize_Count; pageSize++) {
+        result |= strcmp(arg, PageSizeNames[pageSize]) == 0;
+    }
+
+    for (int numa = 0; numa < Numa_Count; numa++) {
+        result |= strcmp(arg, NumaNames[numa]) == 0;
+    }
+
+    return result;
+}
+
+// Reads the backing from arguments like "2m prefault interleave", unknown arguments are ignored
+Backing parseBacking(int argc, char **argv) {
+    Backing result = {.pageSize = PageSize_Small, .prefault = true, .numa = Numa_Default};
+
+    for (int argIndex = 1; argIndex < argc; argIndex++) {
+        char *arg = argv[argIndex];
+
+        for (int pageSize = 0; pageSize < PageSize_Count; pageSize++) {
+            if (strcmp(arg, PageSizeNames[pageSize]) == 0) {
+                result.pageSize = (PageSize) pageSize;
+            }
+        }
+
+        for (int numa = 0; numa < Numa_Count; numa++) {
+            if (strcmp(arg, NumaNames[numa]) == 0) {
+                result.numa = (Numa) numa;
+            }
+        }
+
+        if (strcmp(arg, "prefault") == 0) {
+            result.prefault = true;
+        }
+        else if (strcmp(arg, "noprefault") == 0) {
+            result.prefault = false;
+        }
+    }
+
+    return result;
+}
+
+void touchPages(void *memory, size_t size) {
+    volatile uint8_t *bytes = memory;
+
+    for (size_t offset = 0; offset < size; offset += SMALL_PAGE_SIZE) {
+        bytes[offset] = 0;
+    }
+}
+
+#ifdef _WIN32
+
+// Windows has no transparent huge pages, 1 GB pages or interleaved policy through VirtualAlloc,
+// those backings return a buffer with no memory
+Buffer allocateBuffer(Backing backing, size_t size) {
+    Buffer result = {0};
+    result.backing = backing;
+    result.size = size;
+
+    DWORD flags = MEM_RESERVE | MEM_COMMIT;
+
+    if (backing.pageSize == PageSize_Huge) {
+        uint64_t largePageMinimum = enableLargePages();
+
+        if (largePageMinimum == 0) {
+            return result;
+        }
+
+        size = roundUpToPageSize(size, largePageMinimum);
+        flags |= MEM_LARGE_PAGES;
+    }
+    else if (backing.pageSize != PageSize_Small) {
+        return result;
+    }
+
+    if (backing.numa == Numa_Local) {
+        PROCESSOR_NUMBER processor = {0};
+        GetCurrentProcessorNumberEx(&processor);
+
+        USHORT node = 0;
+        GetNumaProcessorNodeEx(&processor, &node);
+
+        result.mapping = VirtualAllocExNuma(GetCurrentProcess(), 0, size, flags, PAGE_READWRITE, node);
+    }
+    else if (backing.numa == Numa_Default) {
+        result.mapping = VirtualAlloc(0, size, flags, PAGE_READWRITE);
+    }
+
+    result.memory = result.mapping;
+    result.mappingSize = size;
+
+    if (result.memory && backing.prefault) {
+        touchPages(result.memory, result.size);
+    }
+
+    return result;
+}
+
+void freeBuffer(Buffer *buffer) {
+    if (buffer->mapping) {
+        VirtualFree(buffer->mapping, 0, MEM_RELEASE);
+    }
+
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+bool getTransparentHugeBytes(Buffer *buffer, uint64_t *hugeBytes, uint64_t *residentBytes) {
+    (void) buffer;
+    *hugeBytes = 0;
+    *residentBytes = 0;
+
+    return false;
+}
+
+#else
+
+Buffer allocateBuffer(Backing backing, size_t size) {
+    Buffer result = {0};
+    result.backing = backing;
+    result.size = size;
+
+    // Hugetlb mappings must reserve their pages, otherwise an empty pool only shows up as SIGBUS on first touch
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    size_t alignment = SMALL_PAGE_SIZE;
+
+    if (backing.pageSize == PageSize_Small) {
+        flags |= MAP_NORESERVE;
+    }
+    else if (backing.pageSize == PageSize_Transparent) {
+        // Over-allocate so the buffer can start on a huge page boundary
+        flags |= MAP_NORESERVE;
+        alignment = HUGE_PAGE_SIZE;
+    }
+    else if (backing.pageSize == PageSize_Huge) {
+        flags |= MAP_HUGETLB | MAP_HUGE_2MB;
+        size = roundUpToPageSize(size, HUGE_PAGE_SIZE);
+    }
+    else if (backing.pageSize == PageSize_Gigantic) {
+        flags |= MAP_HUGETLB | MAP_HUGE_1GB;
+        size = roundUpToPageSize(size, GIGANTIC_PAGE_SIZE);
+    }
+
+    size_t mappingSize = alignment == SMALL_PAGE_SIZE ? size : roundUpToPageSize(size, alignment) + alignment;
+
+    void *mapping = mmap(0, mappingSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+    if (mapping == MAP_FAILED) {
+        return result;
+    }
+
+    result.mapping = mapping;
+    result.mappingSize = mappingSize;
+    result.memory = (void *) roundUpToPageSize((size_t) mapping, alignment);
+
+    size_t memorySize = mappingSize - ((uint8_t *) result.memory - (uint8_t *) mapping);
+
+    if (backing.pageSize == PageSize_Small) {
+        madvise(result.memory, memorySize, MADV_NOHUGEPAGE);
+    }
+    else if (backing.pageSize == PageSize_Transparent) {
+        madvise(result.memory, memorySize, MADV_HUGEPAGE);
+    }
+
+    if (backing.numa != Numa_Default) {
+        // The policy only applies to pages faulted after mbind, so it must precede the prefault
+        unsigned long nodeMask = ~0ul;
+        int mode = backing.numa == Numa_Local ? MPOL_LOCAL : MPOL_INTERLEAVE;
+        unsigned long maxNode = backing.numa == Numa_Local ? 0 : sizeof(nodeMask) * 8;
+
+        long error = syscall(
+            SYS_mbind,
+            result.memory,
+            memorySize,
+            mode,
+            backing.numa == Numa_Local ? NULL : &nodeMask,
+            maxNode,
+            0
+        );
+
+        if (error != 0) {
+            munmap(mapping, mappingSize);
+            memset(&result, 0, sizeof(result));
+            result.backing = backing;
+            return result;
+        }
+    }
+
+    if (backing.prefault) {
+#ifdef MADV_POPULATE_WRITE
+        if (madvise(result.memory, result.size, MADV_POPULATE_WRITE) != 0) {
+            touchPages(result.memory, result.size);
+        }
+#else
+        touchPages(result.memory, result.size);
+#endif
+    }
+
+    return result;
+}
+
+void freeBuffer(Buffer *buffer) {
+    if (buffer->mapping) {
+        munmap(buffer->mapping, buffer->mappingSize);
+    }
+
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+// The resident bytes of the mapping holding the buffer and how many of them are on transparent huge pages, from its
+// Rss and AnonHugePages lines in smaps. The madvise in allocateBuffer splits the buffer into a mapping of its own.
+bool getTransparentHugeBytes(Buffer *buffer, uint64_t *hugeBytes, uint64_t *residentBytes) {
+    *hugeBytes = 0;
+    *residentBytes = 0;
+
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+
+    if (!smaps) {
+        return false;
+    }
+
+    uintptr_t address = (uintptr_t) buffer->memory;
+    bool isInMapping = false;
+    bool hasHuge = false;
+    bool hasResident = false;
+    char line[256];
+
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long long start = 0;
+        unsigned long long end = 0;
+        unsigned long long kilobytes = 0;
+
+        // Field names can start with hex digits too, but only mapping headers go on with a dash
+        if (sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+            if (isInMapping) {
+                break;
+            }
+
+            isInMapping = start <= address && address < end;
+        }
+        else if (isInMapping && sscanf(line, "Rss: %llu kB", &kilobytes) == 1) {
+            *residentBytes = kilobytes * 1024;
+            hasResident = true;
+        }
+        else if (isInMapping && sscanf(line, "AnonHugePages: %llu kB", &kilobytes) == 1) {
+            *hugeBytes = kilobytes * 1024;
+            hasHuge = true;
+        }
+    }
+
+    fclose(smaps);
+
+    return hasHuge && hasResident;
+}
+
+#endif
+
+// Like describeBacking, with what the buffer actually got when it differs. Only transparent huge pages can silently
+// fall back, hugetlb mappings fail instead and small pages are kept small with MADV_NOHUGEPAGE. Nothing is added
+// before any of the buffer is resident, or when the kernel does not say.
+void describeBuffer(Buffer *buffer, char *description, size_t capacity) {
+    describeBacking(buffer->backing, description, capacity);
+
+    uint64_t hugeBytes;
+    uint64_t residentBytes;
+
+    if (buffer->backing.pageSize != PageSize_Transparent || !getTransparentHugeBytes(buffer, &hugeBytes, &residentBytes)) {
+        return;
+    }
+
+    if (residentBytes > 0 && hugeBytes < residentBytes) {
+        size_t length = strlen(description);
+        snprintf(description + length, capacity - length, " obtained=%s", hugeBytes == 0 ? "4k" : "mixed");
+    }
+}
+
+#endif
@@ -0,0 +1,23 @@
+// Every experiment in one program, run it with list to see the benchmarks and with filter to pick some
+#define BENCHMARK_SUITE
+
+#include "runner.c"
+#include "repetition.c"
+#include "asm.c"
+#include "cache.c"
+#include "sets.c"
+#include "nontemporal.c"
+
+#define BENCH_RESULTS_PATH "data/bench_results.json"
+
+int main(int argc, char **argv) {
+    BenchmarkRegistrar *registrars[] = {
+        registerRepetitionBenchmarks,
+        registerAsmBenchmarks,
+        registerCacheBenchmarks,
+        registerSetsBenchmarks,
+        registerNontemporalBenchmarks,
+    };
+
+    return runBenchmarks(argc, argv, registrars, ARRAYSIZE(registrars), BENCH_RESULTS_PATH);
+}
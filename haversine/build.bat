@@ -30,6 +30,8 @@ REM cl %common% %profile% %build_type%  asm.lib cache.c
 REM cl %common% %profile% %build_type%  asm.lib sets.c
 REM cl %common% %profile% %build_type%  asm.lib nontemporal.c
 REM cl %common% %profile% %build_type% faults.c
+cl %common% %profile% %build_type% Advapi32.lib asm.lib bench.c
+cl %common% %build_type% compare.c
 
 del *.obj *.ilk *.lib
 
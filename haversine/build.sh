@@ -0,0 +1,30 @@
+#!/bin/sh
+
+common="-std=c11 -D_GNU_SOURCE -pthread -Wall -Wno-missing-braces"
+
+build_type="-g"
+
+profile="-DPROFILE"
+
+for arg in "$@"; do
+    if [ "$arg" = "noprofile" ]; then profile=""; fi
+    if [ "$arg" = "release" ]; then build_type="-O2 -g"; fi
+done
+
+nasm -f elf64 asm.asm -o asm.o
+
+# cc $common input.c -o input -lm
+# cc $common test.c -o test -lm
+# cc $common $profile $build_type main.c -o main -lm
+cc $common $profile $build_type repetition.c asm.o -o repetition -lm
+# cc $common $profile $build_type asm.c asm.o -o asm -lm
+# cc $common $profile $build_type cache.c asm.o -o cache -lm
+# cc $common $profile $build_type sets.c asm.o -o sets -lm
+# cc $common $profile $build_type nontemporal.c asm.o -o nontemporal -lm
+# cc $common $profile $build_type faults.c -o faults -lm
+cc $common $profile $build_type bench.c asm.o -o bench -lm
+cc $common $build_type compare.c -o compare -lm
+
+rm -f asm.o
+
+mkdir -p data
@@ -1,118 +1,38 @@
+#ifndef CACHE_C
+
+#define CACHE_C
+
 #include "common.c"
 #include "stdio.h"
 #include "stdbool.h"
 #include "stdint.h"
 #include "stdlib.h"
-#include "profiler.c"
-#include "float.h"
-
-#define MAKE_TEST(f, n, r, b, s) {\
-    .minSeconds = FLT_MAX,\
-    .function = f,\
-    .name = n,\
-    .bytes = r,\
-    .buffer = b,\
-    .rangeSizeOrMask = s\
-}
-
-#define KB(b) (1024LL * b)
-
-#define MB(b) (KB(KB(b)))
-
-#define GB(b) (KB(MB(b)))
-
-typedef struct {
-    float minSeconds;
-    float maxSeconds;
-    float sumSeconds;
-    size_t executionCount;
-    void (*function) (int64_t bytes, void *buffer, int64_t rangeSize);
-    char name[256];
-    float maxThroughput;
-    int64_t bytes;
-    int64_t rangeSizeOrMask;
-    int64_t offset;
-    void *buffer;
-} Test;
-
-void testCache(int64_t bytes, void *buffer, int64_t rangeSize);
-
-void testCacheAnd(int64_t bytes, void *buffer, int64_t mask);
-
-void testCacheUnaligned(int64_t bytes, void *buffer, int64_t mask, int64_t offset);
-
-void testCacheUnalignedNonContiguous(int64_t bytes, void *buffer, int64_t mask, int64_t offset);
+#include "runner.c"
 
-void testCacheSet(int64_t bytes, void *buffer, int64_t mask);
+#define CACHE_RESULTS_PATH "data/cache_results.json"
 
-void repeatTest(Test *test, uint64_t rdtscFrequency) {
-    uint64_t ticksSinceLastReset = __rdtsc();
+#define CACHE_CSV_PATH "cache.csv"
 
-    float secondsSinceLastReset = 0.0f;
+#define CACHE_BYTES GB(4)
 
-    printf("%s\n", test->name);
+#define CACHE_OFFSET_COUNT 64
 
-    while (true) {
-        uint64_t start = __rdtsc();
-        test->function(test->bytes, test->buffer, test->rangeSizeOrMask, test->offset);
-        uint64_t end = __rdtsc();
+// The loops read a whole 256 byte block past the last position they start from
+#define CACHE_BLOCK_SIZE 256
 
-        uint64_t ticks = end - start;
+ASM_CALL void testCacheAnd(int64_t bytes, void *buffer, int64_t mask);
 
-        float secondsForFunction = (float) ticks / (float) rdtscFrequency;
+ASM_CALL void testCacheUnaligned(int64_t bytes, void *buffer, int64_t mask, int64_t offset);
 
-        if (secondsForFunction < test->minSeconds) {
-            test->minSeconds = secondsForFunction;
+typedef enum {
+    CacheKernel_Unaligned,
+    CacheKernel_And,
+    CacheKernel_Count
+} CacheKernel;
 
-            secondsSinceLastReset = 0.0f;
+const char *CacheKernelNames[CacheKernel_Count] = {"unaligned", "and"};
 
-            ticksSinceLastReset = __rdtsc();
-        }
-
-        if (secondsForFunction > test->maxSeconds) {
-            test->maxSeconds = secondsForFunction;
-        }
-
-        test->executionCount++;
-        test->sumSeconds += secondsForFunction;
-
-        float averageSeconds = test->sumSeconds / (float) test->executionCount;
-        float minThroughput = (float) test->bytes / test->maxSeconds;
-        float maxThroughput = (float) test->bytes / test->minSeconds;
-        float avgThroughput = (float) test->bytes / averageSeconds;
-
-        test->maxThroughput = maxThroughput;
-
-        printf(
-            "Best : %f s, Throughput: %f gb/s,\n",
-            test->minSeconds,
-            maxThroughput / (1024.0f * 1024.0f * 1024.0f)
-        );
-        printf(
-            "Worst: %f s, Throughput: %f gb/s\n",
-            test->maxSeconds,
-            minThroughput / (1024.0f * 1024.0f * 1024.0f)
-        );
-        printf(
-            "Avg. : %f s, Throughput: %f gb/s\n",
-            averageSeconds,
-            avgThroughput / (1024.0f * 1024.0f * 1024.0f)
-        );
-
-        ticks = __rdtsc();
-        secondsSinceLastReset = ((float) (ticks - ticksSinceLastReset)) / ((float) rdtscFrequency);
-
-        if (secondsSinceLastReset > 10.0f) {
-            break;
-        }
-
-        for (size_t i = 0; i < 3; i++) {
-            printf("\033[F");
-        }
-    }
-
-    printf("\n");
-}
+const int64_t CacheRangeSizes[] = {KB(1), KB(512), MB(1), GB(1)};
 
 int32_t mask(uint8_t bitsToKeep) {
     int32_t result = 0;
@@ -123,112 +43,71 @@ int32_t mask(uint8_t bitsToKeep) {
     return result;
 }
 
-int main(void) {
-    uint64_t rdtscFrequency = estimateRdtscFrequency();
-
-    int64_t bytes = GB(4);
-
-    // const int32_t l1size = KB(32);
-    // const int32_t l2size = KB(512);
-    // const int32_t l3size = MB(4);
-    char *buffer = malloc(bytes);
-    assert(buffer);
-
-    // Test tests[] = {
-    // MAKE_TEST(testCacheAnd, "10", bytes, buffer, mask(10)),
-    // MAKE_TEST(testCacheAnd, "11", bytes, buffer, mask(11)),
-    // MAKE_TEST(testCacheAnd, "12", bytes, buffer, mask(12)),
-    // MAKE_TEST(testCacheAnd, "13", bytes, buffer, mask(13)),
-    // MAKE_TEST(testCacheAnd, "14", bytes, buffer, mask(14)),
-    // MAKE_TEST(testCacheAnd, "15", bytes, buffer, mask(15)),
-    // MAKE_TEST(testCacheAnd, "16", bytes, buffer, mask(16)),
-    // MAKE_TEST(testCacheAnd, "17", bytes, buffer, mask(17)),
-    // MAKE_TEST(testCacheAnd, "18", bytes, buffer, mask(18)),
-    // MAKE_TEST(testCacheAnd, "19", bytes, buffer, mask(19)),
-    // MAKE_TEST(testCacheAnd, "20", bytes, buffer, mask(20)),
-    // MAKE_TEST(testCacheAnd, "21", bytes, buffer, mask(21)),
-    // MAKE_TEST(testCacheAnd, "22", bytes, buffer, mask(22)),
-    // MAKE_TEST(testCacheAnd, "23", bytes, buffer, mask(23)),
-    // MAKE_TEST(testCacheAnd, "24", bytes, buffer, mask(24)),
-    // MAKE_TEST(testCacheAnd, "25", bytes, buffer, mask(25)),
-    // MAKE_TEST(testCacheAnd, "26", bytes, buffer, mask(26)),
-    // MAKE_TEST(testCacheAnd, "27", bytes, buffer, mask(27)),
-    // MAKE_TEST(testCacheAnd, "28", bytes, buffer, mask(28)),
-    // MAKE_TEST(testCacheAnd, "29", bytes, buffer, mask(29)),
-    // MAKE_TEST(testCacheAnd, "30", bytes, buffer, mask(30)),
-    // MAKE_TEST(testCacheAnd, "31", bytes, buffer, mask(31)),
-    // };
-    int32_t sizes[] = {KB(1), KB(512), MB(1), GB(1)};
-    const int32_t sizesCount = ARRAYSIZE(sizes);
-    const int32_t offsetsPerSize = 64;
-    const int32_t numTests = sizesCount * offsetsPerSize;
-
-    const int32_t testsSize = sizeof(Test) * numTests;
-    Test *tests = malloc(testsSize);
-    memset(tests, 0, testsSize);
-    int32_t size = 0;
-    for (int32_t i = 0; i < sizesCount; i++) {
-        size = sizes[i];
-        int64_t testBytes = (bytes / size) * size;
-
-        char name[256] = {0};
-
-        int32_t testIndex = j;
-
-        sprintf(name, "%d/%d (%d)", testIndex, numTests, size);
-        Test *test = &tests[testIndex];
-        test->minSeconds = FLT_MAX;
-        test->function = testCacheSet;
-        strncpy(test->name, name, sizeof(test->name));
-        test->name[ARRAYSIZE(test->name) - 1] = '\0';
-        test->offset = j;
-        test->bytes = testBytes;
-        test->buffer = buffer;
-        test->rangeSizeOrMask = size;
-    }
-}
+void sampleCacheKernel(Benchmark *benchmark, BenchmarkContext *context, RepetitionTester *tester) {
+    (void) context;
+
+    int64_t bytes = benchmark->arguments[0];
+    int64_t rangeSizeOrMask = benchmark->arguments[1];
+    int64_t offset = benchmark->arguments[2];
 
-while (true) {
-    for (size_t i = 0; i < numTests; i++) {
-        Test *test = tests + i;
+    beginSample(tester);
 
-        repeatTest(test, rdtscFrequency);
+    if (benchmark->kernel == CacheKernel_Unaligned) {
+        testCacheUnaligned(bytes, benchmark->buffer, rangeSizeOrMask, offset);
     }
+    else {
+        testCacheAnd(bytes, benchmark->buffer, rangeSizeOrMask);
+    }
+
+    endSample(tester, (uint64_t) bytes);
+}
 
-    float maxThroughput = 0;
+// Throughput of every range size and offset that ran, one row per range size
+void writeCacheCsv(BenchmarkRegistry *registry, BenchmarkContext *context) {
+    double throughputs[ARRAYSIZE(CacheRangeSizes)][CACHE_OFFSET_COUNT] = {0};
+    bool hasRow[ARRAYSIZE(CacheRangeSizes)] = {0};
+    bool hasAny = false;
 
-    char bestTest[256] = "";
+    for (size_t benchmarkIndex = 0; benchmarkIndex < registry->count; benchmarkIndex++) {
+        Benchmark *benchmark = &registry->benchmarks[benchmarkIndex];
 
-    for (size_t i = 0; i < numTests; i++) {
-        Test test = tests[i];
-        if (test.maxThroughput > maxThroughput) {
-            maxThroughput = test.maxThroughput;
-            strncpy(bestTest, test.name, sizeof(bestTest));
+        if (benchmark->sample == sampleCacheKernel && benchmark->kernel == CacheKernel_Unaligned && benchmark->stats.count > 0) {
+            size_t sizeIndex = (size_t) benchmark->arguments[3];
+            size_t offset = (size_t) benchmark->arguments[2];
+
+            throughputs[sizeIndex][offset] = getThroughput(&benchmark->stats, benchmark->stats.median) / (1024.0 * 1024.0 * 1024.0);
+            hasRow[sizeIndex] = true;
+            hasAny = true;
         }
     }
 
-    printf("BEST THROUGHPUT: %s, %f g/s\n\n", bestTest, maxThroughput / (1024.0f * 1024.0f * 1024.0f));
+    if (!hasAny) {
+        return;
+    }
 
-    FILE *f = fopen("cache.csv", "wb");
+    FILE *f = fopen(CACHE_CSV_PATH, "wb");
 
-    assert(f);
+    if (!f) {
+        die(__FILE__, __LINE__, errno, "could not open %s", CACHE_CSV_PATH);
+    }
 
-    fprintf(f, "Size;");
+    fprintf(f, "Size (%s);", context->backingDescription);
 
-    for (int32_t i = 0; i < offsetsPerSize; i++) {
+    for (int32_t i = 0; i < CACHE_OFFSET_COUNT; i++) {
         fprintf(f, "Offset %d; ", i);
     }
 
     fprintf(f, "\n");
 
-    for (int32_t i = 0; i < sizesCount; i++) {
-        Test test = tests[i * sizesCount];
+    for (size_t i = 0; i < ARRAYSIZE(CacheRangeSizes); i++) {
+        if (!hasRow[i]) {
+            continue;
+        }
 
-        fprintf(f, "%lld; ", test.rangeSizeOrMask);
+        fprintf(f, "%lld; ", (long long) CacheRangeSizes[i]);
 
-        for (int32_t j = 0; j < offsetsPerSize; j++) {
-            test = tests[i * sizesCount + j];
-            fprintf(f, "%f; ", test.maxThroughput / (1024.0f * 1024.0f * 1024.0f));
+        for (int32_t j = 0; j < CACHE_OFFSET_COUNT; j++) {
+            fprintf(f, "%f; ", throughputs[i][j]);
         }
 
         fprintf(f, "\n");
@@ -237,6 +116,49 @@ while (true) {
     fclose(f);
 }
 
-return 0;
+void registerCacheBenchmarks(BenchmarkRegistry *registry) {
+    for (size_t sizeIndex = 0; sizeIndex < ARRAYSIZE(CacheRangeSizes); sizeIndex++) {
+        int64_t size = CacheRangeSizes[sizeIndex];
+
+        for (int64_t offset = 0; offset < CACHE_OFFSET_COUNT; offset++) {
+            Benchmark *benchmark = addBenchmark(registry, "cache", CacheKernelNames[CacheKernel_Unaligned], sampleCacheKernel);
+            benchmark->kernel = CacheKernel_Unaligned;
+            benchmark->arguments[0] = (CACHE_BYTES / size) * size;
+            benchmark->arguments[1] = size;
+            benchmark->arguments[2] = offset;
+            benchmark->arguments[3] = (int64_t) sizeIndex;
+            benchmark->bufferSize = (uint64_t) (size + offset + CACHE_BLOCK_SIZE);
+            benchmark->needsAvx2 = true;
+
+            addBenchmarkParameter(benchmark, makeNumberParameter("bytes", benchmark->arguments[0]));
+            addBenchmarkParameter(benchmark, makeNumberParameter("rangeSize", size));
+            addBenchmarkParameter(benchmark, makeNumberParameter("offset", offset));
+        }
+    }
+
+    for (uint8_t bits = 10; bits < 32; bits++) {
+        Benchmark *benchmark = addBenchmark(registry, "cache", CacheKernelNames[CacheKernel_And], sampleCacheKernel);
+        benchmark->kernel = CacheKernel_And;
+        benchmark->arguments[0] = CACHE_BYTES;
+        benchmark->arguments[1] = mask(bits);
+        benchmark->bufferSize = (uint64_t) mask(bits) + 1 + CACHE_BLOCK_SIZE;
+        benchmark->needsAvx2 = true;
+
+        addBenchmarkParameter(benchmark, makeNumberParameter("bytes", CACHE_BYTES));
+        addBenchmarkParameter(benchmark, makeNumberParameter("maskBits", bits));
+    }
+
+    addBenchmarkReport(registry, writeCacheCsv);
+}
+
+#ifndef BENCHMARK_SUITE
+
+int main(int argc, char **argv) {
+    BenchmarkRegistrar *registrars[] = {registerCacheBenchmarks};
 
+    return runBenchmarks(argc, argv, registrars, ARRAYSIZE(registrars), CACHE_RESULTS_PATH);
 }
+
+#endif
+
+#endif
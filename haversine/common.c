@@ -8,21 +8,9 @@
 #include "math.h"
 #include "stdint.h"
 #include "assert.h"
+#include "errno.h"
+#include "platform.c"
 #include "profiler.c"
-#include "windows.h"
-
-#ifdef _WIN32
-
-#pragma warning(push, 0)
-
-#include "windows.h"
-#include "psapi.h"
-
-#pragma warning(pop)
-
-#include "intrin.h"
-
-#endif
 
 #ifndef COMMON_C
 
@@ -32,6 +20,8 @@
 
 #define ANSWERS_PATH "data/answers"
 
+#define TRACE_PATH "data/trace.json"
+
 #define ARENA_SIZE 8 * 1024ll * 1024ll * 1024l
 
 #define EARTH_RADIUS 6371
@@ -88,26 +78,23 @@ void writeBinaryToFile(FILE *file, const char *path, void *data, size_t size, si
     }
 }
 
-size_t getFileSize(HANDLE *file, char *path) {
+size_t getFileSize(File file, char *path) {
     TIME_FUNCTION;
 
-    DWORD high = 0;
-    DWORD low = GetFileSize(file, &high);
+    uint64_t result = 0;
 
-    if (low == INVALID_FILE_SIZE) {
-        die(__FILE__, __LINE__, 0, "could not query the size of %s", path);
+    if (!osGetFileSize(file, &result)) {
+        die(__FILE__, __LINE__, 0, "could not query the size of %s: %s", path, osErrorMessage());
     }
 
-    LARGE_INTEGER result = {.LowPart = low, .HighPart = high};
-
     STOP_COUNTER;
-    return result.QuadPart;
+    return result;
 }
 
 Arena arenaInit() {
     TIME_FUNCTION Arena arena = {0};
 
-    arena.memory = VirtualAlloc(0, ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    arena.memory = osAllocate(ARENA_SIZE, 0);
 
     if (!arena.memory) {
         die(__FILE__, __LINE__, errno, "could not initialize arena");
@@ -125,6 +112,18 @@ void arenaFreeAll(Arena *arena) {
     arena->previousOffset = 0;
 }
 
+void *arenaAllocate(Arena *arena, size_t size);
+
+// Hands a region of arena to a sub arena, which one thread can then use without touching the offsets of the parent
+Arena arenaSubArena(Arena *arena, size_t size) {
+    Arena result = {0};
+
+    result.memory = arenaAllocate(arena, size);
+    result.size = size;
+
+    return result;
+}
+
 void *arenaAllocate(Arena *arena, size_t size) {
     assert(arena != NULL);
 
@@ -142,10 +141,10 @@ void freeLastAllocation(Arena *arena) {
 }
 
 String readFileToString(char *path, Arena *arena) {
-    HANDLE file = CreateFile(path, GENERIC_READ, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    File file = osOpenFile(path);
 
-    if (file == INVALID_HANDLE_VALUE) {
-        die(__FILE__, __LINE__, errno, "could not open %s", path);
+    if (file == INVALID_FILE) {
+        die(__FILE__, __LINE__, 0, "could not open %s: %s", path, osErrorMessage());
     }
     String result = {0};
     result.size = getFileSize(file, path);
@@ -157,26 +156,28 @@ String readFileToString(char *path, Arena *arena) {
 
     char *buffer = result.data.signedData;
 
-    BOOL ok = TRUE;
-
-    while (totalBytesRead < result.size) {
-        DWORD bytesToRead = result.size <= MAXDWORD ? (DWORD) result.size : MAXDWORD;
+    bool ok = true;
 
-        DWORD bytesRead = 0;
+    while (ok && totalBytesRead < result.size) {
+        size_t bytesRead = 0;
 
-        ok = ReadFile(file, buffer, bytesToRead, &bytesRead, 0);
+        ok = osReadFile(file, buffer, result.size - totalBytesRead, totalBytesRead, &bytesRead);
         totalBytesRead += bytesRead;
         buffer += bytesRead;
+
+        if (bytesRead == 0) {
+            break;
+        }
     }
 
-    if (!ok) {
-        die(__FILE__, __LINE__, errno, "could not read %s", path);
+    if (!ok || totalBytesRead != result.size) {
+        die(__FILE__, __LINE__, 0, "could not read %s: %s", path, osErrorMessage());
     }
 
-    ok = CloseHandle(file);
+    ok = osCloseFile(file);
 
     if (!ok) {
-        die(__FILE__, __LINE__, errno, "could not close %s", path);
+        die(__FILE__, __LINE__, 0, "could not close %s: %s", path, osErrorMessage());
     }
 
     STOP_COUNTER;
@@ -184,34 +185,75 @@ String readFileToString(char *path, Arena *arena) {
     return result;
 }
 
-char *winErrorMessage() {
-    char *result = NULL;
+// Touches one byte per page so the cost of faulting the mapping in is reported apart from the parse
+void touchMappedPages(String text) {
+    MEASURE_THROUGHPUT("pageFaults", text.size);
+
+    volatile uint8_t *bytes = text.data.unsignedData;
+
+    for (size_t offset = 0; offset < text.size; offset += 4096) {
+        (void) bytes[offset];
+    }
+
+    STOP_COUNTER;
+}
+
+// Returns the file contents without copying them, text stays valid until the mapping is released
+String mapFileToString(char *path, uint32_t hints, FileMapping *mapping) {
+    TIME_FUNCTION;
 
-    DWORD error = GetLastError();
-    FormatMessage(
-        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-        NULL,
-        error,
-        MAKELANGID(LANG_ENGLISH, SUBLANG_DEFAULT),
-        (LPTSTR) &result,
-        0,
-        NULL
-    );
+    File file = osOpenFile(path);
+
+    if (file == INVALID_FILE) {
+        die(__FILE__, __LINE__, 0, "could not open %s: %s", path, osErrorMessage());
+    }
+
+    size_t size = getFileSize(file, path);
+
+    if (!osMapFile(file, size, hints, mapping)) {
+        die(__FILE__, __LINE__, 0, "could not map %s: %s", path, osErrorMessage());
+    }
+
+    if (!osCloseFile(file)) {
+        die(__FILE__, __LINE__, 0, "could not close %s: %s", path, osErrorMessage());
+    }
+
+    String result = {0};
+    result.data.signedData = mapping->memory;
+    result.size = mapping->size;
+
+    STOP_COUNTER;
+
+    touchMappedPages(result);
 
     return result;
 }
 
-uint64_t getPageFaultCount(HANDLE process) {
+uint64_t getPageFaultCount(Process process) {
     uint64_t result = 0;
-    PROCESS_MEMORY_COUNTERS memoryCounters = {0};
 
-    if (GetProcessMemoryInfo(process, &memoryCounters, sizeof(memoryCounters))) {
-        result = memoryCounters.PageFaultCount;
+    if (!getOsPageFaultCount(process, &result)) {
+        die(__FILE__, __LINE__, 0, "Failed to get page fault count: %s\n", osErrorMessage());
+    }
+
+    return result;
+}
+
+MemoryCountersSource openMemoryCounters(Process process) {
+    MemoryCountersSource result = {0};
+
+    if (!osOpenMemoryCounters(&result, process)) {
+        die(__FILE__, __LINE__, errno, "Failed to open the memory counters");
     }
-    else {
-        char *message = winErrorMessage();
 
-        die(__FILE__, __LINE__, 0, "Failed to get page fault count: %s\n", message);
+    return result;
+}
+
+MemoryCounters getMemoryCounters(MemoryCountersSource *source) {
+    MemoryCounters result = {0};
+
+    if (!getOsMemoryCounters(source, &result)) {
+        die(__FILE__, __LINE__, 0, "Failed to get memory counters: %s", osErrorMessage());
     }
 
     return result;
@@ -0,0 +1,315 @@
+#include "common.c"
+#include "parser.c"
+
+// Changes smaller than this fraction of the old median are not reported, however significant
+#define DEFAULT_THRESHOLD 0.01
+
+// Two sided p-value below which a change is significant
+#define DEFAULT_ALPHA 0.01
+
+#define TEST_KEY_CAPACITY 512
+
+typedef enum {
+    Verdict_Same,
+    Verdict_Improvement,
+    Verdict_Regression,
+    Verdict_Missing,
+    Verdict_Count
+} Verdict;
+
+const char *VerdictNames[Verdict_Count] = {"same", "improvement", "REGRESSION", "missing"};
+
+typedef struct {
+    double value;
+    bool isAfter;
+} RankedSample;
+
+typedef struct {
+    Value *json;
+    Value *tests;
+    double rdtscFrequency;
+    char cpu[CPU_BRAND_CAPACITY];
+} Results;
+
+Value *getRequiredMember(Value *object, char *key, const char *path) {
+    if (object->type != ValueType_Object) {
+        die(__FILE__, __LINE__, 0, "%s: expected an object around %s", path, key);
+    }
+
+    Value *result = getMemberValueOfObject(object, key);
+
+    if (!result) {
+        die(__FILE__, __LINE__, 0, "%s: missing %s", path, key);
+    }
+
+    return result;
+}
+
+double getRequiredNumber(Value *object, char *key, const char *path) {
+    Value *value = getRequiredMember(object, key, path);
+
+    if (value->type != ValueType_Number) {
+        die(__FILE__, __LINE__, 0, "%s: %s is not a number", path, key);
+    }
+
+    return getAsNumber(value);
+}
+
+Results readResults(char *path, Arena *arena) {
+    Results result = {0};
+
+    Parser parser = initParser(readFileToString(path, arena), arena);
+    result.json = parseJson(&parser);
+
+    Value *machine = getRequiredMember(result.json, "machine", path);
+    Value *cpu = getRequiredMember(machine, "cpu", path);
+
+    result.rdtscFrequency = getRequiredNumber(machine, "rdtscFrequency", path);
+    result.tests = getRequiredMember(result.json, "tests", path);
+
+    if (result.tests->type != ValueType_Array) {
+        die(__FILE__, __LINE__, 0, "%s: tests is not an array", path);
+    }
+
+    if (cpu->type == ValueType_String) {
+        snprintf(result.cpu, sizeof(result.cpu), "%.*s", (int) cpu->payload.string.size, cpu->payload.string.data.signedData);
+    }
+
+    return result;
+}
+
+// The name with every parameter, which is what identifies a test across runs
+void getTestKey(Value *test, const char *path, char key[TEST_KEY_CAPACITY]) {
+    Value *name = getRequiredMember(test, "name", path);
+    Value *parameters = getRequiredMember(test, "parameters", path);
+
+    size_t size = (size_t) snprintf(key, TEST_KEY_CAPACITY, "%.*s", (int) name->payload.string.size, name->payload.string.data.signedData);
+
+    for (size_t memberIndex = 0; memberIndex < parameters->payload.object->count && size < TEST_KEY_CAPACITY; memberIndex++) {
+        Member member = parameters->payload.object->members[memberIndex];
+
+        size += (size_t) snprintf(
+            key + size,
+            TEST_KEY_CAPACITY - size,
+            " %.*s=%.*s",
+            (int) member.key.size,
+            member.key.data.signedData,
+            (int) member.value->payload.string.size,
+            member.value->payload.string.data.signedData
+        );
+    }
+}
+
+Value *findTest(Results *results, char *key, const char *path) {
+    for (size_t testIndex = 0; testIndex < getElementCount(results->tests); testIndex++) {
+        Value *test = getElementOfArray(results->tests, testIndex);
+        char testKey[TEST_KEY_CAPACITY];
+
+        getTestKey(test, path, testKey);
+
+        if (strcmp(testKey, key) == 0) {
+            return test;
+        }
+    }
+
+    return NULL;
+}
+
+int compareRankedSamples(const void *left, const void *right) {
+    double leftValue = ((const RankedSample *) left)->value;
+    double rightValue = ((const RankedSample *) right)->value;
+
+    return (leftValue > rightValue) - (leftValue < rightValue);
+}
+
+// Appends the samples after warmup, in seconds
+size_t addSamples(RankedSample *samples, Value *test, double rdtscFrequency, bool isAfter, const char *path) {
+    Value *ticks = getRequiredMember(test, "ticks", path);
+    size_t warmup = (size_t) getRequiredNumber(test, "warmup", path);
+    size_t count = getElementCount(ticks);
+
+    size_t result = 0;
+
+    for (size_t sampleIndex = warmup; sampleIndex < count; sampleIndex++) {
+        samples[result].value = getAsNumber(getElementOfArray(ticks, sampleIndex)) / rdtscFrequency;
+        samples[result].isAfter = isAfter;
+        result++;
+    }
+
+    return result;
+}
+
+// Mann-Whitney U test with the normal approximation and the tie correction. It only assumes the samples of each run
+// are independent, not that they are normal, which timings with their long right tail never are.
+double getMannWhitneyP(RankedSample *samples, size_t beforeCount, size_t afterCount) {
+    size_t count = beforeCount + afterCount;
+
+    if (beforeCount == 0 || afterCount == 0) {
+        return 1.0;
+    }
+
+    qsort(samples, count, sizeof(RankedSample), compareRankedSamples);
+
+    double afterRankSum = 0;
+    double tieSum = 0;
+
+    for (size_t first = 0; first < count;) {
+        size_t end = first + 1;
+
+        while (end < count && samples[end].value == samples[first].value) {
+            end++;
+        }
+
+        double ties = (double) (end - first);
+        double averageRank = ((double) first + (double) end + 1.0) / 2.0;
+
+        for (size_t sampleIndex = first; sampleIndex < end; sampleIndex++) {
+            if (samples[sampleIndex].isAfter) {
+                afterRankSum += averageRank;
+            }
+        }
+
+        tieSum += ties * ties * ties - ties;
+        first = end;
+    }
+
+    double n = (double) afterCount;
+    double m = (double) beforeCount;
+    double total = (double) count;
+
+    double u = afterRankSum - n * (n + 1.0) / 2.0;
+    double mean = n * m / 2.0;
+    double variance = n * m / 12.0 * ((total + 1.0) - tieSum / (total * (total - 1.0)));
+
+    if (variance <= 0) {
+        return 1.0;
+    }
+
+    double z = (u - mean) / sqrt(variance);
+
+    return erfc(fabs(z) / sqrt(2.0));
+}
+
+void printUsage(char *program) {
+    printf("Usage: %s before.json after.json [threshold PERCENT] [alpha P]\n", program);
+    printf("Exits with 1 when a test is significantly slower by more than the threshold, or is missing\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printUsage(argv[0]);
+
+        return 2;
+    }
+
+    double threshold = DEFAULT_THRESHOLD;
+    double alpha = DEFAULT_ALPHA;
+
+    for (int argIndex = 3; argIndex < argc; argIndex++) {
+        if (strcmp(argv[argIndex], "threshold") == 0 && argIndex + 1 < argc) {
+            threshold = atof(argv[++argIndex]) / 100.0;
+        }
+        else if (strcmp(argv[argIndex], "alpha") == 0 && argIndex + 1 < argc) {
+            alpha = atof(argv[++argIndex]);
+        }
+        else {
+            printUsage(argv[0]);
+
+            return 2;
+        }
+    }
+
+    Arena arena = arenaInit();
+
+    char *beforePath = argv[1];
+    char *afterPath = argv[2];
+
+    Results before = readResults(beforePath, &arena);
+    Results after = readResults(afterPath, &arena);
+
+    printf("Before: %s (%s)\n", beforePath, before.cpu);
+    printf("After : %s (%s)\n", afterPath, after.cpu);
+
+    if (strcmp(before.cpu, after.cpu) != 0) {
+        printf("WARNING: the results come from different cpus\n");
+    }
+
+    printf("\n");
+
+    size_t verdictCounts[Verdict_Count] = {0};
+
+    for (size_t testIndex = 0; testIndex < getElementCount(after.tests); testIndex++) {
+        Value *afterTest = getElementOfArray(after.tests, testIndex);
+        char key[TEST_KEY_CAPACITY];
+
+        getTestKey(afterTest, afterPath, key);
+
+        Value *beforeTest = findTest(&before, key, beforePath);
+
+        if (!beforeTest) {
+            printf("%-60s new test\n", key);
+
+            continue;
+        }
+
+        double beforeMedian = getRequiredNumber(beforeTest, "median", beforePath) / before.rdtscFrequency;
+        double afterMedian = getRequiredNumber(afterTest, "median", afterPath) / after.rdtscFrequency;
+
+        size_t capacity = getElementCount(getRequiredMember(beforeTest, "ticks", beforePath))
+            + getElementCount(getRequiredMember(afterTest, "ticks", afterPath));
+
+        RankedSample *samples = arenaAllocate(&arena, capacity * sizeof(RankedSample));
+
+        size_t beforeCount = addSamples(samples, beforeTest, before.rdtscFrequency, false, beforePath);
+        size_t afterCount = addSamples(samples + beforeCount, afterTest, after.rdtscFrequency, true, afterPath);
+
+        double p = getMannWhitneyP(samples, beforeCount, afterCount);
+        double change = (afterMedian - beforeMedian) / beforeMedian;
+
+        Verdict verdict = Verdict_Same;
+
+        if (p < alpha && change > threshold) {
+            verdict = Verdict_Regression;
+        }
+        else if (p < alpha && change < -threshold) {
+            verdict = Verdict_Improvement;
+        }
+
+        verdictCounts[verdict]++;
+
+        printf(
+            "%-60s %12.6f ms -> %12.6f ms %+8.2f%% p=%.4f %s\n",
+            key,
+            beforeMedian * 1000.0,
+            afterMedian * 1000.0,
+            change * 100.0,
+            p,
+            VerdictNames[verdict]
+        );
+
+        freeLastAllocation(&arena);
+    }
+
+    for (size_t testIndex = 0; testIndex < getElementCount(before.tests); testIndex++) {
+        char key[TEST_KEY_CAPACITY];
+
+        getTestKey(getElementOfArray(before.tests, testIndex), beforePath, key);
+
+        if (!findTest(&after, key, afterPath)) {
+            printf("%-60s %s\n", key, VerdictNames[Verdict_Missing]);
+            verdictCounts[Verdict_Missing]++;
+        }
+    }
+
+    printf(
+        "\n%zu same, %zu improvements, %zu regressions, %zu missing (threshold %.2f%%, alpha %g)\n",
+        verdictCounts[Verdict_Same],
+        verdictCounts[Verdict_Improvement],
+        verdictCounts[Verdict_Regression],
+        verdictCounts[Verdict_Missing],
+        threshold * 100.0,
+        alpha
+    );
+
+    return verdictCounts[Verdict_Regression] > 0 || verdictCounts[Verdict_Missing] > 0 ? 1 : 0;
+}
@@ -1,43 +1,122 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include "stdio.h"
+#include "inttypes.h"
 #include "common.c"
+#include "backing.c"
 
 #define PAGE_SIZE (4 *1024)
 
+#define FAULTS_TOTAL_PAGES 4096
+
+#define FAULTS_PAGE_STEP 16
+
+typedef struct {
+    const char *name;
+    Backing backing;
+    // The size of a page as the kernel faults it in, 0 when nothing should fault
+    size_t faultSize;
+} FaultsVariant;
+
+// The prefaulted variant is populated by allocateBuffer with MADV_POPULATE_WRITE, which plays the part of
+// MAP_POPULATE while keeping the numa policy ahead of the first fault
+FaultsVariant FaultsVariants[] = {
+    {"4k", {PageSize_Small, false, Numa_Default}, SMALL_PAGE_SIZE},
+    {"thp", {PageSize_Transparent, false, Numa_Default}, HUGE_PAGE_SIZE},
+    {"2m", {PageSize_Huge, false, Numa_Default}, HUGE_PAGE_SIZE},
+    {"4k prefault", {PageSize_Small, true, Numa_Default}, 0},
+};
+
 int main(void) {
     FILE *csv = fopen("faults.csv", "wb");
 
     assert(csv);
 
-    const size_t totalPages = 4096;
+    size_t size = FAULTS_TOTAL_PAGES * PAGE_SIZE;
 
-    size_t size = totalPages * PAGE_SIZE;
+    MemoryCountersSource memoryCounters = openMemoryCounters(getCurrentProcess());
 
-    HANDLE process = GetCurrentProcess();
+    fprintf(
+        csv,
+        "%s; %s; %s; %s; %s; %s; %s; %s\n",
+        "Backing",
+        "Pages",
+        "Size",
+        "Minor faults",
+        "Major faults",
+        "Extra faults",
+        "RSS delta",
+        "Resident"
+    );
 
-    fprintf(csv, "%s; %s; %s; %s\n", "Pages", "Faults", "Size", "Extra faults");
+    for (size_t variantIndex = 0; variantIndex < ARRAYSIZE(FaultsVariants); variantIndex++) {
+        FaultsVariant *variant = &FaultsVariants[variantIndex];
 
-    for (size_t pages = 1; pages <= totalPages; pages++) {
-        uint8_t *data = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        uint64_t totalFaults = 0;
+        int64_t totalExtraFaults = 0;
+        size_t rowCount = 0;
 
-        size_t touchSize = pages * PAGE_SIZE;
+        for (size_t pages = FAULTS_PAGE_STEP; pages <= FAULTS_TOTAL_PAGES; pages += FAULTS_PAGE_STEP) {
+            Buffer buffer = allocateBuffer(variant->backing, size);
 
-        uint64_t startFaults = getPageFaultCount(process);
+            if (!buffer.memory) {
+                break;
+            }
 
-        for (size_t byte = 0; byte < touchSize; byte++) {
-            data[byte] = (uint8_t) byte;
-        }
+            uint8_t *data = buffer.memory;
+
+            size_t touchSize = pages * PAGE_SIZE;
+
+            MemoryCounters start = getMemoryCounters(&memoryCounters);
 
-        uint64_t endFaults = getPageFaultCount(process);
+            for (size_t byte = 0; byte < touchSize; byte++) {
+                data[byte] = (uint8_t) byte;
+            }
 
-        VirtualFree(data, 0, MEM_RELEASE);
+            MemoryCounters end = getMemoryCounters(&memoryCounters);
 
-        uint64_t faults = endFaults - startFaults;
+            uint64_t resident = 0;
+            osGetResidentBytes(data, size, &resident);
 
-        uint64_t extraFaults = faults - pages;
+            freeBuffer(&buffer);
+
+            uint64_t minorFaults = end.minorFaults - start.minorFaults;
+            uint64_t majorFaults = end.majorFaults - start.majorFaults;
+
+            int64_t expectedFaults = variant->faultSize ? (int64_t) ((touchSize + variant->faultSize - 1) / variant->faultSize) : 0;
+            int64_t extraFaults = (int64_t) (minorFaults + majorFaults) - expectedFaults;
+            int64_t residentDelta = (int64_t) end.residentBytes - (int64_t) start.residentBytes;
+
+            fprintf(
+                csv,
+                "%s; %zu; %zu; %" PRIu64 "; %" PRIu64 "; %" PRId64 "; %" PRId64 "; %" PRIu64 "\n",
+                variant->name,
+                pages,
+                touchSize,
+                minorFaults,
+                majorFaults,
+                extraFaults,
+                residentDelta,
+                resident
+            );
+
+            totalFaults += minorFaults + majorFaults;
+            totalExtraFaults += extraFaults;
+            rowCount++;
+        }
+
+        if (rowCount == 0) {
+            printf("%s: could not allocate\n", variant->name);
+            continue;
+        }
 
-        fprintf(csv, "%zu; %llu; %llu; %llu\n", pages, faults, touchSize, extraFaults);
+        printf(
+            "%s: %" PRIu64 " faults over %zu runs, %" PRId64 " more than the page size accounts for\n",
+            variant->name,
+            totalFaults,
+            rowCount,
+            totalExtraFaults
+        );
     }
 
     fclose(csv);
@@ -0,0 +1,389 @@
+#ifndef KERNEL_C
+
+#define KERNEL_C
+
+#include "common.c"
+#include "pairs.c"
+
+#define HALF_PI 1.57079632679489661923
+
+#define PI 3.14159265358979323846
+
+#define DEGREES_TO_RADIANS 0.01745329251994329577
+
+typedef enum {
+    HaversineKernel_Libm,
+    HaversineKernel_Polynomial,
+    HaversineKernel_Avx2,
+    HaversineKernel_Avx512,
+    HaversineKernel_Count
+} HaversineKernel;
+
+const char *HaversineKernelNames[HaversineKernel_Count] = {"libm", "poly", "polyavx2", "polyavx512"};
+
+typedef struct {
+    double maxAbsoluteError;
+    double maxRelativeError;
+} ErrorBound;
+
+typedef struct {
+    ErrorBound againstAnswers;
+    ErrorBound againstLibm;
+    size_t count;
+} KernelError;
+
+// Polynomials interpolated at Chebyshev nodes, each within about 1 ulp of the function on its reduced range:
+// sin(x) = x * P(x^2) and cos(x) = Q(x^2) for |x| <= pi/2, asin(x) = x * R(x^2) for 0 <= x <= 1/2.
+// These are measured maxima from the error mode, not bounds. Against data/answers, over 1000000 pairs from seed 7:
+//   uniform: libm 1.6e-9 km (relative 3.6e-12), poly 6.4e-9 km (3.6e-12), polyavx2 and polyavx512 4.2e-9 km (3.6e-12)
+//   cluster: libm 1.4e-10 km (relative 1.5e-10), poly 1.7e-10 km (1.5e-10), polyavx2 and polyavx512 1.7e-10 km (1.5e-10)
+// Most of the error against the answers is already in libm, because the json rounds the coordinates the answers were
+// computed from. Against libm the kernels stay within 6.4e-9 km (relative 3.2e-13) on the uniform pairs. The
+// largest errors are near antipodal pairs, where asin(sqrt(a)) amplifies the rounding of a.
+const double SIN_COEFFICIENTS[] = {
+    0.9999999999999999, -0.1666666666666606, 0.008333333333281902, -0.00019841269824627056,
+    2.755731657864093e-06, -2.50518799539558e-08, 1.6048104699526875e-10, -7.373601495511041e-13
+};
+
+const double COS_COEFFICIENTS[] = {
+    1.0, -0.4999999999999995, 0.041666666666661877, -0.001388888888869439, 2.4801587262135624e-05,
+    -2.755731479950638e-07, 2.087647185627807e-09, -1.1460307576327606e-11, 4.579159515236145e-14
+};
+
+const double ASIN_COEFFICIENTS[] = {
+    0.9999999999999998, 0.16666666666689706, 0.07499999995624415, 0.04464286038603156,
+    0.030381820752221768, 0.022374928823605693, 0.017313700945909897, 0.01432423514994457,
+    0.009376473481056654, 0.018256370242133526, -0.011693559679531316, 0.03150477675162431
+};
+
+double evaluatePolynomial(const double *coefficients, size_t count, double x) {
+    double result = coefficients[count - 1];
+
+    for (size_t index = count - 1; index-- > 0;) {
+        result = result * x + coefficients[index];
+    }
+
+    return result;
+}
+
+// |x| <= pi/2
+double sinApproximation(double x) {
+    return x * evaluatePolynomial(SIN_COEFFICIENTS, ARRAYSIZE(SIN_COEFFICIENTS), x * x);
+}
+
+// |x| <= pi/2
+double cosApproximation(double x) {
+    return evaluatePolynomial(COS_COEFFICIENTS, ARRAYSIZE(COS_COEFFICIENTS), x * x);
+}
+
+// asin(sqrt(x)) for 0 <= x <= 1, above 1/4 it goes through asin(s) = pi/2 - 2 asin(sqrt((1 - s) / 2))
+double asinSqrtApproximation(double x) {
+    double root = sqrt(x);
+
+    if (x <= 0.25) {
+        return root * evaluatePolynomial(ASIN_COEFFICIENTS, ARRAYSIZE(ASIN_COEFFICIENTS), x);
+    }
+
+    double reduced = (1.0 - root) * 0.5;
+
+    return HALF_PI - 2.0 * sqrt(reduced) * evaluatePolynomial(ASIN_COEFFICIENTS, ARRAYSIZE(ASIN_COEFFICIENTS), reduced);
+}
+
+// Latitudes are within +-90 degrees, so half their difference is within +-pi/2 and the cosines need no reduction.
+// Half the longitude difference is within +-pi, sin^2 is symmetric around pi/2 so it folds onto [0, pi/2].
+double haversineApproximation(double x1, double y1, double x2, double y2, double radius) {
+    double halfLatitude = (y2 - y1) * (DEGREES_TO_RADIANS * 0.5);
+    double halfLongitude = fabs((x2 - x1) * (DEGREES_TO_RADIANS * 0.5));
+
+    if (halfLongitude > HALF_PI) {
+        halfLongitude = PI - halfLongitude;
+    }
+
+    double sinLatitude = sinApproximation(halfLatitude);
+    double sinLongitude = sinApproximation(halfLongitude);
+
+    double rootTerm = sinLatitude * sinLatitude
+        + cosApproximation(y1 * DEGREES_TO_RADIANS) * cosApproximation(y2 * DEGREES_TO_RADIANS) * sinLongitude * sinLongitude;
+
+    return 2.0 * radius * asinSqrtApproximation(rootTerm);
+}
+
+TARGET("avx2,fma") static inline __m256d evaluatePolynomialAvx2(const double *coefficients, size_t count, __m256d x) {
+    __m256d result = _mm256_set1_pd(coefficients[count - 1]);
+
+    for (size_t index = count - 1; index-- > 0;) {
+        result = _mm256_fmadd_pd(result, x, _mm256_set1_pd(coefficients[index]));
+    }
+
+    return result;
+}
+
+TARGET("avx2,fma") static inline __m256d haversineAvx2(__m256d x1, __m256d y1, __m256d x2, __m256d y2, double radius) {
+    __m256d signMask = _mm256_set1_pd(-0.0);
+    __m256d halfPi = _mm256_set1_pd(HALF_PI);
+    __m256d halfDegrees = _mm256_set1_pd(DEGREES_TO_RADIANS * 0.5);
+    __m256d degrees = _mm256_set1_pd(DEGREES_TO_RADIANS);
+
+    __m256d halfLatitude = _mm256_mul_pd(_mm256_sub_pd(y2, y1), halfDegrees);
+    __m256d halfLongitude = _mm256_andnot_pd(signMask, _mm256_mul_pd(_mm256_sub_pd(x2, x1), halfDegrees));
+
+    __m256d folded = _mm256_sub_pd(_mm256_set1_pd(PI), halfLongitude);
+    halfLongitude = _mm256_blendv_pd(halfLongitude, folded, _mm256_cmp_pd(halfLongitude, halfPi, _CMP_GT_OQ));
+
+    __m256d sinLatitude = _mm256_mul_pd(halfLatitude, evaluatePolynomialAvx2(SIN_COEFFICIENTS, ARRAYSIZE(SIN_COEFFICIENTS), _mm256_mul_pd(halfLatitude, halfLatitude)));
+    __m256d sinLongitude = _mm256_mul_pd(halfLongitude, evaluatePolynomialAvx2(SIN_COEFFICIENTS, ARRAYSIZE(SIN_COEFFICIENTS), _mm256_mul_pd(halfLongitude, halfLongitude)));
+
+    __m256d latitude1 = _mm256_mul_pd(y1, degrees);
+    __m256d latitude2 = _mm256_mul_pd(y2, degrees);
+
+    __m256d cos1 = evaluatePolynomialAvx2(COS_COEFFICIENTS, ARRAYSIZE(COS_COEFFICIENTS), _mm256_mul_pd(latitude1, latitude1));
+    __m256d cos2 = evaluatePolynomialAvx2(COS_COEFFICIENTS, ARRAYSIZE(COS_COEFFICIENTS), _mm256_mul_pd(latitude2, latitude2));
+
+    __m256d rootTerm = _mm256_fmadd_pd(
+        _mm256_mul_pd(cos1, cos2),
+        _mm256_mul_pd(sinLongitude, sinLongitude),
+        _mm256_mul_pd(sinLatitude, sinLatitude)
+    );
+
+    // Both asin branches share one polynomial, the lanes above 1/4 evaluate it on the reduced argument
+    __m256d root = _mm256_sqrt_pd(rootTerm);
+    __m256d reduced = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(1.0), root), _mm256_set1_pd(0.5));
+    __m256d isReduced = _mm256_cmp_pd(rootTerm, _mm256_set1_pd(0.25), _CMP_GT_OQ);
+
+    __m256d argument = _mm256_blendv_pd(rootTerm, reduced, isReduced);
+    __m256d scale = _mm256_blendv_pd(root, _mm256_sqrt_pd(reduced), isReduced);
+
+    __m256d asin = _mm256_mul_pd(scale, evaluatePolynomialAvx2(ASIN_COEFFICIENTS, ARRAYSIZE(ASIN_COEFFICIENTS), argument));
+    asin = _mm256_blendv_pd(asin, _mm256_fnmadd_pd(_mm256_set1_pd(2.0), asin, halfPi), isReduced);
+
+    return _mm256_mul_pd(asin, _mm256_set1_pd(2.0 * radius));
+}
+
+TARGET("avx2,fma") double computeHaversinesAvx2(Pairs pairs, double *distances) {
+    __m256d sums = _mm256_setzero_pd();
+
+    size_t pairIndex = 0;
+
+    for (; pairIndex + 4 <= pairs.count; pairIndex += 4) {
+        __m256d distance = haversineAvx2(
+            _mm256_loadu_pd(pairs.x1 + pairIndex),
+            _mm256_loadu_pd(pairs.y1 + pairIndex),
+            _mm256_loadu_pd(pairs.x2 + pairIndex),
+            _mm256_loadu_pd(pairs.y2 + pairIndex),
+            EARTH_RADIUS
+        );
+
+        sums = _mm256_add_pd(sums, distance);
+
+        if (distances) {
+            _mm256_storeu_pd(distances + pairIndex, distance);
+        }
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sums);
+
+    double result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; pairIndex < pairs.count; pairIndex++) {
+        double distance = haversineApproximation(pairs.x1[pairIndex], pairs.y1[pairIndex], pairs.x2[pairIndex], pairs.y2[pairIndex], EARTH_RADIUS);
+
+        result += distance;
+
+        if (distances) {
+            distances[pairIndex] = distance;
+        }
+    }
+
+    return result;
+}
+
+TARGET("avx512f") static inline __m512d evaluatePolynomialAvx512(const double *coefficients, size_t count, __m512d x) {
+    __m512d result = _mm512_set1_pd(coefficients[count - 1]);
+
+    for (size_t index = count - 1; index-- > 0;) {
+        result = _mm512_fmadd_pd(result, x, _mm512_set1_pd(coefficients[index]));
+    }
+
+    return result;
+}
+
+TARGET("avx512f") static inline __m512d haversineAvx512(__m512d x1, __m512d y1, __m512d x2, __m512d y2, double radius) {
+    __m512d halfPi = _mm512_set1_pd(HALF_PI);
+    __m512d halfDegrees = _mm512_set1_pd(DEGREES_TO_RADIANS * 0.5);
+    __m512d degrees = _mm512_set1_pd(DEGREES_TO_RADIANS);
+
+    __m512d halfLatitude = _mm512_mul_pd(_mm512_sub_pd(y2, y1), halfDegrees);
+    __m512d halfLongitude = _mm512_abs_pd(_mm512_mul_pd(_mm512_sub_pd(x2, x1), halfDegrees));
+
+    __mmask8 isFolded = _mm512_cmp_pd_mask(halfLongitude, halfPi, _CMP_GT_OQ);
+    halfLongitude = _mm512_mask_sub_pd(halfLongitude, isFolded, _mm512_set1_pd(PI), halfLongitude);
+
+    __m512d sinLatitude = _mm512_mul_pd(halfLatitude, evaluatePolynomialAvx512(SIN_COEFFICIENTS, ARRAYSIZE(SIN_COEFFICIENTS), _mm512_mul_pd(halfLatitude, halfLatitude)));
+    __m512d sinLongitude = _mm512_mul_pd(halfLongitude, evaluatePolynomialAvx512(SIN_COEFFICIENTS, ARRAYSIZE(SIN_COEFFICIENTS), _mm512_mul_pd(halfLongitude, halfLongitude)));
+
+    __m512d latitude1 = _mm512_mul_pd(y1, degrees);
+    __m512d latitude2 = _mm512_mul_pd(y2, degrees);
+
+    __m512d cos1 = evaluatePolynomialAvx512(COS_COEFFICIENTS, ARRAYSIZE(COS_COEFFICIENTS), _mm512_mul_pd(latitude1, latitude1));
+    __m512d cos2 = evaluatePolynomialAvx512(COS_COEFFICIENTS, ARRAYSIZE(COS_COEFFICIENTS), _mm512_mul_pd(latitude2, latitude2));
+
+    __m512d rootTerm = _mm512_fmadd_pd(
+        _mm512_mul_pd(cos1, cos2),
+        _mm512_mul_pd(sinLongitude, sinLongitude),
+        _mm512_mul_pd(sinLatitude, sinLatitude)
+    );
+
+    __m512d root = _mm512_sqrt_pd(rootTerm);
+    __m512d reduced = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(1.0), root), _mm512_set1_pd(0.5));
+    __mmask8 isReduced = _mm512_cmp_pd_mask(rootTerm, _mm512_set1_pd(0.25), _CMP_GT_OQ);
+
+    __m512d argument = _mm512_mask_blend_pd(isReduced, rootTerm, reduced);
+    __m512d scale = _mm512_mask_blend_pd(isReduced, root, _mm512_sqrt_pd(reduced));
+
+    __m512d asin = _mm512_mul_pd(scale, evaluatePolynomialAvx512(ASIN_COEFFICIENTS, ARRAYSIZE(ASIN_COEFFICIENTS), argument));
+    asin = _mm512_mask_blend_pd(isReduced, asin, _mm512_fnmadd_pd(_mm512_set1_pd(2.0), asin, halfPi));
+
+    return _mm512_mul_pd(asin, _mm512_set1_pd(2.0 * radius));
+}
+
+// The tail is done with masked loads, so every pair goes through the same vector code
+TARGET("avx512f") double computeHaversinesAvx512(Pairs pairs, double *distances) {
+    __m512d sums = _mm512_setzero_pd();
+
+    for (size_t pairIndex = 0; pairIndex < pairs.count; pairIndex += 8) {
+        size_t remaining = pairs.count - pairIndex;
+        __mmask8 mask = remaining >= 8 ? 0xff : (__mmask8) ((1u << remaining) - 1);
+
+        __m512d distance = haversineAvx512(
+            _mm512_maskz_loadu_pd(mask, pairs.x1 + pairIndex),
+            _mm512_maskz_loadu_pd(mask, pairs.y1 + pairIndex),
+            _mm512_maskz_loadu_pd(mask, pairs.x2 + pairIndex),
+            _mm512_maskz_loadu_pd(mask, pairs.y2 + pairIndex),
+            EARTH_RADIUS
+        );
+
+        sums = _mm512_mask_add_pd(sums, mask, sums, distance);
+
+        if (distances) {
+            _mm512_mask_storeu_pd(distances + pairIndex, mask, distance);
+        }
+    }
+
+    return _mm512_reduce_add_pd(sums);
+}
+
+bool isHaversineKernelSupported(HaversineKernel kernel) {
+    CpuFeatures features = getCpuFeatures();
+
+    switch (kernel) {
+        case HaversineKernel_Avx2: {
+            return features.avx2 && features.fma;
+        }
+        case HaversineKernel_Avx512: {
+            return features.avx512;
+        }
+        default: {
+            return true;
+        }
+    }
+}
+
+// Not profiled, so it can run on worker threads
+double sumHaversines(Pairs pairs, HaversineKernel kernel, double *distances) {
+    double result = 0;
+
+    switch (kernel) {
+        case HaversineKernel_Libm:
+        case HaversineKernel_Polynomial: {
+            for (size_t pairIndex = 0; pairIndex < pairs.count; pairIndex++) {
+                double x1 = pairs.x1[pairIndex];
+                double y1 = pairs.y1[pairIndex];
+                double x2 = pairs.x2[pairIndex];
+                double y2 = pairs.y2[pairIndex];
+
+                double distance = kernel == HaversineKernel_Libm
+                    ? haversine(x1, y1, x2, y2, EARTH_RADIUS)
+                    : haversineApproximation(x1, y1, x2, y2, EARTH_RADIUS);
+
+                result += distance;
+
+                if (distances) {
+                    distances[pairIndex] = distance;
+                }
+            }
+        }
+        break;
+        case HaversineKernel_Avx2: {
+            result = computeHaversinesAvx2(pairs, distances);
+        }
+        break;
+        case HaversineKernel_Avx512: {
+            result = computeHaversinesAvx512(pairs, distances);
+        }
+        break;
+        default: {
+            assert(false);
+        }
+    }
+
+    return result;
+}
+
+// Returns the sum of the distances, distances also receives each one unless it is NULL
+double computeHaversines(Pairs pairs, HaversineKernel kernel, double *distances) {
+    MEASURE_FUNCTION_THROUGHPUT(pairs.count * PAIR_COORDINATES_COUNT * sizeof(double));
+
+    if (!isHaversineKernelSupported(kernel)) {
+        die(__FILE__, __LINE__, 0, "the %s kernel is not supported by this cpu", HaversineKernelNames[kernel]);
+    }
+
+    double result = sumHaversines(pairs, kernel, distances);
+
+    STOP_COUNTER return result;
+}
+
+void updateErrorBound(ErrorBound *bound, double value, double expected) {
+    double error = fabs(value - expected);
+
+    if (error > bound->maxAbsoluteError) {
+        bound->maxAbsoluteError = error;
+    }
+
+    if (expected != 0 && error / expected > bound->maxRelativeError) {
+        bound->maxRelativeError = error / expected;
+    }
+}
+
+// Compares every distance with the one input.c wrote to data/answers from the unrounded coordinates, and with libm
+// on the same parsed coordinates, which isolates the error of the kernel from the rounding of the json.
+KernelError measureKernelError(Pairs pairs, HaversineKernel kernel, Arena *arena) {
+    TIME_FUNCTION;
+
+    String answers = readFileToString(ANSWERS_PATH, arena);
+
+    if (answers.size != pairs.count * sizeof(double)) {
+        die(__FILE__, __LINE__, 0, "%s has %zu answers for %zu pairs", ANSWERS_PATH, answers.size / sizeof(double), pairs.count);
+    }
+
+    double *distances = arenaAllocate(arena, pairs.count * sizeof(double));
+    double *references = arenaAllocate(arena, pairs.count * sizeof(double));
+
+    computeHaversines(pairs, kernel, distances);
+    computeHaversines(pairs, HaversineKernel_Libm, references);
+
+    KernelError result = {0};
+    result.count = pairs.count;
+
+    for (size_t pairIndex = 0; pairIndex < pairs.count; pairIndex++) {
+        double answer = 0;
+        memcpy(&answer, answers.data.unsignedData + pairIndex * sizeof(double), sizeof(double));
+
+        updateErrorBound(&result.againstAnswers, distances[pairIndex], answer);
+        updateErrorBound(&result.againstLibm, distances[pairIndex], references[pairIndex]);
+    }
+
+    STOP_COUNTER return result;
+}
+
+#endif
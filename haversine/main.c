@@ -3,19 +3,33 @@
 #include "stdio.h"
 #include "common.c"
 #include "parser.c"
+#include "stream.c"
+#include "pairs.c"
+#include "kernel.c"
+#include "parallel.c"
+
+#define RANDOM_NUMBERS_TO_VALIDATE 1000000
+
+typedef struct {
+    bool mapFile;
+    uint32_t mapHints;
+    bool stream;
+    bool pairs;
+    bool scan;
+    Scanner scanner;
+    bool validateNumbers;
+    HaversineKernel kernel;
+    bool measureError;
+    size_t threadCount;
+    bool recursion;
+    bool trace;
+    bool perf;
+} Options;
 
 void bar();
 
 void foo();
 
-#ifdef _WIN32
-
-void sleep(uint32_t milliseconds) {
-    Sleep(milliseconds);
-}
-
-#endif
-
 float getOsSecondsElapsed(uint64_t start, uint64_t frequency) {
     uint64_t time = getOsTimeStamp();
 
@@ -48,9 +62,80 @@ double getAverageDistance(Value *json) {
     STOP_COUNTER return average;
 }
 
+// Reads options like "mmap sequential hugepages" or "pairs avx2 polyavx2 threads 8", unknown arguments are ignored
+Options parseOptions(int argc, char **argv) {
+    Options result = {0};
+
+    for (int argIndex = 1; argIndex < argc; argIndex++) {
+        char *arg = argv[argIndex];
+
+        if (strcmp(arg, "mmap") == 0) {
+            result.mapFile = true;
+        }
+        else if (strcmp(arg, "sequential") == 0) {
+            result.mapHints |= MapHint_Sequential;
+        }
+        else if (strcmp(arg, "hugepages") == 0) {
+            result.mapHints |= MapHint_HugePages;
+        }
+        else if (strcmp(arg, "stream") == 0) {
+            result.stream = true;
+        }
+        else if (strcmp(arg, "pairs") == 0) {
+            result.pairs = true;
+        }
+        else if (strcmp(arg, "validate") == 0) {
+            result.validateNumbers = true;
+        }
+        else if (strcmp(arg, "simd") == 0) {
+            result.scan = true;
+            result.scanner = getBestScanner();
+        }
+        else if (strcmp(arg, "threads") == 0) {
+            result.pairs = true;
+            result.threadCount = osGetProcessorCount();
+
+            if (argIndex + 1 < argc && atoi(argv[argIndex + 1]) > 0) {
+                argIndex++;
+                result.threadCount = (size_t) atoi(argv[argIndex]);
+            }
+        }
+        else if (strcmp(arg, "perf") == 0) {
+            result.perf = true;
+        }
+        else if (strcmp(arg, "trace") == 0) {
+            result.trace = true;
+        }
+        else if (strcmp(arg, "recursion") == 0) {
+            result.recursion = true;
+        }
+        else if (strcmp(arg, "error") == 0) {
+            result.pairs = true;
+            result.measureError = true;
+        }
+
+        for (int scanner = 0; scanner < Scanner_Count; scanner++) {
+            if (strcmp(arg, ScannerNames[scanner]) == 0) {
+                result.scan = true;
+                result.scanner = (Scanner) scanner;
+            }
+        }
+
+        // The kernels work on the coordinate arrays, so they imply the pairs parser
+        for (int kernel = 0; kernel < HaversineKernel_Count; kernel++) {
+            if (strcmp(arg, HaversineKernelNames[kernel]) == 0) {
+                result.pairs = true;
+                result.kernel = (HaversineKernel) kernel;
+            }
+        }
+    }
+
+    return result;
+}
+
 void sleepOneSecond() {
     // TIME_FUNCTION
-    sleep(1000);
+    osSleep(1000);
 
     // STOP_COUNTER;
 }
@@ -76,9 +161,19 @@ void bar() {
     STOP_COUNTER
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    Options options = parseOptions(argc, argv);
+
     COUNTERS.cpuCounterFrequency = estimateRdtscFrequency();
 
+    if (options.trace) {
+        enableTrace(&COUNTERS);
+    }
+
+    if (options.perf) {
+        enablePerfCounters(&COUNTERS);
+    }
+
     startCounters(&COUNTERS);
     // sleepOneSecond();
 #ifdef _WIN32
@@ -87,25 +182,82 @@ int main(void) {
 
     Arena arena = arenaInit();
 
-    String text = readFileToString(JSON_PATH, &arena);
-
-    // printf("Json: %.*s", (int)text.size, text.data);
-    // printf("hi");
-    Parser parser = initParser(text, &arena);
+    FileMapping mapping = {0};
 
-    Value *json = parseJson(&parser);
+    double average = 0;
 
-    // printElement(json, 2, 0);
-    // printf("\n");
-    double average = getAverageDistance(json);
+    if (options.stream) {
+        average = getAverageDistanceStreaming(JSON_PATH, &arena);
+    }
+    else {
+        String text = options.mapFile
+            ? mapFileToString(JSON_PATH, options.mapHints, &mapping)
+            : readFileToString(JSON_PATH, &arena);
+
+        if (options.validateNumbers) {
+            NumberValidation fileValidation = validateNumbers(text);
+            printf("Numbers in %s: %zu, mismatches: %zu\n", JSON_PATH, fileValidation.count, fileValidation.mismatches);
+
+            NumberValidation randomValidation = validateRandomNumbers(RANDOM_NUMBERS_TO_VALIDATE, getOsTimeStamp(), &arena);
+            printf("Random numbers: %zu, mismatches: %zu\n\n", randomValidation.count, randomValidation.mismatches);
+        }
+
+        // printf("Json: %.*s", (int)text.size, text.data);
+        // printf("hi");
+        Parser parser = initParser(text, &arena);
+
+        if (options.scan) {
+            parser.structurals = buildStructuralIndex(text, options.scanner, &arena);
+        }
+
+        if (options.pairs) {
+            Pairs pairs = options.threadCount > 0 ? parsePairsParallel(&parser, options.threadCount) : parsePairs(&parser);
+
+            if (options.threadCount > 0) {
+                average = computeHaversinesParallel(pairs, options.kernel, options.threadCount, &arena) / (double) pairs.count;
+            }
+            else {
+                average = computeHaversines(pairs, options.kernel, NULL) / (double) pairs.count;
+            }
+
+            if (options.measureError) {
+                KernelError error = measureKernelError(pairs, options.kernel, &arena);
+                printf(
+                    "Kernel %s, max absolute/relative error over %zu pairs: %.3e/%.3e against %s, %.3e/%.3e against libm\n",
+                    HaversineKernelNames[options.kernel],
+                    error.count,
+                    error.againstAnswers.maxAbsoluteError,
+                    error.againstAnswers.maxRelativeError,
+                    ANSWERS_PATH,
+                    error.againstLibm.maxAbsoluteError,
+                    error.againstLibm.maxRelativeError
+                );
+            }
+        }
+        else {
+            Value *json = parseJson(&parser);
+
+            // printElement(json, 2, 0);
+            // printf("\n");
+            average = getAverageDistance(json);
+        }
+    }
 
     printf("Average : %1.12f\n\n", average);
 
-    // foo();
+    // foo -> bar -> foo, three seconds of sleep that the report should attribute exactly
+    if (options.recursion) {
+        foo();
+    }
+
     // sleepFiveSeconds();
     stopCounters(&COUNTERS);
 
+    osUnmapFile(&mapping);
+
     printPerformanceReport(&COUNTERS);
 
+    writeTrace(&COUNTERS, TRACE_PATH);
+
     return 0;
 }
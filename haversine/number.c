@@ -0,0 +1,417 @@
+#ifndef NUMBER_C
+
+#define NUMBER_C
+
+#include "common.c"
+#include "powers.c"
+
+// The most decimal digits that always fit in a 64-bit mantissa
+#define MAX_MANTISSA_DIGITS 19
+
+#define MAX_EXACT_POWER_OF_TEN 22
+
+#define MAX_EXACT_MANTISSA (1ull << 53)
+
+#define NUMBER_BUFFER_CAPACITY 128
+
+#define DOUBLE_EXPONENT_BIAS 1023
+
+const uint64_t INTEGER_POWERS_OF_TEN[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+const double EXACT_POWERS_OF_TEN[MAX_EXACT_POWER_OF_TEN + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+typedef struct {
+    uint64_t mantissa;
+    int64_t exponent;
+    size_t digitCount;
+    bool isNegative;
+    // Set when there were more digits than fit in the mantissa, which then is not exact
+    bool isTruncated;
+} Decimal;
+
+typedef struct {
+    size_t count;
+    size_t mismatches;
+} NumberValidation;
+
+static inline bool isDigitByte(uint8_t byte) {
+    return byte >= '0' && byte <= '9';
+}
+
+// Adding 6 carries every byte above '9' into the high nibble, so a byte that is not a digit leaves a nonzero nibble.
+// Carries only leave bytes that are not digits, so the lowest flagged byte is always right.
+static inline uint64_t findNonDigits(uint64_t bytes) {
+    return ((bytes & 0xf0f0f0f0f0f0f0f0) | (((bytes + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) >> 4)) ^ 0x3333333333333333;
+}
+
+// Combines neighbouring digits into pairs, the pairs into fours and the fours into the result, first digit in the lowest byte
+static inline uint32_t parseEightDigits(uint64_t bytes) {
+    bytes -= 0x3030303030303030;
+    bytes = (bytes * 10) + (bytes >> 8);
+    bytes = (((bytes & 0x000000ff000000ff) * (100 + (1000000ull << 32)))
+        + (((bytes >> 16) & 0x000000ff000000ff) * (1 + (10000ull << 32)))) >> 32;
+
+    return (uint32_t) bytes;
+}
+
+// Returns how many digits were read. Runs of up to eight digits are converted at once by shifting them to the top
+// of the word and filling the bytes below with '0'.
+static inline size_t parseDigits(String text, size_t *offset, Decimal *decimal) {
+    size_t start = *offset;
+
+    while (*offset + 8 <= text.size) {
+        uint64_t bytes = 0;
+        memcpy(&bytes, text.data.unsignedData + *offset, sizeof(bytes));
+
+        uint64_t nonDigits = findNonDigits(bytes);
+        uint32_t digits = nonDigits ? countTrailingZeros(nonDigits) / 8 : 8;
+
+        if (digits == 0) {
+            return *offset - start;
+        }
+
+        if (decimal->digitCount + digits > MAX_MANTISSA_DIGITS) {
+            break;
+        }
+
+        if (digits < 8) {
+            bytes = (bytes << (64 - 8 * digits)) | (0x3030303030303030 >> (8 * digits));
+        }
+
+        decimal->mantissa = decimal->mantissa * INTEGER_POWERS_OF_TEN[digits] + parseEightDigits(bytes);
+        decimal->digitCount += digits;
+        *offset += digits;
+
+        if (digits < 8) {
+            return *offset - start;
+        }
+    }
+
+    while (*offset < text.size && isDigitByte(text.data.unsignedData[*offset])) {
+        if (decimal->digitCount < MAX_MANTISSA_DIGITS) {
+            decimal->mantissa = decimal->mantissa * 10 + (text.data.unsignedData[*offset] - '0');
+        }
+        else {
+            decimal->isTruncated = true;
+        }
+
+        decimal->digitCount++;
+        (*offset)++;
+    }
+
+    return *offset - start;
+}
+
+static inline bool hasByte(String text, size_t offset, char byte) {
+    return offset < text.size && text.data.signedData[offset] == byte;
+}
+
+// Reads -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? into mantissa * 10^exponent
+static inline bool scanDecimal(String text, size_t *offset, Decimal *decimal) {
+    if (hasByte(text, *offset, '-')) {
+        decimal->isNegative = true;
+        (*offset)++;
+    }
+
+    if (hasByte(text, *offset, '0')) {
+        (*offset)++;
+    }
+    else if (parseDigits(text, offset, decimal) == 0) {
+        return false;
+    }
+
+    if (hasByte(text, *offset, '.')) {
+        (*offset)++;
+
+        size_t fractionDigits = parseDigits(text, offset, decimal);
+
+        if (fractionDigits == 0) {
+            return false;
+        }
+
+        decimal->exponent -= (int64_t) fractionDigits;
+    }
+
+    if (hasByte(text, *offset, 'e') || hasByte(text, *offset, 'E')) {
+        (*offset)++;
+
+        bool isNegativeExponent = hasByte(text, *offset, '-');
+
+        if (isNegativeExponent || hasByte(text, *offset, '+')) {
+            (*offset)++;
+        }
+
+        if (*offset >= text.size || !isDigitByte(text.data.unsignedData[*offset])) {
+            return false;
+        }
+
+        int64_t exponent = 0;
+
+        while (*offset < text.size && isDigitByte(text.data.unsignedData[*offset])) {
+            // Anything this large is zero or infinity already, stop before it can overflow
+            if (exponent < 100000) {
+                exponent = exponent * 10 + (text.data.unsignedData[*offset] - '0');
+            }
+
+            (*offset)++;
+        }
+
+        decimal->exponent += isNegativeExponent ? -exponent : exponent;
+    }
+
+    return true;
+}
+
+// Clinger's fast path, both operands are exact doubles so the single rounding of the multiply or divide is correct
+static inline bool convertExactDecimal(Decimal decimal, double *result) {
+    if (decimal.mantissa > MAX_EXACT_MANTISSA || decimal.exponent < -MAX_EXACT_POWER_OF_TEN || decimal.exponent > MAX_EXACT_POWER_OF_TEN) {
+        return false;
+    }
+
+    double value = (double) decimal.mantissa;
+
+    if (decimal.exponent < 0) {
+        value /= EXACT_POWERS_OF_TEN[-decimal.exponent];
+    }
+    else {
+        value *= EXACT_POWERS_OF_TEN[decimal.exponent];
+    }
+
+    *result = decimal.isNegative ? -value : value;
+
+    return true;
+}
+
+// Eisel-Lemire: multiplies the mantissa by a 128-bit approximation of 10^exponent and keeps the top 54 bits.
+// Returns false in the rare cases where the truncated product cannot decide the rounding.
+bool convertDecimalEiselLemire(Decimal decimal, double *result) {
+    if (decimal.mantissa == 0) {
+        *result = decimal.isNegative ? -0.0 : 0.0;
+        return true;
+    }
+
+    if (decimal.exponent < POWERS_OF_TEN_MIN_EXPONENT || decimal.exponent > POWERS_OF_TEN_MAX_EXPONENT) {
+        return false;
+    }
+
+    const uint64_t *power = POWERS_OF_TEN[decimal.exponent - POWERS_OF_TEN_MIN_EXPONENT];
+
+    uint32_t leadingZeros = countLeadingZeros(decimal.mantissa);
+    uint64_t mantissa = decimal.mantissa << leadingZeros;
+
+    // 217706 / 2^16 approximates log2(10)
+    uint64_t exponent = (uint64_t) (((217706 * decimal.exponent) >> 16) + 64 + DOUBLE_EXPONENT_BIAS) - leadingZeros;
+
+    uint64_t high = 0;
+    uint64_t low = multiply64(mantissa, power[1], &high);
+
+    // The bits that decide the rounding might still change, bring in the low half of the power
+    if ((high & 0x1ff) == 0x1ff && low + mantissa < mantissa) {
+        uint64_t lowHigh = 0;
+        uint64_t lowLow = multiply64(mantissa, power[0], &lowHigh);
+
+        uint64_t mergedHigh = high;
+        uint64_t mergedLow = low + lowHigh;
+
+        if (mergedLow < low) {
+            mergedHigh++;
+        }
+
+        if ((mergedHigh & 0x1ff) == 0x1ff && mergedLow + 1 == 0 && lowLow + mantissa < mantissa) {
+            return false;
+        }
+
+        high = mergedHigh;
+        low = mergedLow;
+    }
+
+    uint64_t topBit = high >> 63;
+    uint64_t resultMantissa = high >> (topBit + 9);
+    exponent -= 1 ^ topBit;
+
+    // Exactly halfway between two doubles, round to even needs the exact value
+    if (low == 0 && (high & 0x1ff) == 0 && (resultMantissa & 3) == 1) {
+        return false;
+    }
+
+    resultMantissa += resultMantissa & 1;
+    resultMantissa >>= 1;
+
+    if (resultMantissa >> 53 > 0) {
+        resultMantissa >>= 1;
+        exponent++;
+    }
+
+    // Subnormals, infinity and overflow are left to strtod
+    if (exponent - 1 >= 0x7ff - 1) {
+        return false;
+    }
+
+    uint64_t bits = (exponent << 52) | (resultMantissa & 0x000fffffffffffff);
+
+    if (decimal.isNegative) {
+        bits |= 0x8000000000000000;
+    }
+
+    memcpy(result, &bits, sizeof(*result));
+
+    return true;
+}
+
+// The text is not zero terminated, so strtod gets a copy of the number
+double convertWithStrtod(char *number, size_t size) {
+    char buffer[NUMBER_BUFFER_CAPACITY];
+
+    char *copy = size < NUMBER_BUFFER_CAPACITY ? buffer : malloc(size + 1);
+
+    if (!copy) {
+        die(__FILE__, __LINE__, errno, "could not allocate %zu bytes", size + 1);
+    }
+
+    memcpy(copy, number, size);
+    copy[size] = '\0';
+
+    double result = strtod(copy, NULL);
+
+    if (copy != buffer) {
+        free(copy);
+    }
+
+    return result;
+}
+
+// Parses the json number at offset and moves offset past it. Returns false if there is no valid number there.
+bool parseNumberText(String text, size_t *offset, double *result) {
+    size_t start = *offset;
+
+    Decimal decimal = {0};
+
+    if (!scanDecimal(text, offset, &decimal)) {
+        return false;
+    }
+
+    if (!decimal.isTruncated && (convertExactDecimal(decimal, result) || convertDecimalEiselLemire(decimal, result))) {
+        return true;
+    }
+
+    *result = convertWithStrtod(text.data.signedData + start, *offset - start);
+
+    return true;
+}
+
+// Compares every number outside strings in text with what strtod makes of it, bit for bit
+NumberValidation validateNumbers(String text) {
+    TIME_FUNCTION;
+
+    NumberValidation result = {0};
+
+    bool isInString = false;
+    size_t offset = 0;
+
+    while (offset < text.size) {
+        uint8_t byte = text.data.unsignedData[offset];
+
+        if (byte == '"') {
+            isInString = !isInString;
+        }
+        else if (!isInString && (byte == '-' || isDigitByte(byte))) {
+            size_t start = offset;
+
+            double parsed = 0;
+
+            if (!parseNumberText(text, &offset, &parsed)) {
+                die(__FILE__, __LINE__, 0, "invalid number at offset %zu", start);
+            }
+
+            double expected = convertWithStrtod(text.data.signedData + start, offset - start);
+
+            if (memcmp(&parsed, &expected, sizeof(parsed)) != 0) {
+                if (result.mismatches < 10) {
+                    printf("Mismatch for %.*s: %.17g, strtod gives %.17g\n", (int) (offset - start), text.data.signedData + start, parsed, expected);
+                }
+
+                result.mismatches++;
+            }
+
+            result.count++;
+
+            continue;
+        }
+
+        offset++;
+    }
+
+    STOP_COUNTER return result;
+}
+
+uint64_t nextRandom(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+// Random numbers around the edges of every conversion path: long mantissas, exponents near the limits of the
+// powers table and the shortest round trip of random doubles
+NumberValidation validateRandomNumbers(size_t count, uint64_t seed, Arena *arena) {
+    TIME_FUNCTION;
+
+    size_t capacity = count * 64;
+    char *numbers = arenaAllocate(arena, capacity);
+
+    uint64_t state = seed | 1;
+    size_t size = 0;
+
+    for (size_t numberIndex = 0; numberIndex < count; numberIndex++) {
+        uint64_t random = nextRandom(&state);
+        char *number = numbers + size;
+        size_t remaining = capacity - size;
+        int written = 0;
+
+        switch (numberIndex % 4) {
+            case 0: {
+                uint64_t bits = random;
+                double value = 0;
+                memcpy(&value, &bits, sizeof(value));
+
+                if (value != value || value - value != 0) {
+                    value = 0;
+                }
+
+                written = snprintf(number, remaining, "%.17g,", value);
+            }
+            break;
+            case 1: {
+                int exponent = (int) (nextRandom(&state) % 700) - 360;
+                written = snprintf(number, remaining, "%llue%d,", (unsigned long long) random, exponent);
+            }
+            break;
+            case 2: {
+                uint64_t digits = random % 10000000000000000000ull;
+                int exponent = (int) (nextRandom(&state) % 60) - 30;
+                written = snprintf(number, remaining, "-%llu.%04llue%+d,", (unsigned long long) (digits / 10000), (unsigned long long) (digits % 10000), exponent);
+            }
+            break;
+            default: {
+                written = snprintf(number, remaining, "%.12f,", (double) (int64_t) random / 1e6);
+            }
+            break;
+        }
+
+        size += (size_t) written;
+    }
+
+    String text = {0};
+    text.data.signedData = numbers;
+    text.size = size;
+
+    NumberValidation result = validateNumbers(text);
+
+    STOP_COUNTER return result;
+}
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef PAIRS_C
+
+#define PAIRS_C
+
+#include "common.c"
+#include "parser.c"
+
+#define PAIR_COORDINATES_COUNT 4
+
+// Shortest possible pair, {"x1":0,"y1":0,"x2":0,"y2":0} followed by a comma
+#define PAIR_MIN_SIZE 31
+
+typedef struct {
+    double *x1;
+    double *y1;
+    double *x2;
+    double *y2;
+    size_t count;
+    size_t capacity;
+} Pairs;
+
+const String pairKeys[PAIR_COORDINATES_COUNT] = {
+    {"\"x1\"", sizeof("\"x1\"") - 1},
+    {"\"y1\"", sizeof("\"y1\"") - 1},
+    {"\"x2\"", sizeof("\"x2\"") - 1},
+    {"\"y2\"", sizeof("\"y2\"") - 1},
+};
+
+const String pairsKey = {"\"pairs\"", sizeof("\"pairs\"") - 1};
+
+Pairs initPairs(Arena *arena, size_t capacity) {
+    Pairs result = {0};
+
+    result.capacity = capacity;
+    result.x1 = arenaAllocate(arena, capacity * sizeof(double));
+    result.y1 = arenaAllocate(arena, capacity * sizeof(double));
+    result.x2 = arenaAllocate(arena, capacity * sizeof(double));
+    result.y2 = arenaAllocate(arena, capacity * sizeof(double));
+
+    return result;
+}
+
+void addPair(Pairs *pairs, double coordinates[PAIR_COORDINATES_COUNT]) {
+    assert(pairs->count < pairs->capacity);
+
+    pairs->x1[pairs->count] = coordinates[0];
+    pairs->y1[pairs->count] = coordinates[1];
+    pairs->x2[pairs->count] = coordinates[2];
+    pairs->y2[pairs->count] = coordinates[3];
+    pairs->count++;
+}
+
+bool skipLiteral(Parser *parser, String literal) {
+    if (!isLiteral(parser, literal)) {
+        return false;
+    }
+
+    skipChars(parser, literal.size);
+
+    return true;
+}
+
+bool skipCharacter(Parser *parser, char character) {
+    if (!isCharacter(parser, character)) {
+        return false;
+    }
+
+    next(parser);
+
+    return true;
+}
+
+// Parses {"x1":..., "y1":..., "x2":..., "y2":...} with the keys in this exact order, without building values.
+// Leaves the parser untouched and returns false on anything else.
+bool parsePairFast(Parser *parser, double coordinates[PAIR_COORDINATES_COUNT]) {
+    Parser start = *parser;
+
+    if (!skipCharacter(parser, LEFT_BRACE)) {
+        return false;
+    }
+
+    for (size_t keyIndex = 0; keyIndex < PAIR_COORDINATES_COUNT; keyIndex++) {
+        skipWhitespace(parser);
+
+        if (!skipLiteral(parser, pairKeys[keyIndex])) {
+            *parser = start;
+            return false;
+        }
+
+        skipWhitespace(parser);
+
+        if (!skipCharacter(parser, COLON)) {
+            *parser = start;
+            return false;
+        }
+
+        skipWhitespace(parser);
+
+        if (!isNumberStart(parser)) {
+            *parser = start;
+            return false;
+        }
+
+        coordinates[keyIndex] = parseNumber(parser);
+
+        skipWhitespace(parser);
+
+        char separator = keyIndex == PAIR_COORDINATES_COUNT - 1 ? RIGHT_BRACE : COMMA;
+
+        if (!skipCharacter(parser, separator)) {
+            *parser = start;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+double getPairCoordinate(Value *pair, char *key) {
+    Value *value = pair->type == ValueType_Object ? getMemberValueOfObject(pair, key) : NULL;
+
+    if (!value || value->type != ValueType_Number) {
+        die(__FILE__, __LINE__, 0, "pair without a numeric %s", key);
+    }
+
+    return getAsNumber(value);
+}
+
+void addPairFromValue(Pairs *pairs, Value *pair) {
+    double coordinates[PAIR_COORDINATES_COUNT] = {
+        getPairCoordinate(pair, "x1"),
+        getPairCoordinate(pair, "y1"),
+        getPairCoordinate(pair, "x2"),
+        getPairCoordinate(pair, "y2"),
+    };
+
+    addPair(pairs, coordinates);
+}
+
+// Generic path for documents that do not start with the pairs array
+Pairs getPairsFromJson(Value *json, Arena *arena) {
+    TIME_FUNCTION;
+
+    Value *array = json->type == ValueType_Object ? getMemberValueOfObject(json, "pairs") : NULL;
+
+    if (!array || array->type != ValueType_Array) {
+        die(__FILE__, __LINE__, 0, "json without a pairs array");
+    }
+
+    size_t count = getElementCount(array);
+
+    Pairs result = initPairs(arena, count);
+
+    for (size_t elementIndex = 0; elementIndex < count; elementIndex++) {
+        addPairFromValue(&result, getElementOfArray(array, elementIndex));
+    }
+
+    STOP_COUNTER return result;
+}
+
+// Skips {"pairs":[ and leaves the parser on the first pair, or leaves it untouched and returns false
+bool skipPairsArrayStart(Parser *parser) {
+    Parser start = *parser;
+
+    skipWhitespace(parser);
+
+    bool isPairsDocument = skipCharacter(parser, LEFT_BRACE);
+
+    if (isPairsDocument) {
+        skipWhitespace(parser);
+        isPairsDocument = skipLiteral(parser, pairsKey);
+    }
+
+    if (isPairsDocument) {
+        skipWhitespace(parser);
+        isPairsDocument = skipCharacter(parser, COLON);
+    }
+
+    if (isPairsDocument) {
+        skipWhitespace(parser);
+        isPairsDocument = skipCharacter(parser, LEFT_BRACKET);
+    }
+
+    if (!isPairsDocument) {
+        *parser = start;
+    }
+
+    return isPairsDocument;
+}
+
+void expectPairsArrayEnd(Parser *parser) {
+    expectCharacter(parser, RIGHT_BRACKET);
+    skipWhitespace(parser);
+    expectCharacter(parser, RIGHT_BRACE);
+}
+
+// Reads {"pairs":[...]} straight into arrays of coordinates. Pairs that do not match the layout parsePairFast
+// expects go through parseElement, a document that does not start with the pairs array is parsed as a whole.
+Pairs parsePairs(Parser *parser) {
+    MEASURE_FUNCTION_THROUGHPUT(parser->text.size);
+
+    bool isPairsDocument = skipPairsArrayStart(parser);
+
+    if (!isPairsDocument) {
+        Value *json = parseJson(parser);
+
+        Pairs result = getPairsFromJson(json, parser->arena);
+
+        STOP_COUNTER return result;
+    }
+
+    Pairs result = initPairs(parser->arena, parser->text.size / PAIR_MIN_SIZE + 1);
+
+    skipWhitespace(parser);
+
+    if (!isRightBracket(parser)) {
+        do {
+            skipWhitespace(parser);
+
+            double coordinates[PAIR_COORDINATES_COUNT];
+
+            if (parsePairFast(parser, coordinates)) {
+                addPair(&result, coordinates);
+                skipWhitespace(parser);
+            }
+            else {
+                size_t arenaOffset = parser->arena->currentOffset;
+
+                addPairFromValue(&result, parseElement(parser));
+
+                parser->arena->currentOffset = arenaOffset;
+            }
+        } while (skipCharacter(parser, COMMA));
+    }
+
+    expectPairsArrayEnd(parser);
+
+    STOP_COUNTER return result;
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef PARALLEL_C
+
+#define PARALLEL_C
+
+#include "common.c"
+#include "kernel.c"
+
+// Pairs are summed in blocks of this size no matter how many threads there are, so the partial sums, and the order
+// they are added in, never change with the thread count
+#define PARALLEL_BLOCK_SIZE 4096
+
+#define MAX_WORKERS 256
+
+// Scratch space for the parser of every slice, the fast pair layout never allocates
+#define PARSE_WORKER_ARENA_SIZE (64 * 1024)
+
+typedef struct {
+    Pairs pairs;
+    HaversineKernel kernel;
+    size_t firstBlock;
+    size_t blockCount;
+    double *blockSums;
+    Thread thread;
+} SumWorker;
+
+// One slice of the pairs array, from just after a comma (or the opening bracket) to the next split comma, or to the
+// end of the text for the slice that holds the closing bracket
+typedef struct {
+    Parser parser;
+    Arena arena;
+    size_t start;
+    size_t end;
+    bool isLast;
+    size_t count;
+    Pairs pairs;
+    bool failed;
+    Thread thread;
+} ParseWorker;
+
+Pairs getPairsBlock(Pairs pairs, size_t blockIndex) {
+    size_t first = blockIndex * PARALLEL_BLOCK_SIZE;
+    size_t remaining = pairs.count - first;
+
+    Pairs result = {0};
+    result.x1 = pairs.x1 + first;
+    result.y1 = pairs.y1 + first;
+    result.x2 = pairs.x2 + first;
+    result.y2 = pairs.y2 + first;
+    result.count = remaining < PARALLEL_BLOCK_SIZE ? remaining : PARALLEL_BLOCK_SIZE;
+    result.capacity = result.count;
+
+    return result;
+}
+
+THREAD_PROC(sumBlocks) {
+    SumWorker *worker = parameter;
+
+    size_t endPair = (worker->firstBlock + worker->blockCount) * PARALLEL_BLOCK_SIZE;
+
+    if (endPair > worker->pairs.count) {
+        endPair = worker->pairs.count;
+    }
+
+    MEASURE_FUNCTION_THROUGHPUT((endPair - worker->firstBlock * PARALLEL_BLOCK_SIZE) * PAIR_COORDINATES_COUNT * sizeof(double));
+
+    for (size_t blockIndex = worker->firstBlock; blockIndex < worker->firstBlock + worker->blockCount; blockIndex++) {
+        worker->blockSums[blockIndex] = sumHaversines(getPairsBlock(worker->pairs, blockIndex), worker->kernel, NULL);
+    }
+
+    STOP_COUNTER return 0;
+}
+
+// Splits the blocks into one contiguous range per thread, then adds the block sums in block order on this thread,
+// which makes the result bit-identical for every thread count
+double computeHaversinesParallel(Pairs pairs, HaversineKernel kernel, size_t threadCount, Arena *arena) {
+    MEASURE_FUNCTION_THROUGHPUT(pairs.count * PAIR_COORDINATES_COUNT * sizeof(double));
+
+    if (!isHaversineKernelSupported(kernel)) {
+        die(__FILE__, __LINE__, 0, "the %s kernel is not supported by this cpu", HaversineKernelNames[kernel]);
+    }
+
+    size_t blockCount = (pairs.count + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+
+    if (threadCount == 0 || threadCount > MAX_WORKERS) {
+        die(__FILE__, __LINE__, 0, "thread count must be between 1 and %d", MAX_WORKERS);
+    }
+
+    SumWorker *workers = arenaAllocate(arena, threadCount * sizeof(SumWorker));
+
+    double *blockSums = arenaAllocate(arena, blockCount * sizeof(double));
+
+    for (size_t workerIndex = 0; workerIndex < threadCount; workerIndex++) {
+        SumWorker *worker = &workers[workerIndex];
+
+        memset(worker, 0, sizeof(*worker));
+        worker->pairs = pairs;
+        worker->kernel = kernel;
+        worker->blockSums = blockSums;
+        worker->firstBlock = blockCount * workerIndex / threadCount;
+        worker->blockCount = blockCount * (workerIndex + 1) / threadCount - worker->firstBlock;
+
+        if (!osCreateThread(&worker->thread, sumBlocks, worker)) {
+            die(__FILE__, __LINE__, 0, "could not create worker thread: %s", osErrorMessage());
+        }
+    }
+
+    for (size_t workerIndex = 0; workerIndex < threadCount; workerIndex++) {
+        if (!osJoinThread(&workers[workerIndex].thread)) {
+            die(__FILE__, __LINE__, 0, "could not join worker thread: %s", osErrorMessage());
+        }
+    }
+
+    double result = 0;
+
+    for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        result += blockSums[blockIndex];
+    }
+
+    STOP_COUNTER return result;
+}
+
+// Returns the offset of the first comma at or after offset that is followed by the brace of the next pair,
+// or the size of the text if there is none
+size_t findPairSplit(String text, size_t offset) {
+    while (offset < text.size) {
+        uint8_t *comma = memchr(text.data.unsignedData + offset, COMMA, text.size - offset);
+
+        if (!comma) {
+            break;
+        }
+
+        size_t afterComma = (size_t) (comma - text.data.unsignedData) + 1;
+        size_t next = afterComma;
+
+        while (next < text.size && isWhitespaceCharacter(text.data.unsignedData[next])) {
+            next++;
+        }
+
+        if (next < text.size && text.data.unsignedData[next] == LEFT_BRACE) {
+            return afterComma - 1;
+        }
+
+        offset = afterComma;
+    }
+
+    return text.size;
+}
+
+// Every pair has exactly one brace, so this is the pair count of a slice the fast parser accepts
+THREAD_PROC(countPairStarts) {
+    ParseWorker *worker = parameter;
+
+    MEASURE_FUNCTION_THROUGHPUT(worker->end - worker->start);
+
+    String text = worker->parser.text;
+    size_t count = 0;
+
+    for (size_t offset = worker->start; offset < worker->end;) {
+        uint8_t *brace = memchr(text.data.unsignedData + offset, LEFT_BRACE, worker->end - offset);
+
+        if (!brace) {
+            break;
+        }
+
+        count++;
+        offset = (size_t) (brace - text.data.unsignedData) + 1;
+    }
+
+    worker->count = count;
+
+    STOP_COUNTER return 0;
+}
+
+// Only takes the fast path, anything else marks the slice as failed and the whole document is parsed again serially
+THREAD_PROC(parseSlice) {
+    ParseWorker *worker = parameter;
+    Parser *parser = &worker->parser;
+
+    MEASURE_FUNCTION_THROUGHPUT(worker->end - worker->start);
+
+    if (worker->start != worker->end) {
+        do {
+            skipWhitespace(parser);
+
+            double coordinates[PAIR_COORDINATES_COUNT];
+
+            if (worker->pairs.count == worker->pairs.capacity || !parsePairFast(parser, coordinates)) {
+                worker->failed = true;
+                break;
+            }
+
+            addPair(&worker->pairs, coordinates);
+
+            skipWhitespace(parser);
+        } while (skipCharacter(parser, COMMA));
+
+        // The last slice may count braces after the array, the others must hold exactly the pairs they counted
+        if (!worker->isLast && (parser->offset != worker->end || worker->pairs.count != worker->count)) {
+            worker->failed = true;
+        }
+    }
+
+    STOP_COUNTER return 0;
+}
+
+void runParseWorkers(ParseWorker *workers, size_t workerCount, ThreadProc proc) {
+    for (size_t workerIndex = 0; workerIndex < workerCount; workerIndex++) {
+        if (!osCreateThread(&workers[workerIndex].thread, proc, &workers[workerIndex])) {
+            die(__FILE__, __LINE__, 0, "could not create worker thread: %s", osErrorMessage());
+        }
+    }
+
+    for (size_t workerIndex = 0; workerIndex < workerCount; workerIndex++) {
+        if (!osJoinThread(&workers[workerIndex].thread)) {
+            die(__FILE__, __LINE__, 0, "could not join worker thread: %s", osErrorMessage());
+        }
+    }
+}
+
+// Splits the pairs array at commas between pair objects and parses the slices on threadCount threads. Each thread
+// counts the pairs of its slice first, so it can then write them straight to their final place in the shared
+// coordinate arrays and the slices need no copying to be joined. If every slice is a run of fast pairs, their
+// concatenation is too, which is what makes the splits safe. Otherwise the document goes through parsePairs.
+Pairs parsePairsParallel(Parser *parser, size_t threadCount) {
+    MEASURE_FUNCTION_THROUGHPUT(parser->text.size);
+
+    if (threadCount == 0 || threadCount > MAX_WORKERS) {
+        die(__FILE__, __LINE__, 0, "thread count must be between 1 and %d", MAX_WORKERS);
+    }
+
+    Parser start = *parser;
+    size_t arenaOffset = parser->arena->currentOffset;
+
+    if (!skipPairsArrayStart(parser)) {
+        Pairs result = parsePairs(parser);
+
+        STOP_COUNTER return result;
+    }
+
+    String text = parser->text;
+    ParseWorker *workers = arenaAllocate(parser->arena, threadCount * sizeof(ParseWorker));
+
+    {
+        TIME_BLOCK("findSplits");
+
+        size_t sliceStart = parser->offset;
+
+        for (size_t workerIndex = 0; workerIndex < threadCount; workerIndex++) {
+            ParseWorker *worker = &workers[workerIndex];
+
+            size_t target = parser->offset + (text.size - parser->offset) * (workerIndex + 1) / threadCount;
+            size_t split = workerIndex + 1 == threadCount ? text.size : findPairSplit(text, target > sliceStart ? target : sliceStart);
+
+            memset(worker, 0, sizeof(*worker));
+            worker->start = sliceStart;
+            worker->end = split;
+            worker->isLast = split == text.size;
+            worker->arena = arenaSubArena(parser->arena, PARSE_WORKER_ARENA_SIZE);
+            worker->parser = *parser;
+            worker->parser.arena = &worker->arena;
+            worker->parser.text.size = split;
+            worker->parser.offset = sliceStart;
+
+            sliceStart = split < text.size ? split + 1 : text.size;
+        }
+
+        STOP_COUNTER;
+    }
+
+    {
+        TIME_BLOCK("countPairs");
+        runParseWorkers(workers, threadCount, countPairStarts);
+        STOP_COUNTER;
+    }
+
+    size_t capacity = 0;
+
+    for (size_t workerIndex = 0; workerIndex < threadCount; workerIndex++) {
+        capacity += workers[workerIndex].count;
+    }
+
+    Pairs result = initPairs(parser->arena, capacity);
+
+    for (size_t workerIndex = 0, first = 0; workerIndex < threadCount; workerIndex++) {
+        ParseWorker *worker = &workers[workerIndex];
+
+        worker->pairs.x1 = result.x1 + first;
+        worker->pairs.y1 = result.y1 + first;
+        worker->pairs.x2 = result.x2 + first;
+        worker->pairs.y2 = result.y2 + first;
+        worker->pairs.capacity = worker->count;
+
+        first += worker->count;
+    }
+
+    {
+        TIME_BLOCK("parseSlices");
+        runParseWorkers(workers, threadCount, parseSlice);
+        STOP_COUNTER;
+    }
+
+    ParseWorker *last = NULL;
+
+    for (size_t workerIndex = 0; workerIndex < threadCount; workerIndex++) {
+        ParseWorker *worker = &workers[workerIndex];
+
+        if (worker->failed) {
+            *parser = start;
+            parser->arena->currentOffset = arenaOffset;
+
+            result = parsePairs(parser);
+
+            STOP_COUNTER return result;
+        }
+
+        if (worker->start != worker->end) {
+            last = worker;
+        }
+
+        result.count += worker->pairs.count;
+    }
+
+    assert(last != NULL && last->isLast);
+
+    parser->offset = last->parser.offset;
+    expectPairsArrayEnd(parser);
+
+    STOP_COUNTER return result;
+}
+
+#endif
@@ -5,7 +5,10 @@
 #include "common.c"
 #include "stdbool.h"
 #include "stdint.h"
+#include "limits.h"
 #include "profiler.c"
+#include "structural.c"
+#include "number.c"
 
 #define DOUBLE_QUOTES '"'
 
@@ -53,12 +56,12 @@ const String trueLiteral = {TRUE_LITERAL, sizeof(TRUE_LITERAL) - 1};
 
 const String falseLiteral = {FALSE_LITERAL, sizeof(FALSE_LITERAL) - 1};
 
+// When structurals.bits is set the parser jumps over whitespace and string contents using the index
 typedef struct {
     String text;
     size_t offset;
-    size_t line;
-    size_t column;
     Arena *arena;
+    StructuralIndex structurals;
 } Parser;
 
 typedef enum {
@@ -112,19 +115,19 @@ Members *initMembers(Arena *arena);
 
 bool isCharacter(Parser *parser, char character);
 
-void addMember(Members *members, Member member);
+void addMember(Arena *arena, Members *members, Member member);
 
 void printValue(Value *value, size_t indentation, size_t indentationLevel);
 
 void expectCharacter(Parser *parser, char character);
 
-void addElement(Elements *elements, Value *element);
+void addElement(Arena *arena, Elements *elements, Value *element);
 
 void printSpace();
 
 bool isHexDigit(Parser *parser);
 
-Elements *initElements(Arena *arena, size_t maxPairs);
+Elements *initElements(Arena *arena);
 
 void skipChars(Parser *parser, size_t count);
 
@@ -146,13 +149,16 @@ uint32_t codePointFromSurrogatePair(uint16_t highSurrogate, uint16_t lowSurrogat
     return result;
 }
 
+bool isWhitespaceCharacter(uint8_t byte) {
+    return byte == 0x20 || byte == 0x0a || byte == 0x0d || byte == 0x09;
+}
+
 bool isWhitespace(Parser *parser) {
     if (!hasNext(parser)) {
         return false;
     }
 
-    uint8_t byte = parser->text.data.unsignedData[parser->offset];
-    return byte == 0x20 || byte == 0x0a || byte == 0x0d || byte == 0x09;
+    return isWhitespaceCharacter(parser->text.data.unsignedData[parser->offset]);
 }
 
 bool isLiteral(Parser *parser, String literal) {
@@ -187,9 +193,20 @@ bool hasNext(Parser *parser) {
     return parser->offset < parser->text.size;
 }
 
-void nextLine(Parser *parser) {
-    parser->line++;
-    parser->column = 0;
+// Only needed for error messages, so it is worked out from the offset instead of being tracked on every byte
+void getLineAndColumn(Parser *parser, size_t *line, size_t *column) {
+    *line = 1;
+    *column = 1;
+
+    for (size_t byteIndex = 0; byteIndex < parser->offset && byteIndex < parser->text.size; byteIndex++) {
+        if (parser->text.data.signedData[byteIndex] == '\n') {
+            (*line)++;
+            *column = 1;
+        }
+        else {
+            (*column)++;
+        }
+    }
 }
 
 uint32_t decodeUtf8Unchecked(String codepoint) {
@@ -235,15 +252,6 @@ char next(Parser *parser) {
     assert(hasNext(parser));
     char result = (parser->text.data.signedData + parser->offset)[0];
 
-    bool isNewLine = result == '\n';
-
-    if (isNewLine) {
-        nextLine(parser);
-    }
-    else {
-        parser->column++;
-    }
-
     parser->offset++;
 
     return result;
@@ -262,10 +270,16 @@ uint8_t peekBytePlusN(Parser *parser, size_t n) {
 }
 
 void skipWhitespace(Parser *parser) {
-    char byte = peekByte(parser);
+    // The first byte after whitespace is always structural, so the jump lands where the loop below would
+    if (parser->structurals.bits && isWhitespace(parser)) {
+        size_t end = findNextStructural(parser->structurals, parser->offset);
+
+        parser->offset = end < parser->text.size ? end : parser->text.size;
+        return;
+    }
+
     while (isWhitespace(parser)) {
         next(parser);
-        byte = peekByte(parser);
     }
 }
 
@@ -296,6 +310,18 @@ String parseString(Parser *parser) {
 
     result.data.unsignedData = parser->text.data.unsignedData + parser->offset;
 
+    // Nothing inside a string is structural, so the next position is the closing quote
+    if (parser->structurals.bits) {
+        size_t end = findNextStructural(parser->structurals, parser->offset);
+
+        assert(end < parser->text.size);
+
+        result.size = end - parser->offset;
+        parser->offset = end + 1;
+
+        STOP_COUNTER return result;
+    }
+
     while (!isDoubleQuotes(parser)) {
         next(parser);
 
@@ -379,6 +405,18 @@ bool isCharacter(Parser *parser, char character) {
     return byte == character;
 }
 
+void expectCharacter(Parser *parser, char character) {
+    if (!isCharacter(parser, character)) {
+        size_t line = 0;
+        size_t column = 0;
+        getLineAndColumn(parser, &line, &column);
+
+        die(__FILE__, __LINE__, 0, "expected '%c' at line %zu, column %zu", character, line, column);
+    }
+
+    next(parser);
+}
+
 size_t countDigits(Parser *parser) {
     size_t result = 0;
     while (isDigit(parser)) {
@@ -415,48 +453,17 @@ double parseNumberWithStrtod(Parser *parser) {
     return result;
 }
 
-double parseDigit(Parser *parser) {
-    char digit = next(parser);
-
-    double result = (double) (digit - '0');
-
-    return result;
-}
-
-double parseNumberByHand(Parser *parser) {
-    // TIME_FUNCTION
-    bool isNegative = false;
-
-    if (isMinusSign(parser)) {
-        isNegative = true;
-        next(parser);
-    }
-
-    double integerValue = parseDigit(parser);
-
-    while (!isDot(parser)) {
-        integerValue *= 10.0;
-        double digitValue = parseDigit(parser);
-        integerValue += digitValue;
-    }
-
-    next(parser);
-
-    double multiplier = 0.1;
-    double fractionValue = 0.0;
-    while (isDigit(parser)) {
-        double digitValue = parseDigit(parser);
-        fractionValue += digitValue * multiplier;
-        multiplier /= 10.0;
-    }
+double parseNumberExact(Parser *parser) {
+    double result = 0;
 
-    double result = integerValue + fractionValue;
+    if (!parseNumberText(parser->text, &parser->offset, &result)) {
+        size_t line = 0;
+        size_t column = 0;
+        getLineAndColumn(parser, &line, &column);
 
-    if (isNegative) {
-        result = -result;
+        die(__FILE__, __LINE__, 0, "invalid number at line %zu, column %zu", line, column);
     }
 
-    // STOP_COUNTER;
     return result;
 }
 
@@ -469,7 +476,7 @@ double parseNumber(Parser *parser) {
 #if 0
     double result = parseNumberWithStrtod(parser);
 #else
-    double result = parseNumberByHand(parser);
+    double result = parseNumberExact(parser);
 #endif
     return result;
 }
@@ -502,13 +509,13 @@ Members *parseObject(Parser *parser) {
 
     if (!isRightBrace(parser)) {
         Member member = parseMember(parser);
-        addMember(result, member);
+        addMember(parser->arena, result, member);
     }
 
     while (!isRightBrace(parser)) {
         next(parser);
         Member member = parseMember(parser);
-        addMember(result, member);
+        addMember(parser->arena, result, member);
     }
 
     next(parser);
@@ -521,21 +528,17 @@ Elements *parseArray(Parser *parser) {
     assert(isLeftBracket(parser));
     next(parser);
 
-    const size_t pairMaxSize = 14 * 4;
-
-    size_t maxPairs = parser->text.size / pairMaxSize;
-
-    Elements *result = initElements(parser->arena, maxPairs);
+    Elements *result = initElements(parser->arena);
 
     if (!isRightBracket(parser)) {
         Value *element = parseElement(parser);
-        addElement(result, element);
+        addElement(parser->arena, result, element);
     }
 
     while (!isRightBracket(parser)) {
         next(parser);
         Value *element = parseElement(parser);
-        addElement(result, element);
+        addElement(parser->arena, result, element);
     }
 
     next(parser);
@@ -662,10 +665,10 @@ Members *initMembers(Arena *arena) {
     return result;
 }
 
-Elements *initElements(Arena *arena, size_t maxPairs) {
+Elements *initElements(Arena *arena) {
     Elements *result = arenaAllocate(arena, sizeof(Elements));
 
-    result->capacity = maxPairs;
+    result->capacity = MEMBERS_CAPACITY;
 
     result->elements = arenaAllocate(arena, result->capacity *sizeof(*result->elements));
 
@@ -726,19 +729,37 @@ bool hasKey(Members *members, String key) {
     return getMemberValueOfMembers(members, key) != NULL;
 }
 
-void addMember(Members *members, Member member) {
+// Most objects are pairs, so members start with room for 4 and double into a new block when that runs out.
+// The old block stays in the arena, which is not worth reclaiming for the objects we read.
+void addMember(Arena *arena, Members *members, Member member) {
     assert(members != NULL);
 
-    assert(members->count < members->capacity);
+    if (members->count == members->capacity) {
+        Member *grown = arenaAllocate(arena, 2 * members->capacity * sizeof(Member));
+
+        memcpy(grown, members->members, members->count * sizeof(Member));
+
+        members->members = grown;
+        members->capacity *= 2;
+    }
 
     members->members[members->count] = member;
     members->count++;
 }
 
-void addElement(Elements *elements, Value *element) {
+// Arrays start as small as objects and double the same way. The blocks they leave behind add up to less than the
+// final one, so even the pairs array takes at most twice its size in the arena.
+void addElement(Arena *arena, Elements *elements, Value *element) {
     assert(elements != NULL);
 
-    assert(elements->count < elements->capacity);
+    if (elements->count == elements->capacity) {
+        Value **grown = arenaAllocate(arena, 2 * elements->capacity * sizeof(*grown));
+
+        memcpy(grown, elements->elements, elements->count * sizeof(*grown));
+
+        elements->elements = grown;
+        elements->capacity *= 2;
+    }
 
     elements->elements[elements->count] = element;
     elements->count++;
@@ -0,0 +1,1464 @@
+#ifndef PLATFORM_C
+
+#define PLATFORM_C
+
+#include "stdio.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "stdlib.h"
+#include "string.h"
+#include "limits.h"
+
+#ifdef _WIN32
+
+#pragma warning(push, 0)
+
+#include "windows.h"
+#include "psapi.h"
+
+#pragma warning(pop)
+
+#include "intrin.h"
+
+typedef HANDLE Process;
+
+typedef HANDLE File;
+
+#define INVALID_FILE INVALID_HANDLE_VALUE
+
+#define ASM_CALL
+
+typedef HANDLE Thread;
+
+typedef HANDLE Semaphore;
+
+typedef LPTHREAD_START_ROUTINE ThreadProc;
+
+#define THREAD_PROC(NAME) DWORD WINAPI NAME(void *parameter)
+
+#define THREAD_LOCAL __declspec(thread)
+
+// MSVC compiles any intrinsic without per-function target flags
+#define TARGET(FEATURES)
+
+// MSVC does not warn about unused statics
+#define MAYBE_UNUSED
+
+#define OS_NAME "windows"
+
+#else
+
+#include "errno.h"
+#include "fcntl.h"
+#include "pthread.h"
+#include "sched.h"
+#include "semaphore.h"
+#include "time.h"
+#include "unistd.h"
+#include "linux/perf_event.h"
+#include "sys/ioctl.h"
+#include "sys/mman.h"
+#include "sys/resource.h"
+#include "sys/syscall.h"
+#include "sys/stat.h"
+#include "cpuid.h"
+#include "x86intrin.h"
+
+typedef pid_t Process;
+
+typedef int File;
+
+#define INVALID_FILE (-1)
+
+typedef pthread_t Thread;
+
+typedef sem_t Semaphore;
+
+typedef void *(*ThreadProc)(void *parameter);
+
+#define THREAD_PROC(NAME) void *NAME(void *parameter)
+
+#define THREAD_LOCAL _Thread_local
+
+// Lets one translation unit hold kernels for several instruction sets, dispatched at runtime
+#define TARGET(FEATURES) __attribute__((target(FEATURES)))
+
+// For globals that only some of the programs including the file use
+#define MAYBE_UNUSED __attribute__((unused))
+
+#define OS_NAME "linux"
+
+// The kernels in asm.asm follow the Windows x64 calling convention
+#define ASM_CALL __attribute__((ms_abi))
+
+#ifndef ARRAYSIZE
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#endif
+
+typedef struct {
+    bool sse42;
+    bool fma;
+    bool avx2;
+    bool avx512;
+} CpuFeatures;
+
+typedef enum {
+    PerfEvent_Instructions,
+    PerfEvent_Cycles,
+    PerfEvent_L1dMisses,
+    PerfEvent_LlcMisses,
+    PerfEvent_BranchMisses,
+    PerfEvent_DtlbMisses,
+    PerfEvent_Count
+} PerfEvent;
+
+const char *PerfEventNames[PerfEvent_Count] = {"instructions", "cycles", "l1dMisses", "llcMisses", "branchMisses", "dtlbMisses"};
+
+// Hardware counters of the calling thread, read as one group so all values cover the same interval.
+// Events the cpu or the hypervisor does not expose are left out and read as 0.
+typedef struct {
+    int groupFd;
+    int fds[PerfEvent_Count];
+    bool isAvailable[PerfEvent_Count];
+    size_t groupIndex[PerfEvent_Count];
+    size_t groupSize;
+} PerfCounters;
+
+// Resident bytes are the working set on Windows, which does not split the faults into minor and major either
+typedef struct {
+    uint64_t minorFaults;
+    uint64_t majorFaults;
+    uint64_t residentBytes;
+} MemoryCounters;
+
+// Opened once, so reading the counters around a sample does not allocate
+typedef struct {
+    Process process;
+#ifndef _WIN32
+    int statmFd;
+#endif
+} MemoryCountersSource;
+
+// Unhalted core and reference cycles of the calling thread. Their ratio is the one APERF/MPERF give, the actual clock
+// over the nominal one, without the msr access those need.
+typedef struct {
+    int groupFd;
+    int referenceFd;
+} FrequencyCounters;
+
+// The cpufreq clock of the processor the thread last sampled on, kept open so a sample reads it with one pread
+typedef struct {
+    int fd;
+    uint32_t processor;
+} ProcessorFrequency;
+
+typedef enum {
+    RdtscSource_Cpuid,
+    RdtscSource_Hypervisor,
+    RdtscSource_Kernel,
+    RdtscSource_CpuidBase,
+    RdtscSource_Calibration,
+    RdtscSource_Count
+} RdtscSource;
+
+const char *RdtscSourceNames[RdtscSource_Count] = {"cpuid", "hypervisor", "kernel", "cpuid base", "calibration"};
+
+// The error is in ticks per second, either the resolution of the source or the spread of the calibration samples
+typedef struct {
+    uint64_t frequency;
+    uint64_t error;
+    RdtscSource source;
+} RdtscFrequency;
+
+typedef enum {
+    MapHint_None = 0,
+    MapHint_Sequential = 1 << 0,
+    MapHint_HugePages = 1 << 1
+} MapHint;
+
+typedef struct {
+    void *memory;
+    size_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+} FileMapping;
+
+size_t roundUpToPageSize(size_t size, uint64_t pageSize) {
+    if (pageSize != 0) {
+        size_t remainder = size % pageSize;
+
+        if (remainder != 0) {
+            size += (pageSize - remainder);
+        }
+    }
+
+    return size;
+}
+
+#ifdef _WIN32
+
+uint32_t countTrailingZeros(uint64_t value) {
+    unsigned long result = 0;
+
+    _BitScanForward64(&result, value);
+
+    return (uint32_t) result;
+}
+
+uint32_t countLeadingZeros(uint64_t value) {
+    unsigned long result = 0;
+
+    _BitScanReverse64(&result, value);
+
+    return 63 - (uint32_t) result;
+}
+
+// Returns the incremented value
+uint32_t atomicIncrement(volatile uint32_t *value) {
+    return (uint32_t) InterlockedIncrement((volatile LONG *) value);
+}
+
+// Returns the low half of the 128-bit product
+uint64_t multiply64(uint64_t left, uint64_t right, uint64_t *high) {
+    return _umul128(left, right, high);
+}
+
+void osCpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4]) {
+    __cpuidex((int *) registers, (int) leaf, (int) subleaf);
+}
+
+// Besides the cpuid bits, the OS must have enabled saving the ymm and zmm registers
+CpuFeatures getCpuFeatures() {
+    CpuFeatures result = {0};
+
+    int registers[4] = {0};
+
+    __cpuid(registers, 1);
+
+    bool hasXsave = (registers[2] & (1 << 27)) != 0;
+
+    result.sse42 = (registers[2] & (1 << 20)) != 0;
+    result.fma = (registers[2] & (1 << 12)) != 0;
+
+    if (hasXsave) {
+        uint64_t enabledState = _xgetbv(0);
+
+        __cpuidex(registers, 7, 0);
+
+        result.avx2 = (registers[1] & (1 << 5)) != 0 && (enabledState & 0x6) == 0x6;
+        result.avx512 = (registers[1] & (1 << 16)) != 0 && (registers[1] & (1 << 30)) != 0 && (enabledState & 0xe6) == 0xe6;
+    }
+
+    return result;
+}
+
+Process getCurrentProcess() {
+    return GetCurrentProcess();
+}
+
+char *osErrorMessage() {
+    char *result = NULL;
+
+    DWORD error = GetLastError();
+    FormatMessage(
+        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+        NULL,
+        error,
+        MAKELANGID(LANG_ENGLISH, SUBLANG_DEFAULT),
+        (LPTSTR) &result,
+        0,
+        NULL
+    );
+
+    return result;
+}
+
+uint64_t getOsTimeFrequency() {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    return frequency.QuadPart;
+}
+
+uint64_t getOsTimeStamp() {
+    LARGE_INTEGER timestamp;
+
+    QueryPerformanceCounter(&timestamp);
+
+    return timestamp.QuadPart;
+}
+
+bool getOsPageFaultCount(Process process, uint64_t *pageFaults) {
+    PROCESS_MEMORY_COUNTERS memoryCounters = {0};
+
+    bool result = GetProcessMemoryInfo(process, &memoryCounters, sizeof(memoryCounters));
+
+    *pageFaults = memoryCounters.PageFaultCount;
+
+    return result;
+}
+
+bool osOpenMemoryCounters(MemoryCountersSource *source, Process process) {
+    source->process = process;
+
+    return true;
+}
+
+bool getOsMemoryCounters(MemoryCountersSource *source, MemoryCounters *counters) {
+    PROCESS_MEMORY_COUNTERS memoryCounters = {0};
+
+    bool result = GetProcessMemoryInfo(source->process, &memoryCounters, sizeof(memoryCounters));
+
+    counters->minorFaults = memoryCounters.PageFaultCount;
+    counters->majorFaults = 0;
+    counters->residentBytes = memoryCounters.WorkingSetSize;
+
+    return result;
+}
+
+// QueryWorkingSetEx could answer this a page at a time, which is too slow for the buffers the tests use
+bool osGetResidentBytes(void *memory, size_t size, uint64_t *residentBytes) {
+    (void) memory;
+    (void) size;
+    *residentBytes = 0;
+
+    return false;
+}
+
+void *osAllocate(size_t size, uint64_t largePageSize) {
+    DWORD flags = MEM_RESERVE | MEM_COMMIT;
+
+    if (largePageSize != 0) {
+        size = roundUpToPageSize(size, largePageSize);
+        flags |= MEM_LARGE_PAGES;
+    }
+
+    return VirtualAlloc(0, size, flags, PAGE_READWRITE);
+}
+
+void osFree(void *memory, size_t size, uint64_t largePageSize) {
+    (void) size;
+    (void) largePageSize;
+
+    VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+uint64_t enableLargePages() {
+    HANDLE token = INVALID_HANDLE_VALUE;
+
+    uint64_t result = 0;
+
+    if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token)) {
+        TOKEN_PRIVILEGES privileges = {
+            .PrivilegeCount = 1,
+            .Privileges = {{.Attributes = SE_PRIVILEGE_ENABLED}}
+        };
+
+        if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0] .Luid)) {
+            AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL);
+
+            DWORD error = GetLastError();
+            if (error == ERROR_SUCCESS) {
+                result = GetLargePageMinimum();
+            }
+            else {
+                printf("Could not adjust privileges, error = %d\n", error);
+            }
+        }
+        else {
+            printf("Could not lookup privileges\n");
+        }
+    }
+
+    else {
+        printf("Could not open process token\n");
+    }
+
+    return result;
+}
+
+File osOpenFile(char *path) {
+    return CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+}
+
+bool osGetFileSize(File file, uint64_t *size) {
+    LARGE_INTEGER result = {0};
+
+    bool ok = GetFileSizeEx(file, &result);
+
+    *size = result.QuadPart;
+
+    return ok;
+}
+
+bool osReadFile(File file, void *buffer, size_t size, uint64_t offset, size_t *bytesRead) {
+    DWORD bytesToRead = size <= MAXDWORD ? (DWORD) size : MAXDWORD;
+
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD) offset;
+    overlapped.OffsetHigh = (DWORD) (offset >> 32);
+
+    DWORD read = 0;
+
+    bool result = ReadFile(file, buffer, bytesToRead, &read, &overlapped);
+
+    // Positioned reads report end of file as an error, plain reads as zero bytes
+    if (!result && GetLastError() == ERROR_HANDLE_EOF) {
+        result = true;
+    }
+
+    *bytesRead = read;
+
+    return result;
+}
+
+bool osCloseFile(File file) {
+    return CloseHandle(file);
+}
+
+// Hints have no equivalent for views of files on Windows and are ignored
+bool osMapFile(File file, size_t size, uint32_t hints, FileMapping *mapping) {
+    (void) hints;
+
+    memset(mapping, 0, sizeof(*mapping));
+
+    mapping->mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+
+    if (!mapping->mapping) {
+        return false;
+    }
+
+    mapping->memory = MapViewOfFile(mapping->mapping, FILE_MAP_READ, 0, 0, size);
+
+    if (!mapping->memory) {
+        CloseHandle(mapping->mapping);
+        mapping->mapping = 0;
+        return false;
+    }
+
+    mapping->size = size;
+
+    return true;
+}
+
+void osUnmapFile(FileMapping *mapping) {
+    if (mapping->memory) {
+        UnmapViewOfFile(mapping->memory);
+    }
+
+    if (mapping->mapping) {
+        CloseHandle(mapping->mapping);
+    }
+
+    memset(mapping, 0, sizeof(*mapping));
+}
+
+void osSleep(uint32_t milliseconds) {
+    Sleep(milliseconds);
+}
+
+uint32_t osGetProcessorCount() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return (uint32_t) info.dwNumberOfProcessors;
+}
+
+bool osCreateThread(Thread *thread, ThreadProc proc, void *parameter) {
+    *thread = CreateThread(0, 0, proc, parameter, 0, 0);
+
+    return *thread != 0;
+}
+
+bool osJoinThread(Thread *thread) {
+    bool result = WaitForSingleObject(*thread, INFINITE) == WAIT_OBJECT_0;
+
+    CloseHandle(*thread);
+
+    return result;
+}
+
+bool osCreateSemaphore(Semaphore *semaphore, uint32_t initialCount) {
+    *semaphore = CreateSemaphore(0, (LONG) initialCount, LONG_MAX, 0);
+
+    return *semaphore != 0;
+}
+
+void osWaitSemaphore(Semaphore *semaphore) {
+    WaitForSingleObject(*semaphore, INFINITE);
+}
+
+void osSignalSemaphore(Semaphore *semaphore) {
+    ReleaseSemaphore(*semaphore, 1, 0);
+}
+
+void osDestroySemaphore(Semaphore *semaphore) {
+    CloseHandle(*semaphore);
+}
+
+// Windows only exposes hardware counters through ETW, which needs elevation and cannot be read per block
+bool osOpenPerfCounters(PerfCounters *counters) {
+    memset(counters, 0, sizeof(*counters));
+
+    return false;
+}
+
+bool osReadPerfCounters(PerfCounters *counters, uint64_t values[PerfEvent_Count]) {
+    (void) counters;
+    memset(values, 0, PerfEvent_Count * sizeof(uint64_t));
+
+    return false;
+}
+
+// Windows does not publish the tsc frequency it measured at boot
+bool osGetKernelTscFrequency(RdtscFrequency *frequency) {
+    (void) frequency;
+
+    return false;
+}
+
+bool osPinToProcessor(uint32_t processor) {
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << processor) != 0;
+}
+
+uint32_t osGetCurrentProcessor() {
+    return (uint32_t) GetCurrentProcessorNumber();
+}
+
+bool osRaisePriority() {
+    return SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS) && SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+}
+
+// Like the other hardware counters, the cycle counters are not readable from user space on Windows
+bool osOpenFrequencyCounters(FrequencyCounters *counters) {
+    memset(counters, 0, sizeof(*counters));
+
+    return false;
+}
+
+bool osReadFrequencyCounters(FrequencyCounters *counters, uint64_t *cycles, uint64_t *referenceCycles) {
+    (void) counters;
+    *cycles = 0;
+    *referenceCycles = 0;
+
+    return false;
+}
+
+// CallNtPowerInformation reports the nominal clock rather than the current one on most cpus
+bool osGetProcessorFrequency(uint32_t processor, uint64_t *frequency) {
+    (void) processor;
+    *frequency = 0;
+
+    return false;
+}
+
+bool osOpenProcessorFrequency(ProcessorFrequency *file, uint32_t processor) {
+    file->fd = -1;
+    file->processor = processor;
+
+    return false;
+}
+
+bool osReadProcessorFrequency(ProcessorFrequency *file, uint32_t processor, uint64_t *frequency) {
+    (void) file;
+    (void) processor;
+    *frequency = 0;
+
+    return false;
+}
+
+// Windows only reports the busy time of all processors together, per processor times need NtQuerySystemInformation
+bool osGetProcessorTimes(uint32_t processor, uint64_t *busy, uint64_t *total) {
+    (void) processor;
+    *busy = 0;
+    *total = 0;
+
+    return false;
+}
+
+size_t osGetSiblingProcessors(uint32_t processor, uint32_t *siblings, size_t capacity) {
+    (void) processor;
+    (void) siblings;
+    (void) capacity;
+
+    return 0;
+}
+
+#else
+
+uint32_t countTrailingZeros(uint64_t value) {
+    return (uint32_t) __builtin_ctzll(value);
+}
+
+uint32_t countLeadingZeros(uint64_t value) {
+    return (uint32_t) __builtin_clzll(value);
+}
+
+uint32_t atomicIncrement(volatile uint32_t *value) {
+    return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+uint64_t multiply64(uint64_t left, uint64_t right, uint64_t *high) {
+    unsigned __int128 product = (unsigned __int128) left * right;
+
+    *high = (uint64_t) (product >> 64);
+
+    return (uint64_t) product;
+}
+
+void osCpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4]) {
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+}
+
+// The gcc runtime also checks that the OS saves the ymm and zmm registers
+CpuFeatures getCpuFeatures() {
+    CpuFeatures result = {0};
+
+    __builtin_cpu_init();
+
+    result.sse42 = __builtin_cpu_supports("sse4.2");
+    result.fma = __builtin_cpu_supports("fma");
+    result.avx2 = __builtin_cpu_supports("avx2");
+    result.avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+
+    return result;
+}
+
+Process getCurrentProcess() {
+    return getpid();
+}
+
+char *osErrorMessage() {
+    return strerror(errno);
+}
+
+uint64_t getOsTimeFrequency() {
+    return 1000000000ull;
+}
+
+uint64_t getOsTimeStamp() {
+    struct timespec timestamp = {0};
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &timestamp);
+
+    return (uint64_t) timestamp.tv_sec * 1000000000ull + (uint64_t) timestamp.tv_nsec;
+}
+
+bool getOsPageFaultCount(Process process, uint64_t *pageFaults) {
+    // getrusage can only query the calling process
+    (void) process;
+
+    struct rusage usage = {0};
+
+    bool result = getrusage(RUSAGE_SELF, &usage) == 0;
+
+    *pageFaults = (uint64_t) usage.ru_minflt + (uint64_t) usage.ru_majflt;
+
+    return result;
+}
+
+// getrusage and statm can only describe the calling process
+bool osOpenMemoryCounters(MemoryCountersSource *source, Process process) {
+    source->process = process;
+    source->statmFd = open("/proc/self/statm", O_RDONLY);
+
+    return source->statmFd >= 0;
+}
+
+// getrusage only has the peak resident size, the current one comes from statm. It is read with pread rather than
+// stdio, which would allocate a FILE for every sample.
+bool getOsMemoryCounters(MemoryCountersSource *source, MemoryCounters *counters) {
+    struct rusage usage = {0};
+
+    bool result = getrusage(RUSAGE_SELF, &usage) == 0;
+
+    counters->minorFaults = (uint64_t) usage.ru_minflt;
+    counters->majorFaults = (uint64_t) usage.ru_majflt;
+    counters->residentBytes = 0;
+
+    // The total size comes first, then the resident size, both in pages
+    char text[128];
+    ssize_t size = pread(source->statmFd, text, sizeof(text) - 1, 0);
+
+    if (size <= 0) {
+        return false;
+    }
+
+    text[size] = 0;
+
+    char *totalEnd = NULL;
+    char *residentEnd = NULL;
+    strtoull(text, &totalEnd, 10);
+    unsigned long long residentPages = strtoull(totalEnd, &residentEnd, 10);
+
+    if (residentEnd == totalEnd) {
+        return false;
+    }
+
+    counters->residentBytes = residentPages * (uint64_t) sysconf(_SC_PAGESIZE);
+
+    return result;
+}
+
+#define RESIDENCY_CHUNK_PAGES 4096
+
+// mincore reports whole small pages, so the range is widened to page boundaries. A huge page counts as all of its
+// small pages being resident.
+bool osGetResidentBytes(void *memory, size_t size, uint64_t *residentBytes) {
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) memory & ~(uintptr_t) (pageSize - 1);
+    uintptr_t end = roundUpToPageSize((uintptr_t) memory + size, pageSize);
+
+    unsigned char residency[RESIDENCY_CHUNK_PAGES];
+
+    *residentBytes = 0;
+
+    for (uintptr_t chunk = start; chunk < end; chunk += RESIDENCY_CHUNK_PAGES * pageSize) {
+        size_t chunkSize = end - chunk < RESIDENCY_CHUNK_PAGES * pageSize ? end - chunk : RESIDENCY_CHUNK_PAGES * pageSize;
+
+        if (mincore((void *) chunk, chunkSize, residency) != 0) {
+            return false;
+        }
+
+        for (size_t pageIndex = 0; pageIndex < chunkSize / pageSize; pageIndex++) {
+            *residentBytes += (residency[pageIndex] & 1) * pageSize;
+        }
+    }
+
+    return true;
+}
+
+void *osAllocate(size_t size, uint64_t largePageSize) {
+    int protection = PROT_READ | PROT_WRITE;
+    // Reserve the whole range up front and let pages be backed on first touch
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+    void *result = MAP_FAILED;
+
+    if (largePageSize != 0) {
+        size = roundUpToPageSize(size, largePageSize);
+
+        // Without MAP_NORESERVE an empty hugetlb pool fails here instead of faulting with SIGBUS later. Like
+        // VirtualAlloc with MEM_LARGE_PAGES there is no fallback, callers that want transparent huge pages use backing.c.
+        result = mmap(0, size, protection, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    else {
+        result = mmap(0, size, protection, flags, -1, 0);
+    }
+
+    return result == MAP_FAILED ? NULL : result;
+}
+
+void osFree(void *memory, size_t size, uint64_t largePageSize) {
+    munmap(memory, roundUpToPageSize(size, largePageSize));
+}
+
+uint64_t enableLargePages() {
+    uint64_t result = 0;
+
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+
+    if (meminfo) {
+        char line[256];
+
+        while (fgets(line, sizeof(line), meminfo)) {
+            unsigned long long kb = 0;
+
+            if (sscanf(line, "Hugepagesize: %llu kB", &kb) == 1) {
+                result = kb * 1024;
+                break;
+            }
+        }
+
+        fclose(meminfo);
+    }
+    else {
+        printf("Could not open /proc/meminfo\n");
+    }
+
+    return result;
+}
+
+File osOpenFile(char *path) {
+    return open(path, O_RDONLY);
+}
+
+bool osGetFileSize(File file, uint64_t *size) {
+    struct stat fileStat = {0};
+
+    bool result = fstat(file, &fileStat) == 0;
+
+    *size = (uint64_t) fileStat.st_size;
+
+    return result;
+}
+
+bool osReadFile(File file, void *buffer, size_t size, uint64_t offset, size_t *bytesRead) {
+    ssize_t result = pread(file, buffer, size, (off_t) offset);
+
+    *bytesRead = result > 0 ? (size_t) result : 0;
+
+    return result >= 0;
+}
+
+bool osCloseFile(File file) {
+    return close(file) == 0;
+}
+
+bool osMapFile(File file, size_t size, uint32_t hints, FileMapping *mapping) {
+    memset(mapping, 0, sizeof(*mapping));
+
+    void *memory = mmap(0, size, PROT_READ, MAP_PRIVATE, file, 0);
+
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+
+    if (hints & MapHint_Sequential) {
+        madvise(memory, size, MADV_SEQUENTIAL);
+    }
+
+    if (hints & MapHint_HugePages) {
+        // Only honoured for file systems with huge page support, a failure still leaves a usable mapping
+        madvise(memory, size, MADV_HUGEPAGE);
+    }
+
+    mapping->memory = memory;
+    mapping->size = size;
+
+    return true;
+}
+
+void osUnmapFile(FileMapping *mapping) {
+    if (mapping->memory) {
+        munmap(mapping->memory, mapping->size);
+    }
+
+    memset(mapping, 0, sizeof(*mapping));
+}
+
+void osSleep(uint32_t milliseconds) {
+    struct timespec duration = {
+        .tv_sec = milliseconds / 1000,
+        .tv_nsec = (long) (milliseconds % 1000) * 1000000l
+    };
+
+    nanosleep(&duration, NULL);
+}
+
+uint32_t osGetProcessorCount() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (uint32_t) count : 1;
+}
+
+bool osCreateThread(Thread *thread, ThreadProc proc, void *parameter) {
+    return pthread_create(thread, NULL, proc, parameter) == 0;
+}
+
+bool osJoinThread(Thread *thread) {
+    return pthread_join(*thread, NULL) == 0;
+}
+
+bool osCreateSemaphore(Semaphore *semaphore, uint32_t initialCount) {
+    return sem_init(semaphore, 0, initialCount) == 0;
+}
+
+void osWaitSemaphore(Semaphore *semaphore) {
+    // Retry waits cut short by signal handlers
+    while (sem_wait(semaphore) != 0 && errno == EINTR) {
+    }
+}
+
+void osSignalSemaphore(Semaphore *semaphore) {
+    sem_post(semaphore);
+}
+
+void osDestroySemaphore(Semaphore *semaphore) {
+    sem_destroy(semaphore);
+}
+
+struct perf_event_attr getPerfEventAttributes(PerfEvent event) {
+    struct perf_event_attr result = {0};
+    result.size = sizeof(result);
+    result.type = PERF_TYPE_HARDWARE;
+    result.exclude_kernel = 1;
+    result.exclude_hv = 1;
+    result.read_format = PERF_FORMAT_GROUP;
+
+    uint64_t cacheMiss = (uint64_t) PERF_COUNT_HW_CACHE_OP_READ << 8 | (uint64_t) PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+
+    switch (event) {
+        case PerfEvent_Instructions: {
+            result.config = PERF_COUNT_HW_INSTRUCTIONS;
+        }
+        break;
+        case PerfEvent_Cycles: {
+            result.config = PERF_COUNT_HW_CPU_CYCLES;
+        }
+        break;
+        case PerfEvent_L1dMisses: {
+            result.type = PERF_TYPE_HW_CACHE;
+            result.config = PERF_COUNT_HW_CACHE_L1D | cacheMiss;
+        }
+        break;
+        case PerfEvent_LlcMisses: {
+            result.config = PERF_COUNT_HW_CACHE_MISSES;
+        }
+        break;
+        case PerfEvent_BranchMisses: {
+            result.config = PERF_COUNT_HW_BRANCH_MISSES;
+        }
+        break;
+        case PerfEvent_DtlbMisses: {
+            result.type = PERF_TYPE_HW_CACHE;
+            result.config = PERF_COUNT_HW_CACHE_DTLB | cacheMiss;
+        }
+        break;
+        default: {
+        }
+        break;
+    }
+
+    return result;
+}
+
+// Counts the calling thread on any cpu. The first event that opens leads the group, returns false if none does.
+bool osOpenPerfCounters(PerfCounters *counters) {
+    memset(counters, 0, sizeof(*counters));
+    counters->groupFd = -1;
+
+    for (int event = 0; event < PerfEvent_Count; event++) {
+        struct perf_event_attr attributes = getPerfEventAttributes((PerfEvent) event);
+
+        int fd = (int) syscall(SYS_perf_event_open, &attributes, 0, -1, counters->groupFd, 0);
+
+        counters->fds[event] = fd;
+
+        if (fd >= 0) {
+            if (counters->groupFd < 0) {
+                counters->groupFd = fd;
+            }
+
+            counters->isAvailable[event] = true;
+            counters->groupIndex[event] = counters->groupSize++;
+        }
+    }
+
+    return counters->groupFd >= 0;
+}
+
+bool osReadPerfCounters(PerfCounters *counters, uint64_t values[PerfEvent_Count]) {
+    uint64_t buffer[PerfEvent_Count + 1];
+
+    memset(values, 0, PerfEvent_Count * sizeof(uint64_t));
+
+    ssize_t size = read(counters->groupFd, buffer, sizeof(buffer));
+
+    if (size < (ssize_t) sizeof(uint64_t) || buffer[0] != counters->groupSize) {
+        return false;
+    }
+
+    for (int event = 0; event < PerfEvent_Count; event++) {
+        if (counters->isAvailable[event]) {
+            values[event] = buffer[1 + counters->groupIndex[event]];
+        }
+    }
+
+    return true;
+}
+
+// tsc_khz is not exported to user space, but the perf mmap page holds the tsc to nanoseconds factors the kernel
+// derived from it, as long as the tsc is the clock source
+bool osGetKernelTscFrequency(RdtscFrequency *frequency) {
+    struct perf_event_attr attributes = {0};
+    attributes.type = PERF_TYPE_SOFTWARE;
+    attributes.size = sizeof(attributes);
+    attributes.config = PERF_COUNT_SW_DUMMY;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    int fd = (int) syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    bool result = false;
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    void *page = mmap(NULL, pageSize, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (page != MAP_FAILED) {
+        volatile struct perf_event_mmap_page *info = page;
+
+        uint32_t sequence;
+        uint64_t hasUserTime;
+        uint32_t multiplier;
+        uint16_t shift;
+
+        do {
+            sequence = info->lock;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            hasUserTime = info->cap_user_time;
+            multiplier = info->time_mult;
+            shift = info->time_shift;
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while (info->lock != sequence);
+
+        // nanoseconds = ticks * multiplier >> shift
+        if (hasUserTime && multiplier != 0) {
+            frequency->frequency = (uint64_t) (((unsigned __int128) 1000000000ull << shift) / multiplier);
+            frequency->error = frequency->frequency / multiplier + 1;
+            frequency->source = RdtscSource_Kernel;
+            result = true;
+        }
+
+        munmap(page, pageSize);
+    }
+
+    close(fd);
+
+    return result;
+}
+
+bool osPinToProcessor(uint32_t processor) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(processor, &set);
+
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+uint32_t osGetCurrentProcessor() {
+    int processor = sched_getcpu();
+
+    return processor < 0 ? 0 : (uint32_t) processor;
+}
+
+// Only applies to the calling thread, and needs CAP_SYS_NICE or a raised RLIMIT_NICE
+bool osRaisePriority() {
+    return setpriority(PRIO_PROCESS, 0, -20) == 0;
+}
+
+bool osOpenFrequencyCounters(FrequencyCounters *counters) {
+    struct perf_event_attr attributes = {0};
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_GROUP;
+
+    counters->groupFd = (int) syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+    counters->referenceFd = -1;
+
+    if (counters->groupFd < 0) {
+        return false;
+    }
+
+    attributes.config = PERF_COUNT_HW_REF_CPU_CYCLES;
+
+    counters->referenceFd = (int) syscall(SYS_perf_event_open, &attributes, 0, -1, counters->groupFd, 0);
+
+    if (counters->referenceFd < 0) {
+        close(counters->groupFd);
+        counters->groupFd = -1;
+
+        return false;
+    }
+
+    return true;
+}
+
+bool osReadFrequencyCounters(FrequencyCounters *counters, uint64_t *cycles, uint64_t *referenceCycles) {
+    uint64_t buffer[3] = {0};
+
+    bool result = read(counters->groupFd, buffer, sizeof(buffer)) == (ssize_t) sizeof(buffer) && buffer[0] == 2;
+
+    *cycles = buffer[1];
+    *referenceCycles = buffer[2];
+
+    return result;
+}
+
+// cpufreq is missing in most virtual machines, where /proc/cpuinfo still has the clock the kernel last saw
+bool osGetProcessorFrequency(uint32_t processor, uint64_t *frequency) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_cur_freq", processor);
+
+    *frequency = 0;
+
+    FILE *file = fopen(path, "r");
+
+    if (file) {
+        unsigned long long kilohertz = 0;
+
+        if (fscanf(file, "%llu", &kilohertz) == 1) {
+            *frequency = kilohertz * 1000ull;
+        }
+
+        fclose(file);
+
+        return *frequency != 0;
+    }
+
+    file = fopen("/proc/cpuinfo", "r");
+
+    if (!file) {
+        return false;
+    }
+
+    char line[256];
+    long currentProcessor = -1;
+
+    while (fgets(line, sizeof(line), file)) {
+        double megahertz = 0;
+
+        if (sscanf(line, "processor : %ld", &currentProcessor) == 1) {
+            continue;
+        }
+
+        if (currentProcessor == (long) processor && sscanf(line, "cpu MHz : %lf", &megahertz) == 1) {
+            *frequency = (uint64_t) (megahertz * 1000000.0);
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return *frequency != 0;
+}
+
+// Only cpufreq, scanning /proc/cpuinfo is too slow to do around every sample
+bool osOpenProcessorFrequency(ProcessorFrequency *file, uint32_t processor) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_cur_freq", processor);
+
+    file->fd = open(path, O_RDONLY);
+    file->processor = processor;
+
+    return file->fd >= 0;
+}
+
+// Reopens the file when the thread moved to another processor, neither that nor the read allocates
+bool osReadProcessorFrequency(ProcessorFrequency *file, uint32_t processor, uint64_t *frequency) {
+    *frequency = 0;
+
+    if (processor != file->processor || file->fd < 0) {
+        if (file->fd >= 0) {
+            close(file->fd);
+        }
+
+        if (!osOpenProcessorFrequency(file, processor)) {
+            return false;
+        }
+    }
+
+    char text[32];
+    ssize_t size = pread(file->fd, text, sizeof(text) - 1, 0);
+
+    if (size <= 0) {
+        return false;
+    }
+
+    text[size] = 0;
+
+    *frequency = strtoull(text, NULL, 10) * 1000ull;
+
+    return *frequency != 0;
+}
+
+// In clock ticks since boot, idle and iowait are the only times that do not count as busy
+bool osGetProcessorTimes(uint32_t processor, uint64_t *busy, uint64_t *total) {
+    FILE *file = fopen("/proc/stat", "r");
+
+    *busy = 0;
+    *total = 0;
+
+    if (!file) {
+        return false;
+    }
+
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "cpu%u ", processor);
+
+    char line[512];
+    bool result = false;
+
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long times[8] = {0};
+
+        if (strncmp(line, prefix, strlen(prefix)) == 0) {
+            int count = sscanf(
+                line + strlen(prefix),
+                "%llu %llu %llu %llu %llu %llu %llu %llu",
+                &times[0],
+                &times[1],
+                &times[2],
+                &times[3],
+                &times[4],
+                &times[5],
+                &times[6],
+                &times[7]
+            );
+
+            if (count >= 5) {
+                for (int timeIndex = 0; timeIndex < 8; timeIndex++) {
+                    *total += times[timeIndex];
+                }
+
+                *busy = *total - times[3] - times[4];
+                result = true;
+            }
+
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return result;
+}
+
+// The other hardware threads of the core, read from a list like "0,64" or "0-1"
+size_t osGetSiblingProcessors(uint32_t processor, uint32_t *siblings, size_t capacity) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list", processor);
+
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        return 0;
+    }
+
+    char list[256] = {0};
+    char *cursor = fgets(list, sizeof(list), file);
+
+    fclose(file);
+
+    size_t result = 0;
+
+    while (cursor && *cursor >= '0' && *cursor <= '9') {
+        unsigned long first = strtoul(cursor, &cursor, 10);
+        unsigned long last = first;
+
+        if (*cursor == '-') {
+            last = strtoul(cursor + 1, &cursor, 10);
+        }
+
+        for (unsigned long sibling = first; sibling <= last && result < capacity; sibling++) {
+            if (sibling != processor) {
+                siblings[result++] = (uint32_t) sibling;
+            }
+        }
+
+        if (*cursor == ',') {
+            cursor++;
+        }
+    }
+
+    return result;
+}
+
+#endif
+
+#define CPU_BRAND_CAPACITY 49
+
+// The brand string takes 16 bytes from each of the leaves 0x80000002 to 0x80000004, some cpus pad it with spaces
+void getCpuBrand(char brand[CPU_BRAND_CAPACITY]) {
+    uint32_t registers[4];
+
+    memset(brand, 0, CPU_BRAND_CAPACITY);
+
+    osCpuid(0x80000000, 0, registers);
+
+    if (registers[0] < 0x80000004) {
+        strcpy(brand, "unknown");
+
+        return;
+    }
+
+    for (uint32_t leaf = 0; leaf < 3; leaf++) {
+        osCpuid(0x80000002 + leaf, 0, registers);
+        memcpy(brand + leaf * sizeof(registers), registers, sizeof(registers));
+    }
+
+    size_t start = 0;
+
+    while (brand[start] == ' ') {
+        start++;
+    }
+
+    memmove(brand, brand + start, CPU_BRAND_CAPACITY - start);
+
+    for (size_t end = strlen(brand); end > 0 && brand[end - 1] == ' '; end--) {
+        brand[end - 1] = '\0';
+    }
+}
+
+// Leaf 0x15 gives the tsc as a ratio of the crystal clock, which is exact when the crystal frequency is filled in
+bool getCpuidTscFrequency(RdtscFrequency *frequency) {
+    uint32_t registers[4];
+
+    osCpuid(0, 0, registers);
+
+    uint32_t maxLeaf = registers[0];
+
+    if (maxLeaf >= 0x15) {
+        osCpuid(0x15, 0, registers);
+
+        uint32_t denominator = registers[0];
+        uint32_t numerator = registers[1];
+        uint32_t crystalFrequency = registers[2];
+
+        if (denominator != 0 && numerator != 0 && crystalFrequency != 0) {
+            frequency->frequency = (uint64_t) crystalFrequency * numerator / denominator;
+            frequency->error = 0;
+            frequency->source = RdtscSource_Cpuid;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Leaf 0x16 has the marketed base frequency in MHz. The tsc runs near it, but Intel documents the value as nominal
+// and parts without a crystal frequency have been seen several MHz off, so it comes after the kernel's measurement
+// and carries an error of half a percent.
+bool getCpuidBaseFrequency(RdtscFrequency *frequency) {
+    uint32_t registers[4];
+
+    osCpuid(0, 0, registers);
+
+    if (registers[0] >= 0x16) {
+        osCpuid(0x16, 0, registers);
+
+        uint32_t baseMegahertz = registers[0] & 0xffff;
+
+        if (baseMegahertz != 0) {
+            frequency->frequency = (uint64_t) baseMegahertz * 1000000ull;
+            frequency->error = frequency->frequency / 200;
+            frequency->source = RdtscSource_CpuidBase;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// VMware, and KVM when asked to, publish the tsc frequency in kHz in this leaf
+bool getHypervisorTscFrequency(RdtscFrequency *frequency) {
+    uint32_t registers[4];
+
+    osCpuid(1, 0, registers);
+
+    if ((registers[2] & (1u << 31)) == 0) {
+        return false;
+    }
+
+    osCpuid(0x40000000, 0, registers);
+
+    if (registers[0] < 0x40000010) {
+        return false;
+    }
+
+    osCpuid(0x40000010, 0, registers);
+
+    if (registers[0] == 0) {
+        return false;
+    }
+
+    frequency->frequency = (uint64_t) registers[0] * 1000ull;
+    frequency->error = 500;
+    frequency->source = RdtscSource_Hypervisor;
+
+    return true;
+}
+
+#define RDTSC_CALIBRATION_SAMPLES 9
+
+#define RDTSC_CALIBRATION_MILLISECONDS 2
+
+void sortFrequencies(uint64_t *values, size_t count) {
+    for (size_t index = 1; index < count; index++) {
+        uint64_t value = values[index];
+        size_t position = index;
+
+        while (position > 0 && values[position - 1] > value) {
+            values[position] = values[position - 1];
+            position--;
+        }
+
+        values[position] = value;
+    }
+}
+
+// Short windows against the OS clock, the median ignores the ones a context switch or an interrupt landed in and
+// the median absolute deviation is the error
+RdtscFrequency calibrateRdtscFrequency() {
+    uint64_t osFrequency = getOsTimeFrequency();
+    uint64_t osWait = osFrequency * RDTSC_CALIBRATION_MILLISECONDS / 1000;
+
+    uint64_t samples[RDTSC_CALIBRATION_SAMPLES];
+
+    for (size_t sampleIndex = 0; sampleIndex < RDTSC_CALIBRATION_SAMPLES; sampleIndex++) {
+        uint64_t osStart = getOsTimeStamp();
+        uint64_t cpuStart = __rdtsc();
+        uint64_t osEnd;
+
+        do {
+            osEnd = getOsTimeStamp();
+        } while (osEnd - osStart < osWait);
+
+        uint64_t cpuTicks = __rdtsc() - cpuStart;
+
+        samples[sampleIndex] = cpuTicks * osFrequency / (osEnd - osStart);
+    }
+
+    sortFrequencies(samples, RDTSC_CALIBRATION_SAMPLES);
+
+    RdtscFrequency result = {0};
+    result.frequency = samples[RDTSC_CALIBRATION_SAMPLES / 2];
+    result.source = RdtscSource_Calibration;
+
+    uint64_t deviations[RDTSC_CALIBRATION_SAMPLES];
+
+    for (size_t sampleIndex = 0; sampleIndex < RDTSC_CALIBRATION_SAMPLES; sampleIndex++) {
+        uint64_t sample = samples[sampleIndex];
+        deviations[sampleIndex] = sample > result.frequency ? sample - result.frequency : result.frequency - sample;
+    }
+
+    sortFrequencies(deviations, RDTSC_CALIBRATION_SAMPLES);
+
+    result.error = deviations[RDTSC_CALIBRATION_SAMPLES / 2];
+
+    return result;
+}
+
+// Computed once per process, the first call should happen before any thread is started
+RdtscFrequency getRdtscFrequency() {
+    static RdtscFrequency cached;
+    static bool isCached;
+
+    if (!isCached) {
+        bool isKnown = getCpuidTscFrequency(&cached) || getHypervisorTscFrequency(&cached) || osGetKernelTscFrequency(&cached)
+            || getCpuidBaseFrequency(&cached);
+
+        if (!isKnown) {
+            cached = calibrateRdtscFrequency();
+        }
+
+        isCached = true;
+    }
+
+    return cached;
+}
+
+#endif
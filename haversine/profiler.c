@@ -3,36 +3,72 @@
 #define PROFILE_C
 
 #include "stdint.h"
+#include "platform.c"
+#include "assert.h"
 
-#pragma warning(push, 0)
+#define COUNTER_NAME_CAPACITY 50
 
-#include "windows.h"
+#ifdef PROFILE
 
-#pragma warning(pop)
+// Every thread that ever opened a block keeps its entry, including workers that have exited
+#define MAX_PROFILED_THREADS 1024
 
-#include "assert.h"
+#define MAX_BLOCKS_PER_THREAD 256
 
-#define COUNTER_NAME_CAPACITY 50
+#define MAX_REPORTED_BLOCKS (MAX_BLOCKS_PER_THREAD * 4)
 
-typedef struct {
-    uint64_t start;
-    size_t id;
-    uint64_t initialTicksInRoot;
-} Counter;
+#define PROFILER_CALIBRATION_ROUNDS 64
 
-#ifdef PROFILE
+#define PROFILER_CALIBRATION_BLOCKS 256
 
-#define MAX_COUNTERS 4096
+// About 24 MB per thread, only allocated when tracing, untouched pages are never backed
+#define TRACE_EVENTS_PER_THREAD (1024 * 1024)
 
 typedef struct {
     uint64_t totalTicks;
     uint64_t ticksInRoot;
     uint64_t childrenTicks;
     size_t calls;
+    size_t childCalls;
     const char *name;
     size_t bytes;
+    size_t id;
+    uint64_t perfInRoot[PerfEvent_Count];
 } TimedBlock;
 
+// Lives in the profiled function from its push to its pop, so nesting is tracked by the call stack itself
+typedef struct {
+    TimedBlock *block;
+    TimedBlock *parent;
+    size_t depth;
+    uint64_t start;
+    uint64_t initialTicksInRoot;
+    uint64_t perfStart[PerfEvent_Count];
+    uint64_t initialPerfInRoot[PerfEvent_Count];
+} Counter;
+
+// One finished block, written as a complete event of the trace
+typedef struct {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+} TraceEvent;
+
+// Only ever touched by the thread that owns it, so pushing and popping need no synchronization. Blocks live here
+// rather than in the thread local slots that point at them, so they outlive the thread.
+typedef struct {
+    TimedBlock blocks[MAX_BLOCKS_PER_THREAD];
+    size_t blocksCount;
+    TimedBlock *openBlock;
+    size_t depth;
+    size_t threadIndex;
+    TraceEvent *events;
+    size_t eventsCount;
+    size_t droppedEvents;
+    bool hasPerf;
+    PerfCounters perf;
+} ThreadCounters;
+
 #endif
 
 typedef struct {
@@ -40,58 +76,185 @@ typedef struct {
     uint64_t end;
     uint64_t cpuCounterFrequency;
 #ifdef PROFILE
-    TimedBlock timedBlocks[MAX_COUNTERS];
-    size_t blocksCount;
-    Counter stack[MAX_COUNTERS];
-    size_t stackSize;
+    bool isTracing;
+    bool isCountingPerf;
+    bool isPerfAvailable[PerfEvent_Count];
+    uint64_t overheadTicks;
+    ThreadCounters *threads[MAX_PROFILED_THREADS];
+    volatile uint32_t threadCount;
+    TimedBlock reportBlocks[MAX_REPORTED_BLOCKS];
 #endif
 } Counters;
 
+// Tools that never time anything, like compare, still include the profiler through common.c
+static MAYBE_UNUSED Counters COUNTERS = {0};
+
 #ifdef PROFILE
 
-void pushCounter(Counters *counters, size_t id, const char *name, size_t bytes) {
-    assert(id != 0);
-    size_t count = __rdtsc();
+static THREAD_LOCAL ThreadCounters *THREAD_COUNTERS = NULL;
+
+void dieInProfiler(const char *file, int line, const char *message) {
+    printf("ERROR (%s:%d): %s\n", file, line, message);
+    exit(EXIT_FAILURE);
+}
+
+// The first block a thread opens registers its counters, they outlive the thread so the report can merge them
+ThreadCounters *getThreadCounters() {
+    if (!THREAD_COUNTERS) {
+        uint32_t threadIndex = atomicIncrement(&COUNTERS.threadCount) - 1;
+
+        if (threadIndex >= MAX_PROFILED_THREADS) {
+            dieInProfiler(__FILE__, __LINE__, "too many profiled threads");
+        }
+
+        ThreadCounters *counters = osAllocate(sizeof(ThreadCounters), 0);
+
+        if (!counters) {
+            dieInProfiler(__FILE__, __LINE__, "could not allocate thread counters");
+        }
+
+        counters->threadIndex = threadIndex;
+
+        if (COUNTERS.isTracing) {
+            counters->events = osAllocate(TRACE_EVENTS_PER_THREAD * sizeof(TraceEvent), 0);
+
+            if (!counters->events) {
+                dieInProfiler(__FILE__, __LINE__, "could not allocate trace events");
+            }
+        }
+
+        // The counters stay open until the process exits, like the rest of the thread counters
+        if (COUNTERS.isCountingPerf) {
+            counters->hasPerf = osOpenPerfCounters(&counters->perf);
+        }
 
-    TimedBlock *timedBlock = &(counters->timedBlocks[id]);
-    timedBlock->bytes = bytes;
-    if (counters->blocksCount <= id) {
-        counters->blocksCount = id + 1;
+        COUNTERS.threads[threadIndex] = counters;
+        THREAD_COUNTERS = counters;
     }
 
-    if (timedBlock->name == 0) {
-        timedBlock->name = name;
+    return THREAD_COUNTERS;
+}
+
+// slot is the thread local anchor of one call site, it gets its block the first time this thread reaches it
+Counter pushCounter(TimedBlock **slot, size_t id, const char *name, size_t bytes) {
+    assert(id != 0);
+
+    ThreadCounters *counters = getThreadCounters();
+
+    if (!*slot) {
+        if (counters->blocksCount == MAX_BLOCKS_PER_THREAD) {
+            dieInProfiler(__FILE__, __LINE__, "too many profiled blocks");
+        }
+
+        TimedBlock *block = &counters->blocks[counters->blocksCount++];
+        block->id = id;
+        block->name = name;
+        *slot = block;
     }
 
+    TimedBlock *timedBlock = *slot;
     timedBlock->calls++;
+    timedBlock->bytes += bytes;
+
+    Counter result = {0};
+    result.block = timedBlock;
+    result.parent = counters->openBlock;
+    result.depth = counters->depth;
+    result.initialTicksInRoot = timedBlock->ticksInRoot;
+
+    counters->openBlock = timedBlock;
+    counters->depth++;
+
+    if (counters->hasPerf) {
+        memcpy(result.initialPerfInRoot, timedBlock->perfInRoot, sizeof(result.initialPerfInRoot));
+        osReadPerfCounters(&counters->perf, result.perfStart);
+    }
 
-    counters->stack[counters->stackSize] .id = id;
-    counters->stack[counters->stackSize] .start = count;
-    counters->stack[counters->stackSize] .initialTicksInRoot = timedBlock->ticksInRoot;
-    counters->stackSize++;
+    result.start = __rdtsc();
+
+    return result;
 }
 
-void popCounter(Counters *counters) {
-    size_t endTicks = __rdtsc();
+// ticksInRoot is restored from the value it had when this call was pushed, so a block that recurses into itself
+// only counts its outermost call
+void popCounter(Counter *counter) {
+    uint64_t endTicks = __rdtsc();
 
-    assert(counters->stackSize > 0);
+    ThreadCounters *counters = getThreadCounters();
 
-    size_t startTicks = counters->stack[counters->stackSize - 1] .start;
-    size_t id = counters->stack[counters->stackSize - 1] .id;
-    uint64_t initialTicksInRoot = counters->stack[counters->stackSize - 1] .initialTicksInRoot;
+    // Every pop must close the innermost open block
+    assert(counters->depth == counter->depth + 1 && counters->openBlock == counter->block);
 
-    size_t elapsed = endTicks - startTicks;
-    TimedBlock *timedBlock = &(counters->timedBlocks[id]);
+    uint64_t elapsed = endTicks - counter->start;
+    TimedBlock *timedBlock = counter->block;
     timedBlock->totalTicks += elapsed;
-    timedBlock->ticksInRoot = initialTicksInRoot + elapsed;
+    timedBlock->ticksInRoot = counter->initialTicksInRoot + elapsed;
+
+    // Hardware counters follow ticksInRoot, recursive calls only count once
+    if (counters->hasPerf) {
+        uint64_t perfEnd[PerfEvent_Count];
+        osReadPerfCounters(&counters->perf, perfEnd);
+
+        for (int event = 0; event < PerfEvent_Count; event++) {
+            timedBlock->perfInRoot[event] = counter->initialPerfInRoot[event] + (perfEnd[event] - counter->perfStart[event]);
+        }
+    }
+
+    counters->openBlock = counter->parent;
+    counters->depth--;
+
+    if (counter->parent) {
+        counter->parent->childrenTicks += elapsed;
+        counter->parent->childCalls++;
+    }
+
+    // A full trace drops the event instead of growing, the report says how many were lost
+    if (counters->events) {
+        if (counters->eventsCount < TRACE_EVENTS_PER_THREAD) {
+            TraceEvent *event = &counters->events[counters->eventsCount++];
+            event->name = timedBlock->name;
+            event->start = counter->start;
+            event->end = endTicks;
+        }
+        else {
+            counters->droppedEvents++;
+        }
+    }
+}
+
+// Times empty blocks from the outside, which is the cost every child block adds to the time of its parent.
+// The calibration blocks are kept out of the trace, so the figure leaves out the cost of recording events.
+uint64_t measureProfilerOverhead() {
+    ThreadCounters *counters = getThreadCounters();
+    TraceEvent *events = counters->events;
+    counters->events = NULL;
+
+    TimedBlock calibrationBlock = {0};
+    calibrationBlock.id = 1;
+    calibrationBlock.name = "calibration";
+
+    TimedBlock *slot = &calibrationBlock;
+
+    uint64_t result = UINT64_MAX;
 
-    counters->stackSize--;
+    for (size_t round = 0; round < PROFILER_CALIBRATION_ROUNDS; round++) {
+        uint64_t start = __rdtsc();
 
-    if (counters->stackSize > 0) {
-        size_t parentId = counters->stack[counters->stackSize - 1] .id;
-        TimedBlock *parentBlock = &(counters->timedBlocks[parentId]);
-        parentBlock->childrenTicks += elapsed;
+        for (size_t blockIndex = 0; blockIndex < PROFILER_CALIBRATION_BLOCKS; blockIndex++) {
+            Counter counter = pushCounter(&slot, calibrationBlock.id, calibrationBlock.name, 0);
+            popCounter(&counter);
+        }
+
+        uint64_t ticks = (__rdtsc() - start) / PROFILER_CALIBRATION_BLOCKS;
+
+        if (ticks < result) {
+            result = ticks;
+        }
     }
+
+    counters->events = events;
+
+    return result;
 }
 
 int compareTimedBlocks(const void *left, const void *right) {
@@ -113,21 +276,75 @@ int compareTimedBlocks(const void *left, const void *right) {
     }
 }
 
-void printTimedBlocksStats(Counters *counters, size_t totalCount) {
-    assert(counters->stackSize == 0);
+double getPerfRatio(uint64_t numerator, uint64_t denominator) {
+    return denominator != 0 ? (double) numerator / (double) denominator : 0.0;
+}
+
+// Counts are with children. IPC and branch misses per thousand instructions show whether a block is bound by the
+// frontend or by branches, misses per byte whether it is bound by memory.
+// False when perf_event_open failed, or when the main thread could open none of the events
+bool isAnyPerfAvailable(Counters *counters) {
+    for (int event = 0; event < PerfEvent_Count; event++) {
+        if (counters->isPerfAvailable[event]) {
+            return true;
+        }
+    }
 
+    return false;
+}
+
+void printPerfStats(TimedBlock *timedBlocks, size_t blocksCount, Counters *counters) {
+    bool *isAvailable = counters->isPerfAvailable;
+
+    printf("\nHardware counters:\n");
+
+    for (size_t counterIndex = 0; counterIndex < blocksCount; counterIndex++) {
+        TimedBlock *timedBlock = &(timedBlocks[counterIndex]);
+        uint64_t *perf = timedBlock->perfInRoot;
+
+        if (timedBlock->name == NULL) {
+            continue;
+        }
+
+        printf("%-25s", timedBlock->name);
+
+        if (isAvailable[PerfEvent_Instructions] && isAvailable[PerfEvent_Cycles]) {
+            printf(" IPC: %6.3f", getPerfRatio(perf[PerfEvent_Instructions], perf[PerfEvent_Cycles]));
+        }
+
+        if (isAvailable[PerfEvent_Instructions] && isAvailable[PerfEvent_BranchMisses]) {
+            printf(" , branch misses per 1k instructions: %8.3f", 1000.0 * getPerfRatio(perf[PerfEvent_BranchMisses], perf[PerfEvent_Instructions]));
+        }
+
+        for (int event = 0; event < PerfEvent_Count; event++) {
+            if (!isAvailable[event]) {
+                continue;
+            }
+
+            printf(" , %s: %12llu", PerfEventNames[event], (unsigned long long) perf[event]);
+
+            bool isMiss = event == PerfEvent_L1dMisses || event == PerfEvent_LlcMisses || event == PerfEvent_DtlbMisses;
+
+            if (isMiss && timedBlock->bytes > 0) {
+                printf(" (%8.5f per byte)", getPerfRatio(perf[event], timedBlock->bytes));
+            }
+        }
+
+        printf("\n");
+    }
+}
+
+// Blocks are sorted in a copy, the live ones are still pointed to by their call sites.
+// The overhead column estimates how much of the time without children went to profiling the children.
+void printTimedBlocksStats(TimedBlock *timedBlocks, size_t blocksCount, Counters *counters, size_t totalCount) {
     float totalPercentage = 0.0f;
 
-    char format[] = "%-25s (called %10zu times): \t\t with children: %20.10f (%14.10f %%) \t\t without children:  %20.10f (%14.10f %%) , Throughput: %4.10f 5 gB/S\n";
+    char format[] = "%-25s (called %10zu times): \t\t with children: %20.10f (%14.10f %%) \t\t without children:  %20.10f (%14.10f %%) , overhead: %14.10f , Throughput: %4.10f 5 gB/S\n";
+
+    qsort((void *) timedBlocks, blocksCount, sizeof(*timedBlocks), compareTimedBlocks);
 
-    qsort(
-        (void *) (counters->timedBlocks),
-        counters->blocksCount,
-        sizeof(*counters->timedBlocks),
-        compareTimedBlocks
-    );
-    for (size_t counterIndex = 1; counterIndex < counters->blocksCount; counterIndex++) {
-        TimedBlock *timedBlock = &(counters->timedBlocks[counterIndex]);
+    for (size_t counterIndex = 0; counterIndex < blocksCount; counterIndex++) {
+        TimedBlock *timedBlock = &(timedBlocks[counterIndex]);
         if (timedBlock->name != NULL) {
             uint64_t totalTicks = timedBlock->totalTicks;
             uint64_t ticksInRoot = timedBlock->ticksInRoot;
@@ -137,6 +354,7 @@ void printTimedBlocksStats(Counters *counters, size_t totalCount) {
             float secondsWithoutChildren = ((float) (ticksWithoutChildren)) / ((float) (counters->cpuCounterFrequency));
             float percentageWithoutChildren = (((float) ticksWithoutChildren) / ((float) (totalCount))) * 100.0f;
             float percentageWithChildren = (((float) ticksInRoot) / ((float) (totalCount))) * 100.0f;
+            float overheadSeconds = ((float) (timedBlock->childCalls * counters->overheadTicks)) / ((float) (counters->cpuCounterFrequency));
             float througput = 0.0f;
 
             if (timedBlock->bytes > 0) {
@@ -152,41 +370,163 @@ void printTimedBlocksStats(Counters *counters, size_t totalCount) {
                 percentageWithChildren,
                 secondsWithoutChildren,
                 percentageWithoutChildren,
+                overheadSeconds,
                 througput
             );
         }
     }
     printf("Total percentage: %14.10f\n", totalPercentage);
+
+    if (counters->isCountingPerf && isAnyPerfAvailable(counters)) {
+        printPerfStats(timedBlocks, blocksCount, counters);
+    }
 }
 
-#define MEASURE_THROUGHPUT(NAME, BYTES)\
-{\
-    pushCounter(&COUNTERS, (__COUNTER__ + 1), NAME, BYTES);\
+// Adds up the blocks of every thread by id, ids come from __COUNTER__ so they name the same call site in every thread
+size_t mergeThreadCounters(Counters *counters) {
+    size_t result = 0;
+
+    for (uint32_t threadIndex = 0; threadIndex < counters->threadCount; threadIndex++) {
+        ThreadCounters *thread = counters->threads[threadIndex];
+
+        assert(thread->depth == 0);
+
+        for (size_t blockIndex = 0; blockIndex < thread->blocksCount; blockIndex++) {
+            TimedBlock *source = &thread->blocks[blockIndex];
+            TimedBlock *target = NULL;
+
+            for (size_t reportIndex = 0; reportIndex < result; reportIndex++) {
+                if (counters->reportBlocks[reportIndex].id == source->id) {
+                    target = &counters->reportBlocks[reportIndex];
+                    break;
+                }
+            }
+
+            if (!target) {
+                if (result == MAX_REPORTED_BLOCKS) {
+                    dieInProfiler(__FILE__, __LINE__, "too many profiled blocks to report");
+                }
+
+                target = &counters->reportBlocks[result++];
+                memset(target, 0, sizeof(*target));
+                target->id = source->id;
+                target->name = source->name;
+            }
+
+            target->totalTicks += source->totalTicks;
+            target->ticksInRoot += source->ticksInRoot;
+            target->childrenTicks += source->childrenTicks;
+            target->calls += source->calls;
+            target->childCalls += source->childCalls;
+            target->bytes += source->bytes;
+
+            for (int event = 0; event < PerfEvent_Count; event++) {
+                target->perfInRoot[event] += source->perfInRoot[event];
+            }
+        }
+    }
+
+    return result;
 }
 
-#define MEASURE_FUNCTION_THROUGHPUT(BYTES)\
-{\
-    pushCounter(&COUNTERS, (__COUNTER__ + 1), __func__, BYTES);\
+// Worker threads must have been joined, their counters are read without synchronization
+void printThreadsStats(Counters *counters, size_t totalCount) {
+    printf("Profiler overhead: %llu cycles per block\n", (unsigned long long) counters->overheadTicks);
+
+    if (counters->isCountingPerf && !isAnyPerfAvailable(counters)) {
+        printf("Hardware counters are not available, perf_event_open failed or is not supported\n");
+    }
+
+    if (counters->threadCount > 1) {
+        for (uint32_t threadIndex = 0; threadIndex < counters->threadCount; threadIndex++) {
+            ThreadCounters *thread = counters->threads[threadIndex];
+
+            assert(thread->depth == 0);
+
+            printf("\nThread %u:\n", threadIndex);
+
+            memcpy(counters->reportBlocks, thread->blocks, thread->blocksCount * sizeof(TimedBlock));
+            printTimedBlocksStats(counters->reportBlocks, thread->blocksCount, counters, totalCount);
+        }
+
+        printf("\nAll threads, percentages of the wall clock time:\n");
+    }
+
+    size_t blocksCount = mergeThreadCounters(counters);
+    printTimedBlocksStats(counters->reportBlocks, blocksCount, counters, totalCount);
 }
 
-#define TIME_BLOCK(NAME)\
-{\
-    MEASURE_THROUGHPUT(NAME, 0);\
+// Chrome trace event format, which Perfetto and chrome://tracing both open. Timestamps are in microseconds since
+// startCounters and every profiled thread is its own track.
+void writeTraceEvents(Counters *counters, FILE *file) {
+    double microsecondsPerTick = 1000000.0 / (double) counters->cpuCounterFrequency;
+
+    size_t eventsCount = 0;
+    size_t droppedEvents = 0;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    for (uint32_t threadIndex = 0; threadIndex < counters->threadCount; threadIndex++) {
+        ThreadCounters *thread = counters->threads[threadIndex];
+
+        fprintf(
+            file,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+            threadIndex == 0 ? "" : ",\n",
+            threadIndex,
+            threadIndex
+        );
+
+        for (size_t eventIndex = 0; eventIndex < thread->eventsCount; eventIndex++) {
+            TraceEvent *event = &thread->events[eventIndex];
+
+            fprintf(
+                file,
+                ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                event->name,
+                threadIndex,
+                (double) (event->start - counters->start) * microsecondsPerTick,
+                (double) (event->end - event->start) * microsecondsPerTick
+            );
+        }
+
+        eventsCount += thread->eventsCount;
+        droppedEvents += thread->droppedEvents;
+    }
+
+    fprintf(file, "\n]}\n");
+
+    printf("Trace: %zu events, %zu dropped\n", eventsCount, droppedEvents);
 }
 
+#define PROFILE_CONCAT_(LEFT, RIGHT) LEFT##RIGHT
+
+#define PROFILE_CONCAT(LEFT, RIGHT) PROFILE_CONCAT_(LEFT, RIGHT)
+
+// Declares the anchor of the call site and the counter STOP_COUNTER pops, a block without its STOP_COUNTER leaves
+// profileCounter unused, which the warnings of build.bat turn into an error. Blocks that nest in the same function
+// need their own braces.
+#define MEASURE_THROUGHPUT(NAME, BYTES)\
+    static THREAD_LOCAL TimedBlock *PROFILE_CONCAT(timedBlock, __LINE__) = NULL;\
+    Counter profileCounter = pushCounter(&PROFILE_CONCAT(timedBlock, __LINE__), (__COUNTER__ + 1), NAME, BYTES);
+
+#define MEASURE_FUNCTION_THROUGHPUT(BYTES)\
+    MEASURE_THROUGHPUT(__func__, BYTES)
+
+#define TIME_BLOCK(NAME)\
+    MEASURE_THROUGHPUT(NAME, 0)
+
 #define TIME_FUNCTION \
-{\
-    TIME_BLOCK(__func__);\
-}
+    TIME_BLOCK(__func__)
 
 #define STOP_COUNTER \
 {\
-    popCounter(&COUNTERS);\
+    popCounter(&profileCounter);\
 }
 
 #else
 
-#define TIME_BLOCK {}
+#define TIME_BLOCK(NAME) {}
 
 #define MEASURE_THROUGHPUT(NAME, BYTES)\
 {\
@@ -202,9 +542,36 @@ void printTimedBlocksStats(Counters *counters, size_t totalCount) {
 
 #endif
 
-static Counters COUNTERS = {0};
+// Must come before startCounters, threads that are already profiled do not get a trace
+void enableTrace(Counters *counters) {
+#ifdef PROFILE
+    counters->isTracing = true;
+#else
+    (void) counters;
+#endif
+}
 
+// Must come before startCounters, like enableTrace. Reading the counters costs two system calls per block.
+void enablePerfCounters(Counters *counters) {
+#ifdef PROFILE
+    counters->isCountingPerf = true;
+#else
+    (void) counters;
+#endif
+}
+
+// Also registers the calling thread first, so the main thread is thread 0 in the report
 void startCounters(Counters *counters) {
+#ifdef PROFILE
+    ThreadCounters *mainCounters = getThreadCounters();
+
+    for (int event = 0; event < PerfEvent_Count; event++) {
+        counters->isPerfAvailable[event] = mainCounters->hasPerf && mainCounters->perf.isAvailable[event];
+    }
+
+    counters->overheadTicks = measureProfilerOverhead();
+#endif
+
     size_t count = __rdtsc();
 
     counters->start = count;
@@ -220,48 +587,43 @@ void printPerformanceReport(Counters *counters) {
     size_t totalCount = counters->end - counters->start;
 
 #ifdef PROFILE
-    printTimedBlocksStats(counters, totalCount);
+    printThreadsStats(counters, totalCount);
 #endif
 
     float totalSeconds = ((float) (totalCount)) / ((float) (counters->cpuCounterFrequency));
     printf("\n");
 
     printf("Total time:       %14.10f\n", totalSeconds);
+
+    RdtscFrequency frequency = getRdtscFrequency();
+    printf("Timer frequency:  %llu Hz +- %llu (%s)\n", (unsigned long long) frequency.frequency, (unsigned long long) frequency.error, RdtscSourceNames[frequency.source]);
 }
 
-uint64_t getOsTimeFrequency() {
-    LARGE_INTEGER frequency;
-    QueryPerformanceFrequency(&frequency);
+// Worker threads must have been joined, like for the report
+void writeTrace(Counters *counters, const char *path) {
+#ifdef PROFILE
+    if (!counters->isTracing) {
+        return;
+    }
 
-    return frequency.QuadPart;
-}
+    FILE *file = fopen(path, "wb");
 
-uint64_t getOsTimeStamp() {
-    LARGE_INTEGER timestamp;
+    if (!file) {
+        printf("ERROR (%s:%d): could not open %s\n", __FILE__, __LINE__, path);
+        exit(EXIT_FAILURE);
+    }
 
-    QueryPerformanceCounter(&timestamp);
+    writeTraceEvents(counters, file);
 
-    return timestamp.QuadPart;
+    fclose(file);
+#else
+    (void) counters;
+    (void) path;
+#endif
 }
 
 uint64_t estimateRdtscFrequency() {
-    uint64_t frequency = getOsTimeFrequency();
-
-    uint64_t osTicks;
-    uint64_t cpuStart = __rdtsc();
-    uint64_t osStart = getOsTimeStamp();
-
-    do {
-        osTicks = getOsTimeStamp();
-    } while ((osTicks - osStart) < frequency);
-    uint64_t cpuTicks = __rdtsc() - cpuStart;
-
-    /*
-       printf("Os frequency %llu\n", frequency);
-       printf("Os ticks %llu\n", osTicks - osStart);
-       printf("Cpu frequency %llu\n", cpuTicks);
-    */
-    return cpuTicks;
+    return getRdtscFrequency().frequency;
 }
 
 #endif
@@ -1,68 +1,33 @@
+#ifndef REPETITION_C
+
+#define REPETITION_C
+
 #include "common.c"
 #include "stdio.h"
 #include "stdbool.h"
 #include "stdint.h"
 #include "stdlib.h"
-#include "profiler.c"
-#include "float.h"
-#include "intsafe.h"
-
-#pragma warning(push, 0)
-
-#include "windows.h"
-
-#pragma warning(pop)
-
-#include "psapi.h"
-
-#pragma
-
-#include "io.h"
-#include "sys\stat.h"
-#include "fcntl.h"
+#include "runner.c"
 
-void movAllBytes(size_t size, void *buffer);
+#define REPETITION_RESULTS_PATH "data/repetition_results.json"
 
-void nopAllBytes(size_t size, void *buffer);
+ASM_CALL void movAllBytes(int64_t counter, void *buffer);
 
-void cmpAllBytes(size_t size, void *buffer);
+ASM_CALL void nopAllBytes(int64_t counter, void *buffer);
 
-void decAllBytes(size_t size);
+ASM_CALL void cmpAllBytes(int64_t counter, void *buffer);
 
-void incAllBytes(size_t size);
+ASM_CALL void decAllBytes(int64_t counter);
 
 typedef enum {
     Alloc_None,
     Alloc_Malloc,
     Alloc_VirtualAlloc,
-    Alloc_Large
+    Alloc_Large,
+    Alloc_Count
 } Alloc;
 
-#define MAKE_TEST(f, n, a) {\
-    .minSeconds = FLT_MAX, .minPageFaults = UINT64_MAX, .function = f, .name = n, .alloc = a\
-}
-
-typedef struct {
-    uint64_t ticks;
-    uint64_t bytes;
-    uint64_t pageFaults;
-    uint64_t startTicks;
-    uint64_t startPageFaults;
-} Iteration;
-
-typedef struct {
-    float minSeconds;
-    float maxSeconds;
-    float sumSeconds;
-    uint64_t minPageFaults;
-    uint64_t maxPageFaults;
-    uint64_t sumPageFaults;
-    size_t executionCount;
-    void (*function) (Iteration *iteration, Arena *arena, Alloc alloc, HANDLE process, uint64_t largePageMinimum);
-    char *name;
-    float maxGbPerSecond;
-    Alloc alloc;
-} Test;
+const char *AllocNames[Alloc_Count] = {"none", "malloc", "virtualAlloc", "large"};
 
 char *allocate(Alloc alloc, Arena *arena, size_t size, uint64_t largePageMinimum) {
     char *result = 0;
@@ -76,17 +41,11 @@ char *allocate(Alloc alloc, Arena *arena, size_t size, uint64_t largePageMinimum
         }
         break;
         case Alloc_VirtualAlloc: {
-            result = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+            result = osAllocate(size, 0);
         }
         break;
         case Alloc_Large: {
-            size_t remainder = size % largePageMinimum;
-
-            if (remainder != 0) {
-                size += (largePageMinimum - remainder);
-            }
-
-            result = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            result = osAllocate(size, largePageMinimum);
         }
         break;
         default: {
@@ -97,7 +56,7 @@ char *allocate(Alloc alloc, Arena *arena, size_t size, uint64_t largePageMinimum
     return result;
 }
 
-void freeAllocation(Alloc alloc, Arena *arena, char *buffer) {
+void freeAllocation(Alloc alloc, Arena *arena, char *buffer, size_t size, uint64_t largePageMinimum) {
     switch (alloc) {
         case Alloc_None: {
             arenaFreeAll(arena);
@@ -107,8 +66,12 @@ void freeAllocation(Alloc alloc, Arena *arena, char *buffer) {
             free(buffer);
         }
         break;
-        case Alloc_VirtualAlloc: case Alloc_Large: {
-            VirtualFree(buffer, 0, MEM_RELEASE);
+        case Alloc_VirtualAlloc: {
+            osFree(buffer, size, 0);
+        }
+        break;
+        case Alloc_Large: {
+            osFree(buffer, size, largePageMinimum);
         }
         break;
         default: {
@@ -117,439 +80,224 @@ void freeAllocation(Alloc alloc, Arena *arena, char *buffer) {
     }
 }
 
-void iterationStartCounters(Iteration *iteration, HANDLE process, uint64_t bytes) {
-    iteration->startPageFaults = getPageFaultCount(process);
-    iteration->startTicks = __rdtsc();
-    iteration->bytes = bytes;
-}
+void readWithFread(RepetitionTester *tester, Arena *arena, Alloc alloc, uint64_t largePageMinimum, uint64_t size) {
+    FILE *file = fopen(JSON_PATH, "rb");
 
-void iterationStopCounters(Iteration *iteration, HANDLE process) {
-    uint64_t ticks = __rdtsc();
-    uint64_t pageFaults = getPageFaultCount(process);
-    iteration->pageFaults = pageFaults - iteration->startPageFaults;
-    iteration->ticks = ticks - iteration->startTicks;
-}
+    if (!file) {
+        die(__FILE__, __LINE__, errno, "could not open %s", JSON_PATH);
+    }
 
-void repeatTest(
-    Test *test,
-    uint64_t rdtscFrequency,
-    Arena *arena,
-    HANDLE process,
-    uint64_t largePageMinimum
-) {
-    uint64_t ticksSinceLastReset = __rdtsc();
+    char *buffer = allocate(alloc, arena, size, largePageMinimum);
 
-    float secondsSinceLastReset = 0.0f;
+    beginSample(tester);
 
-    printf("%s:\n", test->name);
+    size_t read = fread(buffer, 1, size, file);
 
-    while (true) {
-        Iteration iteration = {0};
+    endSample(tester, size);
 
-        test->function(&iteration, arena, test->alloc, process, largePageMinimum);
+    fclose(file);
 
-        float secondsForFunction = (float) iteration.ticks / (float) rdtscFrequency;
-        uint64_t pageFaults = iteration.pageFaults;
+    freeAllocation(alloc, arena, buffer, size, largePageMinimum);
 
-        if (secondsForFunction < test->minSeconds) {
-            test->minSeconds = secondsForFunction;
+    if (read < size) {
+        die(__FILE__, __LINE__, errno, "Read failed");
+    }
+}
 
-            secondsSinceLastReset = 0.0f;
+void readWithReadFile(RepetitionTester *tester, Arena *arena, Alloc alloc, uint64_t largePageMinimum, uint64_t size) {
+    File file = osOpenFile(JSON_PATH);
 
-            ticksSinceLastReset = __rdtsc();
-        }
+    if (file == INVALID_FILE) {
+        die(__FILE__, __LINE__, 0, "could not open %s: %s", JSON_PATH, osErrorMessage());
+    }
 
-        if (secondsForFunction > test->maxSeconds) {
-            test->maxSeconds = secondsForFunction;
-        }
+    char *buffer = allocate(alloc, arena, size, largePageMinimum);
 
-        if (pageFaults < test->minPageFaults) {
-            test->minPageFaults = pageFaults;
-        }
+    char *cursor = buffer;
 
-        if (pageFaults > test->maxPageFaults) {
-            test->maxPageFaults = pageFaults;
-        }
+    uint64_t remainingBytes = size;
 
-        test->executionCount++;
-        test->sumSeconds += secondsForFunction;
-        test->sumPageFaults += pageFaults;
-
-        float averageSeconds = test->sumSeconds / (float) test->executionCount;
-        float averagePageFaults = (float) test->sumPageFaults / (float) test->executionCount;
-
-        float gb = ((float) iteration.bytes) / (1024.0f * 1024.0f * 1024.0f);
-        float kb = ((float) iteration.bytes) / 1024.0f;
-
-        float minGbPerSecond = gb / test->maxSeconds;
-        float maxGbPerSecond = gb / test->minSeconds;
-        float averageGbPerSecond = gb / averageSeconds;
-
-        test->maxGbPerSecond = maxGbPerSecond;
-
-        float minKbPerFault = kb / (float) test->maxPageFaults;
-        float maxKbPerFault = kb / (float) test->minPageFaults;
-        float averageKbPerFault = kb / averagePageFaults;
-
-        printf(
-            "Best : %f s, Throughput: %f Gb/s, PF: %f (%f kb/fault)\n",
-            test->minSeconds,
-            maxGbPerSecond,
-            (float) test->minPageFaults,
-            maxKbPerFault
-        );
-        printf(
-            "Worst: %f s, Throughput: %f Gb/s, PF: %f (%f kb/fault)\n",
-            test->maxSeconds,
-            minGbPerSecond,
-            (float) test->maxPageFaults,
-            minKbPerFault
-        );
-        printf(
-            "Avg. : %f s, Throughput: %f Gb/s, PF: %f (%f kb/fault)\n",
-            averageSeconds,
-            averageGbPerSecond,
-            averagePageFaults,
-            averageKbPerFault
-        );
-
-        uint64_t ticks = __rdtsc();
-        secondsSinceLastReset = ((float) (ticks - ticksSinceLastReset)) / ((float) rdtscFrequency);
-
-        if (secondsSinceLastReset > 10.0f) {
-            break;
-        }
+    beginSample(tester);
 
-        for (size_t i = 0; i < 3; i++) {
-            printf("\033[F");
-        }
-    }
+    while (remainingBytes > 0) {
+        size_t read = 0;
 
-    printf("\n");
-}
+        bool success = osReadFile(file, cursor, remainingBytes, size - remainingBytes, &read);
 
-// void readWithFread(
-//     Iteration *iteration,
-//     Arena *arena,
-//     Alloc alloc,
-//     HANDLE process,
-//     uint64_t largePageMinimum
-// ) {
-//     FILE *file = fopen(JSON_PATH, "rb");
-
-//     if (file != NULL) {
-//         size_t size = getFileSize(file, JSON_PATH);
-
-//         char *buffer = 0;
-
-//         buffer = allocate(alloc, arena, size, largePageMinimum);
-
-//         iterationStartCounters(iteration, process, size);
-
-//         size_t read = fread(buffer, 1, size, file);
-
-//         iterationStopCounters(iteration, process);
-
-//         fclose(file);
-
-//         freeAllocation(alloc, arena, buffer);
-
-//         if (read < 1) {
-//             die(__FILE__, __LINE__, errno, "Read failed");
-//         }
-//     }
-// }
-
-// void readWith_read(
-//     Iteration *iteration,
-//     Arena *arena,
-//     Alloc alloc,
-//     HANDLE process,
-//     uint64_t largePageMinimum
-// ) {
-//     int fd = _open(JSON_PATH, _O_RDONLY | _O_BINARY);
-
-//     if (fd != 0) {
-//         struct __stat64 fileStat = {0};
-//         if (_stat64(JSON_PATH, &fileStat) == 0) {
-//             size_t size = fileStat.st_size;
-//             char *buffer = 0;
-//             buffer = allocate(alloc, arena, size, largePageMinimum);
-//             char *cursor = buffer;
-//             size_t remainingBytes = size;
-//             iterationStartCounters(iteration, process, size);
-//             while (remainingBytes > 0) {
-//                 int bytesToRead = 0;
-//                 if (size > INT_MAX) {
-//                     bytesToRead = INT_MAX;
-//                 }
-//                 else {
-//                     bytesToRead = (int) size;
-//                 }
-//                 int read = _read(fd, cursor, bytesToRead);
-//                 remainingBytes -= read;
-//                 cursor += read;
-//                 if (read < size) {
-//                     die(__FILE__, __LINE__, errno, "Read failed");
-//                 }
-//             }
-//             iterationStopCounters(iteration, process);
-//             _close(fd);
-//             freeAllocation(alloc, arena, buffer);
-//         }
-//     }
-// }
-
-void readWithReadFile(
-    Iteration *iteration,
-    Arena *arena,
-    Alloc alloc,
-    HANDLE process,
-    uint64_t largePageMinimum
-) {
-    HANDLE file = CreateFile(JSON_PATH, GENERIC_READ, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-
-    if (file != INVALID_HANDLE_VALUE) {
-        LARGE_INTEGER size = {0};
-        if (GetFileSizeEx(file, &size)) {
-            char *buffer = 0;
-
-            buffer = allocate(alloc, arena, size.QuadPart, largePageMinimum);
-
-            char *cursor = buffer;
-
-            uint64_t remainingBytes = (uint64_t) size.QuadPart;
-
-            iterationStartCounters(iteration, process, size.QuadPart);
-
-            while (remainingBytes > 0) {
-                DWORD bytesToRead = 0;
-                if (remainingBytes > DWORD_MAX) {
-                    bytesToRead = DWORD_MAX;
-                }
-                else {
-                    bytesToRead = (DWORD) remainingBytes;
-                }
-
-                DWORD read = 0;
-
-                BOOL success = ReadFile(file, cursor, bytesToRead, &read, NULL);
-
-                cursor += read;
-                remainingBytes -= read;
-                if (!success || bytesToRead != read) {
-                    break;
-                }
-            }
-            iterationStopCounters(iteration, process);
-
-            if (remainingBytes > 0) {
-                die(__FILE__, __LINE__, 0, "Error while reading file");
-            }
-
-            freeAllocation(alloc, arena, buffer);
+        cursor += read;
+        remainingBytes -= read;
+        if (!success || read == 0) {
+            break;
         }
+    }
+    endSample(tester, size);
 
-        CloseHandle(file);
+    if (remainingBytes > 0) {
+        die(__FILE__, __LINE__, 0, "Error while reading file");
     }
-}
 
-// void movBuffer(Iteration *iteration, Arena *arena, Alloc alloc, HANDLE process, uint64_t largePageMinimum) {
-//     FILE *file = fopen(JSON_PATH, "rb");
+    freeAllocation(alloc, arena, buffer, size, largePageMinimum);
 
-//     if (file != NULL) {
-//         size_t size = getFileSize(file, JSON_PATH);
-//         char *buffer = 0;
+    osCloseFile(file);
+}
 
-//         buffer = allocate(alloc, arena, size, largePageMinimum);
+void writeBuffer(RepetitionTester *tester, Arena *arena, Alloc alloc, uint64_t largePageMinimum, uint64_t size) {
+    char *buffer = allocate(alloc, arena, size, largePageMinimum);
 
-//         iterationStartCounters(iteration, process, size);
+    beginSample(tester);
 
-//         movAllBytes(size, buffer);
+    for (uint64_t i = 0; i < size; i++) {
+        buffer[i] = (char) i;
+    }
 
-//         iterationStopCounters(iteration, process);
+    endSample(tester, size);
 
-//         freeAllocation(alloc, arena, buffer);
+    freeAllocation(alloc, arena, buffer, size, largePageMinimum);
+}
 
-//         fclose(file);
-//     }
-// }
+void movBuffer(RepetitionTester *tester, Arena *arena, Alloc alloc, uint64_t largePageMinimum, uint64_t size) {
+    char *buffer = allocate(alloc, arena, size, largePageMinimum);
 
-// void nopBuffer(Iteration *iteration, Arena *arena, Alloc alloc, HANDLE process, uint64_t largePageMinimum) {
-//     FILE *file = fopen(JSON_PATH, "rb");
+    beginSample(tester);
 
-//     if (file != NULL) {
-//         size_t size = getFileSize(file, JSON_PATH);
-//         char *buffer = 0;
+    movAllBytes((int64_t) size, buffer);
 
-//         buffer = allocate(alloc, arena, size, largePageMinimum);
+    endSample(tester, size);
 
-//         iterationStartCounters(iteration, process, size);
+    freeAllocation(alloc, arena, buffer, size, largePageMinimum);
+}
 
-//         nopAllBytes(size, buffer);
+void nopBuffer(RepetitionTester *tester, Arena *arena, Alloc alloc, uint64_t largePageMinimum, uint64_t size) {
+    char *buffer = allocate(alloc, arena, size, largePageMinimum);
 
-//         iterationStopCounters(iteration, process);
+    beginSample(tester);
 
-//         freeAllocation(alloc, arena, buffer);
+    nopAllBytes((int64_t) size, buffer);
 
-//         fclose(file);
-//     }
-// }
+    endSample(tester, size);
 
-// void cmpBuffer(Iteration *iteration, Arena *arena, Alloc alloc, HANDLE process, uint64_t largePageMinimum) {
-//     FILE *file = fopen(JSON_PATH, "rb");
+    freeAllocation(alloc, arena, buffer, size, largePageMinimum);
+}
 
-//     if (file != NULL) {
-//         size_t size = getFileSize(file, JSON_PATH);
-//         char *buffer = 0;
+void cmpBuffer(RepetitionTester *tester, Arena *arena, Alloc alloc, uint64_t largePageMinimum, uint64_t size) {
+    char *buffer = allocate(alloc, arena, size, largePageMinimum);
 
-//         buffer = allocate(alloc, arena, size, largePageMinimum);
+    beginSample(tester);
 
-//         iterationStartCounters(iteration, process, size);
+    cmpAllBytes((int64_t) size, buffer);
 
-//         cmpAllBytes(size, buffer);
+    endSample(tester, size);
 
-//         iterationStopCounters(iteration, process);
+    freeAllocation(alloc, arena, buffer, size, largePageMinimum);
+}
 
-//         freeAllocation(alloc, arena, buffer);
+void dec(RepetitionTester *tester, Arena *arena, Alloc alloc, uint64_t largePageMinimum, uint64_t size) {
+    (void) arena;
+    (void) alloc;
+    (void) largePageMinimum;
 
-//         fclose(file);
-//     }
-// }
+    beginSample(tester);
 
-// void dec(Iteration *iteration, Arena *arena, Alloc alloc, HANDLE process, uint64_t largePageMinimum) {
-//     UNREFERENCED_PARAMETER(arena);
-//     UNREFERENCED_PARAMETER(alloc);
-//     UNREFERENCED_PARAMETER(arena);
-//     UNREFERENCED_PARAMETER(largePageMinimum);
+    decAllBytes((int64_t) size);
 
-//     FILE *file = fopen(JSON_PATH, "rb");
+    endSample(tester, size);
+}
 
-//     if (file != NULL) {
-//         size_t size = getFileSize(file, JSON_PATH);
+typedef struct {
+    const char *name;
+    void (*function) (RepetitionTester *tester, Arena *arena, Alloc alloc, uint64_t largePageMinimum, uint64_t size);
+    // The kernels that touch no buffer only make sense without an allocation
+    bool allocates;
+} RepetitionKernel;
+
+RepetitionKernel RepetitionKernels[] = {
+    {"ReadFile", readWithReadFile, true},
+    {"fread", readWithFread, true},
+    {"writeBuffer", writeBuffer, true},
+    {"movBuffer", movBuffer, true},
+    {"nopBuffer", nopBuffer, true},
+    {"cmpBuffer", cmpBuffer, true},
+    {"dec", dec, false},
+};
+
+// Every kernel works on as many bytes as the input has, the size is read once here rather than in every sample.
+// Large pages are allocated once up front too, an empty pool would otherwise only show up as a NULL buffer mid test.
+bool setupRepetitionKernel(Benchmark *benchmark, BenchmarkContext *context) {
+    if (benchmark->arguments[0] == Alloc_Large && context->largePageMinimum == 0) {
+        printf("Large pages are not available\n");
+
+        return false;
+    }
 
-//         iterationStartCounters(iteration, process, size);
+    File file = osOpenFile(JSON_PATH);
 
-//         decAllBytes(size);
+    if (file == INVALID_FILE) {
+        printf("Could not open %s, generate it with input first\n", JSON_PATH);
 
-//         iterationStopCounters(iteration, process);
+        return false;
+    }
 
-//         fclose(file);
-//     }
-// }
+    uint64_t size = 0;
+    bool hasSize = osGetFileSize(file, &size);
 
-// void writeBuffer(Iteration *iteration, Arena *arena, Alloc alloc, HANDLE process, uint64_t largePageMinimum) {
-//     FILE *file = fopen(JSON_PATH, "rb");
+    osCloseFile(file);
 
-//     if (file != NULL) {
-//         size_t size = getFileSize(file, JSON_PATH);
-//         char *buffer = 0;
+    benchmark->arguments[1] = (int64_t) size;
 
-//         buffer = allocate(alloc, arena, size, largePageMinimum);
+    if (!hasSize || size == 0) {
+        return false;
+    }
 
-//         iterationStartCounters(iteration, process, size);
+    if (benchmark->arguments[0] == Alloc_Large) {
+        void *memory = osAllocate(size, context->largePageMinimum);
 
-//         for (uint64_t i = 0; i < size; i++) {
-//             buffer[i] = (char) i;
-//         }
+        if (!memory) {
+            printf("Large pages are not available, %llu bytes could not be allocated\n", (unsigned long long) size);
 
-//         iterationStopCounters(iteration, process);
+            return false;
+        }
 
-//         freeAllocation(alloc, arena, buffer);
+        osFree(memory, size, context->largePageMinimum);
+    }
 
-//         fclose(file);
-//     }
-// }
+    return true;
+}
 
-uint64_t enableLargePages() {
-    HANDLE token = INVALID_HANDLE_VALUE;
+void sampleRepetitionKernel(Benchmark *benchmark, BenchmarkContext *context, RepetitionTester *tester) {
+    RepetitionKernels[benchmark->kernel].function(
+        tester,
+        &context->arena,
+        (Alloc) benchmark->arguments[0],
+        context->largePageMinimum,
+        (uint64_t) benchmark->arguments[1]
+    );
+}
 
-    uint64_t result = 0;
+void registerRepetitionBenchmarks(BenchmarkRegistry *registry) {
+    for (size_t kernelIndex = 0; kernelIndex < ARRAYSIZE(RepetitionKernels); kernelIndex++) {
+        RepetitionKernel *kernel = &RepetitionKernels[kernelIndex];
 
-    if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token)) {
-        TOKEN_PRIVILEGES privileges = {
-            .PrivilegeCount = 1,
-            .Privileges = {{.Attributes = SE_PRIVILEGE_ENABLED}}
-        };
+        int allocCount = kernel->allocates ? Alloc_Count : 1;
 
-        if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0] .Luid)) {
-            AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL);
+        for (int alloc = 0; alloc < allocCount; alloc++) {
+            Benchmark *benchmark = addBenchmark(registry, "repetition", kernel->name, sampleRepetitionKernel);
+            benchmark->kernel = kernelIndex;
+            benchmark->arguments[0] = alloc;
+            benchmark->setup = setupRepetitionKernel;
 
-            DWORD error = GetLastError();
-            if (error == ERROR_SUCCESS) {
-                result = GetLargePageMinimum();
-            }
-            else {
-                printf("Could not adjust privileges, error = %d\n", error);
-            }
+            addBenchmarkParameter(benchmark, makeParameter("alloc", AllocNames[alloc]));
         }
-        else {
-            printf("Could not lookup privileges\n");
-        }
-    }
-
-    else {
-        printf("Could not open process token\n");
     }
-
-    return result;
 }
 
-int main(void) {
-    uint64_t rdtscFrequency = estimateRdtscFrequency();
-
-    Arena arena = arenaInit();
-
-    HANDLE process = GetCurrentProcess();
-
-    uint64_t largePageMinimum = enableLargePages();
-
-    Test tests[] = {
-        //MAKE_TEST(dec, "dec", Alloc_None),
-        // MAKE_TEST(writeBuffer, "writeBuffer", Alloc_None),
-        // MAKE_TEST(movBuffer, "movBuffer", Alloc_None),
-        // MAKE_TEST(cmpBuffer, "cmpBuffer", Alloc_None),
-        // MAKE_TEST(nopBuffer, "nopBuffer", Alloc_None),
-        // MAKE_TEST(writeBuffer, "malloc + writeBuffer", Alloc_Malloc),
-        // MAKE_TEST(readWith_read, "VirtualAlloc + writeBuffer", Alloc_VirtualAlloc),
-        // MAKE_TEST(readWith_read, "VirtualAlloc (large) + writeBuffer", Alloc_Large),
-        // MAKE_TEST(readWith_read, "_read", Alloc_None),
-        // MAKE_TEST(readWith_read, "malloc + _read", Alloc_Malloc),
-        // MAKE_TEST(readWith_read, "VirtualAlloc + _read", Alloc_VirtualAlloc),
-        // MAKE_TEST(readWith_read, "VirtualAlloc (large) + _read", Alloc_Large),
-        // MAKE_TEST(readWithFread, "fread", Alloc_None),
-        // MAKE_TEST(readWithFread, "malloc + fread", Alloc_Malloc),
-        // MAKE_TEST(readWithFread, "VirtualAlloc + fread", Alloc_VirtualAlloc),
-        // MAKE_TEST(readWithFread, "VirtualAlloc (large) + fread", Alloc_Large),
-        // MAKE_TEST(readWithReadFile, "ReadFile", Alloc_None),
-        // MAKE_TEST(readWithReadFile, "malloc + ReadFile", Alloc_Malloc),
-        MAKE_TEST(readWithReadFile, "VirtualAlloc + ReadFile", Alloc_VirtualAlloc),
-         //MAKE_TEST(readWithReadFile, "VirtualAlloc (large) + ReadFile", Alloc_Large),
-    };
-
-    while (true) {
-        for (size_t i = 0; i < ARRAYSIZE(tests); i++) {
-            Test *test = tests + i;
-
-            if (test->alloc != Alloc_Large || largePageMinimum != 0) {
-                repeatTest(test, rdtscFrequency, &arena, process, largePageMinimum);
-            }
-        }
-
-        float maxGbPerSecond = 0;
+#ifndef BENCHMARK_SUITE
 
-        char *bestTest = "";
+int main(int argc, char **argv) {
+    BenchmarkRegistrar *registrars[] = {registerRepetitionBenchmarks};
 
-        for (size_t i = 0; i < ARRAYSIZE(tests); i++) {
-            Test test = tests[i];
-            if (test.maxGbPerSecond > maxGbPerSecond) {
-                maxGbPerSecond = test.maxGbPerSecond;
-                bestTest = test.name;
-            }
-        }
+    return runBenchmarks(argc, argv, registrars, ARRAYSIZE(registrars), REPETITION_RESULTS_PATH);
+}
 
-        printf("BEST THROUGHPUT: %s, %f Gb/s\n\n", bestTest, maxGbPerSecond);
-    }
+#endif
 
-    return 0;
-}
+#endif
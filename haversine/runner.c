@@ -0,0 +1,569 @@
+#ifndef RUNNER_C
+
+#define RUNNER_C
+
+#include "common.c"
+#include "profiler.c"
+#include "tester.c"
+#include "backing.c"
+
+#define KB(b) (1024LL * b)
+
+#define MB(b) (KB(KB(b)))
+
+#define GB(b) (KB(MB(b)))
+
+#define BENCHMARK_CAPACITY 1024
+
+#define BENCHMARK_NAME_CAPACITY 64
+
+#define BENCHMARK_LABEL_CAPACITY 512
+
+#define BENCHMARK_PARAMETER_CAPACITY 4
+
+#define BENCHMARK_ARGUMENT_COUNT 4
+
+#define BENCHMARK_FILTER_CAPACITY 32
+
+#define BENCHMARK_REPORT_CAPACITY 16
+
+// Without a limit of their own, fixed iteration runs are only stopped by the sample count
+#define BENCHMARK_UNLIMITED_SECONDS 1e9
+
+// /proc/stat counts in hundredths of a second, shorter waits would only see a few ticks
+#define SIBLING_CHECK_MILLISECONDS 200
+
+#define SIBLING_BUSY_LIMIT 0.05
+
+#define SIBLING_CAPACITY 8
+
+typedef struct Benchmark Benchmark;
+
+// Owned by the runner and shared by every benchmark, the backing buffer is sized for the largest selected one
+typedef struct {
+    Backing backing;
+    char backingDescription[BACKING_DESCRIPTION_CAPACITY];
+    Buffer buffer;
+    Arena arena;
+    uint64_t largePageMinimum;
+    CpuFeatures features;
+} BenchmarkContext;
+
+// Takes one sample, calling beginSample and endSample around the code under test
+typedef void BenchmarkSample(Benchmark *benchmark, BenchmarkContext *context, RepetitionTester *tester);
+
+// Runs once before the samples, outside of any timing, returns false to skip the benchmark
+typedef bool BenchmarkSetup(Benchmark *benchmark, BenchmarkContext *context);
+
+// Kernels are picked by index from the table of the experiment that registered them, arguments are
+// the point of the parameter space and parameters describe it in the results
+struct Benchmark {
+    char name[BENCHMARK_NAME_CAPACITY];
+    const char *group;
+    BenchmarkSample *sample;
+    BenchmarkSetup *setup;
+    size_t kernel;
+    int64_t arguments[BENCHMARK_ARGUMENT_COUNT];
+    uint64_t bufferSize;
+    uint8_t *buffer;
+    bool needsAvx2;
+    bool needsAvx512;
+    TestParameter parameters[BENCHMARK_PARAMETER_CAPACITY];
+    size_t parameterCount;
+    bool selected;
+    TestStats stats;
+};
+
+typedef struct BenchmarkRegistry BenchmarkRegistry;
+
+// Called after every round, with the stats of the benchmarks that ran in it
+typedef void BenchmarkReport(BenchmarkRegistry *registry, BenchmarkContext *context);
+
+struct BenchmarkRegistry {
+    Benchmark *benchmarks;
+    size_t count;
+    BenchmarkReport *reports[BENCHMARK_REPORT_CAPACITY];
+    size_t reportCount;
+};
+
+typedef void BenchmarkRegistrar(BenchmarkRegistry *registry);
+
+// Backing arguments are kept apart, so a filter text never changes the backing
+typedef struct {
+    char *filters[BENCHMARK_FILTER_CAPACITY];
+    size_t filterCount;
+    char **backingArguments;
+    int backingArgumentCount;
+    bool list;
+    size_t iterations;
+    double seconds;
+    size_t rounds;
+    const char *resultsPath;
+    bool pin;
+    uint32_t processor;
+    bool raisePriority;
+    bool discardTransitions;
+    bool checkSiblings;
+} BenchmarkOptions;
+
+BenchmarkRegistry initBenchmarkRegistry() {
+    BenchmarkRegistry result = {0};
+
+    result.benchmarks = calloc(BENCHMARK_CAPACITY, sizeof(Benchmark));
+
+    if (!result.benchmarks) {
+        die(__FILE__, __LINE__, errno, "could not allocate %d benchmarks", BENCHMARK_CAPACITY);
+    }
+
+    return result;
+}
+
+Benchmark *addBenchmark(BenchmarkRegistry *registry, const char *group, const char *kernel, BenchmarkSample *sample) {
+    if (registry->count == BENCHMARK_CAPACITY) {
+        die(__FILE__, __LINE__, 0, "more than %d benchmarks registered", BENCHMARK_CAPACITY);
+    }
+
+    Benchmark *result = &registry->benchmarks[registry->count++];
+
+    snprintf(result->name, sizeof(result->name), "%s/%s", group, kernel);
+    result->group = group;
+    result->sample = sample;
+
+    return result;
+}
+
+void addBenchmarkParameter(Benchmark *benchmark, TestParameter parameter) {
+    assert(benchmark->parameterCount < BENCHMARK_PARAMETER_CAPACITY);
+
+    benchmark->parameters[benchmark->parameterCount++] = parameter;
+}
+
+void addBenchmarkReport(BenchmarkRegistry *registry, BenchmarkReport *report) {
+    assert(registry->reportCount < BENCHMARK_REPORT_CAPACITY);
+
+    registry->reports[registry->reportCount++] = report;
+}
+
+// The name followed by the parameters, the same key compare matches tests by
+void getBenchmarkLabel(Benchmark *benchmark, char label[BENCHMARK_LABEL_CAPACITY]) {
+    size_t size = (size_t) snprintf(label, BENCHMARK_LABEL_CAPACITY, "%s", benchmark->name);
+
+    for (size_t parameterIndex = 0; parameterIndex < benchmark->parameterCount && size < BENCHMARK_LABEL_CAPACITY; parameterIndex++) {
+        TestParameter *parameter = &benchmark->parameters[parameterIndex];
+
+        size += (size_t) snprintf(label + size, BENCHMARK_LABEL_CAPACITY - size, " %s=%s", parameter->name, parameter->value);
+    }
+}
+
+size_t selectBenchmarks(BenchmarkRegistry *registry, BenchmarkOptions *options) {
+    size_t result = 0;
+
+    for (size_t benchmarkIndex = 0; benchmarkIndex < registry->count; benchmarkIndex++) {
+        Benchmark *benchmark = &registry->benchmarks[benchmarkIndex];
+
+        char label[BENCHMARK_LABEL_CAPACITY];
+        getBenchmarkLabel(benchmark, label);
+
+        benchmark->selected = options->filterCount == 0;
+
+        for (size_t filterIndex = 0; filterIndex < options->filterCount; filterIndex++) {
+            if (strstr(label, options->filters[filterIndex])) {
+                benchmark->selected = true;
+            }
+        }
+
+        result += benchmark->selected;
+    }
+
+    return result;
+}
+
+void printBenchmarkUsage(char *program) {
+    printf(
+        "Usage: %s [list] [filter TEXT]... [iterations N] [seconds S] [rounds N] [results PATH] [pin N] [priority] [discard] [siblings] [BACKING]...\n",
+        program
+    );
+    printf("  list          print the selected benchmarks without running them\n");
+    printf("  filter TEXT   run the benchmarks whose name and parameters contain TEXT, can be repeated\n");
+    printf("  iterations N  take exactly N samples of each benchmark\n");
+    printf("  seconds S     stop each benchmark after S seconds\n");
+    printf("  rounds N      run the selection N times, the results file holds the last round\n");
+    printf("  results PATH  where to write the results\n");
+    printf("  pin N         run on processor N only\n");
+    printf("  priority      raise the priority of the process, which needs privileges\n");
+    printf("  discard       drop the samples that ran through a clock change instead of only counting them\n");
+    printf("  siblings      before each benchmark, warn when the other hardware threads of the core are busy\n");
+    printf("  BACKING       any of");
+
+    for (int pageSize = 0; pageSize < PageSize_Count; pageSize++) {
+        printf(" %s", PageSizeNames[pageSize]);
+    }
+
+    printf(" prefault noprefault");
+
+    for (int numa = 0; numa < Numa_Count; numa++) {
+        printf(" %s", NumaNames[numa]);
+    }
+
+    printf("\n");
+}
+
+// Returns false on an argument that is neither an option nor a backing
+bool parseBenchmarkOptions(int argc, char **argv, BenchmarkOptions *options) {
+    options->backingArguments = calloc((size_t) argc, sizeof(char *));
+
+    if (!options->backingArguments) {
+        die(__FILE__, __LINE__, errno, "could not allocate %d arguments", argc);
+    }
+
+    options->backingArguments[options->backingArgumentCount++] = argv[0];
+
+    for (int argIndex = 1; argIndex < argc; argIndex++) {
+        char *arg = argv[argIndex];
+        bool hasValue = argIndex + 1 < argc;
+
+        if (strcmp(arg, "list") == 0) {
+            options->list = true;
+        }
+        else if (strcmp(arg, "filter") == 0 && hasValue) {
+            if (options->filterCount == BENCHMARK_FILTER_CAPACITY) {
+                die(__FILE__, __LINE__, 0, "more than %d filters", BENCHMARK_FILTER_CAPACITY);
+            }
+
+            options->filters[options->filterCount++] = argv[++argIndex];
+        }
+        else if (strcmp(arg, "iterations") == 0 && hasValue) {
+            options->iterations = strtoull(argv[++argIndex], NULL, 10);
+
+            if (options->iterations == 0) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "seconds") == 0 && hasValue) {
+            options->seconds = atof(argv[++argIndex]);
+
+            if (options->seconds <= 0) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "rounds") == 0 && hasValue) {
+            options->rounds = strtoull(argv[++argIndex], NULL, 10);
+
+            if (options->rounds == 0) {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "results") == 0 && hasValue) {
+            options->resultsPath = argv[++argIndex];
+        }
+        else if (strcmp(arg, "pin") == 0 && hasValue) {
+            char *end = NULL;
+            char *value = argv[++argIndex];
+
+            options->pin = true;
+            options->processor = (uint32_t) strtoul(value, &end, 10);
+
+            if (end == value || *end != '\0') {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "priority") == 0) {
+            options->raisePriority = true;
+        }
+        else if (strcmp(arg, "discard") == 0) {
+            options->discardTransitions = true;
+        }
+        else if (strcmp(arg, "siblings") == 0) {
+            options->checkSiblings = true;
+        }
+        else if (isBackingArgument(arg)) {
+            options->backingArguments[options->backingArgumentCount++] = arg;
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TesterSettings getBenchmarkTesterSettings(BenchmarkOptions *options) {
+    TesterSettings result = getDefaultTesterSettings();
+
+    if (options->iterations) {
+        result.minSamples = options->iterations;
+        result.maxSamples = options->iterations;
+        result.maxSeconds = BENCHMARK_UNLIMITED_SECONDS;
+    }
+
+    if (options->seconds > 0) {
+        result.maxSeconds = options->seconds;
+    }
+
+    result.discardTransitions = options->discardTransitions;
+
+    return result;
+}
+
+// Another thread on the same core shares its caches and execution units, the numbers only hold while it is idle
+void checkSiblingsIdle(uint32_t processor) {
+    uint32_t siblings[SIBLING_CAPACITY];
+    size_t siblingCount = osGetSiblingProcessors(processor, siblings, ARRAYSIZE(siblings));
+
+    uint64_t startBusy[SIBLING_CAPACITY];
+    uint64_t startTotal[SIBLING_CAPACITY];
+
+    for (size_t siblingIndex = 0; siblingIndex < siblingCount; siblingIndex++) {
+        if (!osGetProcessorTimes(siblings[siblingIndex], &startBusy[siblingIndex], &startTotal[siblingIndex])) {
+            printf("WARNING: could not read the load of processor %u\n", siblings[siblingIndex]);
+
+            return;
+        }
+    }
+
+    osSleep(SIBLING_CHECK_MILLISECONDS);
+
+    for (size_t siblingIndex = 0; siblingIndex < siblingCount; siblingIndex++) {
+        uint64_t busy;
+        uint64_t total;
+
+        if (osGetProcessorTimes(siblings[siblingIndex], &busy, &total) && total > startTotal[siblingIndex]) {
+            double load = (double) (busy - startBusy[siblingIndex]) / (double) (total - startTotal[siblingIndex]);
+
+            if (load > SIBLING_BUSY_LIMIT) {
+                printf("WARNING: processor %u, a sibling of %u, was %.0f%% busy\n", siblings[siblingIndex], processor, load * 100.0);
+            }
+        }
+    }
+}
+
+void runBenchmark(Benchmark *benchmark, BenchmarkContext *context, RepetitionTester *tester, ResultsWriter *results) {
+    char label[BENCHMARK_LABEL_CAPACITY];
+    getBenchmarkLabel(benchmark, label);
+
+    printf("%s:\n", label);
+
+    memset(&benchmark->stats, 0, sizeof(benchmark->stats));
+
+    if ((benchmark->needsAvx2 && !context->features.avx2) || (benchmark->needsAvx512 && !context->features.avx512)) {
+        printf("Skipped, the cpu lacks %s\n\n", benchmark->needsAvx512 ? "avx512" : "avx2");
+
+        return;
+    }
+
+    benchmark->buffer = benchmark->bufferSize ? context->buffer.memory : NULL;
+
+    if (benchmark->setup && !benchmark->setup(benchmark, context)) {
+        printf("Skipped\n\n");
+
+        return;
+    }
+
+    setTestBuffer(tester, benchmark->buffer, benchmark->bufferSize);
+    startTest(tester);
+
+    while (isTesting(tester)) {
+        benchmark->sample(benchmark, context, tester);
+    }
+
+    benchmark->stats = computeTestStats(tester);
+
+    printTestStats(&benchmark->stats);
+
+    TestParameter parameters[BENCHMARK_PARAMETER_CAPACITY + 1];
+    size_t parameterCount = benchmark->parameterCount;
+
+    memcpy(parameters, benchmark->parameters, parameterCount * sizeof(TestParameter));
+
+    // Checked after every benchmark, without prefault the buffer only gets its pages from the benchmarks themselves
+    if (benchmark->bufferSize) {
+        char backingDescription[BACKING_DESCRIPTION_CAPACITY];
+        describeBuffer(&context->buffer, backingDescription, sizeof(backingDescription));
+
+        if (strcmp(backingDescription, context->backingDescription) != 0) {
+            printf("WARNING: asked for %s, the buffer has %s\n", context->backingDescription, backingDescription);
+        }
+
+        parameters[parameterCount++] = makeParameter("backing", backingDescription);
+    }
+
+    writeTestResults(results, tester, &benchmark->stats, benchmark->name, parameters, parameterCount);
+}
+
+void printBestThroughputs(BenchmarkRegistry *registry) {
+    for (size_t groupIndex = 0; groupIndex < registry->count; groupIndex++) {
+        const char *group = registry->benchmarks[groupIndex].group;
+
+        bool isFirstOfGroup = true;
+
+        for (size_t previousIndex = 0; previousIndex < groupIndex; previousIndex++) {
+            if (strcmp(registry->benchmarks[previousIndex].group, group) == 0) {
+                isFirstOfGroup = false;
+                break;
+            }
+        }
+
+        if (!isFirstOfGroup) {
+            continue;
+        }
+
+        double maxThroughput = 0;
+        Benchmark *best = NULL;
+
+        for (size_t benchmarkIndex = groupIndex; benchmarkIndex < registry->count; benchmarkIndex++) {
+            Benchmark *benchmark = &registry->benchmarks[benchmarkIndex];
+
+            if (strcmp(benchmark->group, group) == 0 && benchmark->stats.count > 0) {
+                double throughput = getThroughput(&benchmark->stats, benchmark->stats.median);
+
+                if (throughput > maxThroughput) {
+                    maxThroughput = throughput;
+                    best = benchmark;
+                }
+            }
+        }
+
+        if (best) {
+            char label[BENCHMARK_LABEL_CAPACITY];
+            getBenchmarkLabel(best, label);
+
+            printf("BEST MEDIAN THROUGHPUT: %s, %f gb/s\n", label, maxThroughput / (1024.0 * 1024.0 * 1024.0));
+        }
+    }
+
+    printf("\n");
+}
+
+// Registers every kernel, then runs the ones matching the filters for a number of rounds and returns the exit code
+int runBenchmarks(
+    int argc,
+    char **argv,
+    BenchmarkRegistrar **registrars,
+    size_t registrarCount,
+    const char *defaultResultsPath
+) {
+    BenchmarkOptions options = {0};
+    options.rounds = 1;
+    options.resultsPath = defaultResultsPath;
+
+    if (!parseBenchmarkOptions(argc, argv, &options)) {
+        printBenchmarkUsage(argv[0]);
+
+        return 2;
+    }
+
+    BenchmarkRegistry registry = initBenchmarkRegistry();
+
+    for (size_t registrarIndex = 0; registrarIndex < registrarCount; registrarIndex++) {
+        registrars[registrarIndex](&registry);
+    }
+
+    size_t selectedCount = selectBenchmarks(&registry, &options);
+
+    if (selectedCount == 0) {
+        printf("No benchmark matches the filters, run with list to see them all\n");
+
+        return 1;
+    }
+
+    if (options.list) {
+        for (size_t benchmarkIndex = 0; benchmarkIndex < registry.count; benchmarkIndex++) {
+            if (registry.benchmarks[benchmarkIndex].selected) {
+                char label[BENCHMARK_LABEL_CAPACITY];
+                getBenchmarkLabel(&registry.benchmarks[benchmarkIndex], label);
+
+                printf("%s\n", label);
+            }
+        }
+
+        printf("%zu of %zu benchmarks\n", selectedCount, registry.count);
+
+        return 0;
+    }
+
+    BenchmarkContext context = {0};
+    context.backing = parseBacking(options.backingArgumentCount, options.backingArguments);
+    context.arena = arenaInit();
+    context.largePageMinimum = enableLargePages();
+    context.features = getCpuFeatures();
+
+    describeBacking(context.backing, context.backingDescription, sizeof(context.backingDescription));
+
+    uint64_t bufferSize = 0;
+
+    for (size_t benchmarkIndex = 0; benchmarkIndex < registry.count; benchmarkIndex++) {
+        Benchmark *benchmark = &registry.benchmarks[benchmarkIndex];
+
+        if (benchmark->selected && benchmark->bufferSize > bufferSize) {
+            bufferSize = benchmark->bufferSize;
+        }
+    }
+
+    if (bufferSize) {
+        context.buffer = allocateBuffer(context.backing, bufferSize);
+
+        if (!context.buffer.memory) {
+            die(__FILE__, __LINE__, 0, "could not allocate %llu bytes with %s", (unsigned long long) bufferSize, context.backingDescription);
+        }
+    }
+
+    // Pinned before the tester opens its counters, so they follow the thread to its processor
+    if (options.pin && !osPinToProcessor(options.processor)) {
+        die(__FILE__, __LINE__, errno, "could not pin to processor %u", options.processor);
+    }
+
+    uint32_t processor = options.pin ? options.processor : osGetCurrentProcessor();
+
+    if (options.raisePriority && !osRaisePriority()) {
+        printf("WARNING: could not raise the priority, run with more privileges\n");
+    }
+
+    if (options.checkSiblings) {
+        uint32_t siblings[SIBLING_CAPACITY];
+
+        if (osGetSiblingProcessors(processor, siblings, ARRAYSIZE(siblings)) == 0) {
+            printf("Processor %u has no sibling hardware threads to check\n", processor);
+        }
+    }
+
+    RepetitionTester tester = initRepetitionTester(getBenchmarkTesterSettings(&options), estimateRdtscFrequency());
+
+    printf(
+        "Processor %u%s, clock from %s\n",
+        processor,
+        options.pin ? " (pinned)" : "",
+        FrequencySourceNames[tester.frequencySource]
+    );
+
+    for (size_t round = 0; round < options.rounds; round++) {
+        printf("Round %zu of %zu, %zu benchmarks (%s)\n\n", round + 1, options.rounds, selectedCount, context.backingDescription);
+
+        ResultsWriter results = openResults(options.resultsPath);
+
+        for (size_t benchmarkIndex = 0; benchmarkIndex < registry.count; benchmarkIndex++) {
+            Benchmark *benchmark = &registry.benchmarks[benchmarkIndex];
+
+            if (benchmark->selected) {
+                if (options.checkSiblings) {
+                    checkSiblingsIdle(processor);
+                }
+
+                runBenchmark(benchmark, &context, &tester, &results);
+            }
+        }
+
+        closeResults(&results);
+
+        printBestThroughputs(&registry);
+
+        for (size_t reportIndex = 0; reportIndex < registry.reportCount; reportIndex++) {
+            registry.reports[reportIndex](&registry, &context);
+        }
+    }
+
+    freeBuffer(&context.buffer);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef STREAM_C
+
+#define STREAM_C
+
+#include "common.c"
+#include "parser.c"
+
+#define STREAM_CHUNK_SIZE (1024 * 1024)
+
+#define STREAM_CHUNK_COUNT 4
+
+// Room in front of every chunk for the unparsed tail of the previous one
+#define STREAM_CARRY_CAPACITY (64 * 1024)
+
+_Static_assert(STREAM_CHUNK_COUNT >= 2, "the parser holds on to a chunk while it waits for the next one");
+
+typedef struct {
+    uint8_t *memory;
+    size_t size;
+} Chunk;
+
+typedef struct {
+    File file;
+    uint64_t fileSize;
+    void *memory;
+    size_t memorySize;
+    Chunk chunks[STREAM_CHUNK_COUNT];
+    Semaphore emptyChunks;
+    Semaphore filledChunks;
+    Thread thread;
+    size_t chunkIndex;
+    bool readFailed;
+} ChunkReader;
+
+// Runs on the reader thread
+THREAD_PROC(readChunks) {
+    TIME_FUNCTION;
+
+    ChunkReader *reader = parameter;
+
+    uint64_t offset = 0;
+
+    for (size_t chunkIndex = 0;; chunkIndex++) {
+        Chunk *chunk = &reader->chunks[chunkIndex % STREAM_CHUNK_COUNT];
+
+        {
+            TIME_BLOCK("waitEmptyChunk");
+            osWaitSemaphore(&reader->emptyChunks);
+            STOP_COUNTER;
+        }
+
+        uint64_t remaining = reader->fileSize - offset;
+        size_t readSize = remaining < STREAM_CHUNK_SIZE ? (size_t) remaining : STREAM_CHUNK_SIZE;
+
+        size_t size = 0;
+
+        MEASURE_THROUGHPUT("readChunk", readSize);
+
+        while (size < readSize) {
+            size_t bytesRead = 0;
+
+            if (!osReadFile(reader->file, chunk->memory + size, readSize - size, offset + size, &bytesRead) || bytesRead == 0) {
+                reader->readFailed = true;
+                size = 0;
+                break;
+            }
+
+            size += bytesRead;
+        }
+
+        STOP_COUNTER;
+
+        chunk->size = size;
+        offset += size;
+
+        osSignalSemaphore(&reader->filledChunks);
+
+        // An empty chunk tells the parser there is nothing left to read
+        if (size == 0) {
+            break;
+        }
+    }
+
+    STOP_COUNTER return 0;
+}
+
+void openChunkReader(ChunkReader *reader, char *path) {
+    TIME_FUNCTION;
+
+    memset(reader, 0, sizeof(*reader));
+
+    reader->file = osOpenFile(path);
+
+    if (reader->file == INVALID_FILE) {
+        die(__FILE__, __LINE__, 0, "could not open %s: %s", path, osErrorMessage());
+    }
+
+    reader->fileSize = getFileSize(reader->file, path);
+
+    size_t bufferSize = STREAM_CARRY_CAPACITY + STREAM_CHUNK_SIZE;
+
+    reader->memorySize = bufferSize * STREAM_CHUNK_COUNT;
+    reader->memory = osAllocate(reader->memorySize, 0);
+
+    if (!reader->memory) {
+        die(__FILE__, __LINE__, 0, "could not allocate chunks: %s", osErrorMessage());
+    }
+
+    for (size_t chunkIndex = 0; chunkIndex < STREAM_CHUNK_COUNT; chunkIndex++) {
+        reader->chunks[chunkIndex].memory = (uint8_t *) reader->memory + chunkIndex * bufferSize + STREAM_CARRY_CAPACITY;
+    }
+
+    if (!osCreateSemaphore(&reader->emptyChunks, STREAM_CHUNK_COUNT) || !osCreateSemaphore(&reader->filledChunks, 0)) {
+        die(__FILE__, __LINE__, 0, "could not create semaphores: %s", osErrorMessage());
+    }
+
+    if (!osCreateThread(&reader->thread, readChunks, reader)) {
+        die(__FILE__, __LINE__, 0, "could not create reader thread: %s", osErrorMessage());
+    }
+
+    STOP_COUNTER;
+}
+
+// Copies carry in front of the next chunk, so a token cut by the chunk edge is contiguous again in window.
+// Returns false once the whole file has been handed out, window then only holds the carry.
+bool nextChunk(ChunkReader *reader, String carry, String *window) {
+    TIME_BLOCK("waitChunk");
+    osWaitSemaphore(&reader->filledChunks);
+    STOP_COUNTER;
+
+    Chunk *chunk = &reader->chunks[reader->chunkIndex % STREAM_CHUNK_COUNT];
+
+    if (chunk->size == 0 && reader->readFailed) {
+        die(__FILE__, __LINE__, 0, "could not read file: %s", osErrorMessage());
+    }
+
+    if (carry.size > STREAM_CARRY_CAPACITY) {
+        die(__FILE__, __LINE__, 0, "json element of %zu bytes does not fit in the carry", carry.size);
+    }
+
+    if (carry.size > 0) {
+        memcpy(chunk->memory - carry.size, carry.data.unsignedData, carry.size);
+    }
+
+    // The carry has been copied out of the previous chunk, the reader can refill it
+    if (reader->chunkIndex > 0) {
+        osSignalSemaphore(&reader->emptyChunks);
+    }
+
+    reader->chunkIndex++;
+
+    window->data.unsignedData = chunk->memory - carry.size;
+    window->size = carry.size + chunk->size;
+
+    return chunk->size != 0;
+}
+
+// Only valid after nextChunk has returned false, before that the reader thread may still be waiting for a chunk
+void closeChunkReader(ChunkReader *reader) {
+    TIME_FUNCTION;
+
+    if (!osJoinThread(&reader->thread)) {
+        die(__FILE__, __LINE__, 0, "could not join reader thread: %s", osErrorMessage());
+    }
+
+    osDestroySemaphore(&reader->emptyChunks);
+    osDestroySemaphore(&reader->filledChunks);
+
+    osFree(reader->memory, reader->memorySize, 0);
+
+    if (!osCloseFile(reader->file)) {
+        die(__FILE__, __LINE__, 0, "could not close file: %s", osErrorMessage());
+    }
+
+    STOP_COUNTER;
+}
+
+// Returns the offset of the separator after the last element that is complete in window, or offset if there is
+// none yet. Elements start at offset and arrayEnd is set when the separator is the closing bracket of the array.
+size_t findCompleteElementsEnd(String window, size_t offset, bool *arrayEnd) {
+    size_t result = offset;
+
+    size_t depth = 0;
+    bool isInString = false;
+    bool isEscaped = false;
+
+    for (size_t byteIndex = offset; byteIndex < window.size; byteIndex++) {
+        uint8_t byte = window.data.unsignedData[byteIndex];
+
+        if (isInString) {
+            if (isEscaped) {
+                isEscaped = false;
+            }
+            else if (byte == REVERSE_SOLIDUS) {
+                isEscaped = true;
+            }
+            else if (byte == DOUBLE_QUOTES) {
+                isInString = false;
+            }
+        }
+        else if (byte == DOUBLE_QUOTES) {
+            isInString = true;
+        }
+        else if (byte == LEFT_BRACE || byte == LEFT_BRACKET) {
+            depth++;
+        }
+        else if (byte == RIGHT_BRACE) {
+            depth--;
+        }
+        else if (byte == RIGHT_BRACKET) {
+            if (depth == 0) {
+                *arrayEnd = true;
+                return byteIndex;
+            }
+
+            depth--;
+        }
+        else if (byte == COMMA && depth == 0) {
+            result = byteIndex;
+        }
+    }
+
+    return result;
+}
+
+void expectPairsArrayStart(Parser *parser) {
+    skipWhitespace(parser);
+    expectCharacter(parser, LEFT_BRACE);
+    skipWhitespace(parser);
+
+    if (!isDoubleQuotes(parser) || !stringEqualsCstring(parseString(parser), "pairs")) {
+        die(__FILE__, __LINE__, 0, "streaming expects the pairs array as the first member");
+    }
+
+    skipWhitespace(parser);
+    expectCharacter(parser, COLON);
+    skipWhitespace(parser);
+    expectCharacter(parser, LEFT_BRACKET);
+}
+
+// Parses the pairs one chunk at a time while the reader thread loads the next ones, so memory use does not grow
+// with the file. The arena only holds the values of the current chunk. Whatever follows the pairs array is not validated.
+double getAverageDistanceStreaming(char *path, Arena *arena) {
+    TIME_FUNCTION;
+
+    ChunkReader reader;
+    openChunkReader(&reader, path);
+
+    String carry = {0};
+    String window = {0};
+
+    bool hasMoreChunks = nextChunk(&reader, carry, &window);
+
+    Parser parser = initParser(window, arena);
+
+    expectPairsArrayStart(&parser);
+
+    size_t offset = parser.offset;
+
+    double sum = 0;
+    size_t count = 0;
+
+    bool arrayEnd = false;
+
+    while (!arrayEnd) {
+        size_t end = findCompleteElementsEnd(window, offset, &arrayEnd);
+
+        if (end != offset || arrayEnd) {
+            MEASURE_THROUGHPUT("parseChunk", end - offset);
+
+            parser.text = window;
+            parser.text.size = end;
+            parser.offset = offset;
+
+            while (hasNext(&parser)) {
+                Value *pair = parseElement(&parser);
+
+                double x1 = getAsNumber(getMemberValueOfObject(pair, "x1"));
+                double y1 = getAsNumber(getMemberValueOfObject(pair, "y1"));
+
+                double x2 = getAsNumber(getMemberValueOfObject(pair, "x2"));
+                double y2 = getAsNumber(getMemberValueOfObject(pair, "y2"));
+
+                sum += haversine(x1, y1, x2, y2, EARTH_RADIUS);
+                count++;
+
+                if (hasNext(&parser)) {
+                    expectCharacter(&parser, COMMA);
+                }
+            }
+
+            arenaFreeAll(arena);
+
+            offset = end + 1;
+
+            STOP_COUNTER;
+        }
+
+        if (!arrayEnd) {
+            if (!hasMoreChunks) {
+                die(__FILE__, __LINE__, 0, "unexpected end of %s", path);
+            }
+
+            carry.data.unsignedData = window.data.unsignedData + offset;
+            carry.size = window.size - offset;
+
+            hasMoreChunks = nextChunk(&reader, carry, &window);
+            offset = 0;
+        }
+    }
+
+    String empty = {0};
+
+    while (hasMoreChunks) {
+        hasMoreChunks = nextChunk(&reader, empty, &window);
+    }
+
+    closeChunkReader(&reader);
+
+    double average = sum / (double) count;
+
+    STOP_COUNTER return average;
+}
+
+#endif
@@ -0,0 +1,364 @@
+#ifndef STRUCTURAL_C
+
+#define STRUCTURAL_C
+
+#include "common.c"
+
+#define SCAN_BLOCK_SIZE 64
+
+typedef enum {
+    Scanner_Scalar,
+    Scanner_Sse,
+    Scanner_Avx2,
+    Scanner_Avx512,
+    Scanner_Count
+} Scanner;
+
+const char *ScannerNames[Scanner_Count] = {"scalar", "sse", "avx2", "avx512"};
+
+// One bit per byte of text, set on quotes, on {}[]:, outside strings and on the first byte of every number or literal
+typedef struct {
+    uint64_t *bits;
+    size_t size;
+} StructuralIndex;
+
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t operator;
+    uint64_t whitespace;
+} BlockMasks;
+
+typedef struct {
+    uint64_t escapedCarry;
+    uint64_t inStringCarry;
+    uint64_t scalarCarry;
+} ScanState;
+
+// Escapes are rare enough in our inputs that walking the backslashes one at a time is fine
+static inline uint64_t findEscaped(ScanState *state, uint64_t backslash) {
+    uint64_t result = state->escapedCarry;
+
+    state->escapedCarry = 0;
+
+    while (backslash != 0) {
+        uint32_t index = countTrailingZeros(backslash);
+        uint64_t bit = 1ull << index;
+
+        backslash &= backslash - 1;
+
+        // An escaped backslash escapes nothing
+        if (result & bit) {
+            continue;
+        }
+
+        if (index == SCAN_BLOCK_SIZE - 1) {
+            state->escapedCarry = 1;
+        }
+        else {
+            result |= bit << 1;
+        }
+    }
+
+    return result;
+}
+
+// Each bit becomes the xor of itself and all the bits below it
+static inline uint64_t prefixXor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+
+    return bits;
+}
+
+static inline uint64_t findStructurals(ScanState *state, BlockMasks masks) {
+    uint64_t escaped = 0;
+
+    if (masks.backslash != 0 || state->escapedCarry != 0) {
+        escaped = findEscaped(state, masks.backslash);
+    }
+
+    uint64_t quote = masks.quote & ~escaped;
+
+    // Set from an opening quote up to the byte before its closing quote
+    uint64_t inString = prefixXor(quote) ^ state->inStringCarry;
+    state->inStringCarry = (uint64_t) ((int64_t) inString >> 63);
+
+    uint64_t scalar = ~(masks.operator | masks.whitespace | quote);
+    uint64_t followsScalar = (scalar << 1) | state->scalarCarry;
+    state->scalarCarry = scalar >> 63;
+
+    uint64_t scalarStart = scalar & ~followsScalar;
+
+    return ((masks.operator | scalarStart) & ~inString) | quote;
+}
+
+BlockMasks classifyScalar(const uint8_t *block) {
+    BlockMasks result = {0};
+
+    for (size_t byteIndex = 0; byteIndex < SCAN_BLOCK_SIZE; byteIndex++) {
+        uint8_t byte = block[byteIndex];
+        uint64_t bit = 1ull << byteIndex;
+
+        switch (byte) {
+            case '"': {
+                result.quote |= bit;
+            }
+            break;
+            case '\\': {
+                result.backslash |= bit;
+            }
+            break;
+            case '{':
+            case '}':
+            case '[':
+            case ']':
+            case ':':
+            case ',': {
+                result.operator |= bit;
+            }
+            break;
+            case ' ':
+            case '\t':
+            case '\n':
+            case '\r': {
+                result.whitespace |= bit;
+            }
+            break;
+            default: {
+            }
+            break;
+        }
+    }
+
+    return result;
+}
+
+static inline uint64_t matchSse(__m128i bytes, char character) {
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(character)));
+}
+
+// '[' and ']' only differ from '{' and '}' by 0x20, so one compare on the or-ed bytes covers both
+BlockMasks classifySse(const uint8_t *block) {
+    BlockMasks result = {0};
+
+    for (size_t part = 0; part < SCAN_BLOCK_SIZE / 16; part++) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (block + part * 16));
+        __m128i folded = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+
+        uint64_t quote = matchSse(bytes, '"');
+        uint64_t backslash = matchSse(bytes, '\\');
+        uint64_t operator = matchSse(folded, '{') | matchSse(folded, '}') | matchSse(bytes, ':') | matchSse(bytes, ',');
+        uint64_t whitespace = matchSse(bytes, ' ') | matchSse(bytes, '\t') | matchSse(bytes, '\n') | matchSse(bytes, '\r');
+
+        result.quote |= quote << (part * 16);
+        result.backslash |= backslash << (part * 16);
+        result.operator |= operator << (part * 16);
+        result.whitespace |= whitespace << (part * 16);
+    }
+
+    return result;
+}
+
+TARGET("avx2") static inline uint64_t matchAvx2(__m256i bytes, char character) {
+    return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(character)));
+}
+
+TARGET("avx2") BlockMasks classifyAvx2(const uint8_t *block) {
+    BlockMasks result = {0};
+
+    for (size_t part = 0; part < SCAN_BLOCK_SIZE / 32; part++) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (block + part * 32));
+        __m256i folded = _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+
+        uint64_t quote = matchAvx2(bytes, '"');
+        uint64_t backslash = matchAvx2(bytes, '\\');
+        uint64_t operator = matchAvx2(folded, '{') | matchAvx2(folded, '}') | matchAvx2(bytes, ':') | matchAvx2(bytes, ',');
+        uint64_t whitespace = matchAvx2(bytes, ' ') | matchAvx2(bytes, '\t') | matchAvx2(bytes, '\n') | matchAvx2(bytes, '\r');
+
+        result.quote |= quote << (part * 32);
+        result.backslash |= backslash << (part * 32);
+        result.operator |= operator << (part * 32);
+        result.whitespace |= whitespace << (part * 32);
+    }
+
+    return result;
+}
+
+TARGET("avx512f,avx512bw") static inline uint64_t matchAvx512(__m512i bytes, char character) {
+    return _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8(character));
+}
+
+TARGET("avx512f,avx512bw") BlockMasks classifyAvx512(const uint8_t *block) {
+    BlockMasks result = {0};
+
+    __m512i bytes = _mm512_loadu_si512((const void *) block);
+    __m512i folded = _mm512_or_si512(bytes, _mm512_set1_epi8(0x20));
+
+    result.quote = matchAvx512(bytes, '"');
+    result.backslash = matchAvx512(bytes, '\\');
+    result.operator = matchAvx512(folded, '{') | matchAvx512(folded, '}') | matchAvx512(bytes, ':') | matchAvx512(bytes, ',');
+    result.whitespace = matchAvx512(bytes, ' ') | matchAvx512(bytes, '\t') | matchAvx512(bytes, '\n') | matchAvx512(bytes, '\r');
+
+    return result;
+}
+
+// Pads the last partial block with whitespace, which never sets a bit
+const uint8_t *getTailBlock(String text, uint8_t block[SCAN_BLOCK_SIZE]) {
+    size_t tailSize = text.size % SCAN_BLOCK_SIZE;
+
+    memset(block, ' ', SCAN_BLOCK_SIZE);
+    memcpy(block, text.data.unsignedData + text.size - tailSize, tailSize);
+
+    return block;
+}
+
+void scanScalar(String text, uint64_t *bits) {
+    ScanState state = {0};
+
+    size_t blockCount = text.size / SCAN_BLOCK_SIZE;
+
+    for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        bits[blockIndex] = findStructurals(&state, classifyScalar(text.data.unsignedData + blockIndex * SCAN_BLOCK_SIZE));
+    }
+
+    uint8_t block[SCAN_BLOCK_SIZE];
+    bits[blockCount] = findStructurals(&state, classifyScalar(getTailBlock(text, block)));
+}
+
+void scanSse(String text, uint64_t *bits) {
+    ScanState state = {0};
+
+    size_t blockCount = text.size / SCAN_BLOCK_SIZE;
+
+    for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        bits[blockIndex] = findStructurals(&state, classifySse(text.data.unsignedData + blockIndex * SCAN_BLOCK_SIZE));
+    }
+
+    uint8_t block[SCAN_BLOCK_SIZE];
+    bits[blockCount] = findStructurals(&state, classifySse(getTailBlock(text, block)));
+}
+
+TARGET("avx2") void scanAvx2(String text, uint64_t *bits) {
+    ScanState state = {0};
+
+    size_t blockCount = text.size / SCAN_BLOCK_SIZE;
+
+    for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        bits[blockIndex] = findStructurals(&state, classifyAvx2(text.data.unsignedData + blockIndex * SCAN_BLOCK_SIZE));
+    }
+
+    uint8_t block[SCAN_BLOCK_SIZE];
+    bits[blockCount] = findStructurals(&state, classifyAvx2(getTailBlock(text, block)));
+}
+
+TARGET("avx512f,avx512bw") void scanAvx512(String text, uint64_t *bits) {
+    ScanState state = {0};
+
+    size_t blockCount = text.size / SCAN_BLOCK_SIZE;
+
+    for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        bits[blockIndex] = findStructurals(&state, classifyAvx512(text.data.unsignedData + blockIndex * SCAN_BLOCK_SIZE));
+    }
+
+    uint8_t block[SCAN_BLOCK_SIZE];
+    bits[blockCount] = findStructurals(&state, classifyAvx512(getTailBlock(text, block)));
+}
+
+bool isScannerSupported(Scanner scanner) {
+    CpuFeatures features = getCpuFeatures();
+
+    switch (scanner) {
+        case Scanner_Avx512: {
+            return features.avx512;
+        }
+        case Scanner_Avx2: {
+            return features.avx2;
+        }
+        default: {
+            return true;
+        }
+    }
+}
+
+Scanner getBestScanner() {
+    Scanner result = Scanner_Sse;
+
+    if (isScannerSupported(Scanner_Avx512)) {
+        result = Scanner_Avx512;
+    }
+    else if (isScannerSupported(Scanner_Avx2)) {
+        result = Scanner_Avx2;
+    }
+
+    return result;
+}
+
+// Stage 1 only classifies bytes, malformed json is still caught by the parser that walks the index
+StructuralIndex buildStructuralIndex(String text, Scanner scanner, Arena *arena) {
+    MEASURE_FUNCTION_THROUGHPUT(text.size);
+
+    if (!isScannerSupported(scanner)) {
+        die(__FILE__, __LINE__, 0, "the %s scanner is not supported by this cpu", ScannerNames[scanner]);
+    }
+
+    StructuralIndex result = {0};
+    result.size = text.size;
+    result.bits = arenaAllocate(arena, (text.size / SCAN_BLOCK_SIZE + 1) * sizeof(uint64_t));
+
+    switch (scanner) {
+        case Scanner_Scalar: {
+            scanScalar(text, result.bits);
+        }
+        break;
+        case Scanner_Sse: {
+            scanSse(text, result.bits);
+        }
+        break;
+        case Scanner_Avx2: {
+            scanAvx2(text, result.bits);
+        }
+        break;
+        case Scanner_Avx512: {
+            scanAvx512(text, result.bits);
+        }
+        break;
+        default: {
+            assert(false);
+        }
+    }
+
+    STOP_COUNTER return result;
+}
+
+// Returns the first structural position at or after offset, or the size of the text if there is none
+size_t findNextStructural(StructuralIndex index, size_t offset) {
+    if (offset >= index.size) {
+        return index.size;
+    }
+
+    size_t wordIndex = offset / SCAN_BLOCK_SIZE;
+    size_t wordCount = index.size / SCAN_BLOCK_SIZE + 1;
+
+    uint64_t word = index.bits[wordIndex] & (~0ull << (offset % SCAN_BLOCK_SIZE));
+
+    while (word == 0) {
+        wordIndex++;
+
+        if (wordIndex == wordCount) {
+            return index.size;
+        }
+
+        word = index.bits[wordIndex];
+    }
+
+    size_t result = wordIndex * SCAN_BLOCK_SIZE + countTrailingZeros(word);
+
+    return result < index.size ? result : index.size;
+}
+
+#endif
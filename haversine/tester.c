@@ -0,0 +1,856 @@
+#ifndef TESTER_C
+
+#define TESTER_C
+
+#include "common.c"
+
+#define TESTER_BOOTSTRAP_RESAMPLES 1000
+
+// Scales the median absolute deviation to the standard deviation of a normal distribution
+#define TESTER_MAD_SCALE 1.4826
+
+// A leading sample this many scaled deviations above the steady state median is counted as warmup
+#define TESTER_WARMUP_DEVIATIONS 3.0
+
+// Convergence needs a sort of all the samples, so it is only checked every so many samples
+#define TESTER_CHECK_INTERVAL 16
+
+// Both thirds need a few samples for their medians to mean anything
+#define TESTER_MIN_DRIFT_SAMPLES 15
+
+// 1.96 standard deviations on each side
+#define TESTER_CONFIDENCE_Z 1.96
+
+#define TEST_PARAMETER_CAPACITY 64
+
+#define TESTER_SIGN_BIT 0x8000000000000000ull
+
+typedef enum {
+    TestStop_Converged,
+    TestStop_MaxSamples,
+    TestStop_TimeLimit,
+    TestStop_Count
+} TestStop;
+
+const char *TestStopNames[TestStop_Count] = {"converged", "max samples", "time limit"};
+
+typedef enum {
+    FrequencySource_None,
+    // Core over reference cycles from the performance counters, the average clock over the whole sample
+    FrequencySource_Counters,
+    // The clock the OS reports before and after the sample, which only catches changes it happens to see
+    FrequencySource_Os,
+    // The clock /proc/cpuinfo reports at the start of the test, when cpufreq is missing. No sample is a transition.
+    FrequencySource_OsPerTest,
+    FrequencySource_Count
+} FrequencySource;
+
+const char *FrequencySourceNames[FrequencySource_Count] = {"none", "counters", "os", "os per test"};
+
+typedef struct {
+    size_t minSamples;
+    size_t maxSamples;
+    double maxSeconds;
+    // Stops once the 95% confidence interval of the median is within this fraction of it
+    double precision;
+    // Flags a change of the median by more than this fraction between the first and the last third of the samples
+    double driftTolerance;
+    bool trackFrequency;
+    // A sample whose clock is off the median clock of the test by more than this fraction ran through a transition
+    double frequencyTolerance;
+    bool discardTransitions;
+} TesterSettings;
+
+typedef struct {
+    uint64_t ticks;
+    uint64_t bytes;
+    // Minor and major together, like the Windows count
+    uint64_t pageFaults;
+    uint64_t majorFaults;
+    int64_t residentDelta;
+    // In Hz, 0 when it could not be measured
+    uint64_t frequency;
+    bool isTransition;
+} Sample;
+
+// All buffers are allocated once, so taking a sample never allocates and the code under test sees the same heap
+typedef struct {
+    TesterSettings settings;
+    uint64_t rdtscFrequency;
+    MemoryCountersSource memoryCounters;
+    Sample *samples;
+    uint64_t *sorted;
+    uint32_t *resampleCounts;
+    uint64_t *bootstrapMedians;
+    size_t sampleCount;
+    uint64_t testStart;
+    uint64_t sampleStartTicks;
+    MemoryCounters sampleStartMemory;
+    void *buffer;
+    size_t bufferSize;
+    uint64_t residentBefore;
+    bool hasResidency;
+    FrequencySource frequencySource;
+    FrequencyCounters frequencyCounters;
+    ProcessorFrequency processorFrequency;
+    uint64_t testFrequency;
+    uint64_t sampleStartCycles;
+    uint64_t sampleStartReferenceCycles;
+    uint64_t sampleStartFrequency;
+    uint64_t random;
+    TestStop stop;
+} RepetitionTester;
+
+// Times are in ticks, the warmup samples are left out of everything but warmupCount
+typedef struct {
+    size_t count;
+    size_t warmupCount;
+    TestStop stop;
+    uint64_t bytes;
+    uint64_t rdtscFrequency;
+    double min;
+    double max;
+    double mean;
+    double median;
+    double medianLow;
+    double medianHigh;
+    double mad;
+    double p10;
+    double p90;
+    double p99;
+    double drift;
+    bool hasDrift;
+    double medianPageFaults;
+    uint64_t minPageFaults;
+    uint64_t maxPageFaults;
+    double medianMajorFaults;
+    uint64_t maxMajorFaults;
+    // Change of the resident size of the process over a sample, in bytes
+    double medianResidentDelta;
+    // Residency of the buffer given to setTestBuffer, before the first sample and after the last
+    bool hasResidency;
+    uint64_t bufferBytes;
+    uint64_t residentBefore;
+    uint64_t residentAfter;
+    FrequencySource frequencySource;
+    double medianFrequency;
+    double frequencyTolerance;
+    size_t transitionCount;
+    size_t discardedCount;
+} TestStats;
+
+// Values are strings so every experiment can describe its own parameters
+typedef struct {
+    const char *name;
+    char value[TEST_PARAMETER_CAPACITY];
+} TestParameter;
+
+// Writes one json document per run, the samples of every test go in as soon as it finishes because the tester
+// reuses its buffers for the next one
+typedef struct {
+    FILE *file;
+    const char *path;
+    size_t testCount;
+} ResultsWriter;
+
+TesterSettings getDefaultTesterSettings() {
+    TesterSettings result = {0};
+
+    result.minSamples = 32;
+    result.maxSamples = 4096;
+    result.maxSeconds = 10.0;
+    result.precision = 0.005;
+    result.driftTolerance = 0.02;
+    result.trackFrequency = true;
+    result.frequencyTolerance = 0.02;
+    result.discardTransitions = false;
+
+    return result;
+}
+
+RepetitionTester initRepetitionTester(TesterSettings settings, uint64_t rdtscFrequency) {
+    RepetitionTester result = {0};
+
+    if (settings.maxSamples == 0 || settings.minSamples > settings.maxSamples) {
+        die(__FILE__, __LINE__, 0, "min samples must not exceed max samples");
+    }
+
+    size_t size = settings.maxSamples * (sizeof(Sample) + sizeof(uint64_t) + sizeof(uint32_t))
+        + TESTER_BOOTSTRAP_RESAMPLES * sizeof(uint64_t);
+
+    uint8_t *memory = osAllocate(size, 0);
+
+    if (!memory) {
+        die(__FILE__, __LINE__, errno, "could not allocate %zu samples", settings.maxSamples);
+    }
+
+    result.settings = settings;
+    result.rdtscFrequency = rdtscFrequency;
+    result.memoryCounters = openMemoryCounters(getCurrentProcess());
+    result.samples = (Sample *) memory;
+    result.sorted = (uint64_t *) (result.samples + settings.maxSamples);
+    result.bootstrapMedians = result.sorted + settings.maxSamples;
+    result.resampleCounts = (uint32_t *) (result.bootstrapMedians + TESTER_BOOTSTRAP_RESAMPLES);
+
+    if (settings.trackFrequency) {
+        if (osOpenFrequencyCounters(&result.frequencyCounters)) {
+            result.frequencySource = FrequencySource_Counters;
+        }
+        else if (osOpenProcessorFrequency(&result.processorFrequency, osGetCurrentProcessor())) {
+            result.frequencySource = FrequencySource_Os;
+        }
+        else {
+            uint64_t frequency;
+
+            if (osGetProcessorFrequency(osGetCurrentProcessor(), &frequency)) {
+                result.frequencySource = FrequencySource_OsPerTest;
+            }
+        }
+    }
+
+    return result;
+}
+
+// The buffer the code under test works on, its residency is checked around the test. It stays until the next call,
+// NULL clears it.
+void setTestBuffer(RepetitionTester *tester, void *memory, size_t size) {
+    tester->buffer = memory;
+    tester->bufferSize = memory ? size : 0;
+}
+
+void startTest(RepetitionTester *tester) {
+    tester->sampleCount = 0;
+    tester->stop = TestStop_Count;
+    tester->random = 0x9e3779b97f4a7c15ull;
+    tester->hasResidency = tester->buffer && osGetResidentBytes(tester->buffer, tester->bufferSize, &tester->residentBefore);
+
+    if (tester->frequencySource == FrequencySource_OsPerTest) {
+        osGetProcessorFrequency(osGetCurrentProcessor(), &tester->testFrequency);
+    }
+    tester->testStart = __rdtsc();
+}
+
+// Memory counters and the clock are read outside the timed region, like the iteration counters of the tests used to
+void beginSample(RepetitionTester *tester) {
+    tester->sampleStartMemory = getMemoryCounters(&tester->memoryCounters);
+
+    if (tester->frequencySource == FrequencySource_Counters) {
+        osReadFrequencyCounters(&tester->frequencyCounters, &tester->sampleStartCycles, &tester->sampleStartReferenceCycles);
+    }
+    else if (tester->frequencySource == FrequencySource_Os) {
+        osReadProcessorFrequency(&tester->processorFrequency, osGetCurrentProcessor(), &tester->sampleStartFrequency);
+    }
+
+    tester->sampleStartTicks = __rdtsc();
+}
+
+void endSample(RepetitionTester *tester, uint64_t bytes) {
+    uint64_t ticks = __rdtsc();
+
+    assert(tester->sampleCount < tester->settings.maxSamples);
+
+    Sample *sample = &tester->samples[tester->sampleCount++];
+    sample->ticks = ticks - tester->sampleStartTicks;
+    sample->bytes = bytes;
+    sample->frequency = 0;
+    sample->isTransition = false;
+
+    if (tester->frequencySource == FrequencySource_Counters) {
+        uint64_t cycles;
+        uint64_t referenceCycles;
+
+        // Reference cycles tick at the nominal clock, which is the rate of the invariant tsc
+        if (osReadFrequencyCounters(&tester->frequencyCounters, &cycles, &referenceCycles)
+            && referenceCycles > tester->sampleStartReferenceCycles) {
+            double ratio = (double) (cycles - tester->sampleStartCycles) / (double) (referenceCycles - tester->sampleStartReferenceCycles);
+
+            sample->frequency = (uint64_t) (ratio * (double) tester->rdtscFrequency);
+        }
+    }
+    else if (tester->frequencySource == FrequencySource_Os) {
+        uint64_t endFrequency = 0;
+        osReadProcessorFrequency(&tester->processorFrequency, osGetCurrentProcessor(), &endFrequency);
+
+        double change = fabs((double) endFrequency - (double) tester->sampleStartFrequency);
+
+        sample->frequency = (tester->sampleStartFrequency + endFrequency) / 2;
+        sample->isTransition = change > tester->settings.frequencyTolerance * (double) tester->sampleStartFrequency;
+    }
+    else if (tester->frequencySource == FrequencySource_OsPerTest) {
+        sample->frequency = tester->testFrequency;
+    }
+
+    MemoryCounters memory = getMemoryCounters(&tester->memoryCounters);
+    MemoryCounters *start = &tester->sampleStartMemory;
+
+    sample->majorFaults = memory.majorFaults - start->majorFaults;
+    sample->pageFaults = memory.minorFaults - start->minorFaults + sample->majorFaults;
+    sample->residentDelta = (int64_t) memory.residentBytes - (int64_t) start->residentBytes;
+}
+
+int compareTicks(const void *left, const void *right) {
+    uint64_t leftTicks = *(const uint64_t *) left;
+    uint64_t rightTicks = *(const uint64_t *) right;
+
+    return (leftTicks > rightTicks) - (leftTicks < rightTicks);
+}
+
+size_t sortTicks(RepetitionTester *tester, size_t first, size_t end) {
+    size_t count = end - first;
+
+    for (size_t sampleIndex = 0; sampleIndex < count; sampleIndex++) {
+        tester->sorted[sampleIndex] = tester->samples[first + sampleIndex].ticks;
+    }
+
+    qsort(tester->sorted, count, sizeof(uint64_t), compareTicks);
+
+    return count;
+}
+
+// Linear interpolation between the closest ranks
+double getPercentile(uint64_t *sorted, size_t count, double percentile) {
+    double position = percentile * (double) (count - 1);
+    size_t lower = (size_t) position;
+
+    if (lower + 1 >= count) {
+        return (double) sorted[count - 1];
+    }
+
+    double fraction = position - (double) lower;
+
+    return (double) sorted[lower] + fraction * ((double) sorted[lower + 1] - (double) sorted[lower]);
+}
+
+double getSortedMedian(uint64_t *sorted, size_t count) {
+    return getPercentile(sorted, count, 0.5);
+}
+
+double getMedianTicks(RepetitionTester *tester, size_t first, size_t end) {
+    size_t count = sortTicks(tester, first, end);
+
+    return getSortedMedian(tester->sorted, count);
+}
+
+// Median absolute deviation of the samples from first to end, around their median
+double getMedianDeviation(RepetitionTester *tester, size_t first, size_t end, double median) {
+    size_t count = end - first;
+
+    for (size_t sampleIndex = 0; sampleIndex < count; sampleIndex++) {
+        double deviation = (double) tester->samples[first + sampleIndex].ticks - median;
+
+        tester->sorted[sampleIndex] = (uint64_t) (deviation < 0 ? -deviation : deviation);
+    }
+
+    qsort(tester->sorted, count, sizeof(uint64_t), compareTicks);
+
+    return getSortedMedian(tester->sorted, count);
+}
+
+// Cold caches, page faults on first touch and the cpu leaving a low power state all make the first samples slow.
+// They are the leading run of samples far above the median of the second half, which is taken as the steady state.
+size_t findWarmupCount(RepetitionTester *tester) {
+    size_t count = tester->sampleCount;
+    size_t half = count / 2;
+
+    if (half == 0) {
+        return 0;
+    }
+
+    double median = getMedianTicks(tester, half, count);
+    double deviation = getMedianDeviation(tester, half, count, median);
+    double threshold = median + TESTER_WARMUP_DEVIATIONS * TESTER_MAD_SCALE * deviation;
+
+    size_t result = 0;
+
+    while (result < half && (double) tester->samples[result].ticks > threshold) {
+        result++;
+    }
+
+    return result;
+}
+
+// Distribution free: the ranks of the median bounds come from the binomial distribution of samples below the median
+void getMedianBoundsByRank(uint64_t *sorted, size_t count, double *low, double *high) {
+    double spread = TESTER_CONFIDENCE_Z * sqrt((double) count) / 2.0;
+    double lowRank = (double) count / 2.0 - spread;
+    double highRank = (double) count / 2.0 + spread;
+
+    *low = (double) sorted[lowRank < 0 ? 0 : (size_t) lowRank];
+    *high = (double) sorted[highRank >= (double) (count - 1) ? count - 1 : (size_t) highRank];
+}
+
+bool hasConverged(RepetitionTester *tester) {
+    size_t warmupCount = findWarmupCount(tester);
+    size_t count = sortTicks(tester, warmupCount, tester->sampleCount);
+
+    if (count < tester->settings.minSamples) {
+        return false;
+    }
+
+    double median = getSortedMedian(tester->sorted, count);
+    double low;
+    double high;
+
+    getMedianBoundsByRank(tester->sorted, count, &low, &high);
+
+    return (high - low) / 2.0 <= tester->settings.precision * median;
+}
+
+bool isTesting(RepetitionTester *tester) {
+    if (tester->stop != TestStop_Count) {
+        return false;
+    }
+
+    size_t count = tester->sampleCount;
+    double seconds = (double) (__rdtsc() - tester->testStart) / (double) tester->rdtscFrequency;
+
+    if (count == tester->settings.maxSamples) {
+        tester->stop = TestStop_MaxSamples;
+    }
+    else if (seconds > tester->settings.maxSeconds) {
+        tester->stop = TestStop_TimeLimit;
+    }
+    else if (count >= tester->settings.minSamples && count % TESTER_CHECK_INTERVAL == 0 && hasConverged(tester)) {
+        tester->stop = TestStop_Converged;
+    }
+
+    return tester->stop == TestStop_Count;
+}
+
+// xorshift64*, seeded the same for every test so the reported intervals are reproducible
+uint64_t getRandom(RepetitionTester *tester) {
+    uint64_t x = tester->random;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+
+    tester->random = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+// Resamples the ranks of the sorted samples rather than their values, which turns the median of every resample into
+// a walk over rank counts instead of a sort
+void bootstrapMedian(RepetitionTester *tester, size_t count, double *low, double *high) {
+    for (size_t resample = 0; resample < TESTER_BOOTSTRAP_RESAMPLES; resample++) {
+        memset(tester->resampleCounts, 0, count * sizeof(uint32_t));
+
+        for (size_t draw = 0; draw < count; draw++) {
+            uint64_t rank;
+            multiply64(getRandom(tester), count, &rank);
+
+            tester->resampleCounts[rank]++;
+        }
+
+        size_t lowerMiddle = (count - 1) / 2;
+        size_t upperMiddle = count / 2;
+        size_t seen = 0;
+        uint64_t lowerValue = 0;
+
+        for (size_t rank = 0; rank < count; rank++) {
+            size_t nextSeen = seen + tester->resampleCounts[rank];
+
+            if (seen <= lowerMiddle && lowerMiddle < nextSeen) {
+                lowerValue = tester->sorted[rank];
+            }
+
+            if (seen <= upperMiddle && upperMiddle < nextSeen) {
+                tester->bootstrapMedians[resample] = (lowerValue + tester->sorted[rank]) / 2;
+                break;
+            }
+
+            seen = nextSeen;
+        }
+    }
+
+    qsort(tester->bootstrapMedians, TESTER_BOOTSTRAP_RESAMPLES, sizeof(uint64_t), compareTicks);
+
+    *low = getPercentile(tester->bootstrapMedians, TESTER_BOOTSTRAP_RESAMPLES, 0.025);
+    *high = getPercentile(tester->bootstrapMedians, TESTER_BOOTSTRAP_RESAMPLES, 0.975);
+}
+
+// Flags the samples whose clock is off the median clock of the steady state samples, and drops them from the
+// tester when the settings ask for it, so everything after only sees samples taken at the same clock
+void findFrequencyTransitions(RepetitionTester *tester, size_t first, TestStats *stats) {
+    size_t count = 0;
+
+    for (size_t sampleIndex = first; sampleIndex < tester->sampleCount; sampleIndex++) {
+        if (tester->samples[sampleIndex].frequency) {
+            tester->sorted[count++] = tester->samples[sampleIndex].frequency;
+        }
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    qsort(tester->sorted, count, sizeof(uint64_t), compareTicks);
+
+    stats->medianFrequency = getSortedMedian(tester->sorted, count);
+
+    size_t kept = first;
+
+    for (size_t sampleIndex = first; sampleIndex < tester->sampleCount; sampleIndex++) {
+        Sample *sample = &tester->samples[sampleIndex];
+
+        if (sample->frequency && fabs((double) sample->frequency - stats->medianFrequency) > stats->frequencyTolerance * stats->medianFrequency) {
+            sample->isTransition = true;
+        }
+
+        stats->transitionCount += sample->isTransition;
+
+        if (!sample->isTransition || !tester->settings.discardTransitions) {
+            tester->samples[kept++] = *sample;
+        }
+    }
+
+    stats->discardedCount = tester->sampleCount - kept;
+    tester->sampleCount = kept;
+}
+
+TestStats computeTestStats(RepetitionTester *tester) {
+    TestStats result = {0};
+
+    if (tester->sampleCount == 0) {
+        return result;
+    }
+
+    result.stop = tester->stop;
+    result.rdtscFrequency = tester->rdtscFrequency;
+    result.bytes = tester->samples[tester->sampleCount - 1].bytes;
+    result.warmupCount = findWarmupCount(tester);
+
+    result.frequencySource = tester->frequencySource;
+    result.frequencyTolerance = tester->settings.frequencyTolerance;
+
+    if (tester->frequencySource != FrequencySource_None) {
+        findFrequencyTransitions(tester, result.warmupCount, &result);
+    }
+
+    size_t first = result.warmupCount;
+    size_t end = tester->sampleCount;
+    size_t count = end - first;
+
+    result.count = count;
+
+    if (count == 0) {
+        return result;
+    }
+
+    // Thirds first, they need the sorted buffer for themselves
+    if (count >= TESTER_MIN_DRIFT_SAMPLES) {
+        double firstMedian = getMedianTicks(tester, first, first + count / 3);
+        double lastMedian = getMedianTicks(tester, end - count / 3, end);
+
+        result.drift = (lastMedian - firstMedian) / firstMedian;
+        result.hasDrift = fabs(result.drift) > tester->settings.driftTolerance;
+    }
+
+    result.minPageFaults = UINT64_MAX;
+
+    for (size_t sampleIndex = first; sampleIndex < end; sampleIndex++) {
+        uint64_t pageFaults = tester->samples[sampleIndex].pageFaults;
+
+        tester->sorted[sampleIndex - first] = pageFaults;
+
+        result.minPageFaults = pageFaults < result.minPageFaults ? pageFaults : result.minPageFaults;
+        result.maxPageFaults = pageFaults > result.maxPageFaults ? pageFaults : result.maxPageFaults;
+    }
+
+    qsort(tester->sorted, count, sizeof(uint64_t), compareTicks);
+    result.medianPageFaults = getSortedMedian(tester->sorted, count);
+
+    for (size_t sampleIndex = first; sampleIndex < end; sampleIndex++) {
+        uint64_t majorFaults = tester->samples[sampleIndex].majorFaults;
+
+        tester->sorted[sampleIndex - first] = majorFaults;
+        result.maxMajorFaults = majorFaults > result.maxMajorFaults ? majorFaults : result.maxMajorFaults;
+    }
+
+    qsort(tester->sorted, count, sizeof(uint64_t), compareTicks);
+    result.medianMajorFaults = getSortedMedian(tester->sorted, count);
+
+    // Flipping the sign bit orders signed deltas as unsigned values
+    for (size_t sampleIndex = first; sampleIndex < end; sampleIndex++) {
+        tester->sorted[sampleIndex - first] = (uint64_t) tester->samples[sampleIndex].residentDelta ^ TESTER_SIGN_BIT;
+    }
+
+    qsort(tester->sorted, count, sizeof(uint64_t), compareTicks);
+    result.medianResidentDelta = (double) (int64_t) (tester->sorted[(count - 1) / 2] ^ TESTER_SIGN_BIT);
+
+    if (tester->hasResidency) {
+        result.bufferBytes = tester->bufferSize;
+        result.residentBefore = tester->residentBefore;
+        result.hasResidency = osGetResidentBytes(tester->buffer, tester->bufferSize, &result.residentAfter);
+    }
+
+    double median = getMedianTicks(tester, first, end);
+    result.mad = getMedianDeviation(tester, first, end, median);
+
+    sortTicks(tester, first, end);
+
+    double sum = 0;
+
+    for (size_t sampleIndex = 0; sampleIndex < count; sampleIndex++) {
+        sum += (double) tester->sorted[sampleIndex];
+    }
+
+    result.median = median;
+    result.mean = sum / (double) count;
+    result.min = (double) tester->sorted[0];
+    result.max = (double) tester->sorted[count - 1];
+    result.p10 = getPercentile(tester->sorted, count, 0.10);
+    result.p90 = getPercentile(tester->sorted, count, 0.90);
+    result.p99 = getPercentile(tester->sorted, count, 0.99);
+
+    bootstrapMedian(tester, count, &result.medianLow, &result.medianHigh);
+
+    return result;
+}
+
+double ticksToSeconds(TestStats *stats, double ticks) {
+    return ticks / (double) stats->rdtscFrequency;
+}
+
+// Bytes per second at the given tick count, 0 when the test does not count bytes
+double getThroughput(TestStats *stats, double ticks) {
+    return ticks > 0 ? (double) stats->bytes / ticksToSeconds(stats, ticks) : 0;
+}
+
+double ticksToMilliseconds(TestStats *stats, double ticks) {
+    return 1000.0 * ticksToSeconds(stats, ticks);
+}
+
+void printTestStats(TestStats *stats) {
+    double gigabyte = 1024.0 * 1024.0 * 1024.0;
+
+    printf(
+        "Median: %f ms [%f, %f], Throughput: %f gb/s\n",
+        ticksToMilliseconds(stats, stats->median),
+        ticksToMilliseconds(stats, stats->medianLow),
+        ticksToMilliseconds(stats, stats->medianHigh),
+        getThroughput(stats, stats->median) / gigabyte
+    );
+    printf("Best  : %f ms, Throughput: %f gb/s\n", ticksToMilliseconds(stats, stats->min), getThroughput(stats, stats->min) / gigabyte);
+    printf("Worst : %f ms, Throughput: %f gb/s\n", ticksToMilliseconds(stats, stats->max), getThroughput(stats, stats->max) / gigabyte);
+    printf(
+        "Spread: MAD %f ms, p10 %f ms, p90 %f ms, p99 %f ms, mean %f ms\n",
+        ticksToMilliseconds(stats, stats->mad),
+        ticksToMilliseconds(stats, stats->p10),
+        ticksToMilliseconds(stats, stats->p90),
+        ticksToMilliseconds(stats, stats->p99),
+        ticksToMilliseconds(stats, stats->mean)
+    );
+
+    if (stats->medianPageFaults > 0) {
+        printf(
+            "PF    : %.1f median (%llu - %llu), %f kb/fault, %.1f major (max %llu)\n",
+            stats->medianPageFaults,
+            (unsigned long long) stats->minPageFaults,
+            (unsigned long long) stats->maxPageFaults,
+            (double) stats->bytes / 1024.0 / stats->medianPageFaults,
+            stats->medianMajorFaults,
+            (unsigned long long) stats->maxMajorFaults
+        );
+    }
+
+    if (stats->medianResidentDelta != 0) {
+        printf("RSS   : %+f mb median change per sample\n", stats->medianResidentDelta / (1024.0 * 1024.0));
+    }
+
+    if (stats->hasResidency) {
+        printf(
+            "Buffer: %f of %f mb resident before the test, %f after\n",
+            (double) stats->residentBefore / (1024.0 * 1024.0),
+            (double) stats->bufferBytes / (1024.0 * 1024.0),
+            (double) stats->residentAfter / (1024.0 * 1024.0)
+        );
+    }
+
+    printf("%zu samples after %zu warmup, %s\n", stats->count, stats->warmupCount, TestStopNames[stats->stop]);
+
+    if (stats->medianFrequency > 0) {
+        printf(
+            "Clock : %f GHz median (%s), %zu samples off by more than %.1f%%",
+            stats->medianFrequency / 1e9,
+            FrequencySourceNames[stats->frequencySource],
+            stats->transitionCount,
+            stats->frequencyTolerance * 100.0
+        );
+
+        if (stats->discardedCount) {
+            printf(", %zu discarded", stats->discardedCount);
+        }
+
+        printf("\n");
+    }
+
+    if (stats->hasDrift) {
+        printf("WARNING: the median moved by %+.2f%% from the first to the last third of the samples\n", stats->drift * 100.0);
+    }
+
+    if (stats->transitionCount > stats->discardedCount) {
+        printf("WARNING: %zu samples ran through a clock change, pin the test and fix the clock\n", stats->transitionCount - stats->discardedCount);
+    }
+
+    printf("\n");
+}
+
+TestParameter makeParameter(const char *name, const char *value) {
+    TestParameter result = {0};
+    result.name = name;
+    snprintf(result.value, sizeof(result.value), "%s", value);
+
+    return result;
+}
+
+TestParameter makeNumberParameter(const char *name, int64_t value) {
+    TestParameter result = {0};
+    result.name = name;
+    snprintf(result.value, sizeof(result.value), "%lld", (long long) value);
+
+    return result;
+}
+
+// The json parser does not decode escapes, so quotes and backslashes are replaced rather than escaped
+void writeResultsString(FILE *file, const char *string) {
+    fputc('"', file);
+
+    for (const char *character = string; *character; character++) {
+        bool isSpecial = *character == '"' || *character == '\\' || (unsigned char) *character < 0x20;
+
+        fputc(isSpecial ? '\'' : *character, file);
+    }
+
+    fputc('"', file);
+}
+
+ResultsWriter openResults(const char *path) {
+    ResultsWriter result = {0};
+    result.path = path;
+    result.file = fopen(path, "wb");
+
+    if (!result.file) {
+        die(__FILE__, __LINE__, errno, "could not open %s", path);
+    }
+
+    char cpuBrand[CPU_BRAND_CAPACITY];
+    getCpuBrand(cpuBrand);
+
+    RdtscFrequency frequency = getRdtscFrequency();
+
+    fprintf(result.file, "{\n\"machine\": {\"cpu\": ");
+    writeResultsString(result.file, cpuBrand);
+    fprintf(
+        result.file,
+        ", \"os\": \"%s\", \"processors\": %u, \"rdtscFrequency\": %llu, \"rdtscError\": %llu, \"rdtscSource\": \"%s\"},\n",
+        OS_NAME,
+        osGetProcessorCount(),
+        (unsigned long long) frequency.frequency,
+        (unsigned long long) frequency.error,
+        RdtscSourceNames[frequency.source]
+    );
+    fprintf(result.file, "\"tests\": [");
+
+    return result;
+}
+
+// Stats are in ticks like the samples, warmup samples are written too and counted by warmup, discarded ones are not
+void writeTestResults(
+    ResultsWriter *writer,
+    RepetitionTester *tester,
+    TestStats *stats,
+    const char *name,
+    TestParameter *parameters,
+    size_t parameterCount
+) {
+    FILE *file = writer->file;
+
+    fprintf(file, "%s\n{\"name\": ", writer->testCount == 0 ? "" : ",");
+    writeResultsString(file, name);
+    fprintf(file, ", \"parameters\": {");
+
+    for (size_t parameterIndex = 0; parameterIndex < parameterCount; parameterIndex++) {
+        fprintf(file, "%s", parameterIndex == 0 ? "" : ", ");
+        writeResultsString(file, parameters[parameterIndex].name);
+        fprintf(file, ": ");
+        writeResultsString(file, parameters[parameterIndex].value);
+    }
+
+    fprintf(
+        file,
+        "}, \"bytes\": %llu, \"stop\": \"%s\", \"warmup\": %zu, \"median\": %.3f, \"medianLow\": %.3f, \"medianHigh\": %.3f, "
+        "\"mad\": %.3f, \"min\": %.3f, \"max\": %.3f, \"mean\": %.3f, \"p10\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+        "\"drift\": %.6f, \"frequency\": %.0f, \"frequencySource\": \"%s\", \"transitions\": %zu, \"discarded\": %zu, "
+        "\"medianMajorFaults\": %.1f, \"residentDelta\": %.0f, \"bufferBytes\": %llu, \"residentBefore\": %llu, \"residentAfter\": %llu,\n",
+        (unsigned long long) stats->bytes,
+        TestStopNames[stats->stop],
+        stats->warmupCount,
+        stats->median,
+        stats->medianLow,
+        stats->medianHigh,
+        stats->mad,
+        stats->min,
+        stats->max,
+        stats->mean,
+        stats->p10,
+        stats->p90,
+        stats->p99,
+        stats->drift,
+        stats->medianFrequency,
+        FrequencySourceNames[stats->frequencySource],
+        stats->transitionCount,
+        stats->discardedCount,
+        stats->medianMajorFaults,
+        stats->medianResidentDelta,
+        (unsigned long long) stats->bufferBytes,
+        (unsigned long long) stats->residentBefore,
+        (unsigned long long) stats->residentAfter
+    );
+
+    fprintf(file, "\"ticks\": [");
+
+    for (size_t sampleIndex = 0; sampleIndex < tester->sampleCount; sampleIndex++) {
+        fprintf(file, "%s%llu", sampleIndex == 0 ? "" : ",", (unsigned long long) tester->samples[sampleIndex].ticks);
+    }
+
+    fprintf(file, "],\n\"pageFaults\": [");
+
+    for (size_t sampleIndex = 0; sampleIndex < tester->sampleCount; sampleIndex++) {
+        fprintf(file, "%s%llu", sampleIndex == 0 ? "" : ",", (unsigned long long) tester->samples[sampleIndex].pageFaults);
+    }
+
+    fprintf(file, "],\n\"majorFaults\": [");
+
+    for (size_t sampleIndex = 0; sampleIndex < tester->sampleCount; sampleIndex++) {
+        fprintf(file, "%s%llu", sampleIndex == 0 ? "" : ",", (unsigned long long) tester->samples[sampleIndex].majorFaults);
+    }
+
+    fprintf(file, "],\n\"residentDeltas\": [");
+
+    for (size_t sampleIndex = 0; sampleIndex < tester->sampleCount; sampleIndex++) {
+        fprintf(file, "%s%lld", sampleIndex == 0 ? "" : ",", (long long) tester->samples[sampleIndex].residentDelta);
+    }
+
+    fprintf(file, "],\n\"frequencies\": [");
+
+    for (size_t sampleIndex = 0; sampleIndex < tester->sampleCount; sampleIndex++) {
+        fprintf(file, "%s%llu", sampleIndex == 0 ? "" : ",", (unsigned long long) tester->samples[sampleIndex].frequency);
+    }
+
+    fprintf(file, "]}");
+
+    writer->testCount++;
+}
+
+void closeResults(ResultsWriter *writer) {
+    fprintf(writer->file, "\n]}\n");
+    fclose(writer->file);
+
+    printf("Results: %zu tests written to %s\n\n", writer->testCount, writer->path);
+
+    writer->file = NULL;
+}
+
+#endif
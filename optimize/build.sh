@@ -0,0 +1,19 @@
+#!/bin/sh
+
+common="-std=c11 -D_GNU_SOURCE -pthread -Wall -Wno-missing-braces"
+
+build_type="-g"
+
+profile="-DPROFILE"
+
+for arg in "$@"; do
+    if [ "$arg" = "noprofile" ]; then profile=""; fi
+    if [ "$arg" = "release" ]; then build_type="-O2 -g"; fi
+done
+
+cc $common $profile $build_type hav0.c -o hav0 -lm
+cc $common $profile $build_type hav1.c -o hav1 -lm
+cc $common $profile $build_type file.c -o file -lm
+cc $common $profile $build_type hav2.c -o hav2 -lm
+
+mkdir -p data
@@ -2,13 +2,7 @@
 
 #include "stdio.h"
 
-#pragma warning(push, 0)
-
-#include "windows.h"
-
-#pragma warning(pop)
-
-#include "intrin.h"
+#include "../haversine/platform.c"
 #include "assert.h"
 #include "stdint.h"
 
@@ -25,53 +19,32 @@ typedef uint32_t u32;
 typedef uint64_t u64;
 
 u64 measureRdtscFrequency() {
-    LARGE_INTEGER performanceFrequency = {0};
-    BOOL ok = QueryPerformanceFrequency(&performanceFrequency);
-    assert(ok);
-
-    LARGE_INTEGER performanceCounterStart = {0};
-    ok = QueryPerformanceCounter(&performanceCounterStart);
-    assert(ok);
-
-    LARGE_INTEGER performanceCount = {0};
-
-    u64 rdtscStart = __rdtsc();
-    do {
-        ok = QueryPerformanceCounter(&performanceCount);
-    } while (performanceCount.QuadPart - performanceCounterStart.QuadPart < performanceFrequency.QuadPart);
-    u64 rdtscEnd = __rdtsc();
-
-    assert(ok);
-
-    u64 rdtscFrequency = rdtscEnd - rdtscStart;
-
-    return rdtscFrequency;
+    return getRdtscFrequency().frequency;
 }
 
 u64 readFromFile(u32 bufferSize) {
-    DWORD bytesRead = 0;
+    size_t bytesRead = 0;
     u64 totalBytesRead = 0;
 
-    char *buffer = VirtualAlloc(0, bufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    char *buffer = osAllocate(bufferSize, 0);
 
     assert(buffer);
 
-    HANDLE file = CreateFile(FILE_NAME, GENERIC_READ, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    File file = osOpenFile(FILE_NAME);
 
-    assert(file);
+    assert(file != INVALID_FILE);
 
-    BOOL ok = 0;
+    bool ok = 0;
     do {
-        ok = ReadFile(file, buffer, bufferSize, &bytesRead, 0);
+        ok = osReadFile(file, buffer, bufferSize, totalBytesRead, &bytesRead);
         assert(ok);
         totalBytesRead += bytesRead;
     } while (bytesRead == bufferSize);
 
-    ok = CloseHandle(file);
+    ok = osCloseFile(file);
     assert(ok);
 
-    ok = VirtualFree(buffer, 0, MEM_RELEASE);
-    assert(ok);
+    osFree(buffer, bufferSize, 0);
 
     return totalBytesRead;
 }
@@ -106,7 +79,7 @@ float measureThroughput(u32 bufferSize, u64 rdtscFrequency) {
 
             bestGbPerSecond = gbPerSecond;
 
-            printf("Buffer size %I32u: %f sec, %f gb/sec\n", bufferSize, seconds, gbPerSecond);
+            printf("Buffer size %u: %f sec, %f gb/sec\n", bufferSize, seconds, gbPerSecond);
         }
     }
 
@@ -10,13 +10,10 @@
 #include "assert.h"
 #include "stdint.h"
 #include "stdbool.h"
+#include "limits.h"
 
-#pragma warning(push, 0)
-
-#include "windows.h"
-#include "psapi.h"
-
-#pragma warning(pop)
+#include "errno.h"
+#include "../haversine/platform.c"
 
 #define COUNTER_NAME_CAPACITY 50
 
@@ -190,7 +187,7 @@ void printTimedBlocksStats(Counters *counters, size_t totalCount) {
 
 #else
 
-#define TIME_BLOCK {}
+#define TIME_BLOCK(NAME) {}
 
 #define MEASURE_THROUGHPUT(NAME, BYTES)\
 {\
@@ -233,39 +230,8 @@ void printPerformanceReport(Counters *counters) {
     printf("Total time:       %14.10f\n", totalSeconds);
 }
 
-uint64_t getOsTimeFrequency() {
-    LARGE_INTEGER frequency;
-    QueryPerformanceFrequency(&frequency);
-
-    return frequency.QuadPart;
-}
-
-uint64_t getOsTimeStamp() {
-    LARGE_INTEGER timestamp;
-
-    QueryPerformanceCounter(&timestamp);
-
-    return timestamp.QuadPart;
-}
-
 uint64_t estimateRdtscFrequency() {
-    uint64_t frequency = getOsTimeFrequency();
-
-    uint64_t osTicks;
-    uint64_t cpuStart = __rdtsc();
-    uint64_t osStart = getOsTimeStamp();
-
-    do {
-        osTicks = getOsTimeStamp();
-    } while ((osTicks - osStart) < frequency);
-    uint64_t cpuTicks = __rdtsc() - cpuStart;
-
-    /*
-       printf("Os frequency %llu\n", frequency);
-       printf("Os ticks %llu\n", osTicks - osStart);
-       printf("Cpu frequency %llu\n", cpuTicks);
-    */
-    return cpuTicks;
+    return getRdtscFrequency().frequency;
 }
 
 #define JSON_PATH "data/pairs.json"
@@ -328,26 +294,23 @@ void writeBinaryToFile(FILE *file, const char *path, void *data, size_t size, si
     }
 }
 
-size_t getFileSize(HANDLE *file, char *path) {
+size_t getFileSize(File file, char *path) {
     TIME_FUNCTION;
 
-    DWORD high = 0;
-    DWORD low = GetFileSize(file, &high);
+    uint64_t result = 0;
 
-    if (low == INVALID_FILE_SIZE) {
-        die(__FILE__, __LINE__, 0, "could not query the size of %s", path);
+    if (!osGetFileSize(file, &result)) {
+        die(__FILE__, __LINE__, 0, "could not query the size of %s: %s", path, osErrorMessage());
     }
 
-    LARGE_INTEGER result = {.LowPart = low, .HighPart = high};
-
     STOP_COUNTER;
-    return result.QuadPart;
+    return result;
 }
 
 Arena arenaInit() {
     TIME_FUNCTION Arena arena = {0};
 
-    arena.memory = VirtualAlloc(0, ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    arena.memory = osAllocate(ARENA_SIZE, 0);
 
     if (!arena.memory) {
         die(__FILE__, __LINE__, errno, "could not initialize arena");
@@ -383,10 +346,10 @@ void freeLastAllocation(Arena *arena) {
 
 String readFileToString(char *path, Arena *arena) {
     TIME_FUNCTION;
-    HANDLE file = CreateFile(path, GENERIC_READ, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    File file = osOpenFile(path);
 
-    if (file == INVALID_HANDLE_VALUE) {
-        die(__FILE__, __LINE__, errno, "could not open %s", path);
+    if (file == INVALID_FILE) {
+        die(__FILE__, __LINE__, 0, "could not open %s: %s", path, osErrorMessage());
     }
     String result = {0};
     result.size = getFileSize(file, path);
@@ -396,26 +359,28 @@ String readFileToString(char *path, Arena *arena) {
 
     char *buffer = result.data.signedData;
 
-    BOOL ok = TRUE;
+    bool ok = true;
 
-    while (totalBytesRead < result.size) {
-        DWORD bytesToRead = result.size <= MAXDWORD ? (DWORD) result.size : MAXDWORD;
+    while (ok && totalBytesRead < result.size) {
+        size_t bytesRead = 0;
 
-        DWORD bytesRead = 0;
-
-        ok = ReadFile(file, buffer, bytesToRead, &bytesRead, 0);
+        ok = osReadFile(file, buffer, result.size - totalBytesRead, totalBytesRead, &bytesRead);
         totalBytesRead += bytesRead;
         buffer += bytesRead;
+
+        if (bytesRead == 0) {
+            break;
+        }
     }
 
-    if (!ok) {
-        die(__FILE__, __LINE__, errno, "could not read %s", path);
+    if (!ok || totalBytesRead != result.size) {
+        die(__FILE__, __LINE__, 0, "could not read %s: %s", path, osErrorMessage());
     }
 
-    ok = CloseHandle(file);
+    ok = osCloseFile(file);
 
     if (!ok) {
-        die(__FILE__, __LINE__, errno, "could not close %s", path);
+        die(__FILE__, __LINE__, 0, "could not close %s: %s", path, osErrorMessage());
     }
 
     STOP_COUNTER;
@@ -423,34 +388,11 @@ String readFileToString(char *path, Arena *arena) {
     return result;
 }
 
-char *winErrorMessage() {
-    char *result = NULL;
-
-    DWORD error = GetLastError();
-    FormatMessage(
-        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-        NULL,
-        error,
-        MAKELANGID(LANG_ENGLISH, SUBLANG_DEFAULT),
-        (LPTSTR) &result,
-        0,
-        NULL
-    );
-
-    return result;
-}
-
-uint64_t getPageFaultCount(HANDLE process) {
+uint64_t getPageFaultCount(Process process) {
     uint64_t result = 0;
-    PROCESS_MEMORY_COUNTERS memoryCounters = {0};
 
-    if (GetProcessMemoryInfo(process, &memoryCounters, sizeof(memoryCounters))) {
-        result = memoryCounters.PageFaultCount;
-    }
-    else {
-        char *message = winErrorMessage();
-
-        die(__FILE__, __LINE__, 0, "Failed to get page fault count: %s\n", message);
+    if (!getOsPageFaultCount(process, &result)) {
+        die(__FILE__, __LINE__, 0, "Failed to get page fault count: %s\n", osErrorMessage());
     }
 
     return result;
@@ -735,10 +677,8 @@ uint8_t peekBytePlusN(Parser *parser, size_t n) {
 }
 
 void skipWhitespace(Parser *parser) {
-    char byte = peekByte(parser);
     while (isWhitespace(parser)) {
         next(parser);
-        byte = peekByte(parser);
     }
 }
 
@@ -1346,10 +1286,6 @@ void bar();
 
 void foo();
 
-void sleep(uint32_t milliseconds) {
-    Sleep(milliseconds);
-}
-
 float getOsSecondsElapsed(uint64_t start, uint64_t frequency) {
     uint64_t time = getOsTimeStamp();
 
@@ -1384,7 +1320,7 @@ double getAverageDistance(Value *json) {
 
 void sleepOneSecond() {
     // TIME_FUNCTION
-    sleep(1000);
+    osSleep(1000);
 
     // STOP_COUNTER;
 }
@@ -1413,13 +1349,17 @@ void bar() {
 int main(void) {
     uint64_t bestResult = UINT64_MAX;
 
+    uint64_t cpuCounterFrequency = estimateRdtscFrequency();
+
     for (int i = 0; i < 100; i++) {
-        ZeroMemory(&COUNTERS, sizeof(COUNTERS));
-        COUNTERS.cpuCounterFrequency = estimateRdtscFrequency();
+        memset(&COUNTERS, 0, sizeof(COUNTERS));
+        COUNTERS.cpuCounterFrequency = cpuCounterFrequency;
 
         startCounters(&COUNTERS);
         // sleepOneSecond();
+#ifdef _WIN32
         SetConsoleOutputCP(65001);
+#endif
 
         Arena arena = arenaInit();
 
@@ -1442,7 +1382,7 @@ int main(void) {
         stopCounters(&COUNTERS);
 
         // printPerformanceReport(&COUNTERS);
-        VirtualFree(arena.memory, 0, MEM_RELEASE);
+        osFree(arena.memory, arena.size, 0);
 
         uint64_t elapsed = COUNTERS.end - COUNTERS.start;
 
@@ -10,13 +10,10 @@
 #include "assert.h"
 #include "stdint.h"
 #include "stdbool.h"
+#include "limits.h"
 
-#pragma warning(push, 0)
-
-#include "windows.h"
-#include "psapi.h"
-
-#pragma warning(pop)
+#include "errno.h"
+#include "../haversine/platform.c"
 
 #define COUNTER_NAME_CAPACITY 50
 
@@ -26,12 +23,12 @@ typedef struct {
     uint64_t initialTicksInRoot;
 } Counter;
 
+#define READ_SIZE ((size_t)1024 * 1024)
+
 #ifdef PROFILE
 
 #define MAX_COUNTERS 4096
 
-#define READ_SIZE ((size_t)1024 * 1024)
-
 typedef struct {
     uint64_t totalTicks;
     uint64_t ticksInRoot;
@@ -192,7 +189,7 @@ void printTimedBlocksStats(Counters *counters, size_t totalCount) {
 
 #else
 
-#define TIME_BLOCK {}
+#define TIME_BLOCK(NAME) {}
 
 #define MEASURE_THROUGHPUT(NAME, BYTES)\
 {\
@@ -235,39 +232,8 @@ void printPerformanceReport(Counters *counters) {
 #endif
 }
 
-uint64_t getOsTimeFrequency() {
-    LARGE_INTEGER frequency;
-    QueryPerformanceFrequency(&frequency);
-
-    return frequency.QuadPart;
-}
-
-uint64_t getOsTimeStamp() {
-    LARGE_INTEGER timestamp;
-
-    QueryPerformanceCounter(&timestamp);
-
-    return timestamp.QuadPart;
-}
-
 uint64_t estimateRdtscFrequency() {
-    uint64_t frequency = getOsTimeFrequency();
-
-    uint64_t osTicks;
-    uint64_t cpuStart = __rdtsc();
-    uint64_t osStart = getOsTimeStamp();
-
-    do {
-        osTicks = getOsTimeStamp();
-    } while ((osTicks - osStart) < frequency);
-    uint64_t cpuTicks = __rdtsc() - cpuStart;
-
-    /*
-       printf("Os frequency %llu\n", frequency);
-       printf("Os ticks %llu\n", osTicks - osStart);
-       printf("Cpu frequency %llu\n", cpuTicks);
-    */
-    return cpuTicks;
+    return getRdtscFrequency().frequency;
 }
 
 #define JSON_PATH "data/pairs.json"
@@ -330,26 +296,23 @@ void writeBinaryToFile(FILE *file, const char *path, void *data, size_t size, si
     }
 }
 
-size_t getFileSize(HANDLE *file) {
+size_t getFileSize(File file, char *path) {
     TIME_FUNCTION;
 
-    DWORD high = 0;
-    DWORD low = GetFileSize(file, &high);
+    uint64_t result = 0;
 
-    if (low == INVALID_FILE_SIZE) {
-        die(__FILE__, __LINE__, 0, "could not query the size of file");
+    if (!osGetFileSize(file, &result)) {
+        die(__FILE__, __LINE__, 0, "could not query the size of %s: %s", path, osErrorMessage());
     }
 
-    LARGE_INTEGER result = {.LowPart = low, .HighPart = high};
-
     STOP_COUNTER;
-    return result.QuadPart;
+    return result;
 }
 
 Arena arenaInit() {
     TIME_FUNCTION Arena arena = {0};
 
-    arena.memory = VirtualAlloc(0, ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    arena.memory = osAllocate(ARENA_SIZE, 0);
 
     if (!arena.memory) {
         die(__FILE__, __LINE__, errno, "could not initialize arena");
@@ -383,23 +346,18 @@ void freeLastAllocation(Arena *arena) {
     arena->currentOffset = arena->previousOffset;
 }
 
-void readFileToString(HANDLE file, size_t size, char *buffer) {
+void readFileToString(File file, size_t size, uint64_t offset, char *buffer) {
     TIME_FUNCTION;
 
     size_t totalBytesRead = 0;
 
-    BOOL ok = TRUE;
-
     while (totalBytesRead < size) {
-        DWORD bytesToRead = size <= MAXDWORD ? (DWORD) size : MAXDWORD;
-
-        DWORD bytesRead = 0;
+        size_t bytesRead = 0;
 
-        ok = ReadFile(file, buffer, bytesToRead, &bytesRead, 0);
+        bool ok = osReadFile(file, buffer, size - totalBytesRead, offset + totalBytesRead, &bytesRead);
 
-        if (!ok) {
-            DWORD error = GetLastError();
-            die(__FILE__, __LINE__, error, "could not read file");
+        if (!ok || bytesRead == 0) {
+            die(__FILE__, __LINE__, 0, "could not read file: %s", osErrorMessage());
         }
 
         totalBytesRead += bytesRead;
@@ -409,34 +367,11 @@ void readFileToString(HANDLE file, size_t size, char *buffer) {
     STOP_COUNTER;
 }
 
-char *winErrorMessage() {
-    char *result = NULL;
-
-    DWORD error = GetLastError();
-    FormatMessage(
-        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-        NULL,
-        error,
-        MAKELANGID(LANG_ENGLISH, SUBLANG_DEFAULT),
-        (LPTSTR) &result,
-        0,
-        NULL
-    );
-
-    return result;
-}
-
-uint64_t getPageFaultCount(HANDLE process) {
+uint64_t getPageFaultCount(Process process) {
     uint64_t result = 0;
-    PROCESS_MEMORY_COUNTERS memoryCounters = {0};
 
-    if (GetProcessMemoryInfo(process, &memoryCounters, sizeof(memoryCounters))) {
-        result = memoryCounters.PageFaultCount;
-    }
-    else {
-        char *message = winErrorMessage();
-
-        die(__FILE__, __LINE__, 0, "Failed to get page fault count: %s\n", message);
+    if (!getOsPageFaultCount(process, &result)) {
+        die(__FILE__, __LINE__, 0, "Failed to get page fault count: %s\n", osErrorMessage());
     }
 
     return result;
@@ -517,7 +452,7 @@ typedef struct {
     size_t line;
     size_t column;
     Arena *arena;
-    HANDLE file;
+    File file;
 } Parser;
 
 typedef enum {
@@ -589,7 +524,7 @@ void skipChars(Parser *parser, size_t count);
 
 void printString(String string);
 
-Parser initParser(HANDLE file, size_t size, Arena *arena) {
+Parser initParser(File file, size_t size, Arena *arena) {
     TIME_FUNCTION Parser parser = {0};
     parser.file = file;
     parser.arena = arena;
@@ -723,10 +658,8 @@ uint8_t peekBytePlusN(Parser *parser, size_t n) {
 }
 
 void skipWhitespace(Parser *parser) {
-    char byte = peekByte(parser);
     while (isWhitespace(parser)) {
         next(parser);
-        byte = peekByte(parser);
     }
 }
 
@@ -1286,7 +1219,7 @@ Value *parseElement(Parser *parser) {
     if (parser->bytesRead - parser->offset < 1024) {
         size_t remaining = parser->text.size - parser->bytesRead;
         size_t readSize = ((size_t) READ_SIZE > (size_t) remaining) ? (size_t) remaining : (size_t) READ_SIZE;
-        readFileToString(parser->file, readSize, parser->text.data.signedData + parser->bytesRead);
+        readFileToString(parser->file, readSize, parser->bytesRead, parser->text.data.signedData + parser->bytesRead);
         parser->bytesRead += readSize;
     }
 
@@ -1342,10 +1275,6 @@ void bar();
 
 void foo();
 
-void sleep(uint32_t milliseconds) {
-    Sleep(milliseconds);
-}
-
 float getOsSecondsElapsed(uint64_t start, uint64_t frequency) {
     uint64_t time = getOsTimeStamp();
 
@@ -1380,7 +1309,7 @@ double getAverageDistance(Value *json) {
 
 void sleepOneSecond() {
     // TIME_FUNCTION
-    sleep(1000);
+    osSleep(1000);
 
     // STOP_COUNTER;
 }
@@ -1409,34 +1338,38 @@ void bar() {
 int main(void) {
     uint64_t bestResult = UINT64_MAX;
 
+    uint64_t cpuCounterFrequency = estimateRdtscFrequency();
+
     for (int i = 0; i < 100; i++) {
-        ZeroMemory(&COUNTERS, sizeof(COUNTERS));
-        COUNTERS.cpuCounterFrequency = estimateRdtscFrequency();
+        memset(&COUNTERS, 0, sizeof(COUNTERS));
+        COUNTERS.cpuCounterFrequency = cpuCounterFrequency;
 
         startCounters(&COUNTERS);
         // sleepOneSecond();
+#ifdef _WIN32
         SetConsoleOutputCP(65001);
+#endif
 
         Arena arena = arenaInit();
 
-        HANDLE file = CreateFile(JSON_PATH, GENERIC_READ, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        File file = osOpenFile(JSON_PATH);
 
-        size_t size = getFileSize(file);
-
-        if (file == INVALID_HANDLE_VALUE) {
-            die(__FILE__, __LINE__, errno, "could not open %s", JSON_PATH);
+        if (file == INVALID_FILE) {
+            die(__FILE__, __LINE__, 0, "could not open %s: %s", JSON_PATH, osErrorMessage());
         }
 
+        size_t size = getFileSize(file, JSON_PATH);
+
         // printf("Json: %.*s", (int)text.size, text.data);
         // printf("hi");
         Parser parser = initParser(file, size, &arena);
 
         Value *json = parseJson(&parser);
 
-        bool ok = CloseHandle(file);
+        bool ok = osCloseFile(file);
 
         if (!ok) {
-            die(__FILE__, __LINE__, errno, "could not close %s", JSON_PATH);
+            die(__FILE__, __LINE__, 0, "could not close %s: %s", JSON_PATH, osErrorMessage());
         }
 
         // printElement(json, 2, 0);
@@ -1450,7 +1383,7 @@ int main(void) {
         // sleepFiveSeconds();
         stopCounters(&COUNTERS);
 
-        VirtualFree(arena.memory, 0, MEM_RELEASE);
+        osFree(arena.memory, arena.size, 0);
 
         //printPerformanceReport(&COUNTERS);
 
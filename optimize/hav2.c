@@ -10,13 +10,10 @@
 #include "assert.h"
 #include "stdint.h"
 #include "stdbool.h"
+#include "limits.h"
 
-#pragma warning(push, 0)
-
-#include "windows.h"
-#include "psapi.h"
-
-#pragma warning(pop)
+#include "errno.h"
+#include "../haversine/platform.c"
 
 #define COUNTER_NAME_CAPACITY 50
 
@@ -55,40 +52,6 @@ typedef struct {
 
 #ifdef PROFILE
 
-uint64_t enableLargePages() {
-    HANDLE token = INVALID_HANDLE_VALUE;
-
-    uint64_t result = 0;
-
-    if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token)) {
-        TOKEN_PRIVILEGES privileges = {
-            .PrivilegeCount = 1,
-            .Privileges = {{.Attributes = SE_PRIVILEGE_ENABLED}}
-        };
-
-        if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)) {
-            AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL);
-
-            DWORD error = GetLastError();
-            if (error == ERROR_SUCCESS) {
-                result = GetLargePageMinimum();
-            }
-            else {
-                printf("Could not adjust privileges, error = %d\n", error);
-            }
-        }
-        else {
-            printf("Could not lookup privileges\n");
-        }
-    }
-
-    else {
-        printf("Could not open process token\n");
-    }
-
-    return result;
-}
-
 void pushCounter(Counters *counters, size_t id, const char *name, size_t bytes) {
     assert(id != 0);
     size_t count = __rdtsc();
@@ -224,7 +187,7 @@ void printTimedBlocksStats(Counters *counters, size_t totalCount) {
 
 #else
 
-#define TIME_BLOCK {}
+#define TIME_BLOCK(NAME) {}
 
 #define MEASURE_THROUGHPUT(NAME, BYTES)\
 {\
@@ -267,39 +230,8 @@ void printPerformanceReport(Counters *counters) {
     printf("Total time:       %14.10f\n", totalSeconds);
 }
 
-uint64_t getOsTimeFrequency() {
-    LARGE_INTEGER frequency;
-    QueryPerformanceFrequency(&frequency);
-
-    return frequency.QuadPart;
-}
-
-uint64_t getOsTimeStamp() {
-    LARGE_INTEGER timestamp;
-
-    QueryPerformanceCounter(&timestamp);
-
-    return timestamp.QuadPart;
-}
-
 uint64_t estimateRdtscFrequency() {
-    uint64_t frequency = getOsTimeFrequency();
-
-    uint64_t osTicks;
-    uint64_t cpuStart = __rdtsc();
-    uint64_t osStart = getOsTimeStamp();
-
-    do {
-        osTicks = getOsTimeStamp();
-    } while ((osTicks - osStart) < frequency);
-    uint64_t cpuTicks = __rdtsc() - cpuStart;
-
-    /*
-       printf("Os frequency %llu\n", frequency);
-       printf("Os ticks %llu\n", osTicks - osStart);
-       printf("Cpu frequency %llu\n", cpuTicks);
-    */
-    return cpuTicks;
+    return getRdtscFrequency().frequency;
 }
 
 #define JSON_PATH "data/pairs.json"
@@ -323,6 +255,7 @@ typedef struct {
     size_t size;
     size_t currentOffset;
     size_t previousOffset;
+    uint64_t largePageMinimum;
 } Arena;
 
 void die(const char *file, const size_t line, int errorNumber, const char *message, ...) {
@@ -362,42 +295,32 @@ void writeBinaryToFile(FILE *file, const char *path, void *data, size_t size, si
     }
 }
 
-size_t getFileSize(HANDLE *file, char *path) {
+size_t getFileSize(File file, char *path) {
     TIME_FUNCTION;
 
-    DWORD high = 0;
-    DWORD low = GetFileSize(file, &high);
+    uint64_t result = 0;
 
-    if (low == INVALID_FILE_SIZE) {
-        die(__FILE__, __LINE__, 0, "could not query the size of %s", path);
+    if (!osGetFileSize(file, &result)) {
+        die(__FILE__, __LINE__, 0, "could not query the size of %s: %s", path, osErrorMessage());
     }
 
-    LARGE_INTEGER result = {.LowPart = low, .HighPart = high};
-
     STOP_COUNTER;
-    return result.QuadPart;
+    return result;
 }
 
 Arena arenaInit(uint64_t size, uint64_t largePageMinimum) {
     TIME_FUNCTION Arena arena = {0};
 
-    size_t remainder = size % largePageMinimum;
-
-    if (remainder != 0) {
-        size += (largePageMinimum - remainder);
-    }
-
-    arena.memory = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    arena.memory = osAllocate(size, largePageMinimum);
 
     if (!arena.memory) {
-        DWORD error = GetLastError();
-        printf("%d\n", error);
-        die(__FILE__, __LINE__, error, "could not initialize arena");
+        die(__FILE__, __LINE__, 0, "could not initialize arena: %s", osErrorMessage());
     }
 
     arena.size = ARENA_SIZE;
     arena.currentOffset = 0;
     arena.previousOffset = 0;
+    arena.largePageMinimum = largePageMinimum;
 
     STOP_COUNTER return arena;
 }
@@ -425,10 +348,10 @@ void freeLastAllocation(Arena *arena) {
 
 String readFileToString(char *path, Arena *arena) {
     TIME_FUNCTION;
-    HANDLE file = CreateFile(path, GENERIC_READ, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    File file = osOpenFile(path);
 
-    if (file == INVALID_HANDLE_VALUE) {
-        die(__FILE__, __LINE__, errno, "could not open %s", path);
+    if (file == INVALID_FILE) {
+        die(__FILE__, __LINE__, 0, "could not open %s: %s", path, osErrorMessage());
     }
     String result = {0};
     result.size = getFileSize(file, path);
@@ -438,26 +361,28 @@ String readFileToString(char *path, Arena *arena) {
 
     char *buffer = result.data.signedData;
 
-    BOOL ok = TRUE;
-
-    while (totalBytesRead < result.size) {
-        DWORD bytesToRead = result.size <= MAXDWORD ? (DWORD) result.size : MAXDWORD;
+    bool ok = true;
 
-        DWORD bytesRead = 0;
+    while (ok && totalBytesRead < result.size) {
+        size_t bytesRead = 0;
 
-        ok = ReadFile(file, buffer, bytesToRead, &bytesRead, 0);
+        ok = osReadFile(file, buffer, result.size - totalBytesRead, totalBytesRead, &bytesRead);
         totalBytesRead += bytesRead;
         buffer += bytesRead;
+
+        if (bytesRead == 0) {
+            break;
+        }
     }
 
-    if (!ok) {
-        die(__FILE__, __LINE__, errno, "could not read %s", path);
+    if (!ok || totalBytesRead != result.size) {
+        die(__FILE__, __LINE__, 0, "could not read %s: %s", path, osErrorMessage());
     }
 
-    ok = CloseHandle(file);
+    ok = osCloseFile(file);
 
     if (!ok) {
-        die(__FILE__, __LINE__, errno, "could not close %s", path);
+        die(__FILE__, __LINE__, 0, "could not close %s: %s", path, osErrorMessage());
     }
 
     STOP_COUNTER;
@@ -465,34 +390,11 @@ String readFileToString(char *path, Arena *arena) {
     return result;
 }
 
-char *winErrorMessage() {
-    char *result = NULL;
-
-    DWORD error = GetLastError();
-    FormatMessage(
-        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-        NULL,
-        error,
-        MAKELANGID(LANG_ENGLISH, SUBLANG_DEFAULT),
-        (LPTSTR) &result,
-        0,
-        NULL
-    );
-
-    return result;
-}
-
-uint64_t getPageFaultCount(HANDLE process) {
+uint64_t getPageFaultCount(Process process) {
     uint64_t result = 0;
-    PROCESS_MEMORY_COUNTERS memoryCounters = {0};
 
-    if (GetProcessMemoryInfo(process, &memoryCounters, sizeof(memoryCounters))) {
-        result = memoryCounters.PageFaultCount;
-    }
-    else {
-        char *message = winErrorMessage();
-
-        die(__FILE__, __LINE__, 0, "Failed to get page fault count: %s\n", message);
+    if (!getOsPageFaultCount(process, &result)) {
+        die(__FILE__, __LINE__, 0, "Failed to get page fault count: %s\n", osErrorMessage());
     }
 
     return result;
@@ -777,10 +679,8 @@ uint8_t peekBytePlusN(Parser *parser, size_t n) {
 }
 
 void skipWhitespace(Parser *parser) {
-    char byte = peekByte(parser);
     while (isWhitespace(parser)) {
         next(parser);
-        byte = peekByte(parser);
     }
 }
 
@@ -1388,10 +1288,6 @@ void bar();
 
 void foo();
 
-void sleep(uint32_t milliseconds) {
-    Sleep(milliseconds);
-}
-
 float getOsSecondsElapsed(uint64_t start, uint64_t frequency) {
     uint64_t time = getOsTimeStamp();
 
@@ -1426,7 +1322,7 @@ double getAverageDistance(Value *json) {
 
 void sleepOneSecond() {
     // TIME_FUNCTION
-    sleep(1000);
+    osSleep(1000);
 
     // STOP_COUNTER;
 }
@@ -1455,15 +1351,19 @@ void bar() {
 int main(void) {
     uint64_t bestResult = UINT64_MAX;
 
+    uint64_t cpuCounterFrequency = estimateRdtscFrequency();
+
     for (int i = 0; i < 100; i++) {
-        ZeroMemory(&COUNTERS, sizeof(COUNTERS));
-        COUNTERS.cpuCounterFrequency = estimateRdtscFrequency();
+        memset(&COUNTERS, 0, sizeof(COUNTERS));
+        COUNTERS.cpuCounterFrequency = cpuCounterFrequency;
 
         uint64_t largePageMinimum = enableLargePages();
 
         startCounters(&COUNTERS);
         // sleepOneSecond();
+#ifdef _WIN32
         SetConsoleOutputCP(65001);
+#endif
 
         Arena arena = arenaInit(ARENA_SIZE, largePageMinimum);
 
@@ -1486,7 +1386,7 @@ int main(void) {
         stopCounters(&COUNTERS);
 
         // printPerformanceReport(&COUNTERS);
-        VirtualFree(arena.memory, 0, MEM_RELEASE);
+        osFree(arena.memory, arena.size, arena.largePageMinimum);
 
         uint64_t elapsed = COUNTERS.end - COUNTERS.start;
 